@@ -11,11 +11,10 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include "client.h"
+#include "resolve.h"
+#include "duplex.h"
 #include <errno.h>
 
-extern char *inet_ntoa(struct in_addr);
-
-#define NAMESIZE 255
 #define BUFSIZE 81
 
 // ANSI color codes for prettier output
@@ -50,64 +49,47 @@ void send_reply(int client_fd, const char *message)
   }
 }
 
-void client(int server_number, char *server_node)
+int client_connect(int server_number, char *server_node)
 {
-  int length;
-  int n, len;
-  short fd;
-  struct sockaddr_in address;
-  struct hostent *node_ptr;
-  char local_node[NAMESIZE];
-  char buffer[BUFSIZE];
-  int my_turn = 1;
-  int chat_over = 0;
+  socklen_t length;
+  int fd = -1, err = 0;
+  struct sockaddr_storage address;
+  const struct addrinfo *addrs, *ai;
+  char host[NI_MAXHOST];
 
-  /*  get the internet name of the local host node on which we are running  */
-  if (gethostname(local_node, NAMESIZE) < 0)
-  {
-    perror("client gethostname");
-    exit(1);
-  }
-  fprintf(stderr, "client running on node %s\n", local_node);
-
-  /*  get the name of the remote host node on which we hope to find server  */
-  if (server_node == NULL)
-    server_node = local_node;
   fprintf(stderr, "client about to connect to server at port number %d on node %s\n",
-          server_number, server_node);
+          server_number, server_node ? server_node : "localhost");
 
-  /*  get structure for remote host node on which server resides  */
-  if ((node_ptr = gethostbyname(server_node)) == NULL)
+  /*  look up the server's addresses; a numeric address skips DNS entirely  */
+  if ((addrs = resolve_tcp(server_node, server_number, &err)) == NULL)
   {
-    perror("client gethostbyname");
+    fprintf(stderr, "client getaddrinfo: %s\n", gai_strerror(err));
     exit(1);
   }
 
-  /*  set up Internet address structure for the server  */
-  memset(&address, 0, sizeof(address));
-  address.sin_family = AF_INET;
-  memcpy(&address.sin_addr, node_ptr->h_addr, node_ptr->h_length);
-  address.sin_port = htons(server_number);
-
-  fprintf(stderr, "client full name of server node %s, internet address %s\n",
-          node_ptr->h_name, inet_ntoa(address.sin_addr));
-
-  /*  open an Internet tcp socket  */
-  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  /*  open a tcp socket and connect it to the first address that answers  */
+  for (ai = addrs; ai != NULL; ai = ai->ai_next)
   {
-    perror("client socket");
-    exit(1);
+    resolve_text(ai->ai_addr, ai->ai_addrlen, host, sizeof(host));
+    fprintf(stderr, "client trying server at internet address %s\n", host);
+    if ((fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    err = errno;
+    close(fd);
+    fd = -1;
+    errno = err;
   }
-
-  /*  connect this socket to the server's Internet address  */
-  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+  if (fd < 0)
   {
     perror("client connect");
+    resolve_forget(server_node, server_number); // look again on the next attempt
     exit(1);
   }
 
   /*  now find out what local port number was assigned to this client  */
-  len = sizeof(address);
+  length = sizeof(address);
   if (getsockname(fd, (struct sockaddr *)&address, &length) < 0)
   {
     perror("client getsockname");
@@ -115,8 +97,35 @@ void client(int server_number, char *server_node)
   }
 
   /*  we are now successfully connected to a remote server  */
-  fprintf(stderr, "client at internet address %s, port %d\n",
-          inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+  int port = resolve_text((struct sockaddr *)&address, length, host, sizeof(host));
+  fprintf(stderr, "client at internet address %s, port %d\n", host, port);
+
+  /*  with --tls, nothing goes out before the handshake  */
+  duplex_secure(fd, server_node ? server_node : "localhost");
+  return fd;
+}
+
+void client(int server_number, char *server_node, int duplex)
+{
+  int n, len;
+  short fd;
+  char buffer[BUFSIZE];
+  char inbox[BUFSIZE];   /* received bytes not yet split into lines */
+  size_t have = 0;
+  int my_turn = 1;
+  int chat_over = 0;
+  int turn_over;
+
+  /*  connect to the server  */
+  fd = client_connect(server_number, server_node);
+
+  /*  in full-duplex mode both sides talk whenever they like  */
+  if (duplex)
+  {
+    duplex_chat(fd, "[SERVER]");
+    duplex_close(fd);
+    return;
+  }
 
   /*  transmit data from standard input to server  */
   while (!chat_over)
@@ -129,6 +138,7 @@ void client(int server_number, char *server_node)
 
       while (fgets(buffer, BUFSIZE, stdin) != NULL)
       {
+        len = strlen(buffer);
 
         /* Check for control signals */
         if (strcmp(buffer, "xx\n") == 0)
@@ -174,25 +184,51 @@ void client(int server_number, char *server_node)
       /* ---- Read Mode ---- */
       print_message("[WAITING]", " Waiting for server response...\n", COLOR_BLUE);
 
-      while ((n = recv(fd, buffer, BUFSIZE - 1, 0)) > 0)
+      /* split what arrives into lines; an ack and "x"/"xx" may share a recv */
+      turn_over = 0;
+      n = 1;
+      while (1)
       {
-        buffer[n] = '\0'; /* Null-terminate the received string */
-
-        /* Check for control signals from the server */
-        if (strcmp(buffer, "xx\n") == 0)
+        size_t start = 0;
+        while (!turn_over && start < have)
         {
-          chat_over = 1;
-          break;
-        }
-        if (strcmp(buffer, "x\n") == 0)
-        {
-          /* Server has finished its turn; switch back to write mode */
-          break;
+          char *nl = memchr(inbox + start, '\n', have - start);
+          size_t line_len;
+          if (nl != NULL)
+            line_len = nl - (inbox + start) + 1;
+          else if (start == 0 && have == BUFSIZE - 1)
+            line_len = have; /* the server sends a long line in BUFSIZE - 1 pieces */
+          else
+            break;
+          memcpy(buffer, inbox + start, line_len);
+          buffer[line_len] = '\0';
+          start += line_len;
+
+          /* Check for control signals from the server */
+          if (strcmp(buffer, "xx\n") == 0)
+          {
+            chat_over = 1;
+            turn_over = 1;
+          }
+          else if (strcmp(buffer, "x\n") == 0)
+          {
+            /* Server has finished its turn; switch back to write mode */
+            turn_over = 1;
+          }
+          else
+          {
+            /* Otherwise, print the received message */
+            print_message("[SERVER]", buffer, COLOR_CYAN);
+            printf("\n");
+          }
         }
+        /* anything after "x" stays for the next read turn */
+        memmove(inbox, inbox + start, have - start);
+        have -= start;
 
-        /* Otherwise, print the received message */
-        print_message("[SERVER]", buffer, COLOR_CYAN);
-        printf("\n");
+        if (turn_over || (n = recv(fd, inbox + have, BUFSIZE - 1 - have, 0)) <= 0)
+          break;
+        have += n;
       }
 
       if (n < 0)
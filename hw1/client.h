@@ -1,6 +1,13 @@
-/**
- **  header for client.c
- **
- **/
-
-void client( int server_number, char *server_node );
+/**
+ **  header for client.c
+ **
+ **/
+
+/*  duplex: chat in full-duplex framed mode (see duplex.h) instead of taking turns  */
+void client( int server_number, char *server_node, int duplex );
+
+/*
+ *  connect a tcp socket to server_number on server_node (NULL = this node)
+ *  and print where it is, secured if duplex_use_tls() was called; exits on error
+ */
+int client_connect( int server_number, char *server_node );
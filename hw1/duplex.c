@@ -0,0 +1,317 @@
+/**
+ ** duplex.c  -  full-duplex, length-framed chat loop shared by speak and speakd
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "duplex.h"
+#include "tls.h"
+
+// ANSI color codes for prettier output
+#define COLOR_RESET "\x1b[0m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_BLUE "\x1b[34m"
+#define COLOR_CYAN "\x1b[36m"
+
+static TlsCtx *tls_ctx; /* set by duplex_use_tls() */
+static TlsConn *tls;    /* the secured connection, if any */
+
+/* bytes waiting to be turned into lines or frames */
+struct pending
+{
+  char *data;
+  size_t len;
+};
+
+void duplex_use_tls(const char *cert, const char *key, const char *ca)
+{
+  tls_ctx = cert != NULL ? tls_server_ctx(cert, key) : tls_client_ctx(ca);
+  if (tls_ctx == NULL)
+    exit(1);
+}
+
+void duplex_secure(int fd, const char *host)
+{
+  char desc[128];
+  if (tls_ctx == NULL)
+    return;
+  signal(SIGPIPE, SIG_IGN); // SSL_write() can't pass MSG_NOSIGNAL
+  if ((tls = tls_conn_new(tls_ctx, fd, host)) == NULL || tls_handshake(tls) != 1)
+  {
+    fprintf(stderr, "no TLS connection with the peer (does it use --tls too?)\n");
+    exit(1);
+  }
+  fprintf(stderr, "TLS: %s\n", tls_describe(tls, desc, sizeof(desc)));
+}
+
+struct tls_conn *duplex_tls(void)
+{
+  return tls;
+}
+
+void duplex_close(int fd)
+{
+  tls_conn_free(tls);
+  tls = NULL;
+  close(fd);
+}
+
+static ssize_t recv_some(int fd, char *buf, size_t len)
+{
+  return tls != NULL ? tls_recv(tls, buf, len) : recv(fd, buf, len, 0);
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = tls != NULL ? tls_send(tls, buf, len) : send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* send one frame: header and payload in a single send */
+int duplex_send(int fd, char type, const char *payload, size_t len)
+{
+  char *frame = malloc(DUPLEX_HEADER_SIZE + len);
+  if (frame == NULL)
+    return -1;
+  frame[0] = type;
+  frame[1] = (len >> 24) & 0xFF;
+  frame[2] = (len >> 16) & 0xFF;
+  frame[3] = (len >> 8) & 0xFF;
+  frame[4] = len & 0xFF;
+  memcpy(frame + DUPLEX_HEADER_SIZE, payload, len);
+  int rc = send_all(fd, frame, DUPLEX_HEADER_SIZE + len);
+  free(frame);
+  return rc;
+}
+
+static int recv_all(int fd, char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = recv_some(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int duplex_recv(int fd, char *type, char *payload, size_t max, size_t *len)
+{
+  unsigned char h[DUPLEX_HEADER_SIZE];
+  if (recv_all(fd, (char *)h, sizeof(h)) < 0)
+    return -1;
+  uint32_t n = ((uint32_t)h[1] << 24) | ((uint32_t)h[2] << 16) | ((uint32_t)h[3] << 8) | h[4];
+  if (n > max || recv_all(fd, payload, n) < 0)
+    return -1;
+  *type = h[0];
+  *len = n;
+  return 0;
+}
+
+/* append n bytes to p; returns -1 if out of memory */
+static int pending_add(struct pending *p, const char *buf, size_t n)
+{
+  char *grown = realloc(p->data, p->len + n);
+  if (grown == NULL)
+    return -1;
+  memcpy(grown + p->len, buf, n);
+  p->data = grown;
+  p->len += n;
+  return 0;
+}
+
+/* drop the first n bytes of p */
+static void pending_consume(struct pending *p, size_t n)
+{
+  memmove(p->data, p->data + n, p->len - n);
+  p->len -= n;
+}
+
+static void prompt(void)
+{
+  printf(COLOR_GREEN "> " COLOR_RESET);
+  fflush(stdout);
+}
+
+/*
+ *  handle the typed lines in p; returns 1 once the user quits ("xx"),
+ *  -1 if the peer is gone
+ */
+static int handle_input(int fd, struct pending *p, int at_eof)
+{
+  while (p->len > 0)
+  {
+    /*  a line longer than a message goes out in DUPLEX_MAX_MSG pieces  */
+    size_t scan = p->len > DUPLEX_MAX_MSG ? DUPLEX_MAX_MSG + 1 : p->len;
+    char *nl = memchr(p->data, '\n', scan);
+    size_t line;
+    if (nl != NULL)
+      line = nl - p->data;
+    else if (p->len >= DUPLEX_MAX_MSG || at_eof)
+      line = p->len > DUPLEX_MAX_MSG ? DUPLEX_MAX_MSG : p->len; // send what we have
+    else
+      return 0; // wait for the rest of the line
+
+    if (line == 2 && memcmp(p->data, "xx", 2) == 0)
+    {
+      duplex_send(fd, DUPLEX_QUIT, NULL, 0);
+      return 1;
+    }
+    if (duplex_send(fd, DUPLEX_TEXT, p->data, line) < 0)
+      return -1;
+    pending_consume(p, (nl != NULL && (size_t)(nl - p->data) == line) ? line + 1 : line);
+    prompt();
+  }
+  return 0;
+}
+
+/*
+ *  handle the complete frames in p; returns 1 once the peer quits,
+ *  -1 on a protocol error
+ */
+static int handle_frames(struct pending *p, const char *peer, int *greeted)
+{
+  while (p->len >= DUPLEX_HEADER_SIZE)
+  {
+    const unsigned char *h = (const unsigned char *)p->data;
+    uint32_t len = ((uint32_t)h[1] << 24) | ((uint32_t)h[2] << 16) | ((uint32_t)h[3] << 8) | h[4];
+    if (len > DUPLEX_MAX_MSG)
+      return -1;
+    if (p->len < DUPLEX_HEADER_SIZE + len)
+      return 0; // the rest of the message is still on its way
+    char type = p->data[0];
+    const char *body = p->data + DUPLEX_HEADER_SIZE;
+
+    if (!*greeted)
+    {
+      if (type != DUPLEX_HELLO || len != strlen(DUPLEX_VERSION) ||
+          memcmp(body, DUPLEX_VERSION, len) != 0)
+        return -1;
+      *greeted = 1;
+    }
+    else if (type == DUPLEX_QUIT)
+    {
+      return 1;
+    }
+    else if (type == DUPLEX_TEXT)
+    {
+      printf("\r%s%s: %.*s%s\n", COLOR_CYAN, peer, (int)len, body, COLOR_RESET);
+      prompt();
+    }
+    // unknown frame types are skipped, so later versions can add some
+    pending_consume(p, DUPLEX_HEADER_SIZE + len);
+  }
+  return 0;
+}
+
+void duplex_chat(int fd, const char *peer)
+{
+  struct pending in = {NULL, 0}, net = {NULL, 0};
+  struct pollfd fds[2];
+  char buffer[4096];
+  int greeted = 0;
+  int stdin_open = 1;
+  int done = 0;
+
+  if (duplex_send(fd, DUPLEX_HELLO, DUPLEX_VERSION, strlen(DUPLEX_VERSION)) < 0)
+  {
+    perror("duplex send");
+    exit(1);
+  }
+  printf("%sSYSTEM: Full-duplex chat with %s. Type any time; 'xx' quits.%s\n",
+         COLOR_CYAN, peer, COLOR_RESET);
+  prompt();
+
+  while (!done)
+  {
+    fds[0].fd = stdin_open ? STDIN_FILENO : -1;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    /*  TLS may hold decrypted frames already, which poll() can't see  */
+    int buffered = tls != NULL && tls_pending(tls);
+    if (poll(fds, 2, buffered ? 0 : -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("duplex poll");
+      exit(1);
+    }
+    if (buffered)
+      fds[1].revents |= POLLIN;
+
+    if (fds[1].revents)
+    {
+      ssize_t n = recv_some(fd, buffer, sizeof(buffer));
+      if (n <= 0)
+      {
+        printf("\n%sSYSTEM: %s disconnected.%s\n", COLOR_BLUE, peer, COLOR_RESET);
+        break;
+      }
+      if (pending_add(&net, buffer, n) < 0)
+      {
+        perror("duplex");
+        exit(1);
+      }
+      int rc = handle_frames(&net, peer, &greeted);
+      if (rc < 0)
+      {
+        fprintf(stderr, "%s is not speaking the full-duplex protocol (start both ends with -d)\n", peer);
+        break;
+      }
+      if (rc > 0)
+      {
+        printf("\n%sSYSTEM: %s ended the chat.%s\n", COLOR_BLUE, peer, COLOR_RESET);
+        break;
+      }
+    }
+
+    if (fds[0].revents)
+    {
+      ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+      if (n > 0 && pending_add(&in, buffer, n) < 0)
+      {
+        perror("duplex");
+        exit(1);
+      }
+      if (n <= 0)
+        stdin_open = 0; // end of input: flush the last line and leave
+      int rc = handle_input(fd, &in, !stdin_open);
+      if (rc < 0)
+      {
+        perror("duplex send");
+        break;
+      }
+      if (rc > 0 || !stdin_open)
+      {
+        if (!stdin_open)
+          duplex_send(fd, DUPLEX_QUIT, NULL, 0);
+        printf("%sSYSTEM: Chat session ended.%s\n", COLOR_BLUE, COLOR_RESET);
+        done = 1;
+      }
+    }
+  }
+  free(in.data);
+  free(net.data);
+}
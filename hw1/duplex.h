@@ -0,0 +1,58 @@
+/**
+ **  header for duplex.c
+ **
+ **  Full-duplex chat over a connected socket: stdin and the socket are
+ **  multiplexed in one poll() loop, so either side may type at any time.
+ **
+ **  Every message is length-framed:  [type: 1 byte][length: 4 bytes, big
+ **  endian][payload: length bytes].  Control signals are frame types, not
+ **  text, so a message that happens to say "x" is just a message, and a
+ **  line is never split by the size of a recv().
+ **
+ **  With duplex_use_tls() the frames (and a bulk transfer, see transfer.h)
+ **  travel inside TLS; the framing itself does not change.
+ **
+ **/
+
+#include <stddef.h>
+
+#define DUPLEX_HEADER_SIZE 5 /* type byte + 4 length bytes */
+
+#define DUPLEX_HELLO 'H' /* first frame from both ends; payload DUPLEX_VERSION */
+#define DUPLEX_TEXT 'T'  /* one line of chat, without its newline */
+#define DUPLEX_QUIT 'Q'  /* the sender left the chat ("xx") */
+
+#define DUPLEX_VERSION "speak-duplex/1"
+#define DUPLEX_MAX_MSG 65536 /* longest line sent as one message */
+
+struct tls_conn;
+
+/*
+ *  speak TLS on the next connection: a server passes its PEM certificate
+ *  and key, a client (cert NULL) the CA file it trusts; exits on error
+ */
+void duplex_use_tls( const char *cert, const char *key, const char *ca );
+
+/*
+ *  run the TLS handshake on a freshly connected fd if duplex_use_tls() was
+ *  called; a client checks the server's certificate against host. Exits on error
+ */
+void duplex_secure( int fd, const char *host );
+
+/*  the TLS state of the secured connection, or NULL if it is cleartext  */
+struct tls_conn *duplex_tls( void );
+
+/*  end the connection: close_notify if it is secured, then close(fd)  */
+void duplex_close( int fd );
+
+/*  send one frame (blocking); returns 0, or -1 if the peer is gone  */
+int duplex_send( int fd, char type, const char *payload, size_t len );
+
+/*
+ *  receive exactly one frame (blocking) into payload, which holds max bytes;
+ *  returns 0, or -1 if the peer is gone or the frame is larger than max
+ */
+int duplex_recv( int fd, char *type, char *payload, size_t max, size_t *len );
+
+/*  run the chat on fd until either side quits; peer names the other side  */
+void duplex_chat( int fd, const char *peer );
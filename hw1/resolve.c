@@ -0,0 +1,112 @@
+/**
+ ** resolve.c  -  getaddrinfo() lookups with a numeric fast path and a small cache
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "resolve.h"
+
+/* one remembered lookup */
+struct cached
+{
+  char *node; /* NULL = loopback */
+  int port;
+  time_t expires;
+  struct addrinfo *addrs;
+};
+
+static struct cached cache[RESOLVE_CACHE_SIZE];
+
+static int same_node(const char *a, const char *b)
+{
+  return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+static struct cached *lookup(const char *node, int port)
+{
+  for (int i = 0; i < RESOLVE_CACHE_SIZE; i++)
+    if (cache[i].addrs != NULL && cache[i].port == port && same_node(cache[i].node, node))
+      return &cache[i];
+  return NULL;
+}
+
+static void drop(struct cached *c)
+{
+  freeaddrinfo(c->addrs);
+  free(c->node);
+  memset(c, 0, sizeof(*c));
+}
+
+const struct addrinfo *resolve_tcp(const char *node, int port, int *err)
+{
+  struct addrinfo hints, *addrs = NULL;
+  char service[16];
+  time_t now = time(NULL);
+  struct cached *c = lookup(node, port);
+
+  if (c != NULL && c->expires > now)
+    return c->addrs;
+  if (c != NULL)
+    drop(c);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%d", port);
+
+  /* a numeric address (or the loopback) is parsed in place: no DNS at all */
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  *err = getaddrinfo(node, service, &hints, &addrs);
+  if (*err == EAI_NONAME && node != NULL)
+  {
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    *err = getaddrinfo(node, service, &hints, &addrs);
+  }
+  if (*err != 0)
+    return NULL;
+
+  /* keep it in a free slot, or in place of the entry closest to expiring */
+  c = &cache[0];
+  for (int i = 0; i < RESOLVE_CACHE_SIZE; i++)
+  {
+    if (cache[i].addrs == NULL)
+    {
+      c = &cache[i];
+      break;
+    }
+    if (cache[i].expires < c->expires)
+      c = &cache[i];
+  }
+  if (c->addrs != NULL)
+    drop(c);
+  c->node = node ? strdup(node) : NULL;
+  c->port = port;
+  c->expires = now + RESOLVE_TTL;
+  c->addrs = addrs;
+  return addrs;
+}
+
+void resolve_forget(const char *node, int port)
+{
+  struct cached *c = lookup(node, port);
+  if (c != NULL)
+    drop(c);
+}
+
+int resolve_text(const struct sockaddr *sa, socklen_t len, char *host, size_t size)
+{
+  char service[16];
+  if (getnameinfo(sa, len, host, size, service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+  {
+    snprintf(host, size, "?");
+    return 0;
+  }
+  /* show IPv4 clients of a dual-stack socket as plain IPv4 */
+  if (strncmp(host, "::ffff:", 7) == 0 && strchr(host + 7, ':') == NULL)
+    memmove(host, host + 7, strlen(host + 7) + 1);
+  return atoi(service);
+}
@@ -0,0 +1,27 @@
+/**
+ **  header for resolve.c
+ **
+ **  Address lookup for speak and speakd through getaddrinfo(): IPv4 and
+ **  IPv6 alike, numeric addresses without touching DNS, and a small cache
+ **  so a reconnect does not resolve the same name again.
+ **
+ **/
+
+#include <sys/socket.h>
+#include <netdb.h>
+
+#define RESOLVE_CACHE_SIZE 8 /* names remembered */
+#define RESOLVE_TTL 60       /* seconds a cached lookup stays valid */
+
+/*
+ *  the addresses to try for a tcp connection to node (NULL = this host's
+ *  loopback) on port; owned by the cache, so do not freeaddrinfo() them.
+ *  Returns NULL and sets *err to the getaddrinfo() error on failure.
+ */
+const struct addrinfo *resolve_tcp( const char *node, int port, int *err );
+
+/*  drop node's cached lookup (every address failed; look again next time)  */
+void resolve_forget( const char *node, int port );
+
+/*  numeric text for sa's address into host; returns its port  */
+int resolve_text( const struct sockaddr *sa, socklen_t len, char *host, size_t size );
@@ -0,0 +1,523 @@
+/**
+ ** room.c  -  speakd chat room: many clients, every message fanned out to the rest
+ **
+ **  Each client speaks the full-duplex framing (duplex.h). A relayed message
+ **  is framed once into pooled OutBufs and every other member queues
+ **  references to them, so a broadcast costs one encode. Queues are bounded
+ **  (OUTQ_LEN buffers per member): a member too slow to keep up has new
+ **  messages dropped instead of stalling the room, and is told how many it
+ **  missed once it catches up.
+ **
+ **  With --io-uring the loop accepts and receives in the kernel (multishot
+ **  accept, multishot recv into a shared buffer ring) and sends through the
+ **  loop's per-connection queues, so a busy room costs a few io_uring_enter
+ **  calls per pass instead of a recv and a writev per member.
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "reactor.h"
+#include "outbuf.h"
+#include "duplex.h"
+#include "server.h"
+#include "resolve.h"
+#include "room.h"
+
+#define NOTICE_SIZE 128
+#define RECV_SIZE 4096
+/* OutBufs one relayed frame can take: header, "guest N: " and the text */
+#define MAX_CHUNKS ((DUPLEX_HEADER_SIZE + NOTICE_SIZE + ROOM_MAX_MSG) / OUTBUF_SIZE + 1)
+
+typedef struct room Room;
+
+typedef struct member
+{
+	int fd; /* -1 once the member has left */
+	int id;
+	int greeted;  /* its HELLO arrived */
+	int writing;  /* REACTOR_WRITE is requested */
+	int stream;   /* completion I/O on an io_uring loop (reactor_stream) */
+	long dropped; /* messages it was too slow to receive */
+	unsigned char header[DUPLEX_HEADER_SIZE];
+	uint32_t header_have;
+	uint32_t body_len, body_have; /* the frame being received */
+	char body[ROOM_MAX_MSG];
+	OutQueue outq;
+	Room *room;
+	struct member *prev, *next;
+	struct member *next_dead;
+} Member;
+
+struct room
+{
+	Reactor *reactor;
+	int listen_fd;
+	int next_id;
+	int members;
+	Member *list;
+	Member *dead; /* left during this loop pass; freed after it */
+	OutPool pool;
+};
+
+static void on_accept(Reactor *r, int fd, unsigned events, void *arg);
+static void on_accepted(Reactor *r, int fd, int client_fd, void *arg);
+static void member_join(Room *room, int client_fd);
+static void on_member(Reactor *r, int fd, unsigned events, void *arg);
+static void on_member_data(Reactor *r, int fd, const void *data, ssize_t len, void *arg);
+static int member_feed(Member *m, const char *buf, size_t len);
+static void member_hello(Member *m);
+static int member_frame(Member *m, char type);
+static void member_flush(Member *m);
+static ssize_t member_send(void *arg, const struct iovec *iov, int iovcnt);
+static void member_leave(Member *m, const char *why);
+static int encode(Room *room, char type, const char *prefix, const char *text, size_t len,
+									OutBuf **chunks);
+static int deliver(Member *m, OutBuf **chunks, int n);
+static void broadcast(Room *room, Member *from, const char *prefix, const char *text, size_t len);
+static void notice(Room *room, Member *to, Member *except, const char *fmt, ...);
+
+void room(int server_number, int io_uring)
+{
+	Room room;
+
+	memset(&room, 0, sizeof(room));
+	outpool_init(&room.pool);
+	signal(SIGPIPE, SIG_IGN);
+
+	room.listen_fd = server_listen(server_number, ROOM_LISTEN_DEPTH);
+	if ((room.reactor = reactor_create(io_uring ? REACTOR_BACKEND_URING : REACTOR_BACKEND_AUTO)) == NULL)
+	{
+		perror("room reactor");
+		exit(1);
+	}
+	/*  io_uring accepts in the kernel (multishot); otherwise accept() on readiness  */
+	if (set_nonblocking(room.listen_fd) < 0 ||
+			(reactor_add_acceptor(room.reactor, room.listen_fd, on_accepted, &room) < 0 &&
+			 reactor_add(room.reactor, room.listen_fd, REACTOR_READ, on_accept, &room) < 0))
+	{
+		perror("room listen");
+		exit(1);
+	}
+	fprintf(stderr, "room open (%s event loop); connect with: speak -d <port>\n",
+					reactor_backend_name(room.reactor));
+
+	for (;;)
+	{
+		if (reactor_poll(room.reactor, -1) < 0)
+		{
+			perror("room poll");
+			exit(1);
+		}
+		while (room.dead != NULL)
+		{
+			Member *m = room.dead;
+			room.dead = m->next_dead;
+			free(m);
+		}
+	}
+}
+
+static void on_accept(Reactor *r, int fd, unsigned events, void *arg)
+{
+	Room *room = arg;
+	(void)r;
+	(void)events;
+
+	for (;;)
+	{
+		int client_fd = accept(fd, NULL, NULL);
+		if (client_fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("room accept");
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		member_join(room, client_fd);
+	}
+}
+
+/*  io_uring's multishot accept: one call per connection (or error)  */
+static void on_accepted(Reactor *r, int fd, int client_fd, void *arg)
+{
+	(void)r;
+	(void)fd;
+
+	if (client_fd < 0)
+	{
+		perror("room accept");
+		return;
+	}
+	member_join(arg, client_fd);
+}
+
+static void member_join(Room *room, int client_fd)
+{
+	struct sockaddr_storage peer;
+	char host[NI_MAXHOST];
+	socklen_t len = sizeof(peer);
+	Reactor *r = room->reactor;
+
+	Member *m = calloc(1, sizeof(*m));
+	if (m == NULL || set_nonblocking(client_fd) < 0 ||
+			reactor_add(r, client_fd, REACTOR_READ, on_member, m) < 0)
+	{
+		perror("room add member");
+		free(m);
+		close(client_fd);
+		return;
+	}
+	/*  nothing read yet, so it can switch to completions right away  */
+	m->stream = reactor_stream(r, client_fd, on_member_data) == 0;
+	m->fd = client_fd;
+	m->id = ++room->next_id;
+	m->room = room;
+	outq_init(&m->outq);
+	m->next = room->list;
+	if (m->next != NULL)
+		m->next->prev = m;
+	room->list = m;
+	room->members++;
+
+	if (getpeername(client_fd, (struct sockaddr *)&peer, &len) < 0)
+		len = 0;
+	int port = resolve_text((struct sockaddr *)&peer, len, host, sizeof(host));
+	fprintf(stderr, "guest %d connected from %s, port %d (%d in the room)\n",
+					m->id, host, port, room->members);
+	member_hello(m);
+}
+
+static void on_member(Reactor *r, int fd, unsigned events, void *arg)
+{
+	Member *m = arg;
+	char buf[RECV_SIZE];
+	(void)r;
+
+	if (m->fd != fd)
+		return; // already left during this loop pass
+
+	if (events & REACTOR_WRITE)
+	{
+		member_flush(m);
+		if (m->fd < 0)
+			return;
+	}
+	if (!(events & (REACTOR_READ | REACTOR_ERROR)))
+		return;
+
+	/*  edge-triggered: read until the socket is drained  */
+	for (;;)
+	{
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n > 0)
+		{
+			if (member_feed(m, buf, n) < 0)
+				return; // left
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		member_leave(m, n == 0 ? "left" : "lost its connection");
+		return;
+	}
+}
+
+/*  a stream's bytes (len > 0), end of file (0) or receive error (< 0)  */
+static void on_member_data(Reactor *r, int fd, const void *data, ssize_t len, void *arg)
+{
+	Member *m = arg;
+	(void)r;
+
+	if (m->fd != fd)
+		return;
+	if (len > 0)
+		member_feed(m, data, len);
+	else
+		member_leave(m, len == 0 ? "left" : "lost its connection");
+}
+
+/*  parse frames out of buf; returns -1 if the member left  */
+static int member_feed(Member *m, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		if (m->header_have < DUPLEX_HEADER_SIZE)
+		{
+			size_t take = DUPLEX_HEADER_SIZE - m->header_have;
+			if (take > len)
+				take = len;
+			memcpy(m->header + m->header_have, buf, take);
+			m->header_have += take;
+			buf += take;
+			len -= take;
+			if (m->header_have < DUPLEX_HEADER_SIZE)
+				return 0;
+			m->body_len = ((uint32_t)m->header[1] << 24) | ((uint32_t)m->header[2] << 16) |
+										((uint32_t)m->header[3] << 8) | m->header[4];
+			m->body_have = 0;
+			if (!m->greeted && m->header[0] != DUPLEX_HELLO)
+			{
+				member_leave(m, "is not a full-duplex client (start speak with -d)");
+				return -1;
+			}
+			if (m->body_len > DUPLEX_MAX_MSG)
+			{
+				member_leave(m, "sent an oversized message");
+				return -1;
+			}
+		}
+
+		/*  keep the first ROOM_MAX_MSG bytes of the body, skip the rest  */
+		size_t take = m->body_len - m->body_have;
+		if (take > len)
+			take = len;
+		if (m->body_have < ROOM_MAX_MSG)
+		{
+			size_t keep = ROOM_MAX_MSG - m->body_have;
+			memcpy(m->body + m->body_have, buf, take < keep ? take : keep);
+		}
+		m->body_have += take;
+		buf += take;
+		len -= take;
+		if (m->body_have < m->body_len)
+			return 0;
+
+		m->header_have = 0;
+		if (member_frame(m, (char)m->header[0]) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*  send our HELLO to a member that was just accepted  */
+static void member_hello(Member *m)
+{
+	OutBuf *chunks[MAX_CHUNKS];
+	int n = encode(m->room, DUPLEX_HELLO, "", DUPLEX_VERSION, strlen(DUPLEX_VERSION), chunks);
+
+	if (n < 0)
+	{
+		member_leave(m, "could not be greeted (out of memory)");
+		return;
+	}
+	if (deliver(m, chunks, n) == 0)
+		member_flush(m);
+	for (int i = 0; i < n; i++)
+		outbuf_unref(chunks[i]);
+}
+
+/*  act on a complete frame from m; returns -1 if the member left  */
+static int member_frame(Member *m, char type)
+{
+	Room *room = m->room;
+	size_t len = m->body_len < ROOM_MAX_MSG ? m->body_len : ROOM_MAX_MSG;
+
+	if (!m->greeted)
+	{
+		if (type != DUPLEX_HELLO || m->body_len != strlen(DUPLEX_VERSION) ||
+				memcmp(m->body, DUPLEX_VERSION, m->body_len) != 0)
+		{
+			member_leave(m, "is not a full-duplex client (start speak with -d)");
+			return -1;
+		}
+		m->greeted = 1;
+		notice(room, m, NULL, "* welcome, you are guest %d; %d other%s here", m->id,
+					 room->members - 1, room->members == 2 ? " is" : "s are");
+		notice(room, NULL, m, "* guest %d joined", m->id);
+		return m->fd < 0 ? -1 : 0;
+	}
+
+	if (type == DUPLEX_QUIT)
+	{
+		member_leave(m, "left");
+		return -1;
+	}
+	if (type == DUPLEX_TEXT)
+	{
+		char prefix[NOTICE_SIZE];
+		snprintf(prefix, sizeof(prefix), "guest %d: ", m->id);
+		broadcast(room, m, prefix, m->body, len);
+	}
+	return 0;
+}
+
+/*  write what the socket takes; once caught up, report any drops  */
+static void member_flush(Member *m)
+{
+	int rc = m->stream ? outq_flush_via(&m->outq, member_send, m, NULL)
+										 : outq_flush(&m->outq, m->fd, NULL);
+
+	if (rc == 1 && m->dropped > 0)
+	{
+		long dropped = m->dropped;
+		m->dropped = 0;
+		notice(m->room, m, NULL, "* %ld message%s dropped: you were reading too slowly",
+					 dropped, dropped == 1 ? "" : "s");
+		return; // notice() flushed again
+	}
+	if (rc < 0)
+	{
+		member_leave(m, "lost its connection");
+		return;
+	}
+
+	int want = rc == 0;
+	if (want != m->writing)
+	{
+		m->writing = want;
+		reactor_mod(m->room->reactor, m->fd, REACTOR_READ | (want ? REACTOR_WRITE : 0));
+	}
+}
+
+/*  a stream's writes go through the loop's send queue, in the background  */
+static ssize_t member_send(void *arg, const struct iovec *iov, int iovcnt)
+{
+	Member *m = arg;
+	return reactor_send(m->room->reactor, m->fd, iov, iovcnt);
+}
+
+static void member_leave(Member *m, const char *why)
+{
+	Room *room = m->room;
+
+	if (m->fd < 0)
+		return;
+	reactor_del(room->reactor, m->fd);
+	close(m->fd);
+	m->fd = -1;
+	outq_clear(&m->outq);
+
+	/* unlink now, free after the loop pass: callbacks may still hold m */
+	if (m->prev != NULL)
+		m->prev->next = m->next;
+	else
+		room->list = m->next;
+	if (m->next != NULL)
+		m->next->prev = m->prev;
+	m->next_dead = room->dead;
+	room->dead = m;
+	room->members--;
+
+	fprintf(stderr, "guest %d %s (%d in the room)\n", m->id, why, room->members);
+	if (m->greeted)
+		notice(room, NULL, NULL, "* guest %d %s", m->id, why);
+}
+
+/*
+ *  frame prefix + text as one message into pooled buffers; returns how
+ *  many were used, or -1 when out of memory
+ */
+static int encode(Room *room, char type, const char *prefix, const char *text, size_t len,
+									OutBuf **chunks)
+{
+	size_t plen = strlen(prefix);
+	size_t total = plen + len;
+	unsigned char header[DUPLEX_HEADER_SIZE];
+	const char *parts[3] = {(const char *)header, prefix, text};
+	size_t sizes[3] = {DUPLEX_HEADER_SIZE, plen, len};
+	int n = 0;
+
+	header[0] = type;
+	header[1] = (total >> 24) & 0xFF;
+	header[2] = (total >> 16) & 0xFF;
+	header[3] = (total >> 8) & 0xFF;
+	header[4] = total & 0xFF;
+
+	for (int p = 0; p < 3; p++)
+	{
+		size_t off = 0;
+		while (off < sizes[p])
+		{
+			if (n == 0 || chunks[n - 1]->end == OUTBUF_SIZE)
+			{
+				if (n == MAX_CHUNKS || (chunks[n] = outbuf_get(&room->pool)) == NULL)
+				{
+					while (n > 0)
+						outbuf_unref(chunks[--n]);
+					return -1;
+				}
+				n++;
+			}
+			OutBuf *b = chunks[n - 1];
+			size_t take = sizes[p] - off;
+			if (take > OUTBUF_SIZE - b->end)
+				take = OUTBUF_SIZE - b->end;
+			memcpy(b->data + b->end, parts[p] + off, take);
+			b->end += take;
+			off += take;
+		}
+	}
+	return n;
+}
+
+/*  queue all n chunks for m, or none of them if its queue is full  */
+static int deliver(Member *m, OutBuf **chunks, int n)
+{
+	if (OUTQ_LEN - m->outq.count < n)
+	{
+		m->dropped++;
+		return -1;
+	}
+	for (int i = 0; i < n; i++)
+		outq_push(&m->outq, chunks[i]);
+	return 0;
+}
+
+static void broadcast(Room *room, Member *from, const char *prefix, const char *text, size_t len)
+{
+	OutBuf *chunks[MAX_CHUNKS];
+	int n = encode(room, DUPLEX_TEXT, prefix, text, len, chunks);
+	if (n < 0)
+	{
+		fprintf(stderr, "room: out of memory, message from guest %d lost\n", from ? from->id : 0);
+		return;
+	}
+
+	/* members leaving mid-way are unlinked but not freed, so m->next stays valid */
+	for (Member *m = room->list; m != NULL; m = m->next)
+	{
+		if (m == from || m->fd < 0 || !m->greeted)
+			continue;
+		if (deliver(m, chunks, n) == 0)
+			member_flush(m);
+	}
+	for (int i = 0; i < n; i++)
+		outbuf_unref(chunks[i]);
+}
+
+/*  send a system line to one member (to), or to everyone but except  */
+static void notice(Room *room, Member *to, Member *except, const char *fmt, ...)
+{
+	char text[NOTICE_SIZE];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+
+	if (to == NULL)
+	{
+		broadcast(room, except, "", text, strlen(text));
+		return;
+	}
+	OutBuf *chunks[MAX_CHUNKS];
+	int n = encode(room, DUPLEX_TEXT, "", text, strlen(text), chunks);
+	if (n < 0)
+		return;
+	if (deliver(to, chunks, n) == 0)
+		member_flush(to);
+	for (int i = 0; i < n; i++)
+		outbuf_unref(chunks[i]);
+}
@@ -0,0 +1,15 @@
+/**
+ **  header for room.c
+ **
+ **  Chat-room mode for speakd: many "speak -d" clients at once, each
+ **  message relayed to everybody else in the room. Runs on the spock
+ **  server's event loop (hw3/reactor.h) and output queues (hw3/outbuf.h).
+ **
+ **/
+
+#define ROOM_MAX_MSG 4096    /* longer messages are cut to this many bytes */
+#define ROOM_LISTEN_DEPTH 64 /* pending connections before accept() */
+
+/*  serve a chat room on server_number (0 = any free port), on io_uring if
+    asked and the kernel has it; never returns  */
+void room( int server_number, int io_uring );
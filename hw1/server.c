@@ -1,267 +1,440 @@
-/**
- ** server.c  -  a server program that uses the socket interface to tcp
- **
- **/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include "server.h"
-#include <errno.h>
-
-extern char *inet_ntoa(struct in_addr);
-
-#define NAMESIZE 255
-#define BUFSIZE 81
-#define listening_depth 2
-
-// ANSI color codes for prettier output
-#define COLOR_RESET "\x1b[0m"
-#define COLOR_GREEN "\x1b[32m"
-#define COLOR_BLUE "\x1b[34m"
-#define COLOR_CYAN "\x1b[36m"
-
-// Helper function to clear the screen
-void clear_screen()
-{
-	printf("\033[2J\033[H");
-}
-
-// Helper function to print colored messages
-void print_message(const char *prefix, const char *message, const char *color)
-{
-	printf("%s%s: %s%s", color, prefix, message, COLOR_RESET);
-}
-
-void send_reply(int client_fd, const char *message)
-{
-	int len = strlen(message);
-	int n = send(client_fd, message, len, 0);
-	if (n != len)
-	{
-		char err_msg[BUFSIZE];
-		fprintf(stderr, "Error: %s\n", strerror(errno));
-		snprintf(err_msg, BUFSIZE, "ERROR: %s", strerror(errno));
-		send(client_fd, err_msg, strlen(err_msg), 0);
-		exit(1);
-	}
-}
-
-void display_help()
-{
-	printf("\n%sAvailable commands:%s\n", COLOR_CYAN, COLOR_RESET);
-	printf("  x    - End your turn\n");
-	printf("  xx   - End chat session\n");
-	printf("  clear- Clear screen\n");
-	printf("  help - Show this help message\n\n");
-}
-
-void server(int server_number)
-{
-	int c, i;
-	int n, len;
-	short fd, client_fd;
-	struct sockaddr_in address, client;
-	struct hostent *node_ptr;
-	char local_node[NAMESIZE];
-	char buffer[BUFSIZE + 1];
-	char reply[BUFSIZE + 1];
-	int chat_over = 0;
-	int server_turn = 0;
-
-	/*  get the internet name of the local host node on which we are running  */
-	if (gethostname(local_node, NAMESIZE) < 0)
-	{
-		perror("server gethostname");
-		exit(1);
-	}
-	fprintf(stderr, "server running on node %s\n", local_node);
-
-	/*  get structure for local host node on which server resides  */
-	if ((node_ptr = gethostbyname(local_node)) == NULL)
-	{
-		perror("server gethostbyname");
-		exit(1);
-	}
-
-	/*  set up Internet address structure for the server  */
-	memset(&address, 0, sizeof(address));
-	address.sin_family = AF_INET;
-	memcpy(&address.sin_addr, node_ptr->h_addr, node_ptr->h_length);
-	address.sin_port = htons(server_number);
-
-	fprintf(stderr, "server full name of server node %s, internet address %s\n",
-					node_ptr->h_name, inet_ntoa(address.sin_addr));
-
-	/*  open an Internet tcp socket  */
-	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-	{
-		perror("server socket");
-		exit(1);
-	}
-
-	/*  bind this socket to the server's Internet address  */
-	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
-	{
-		perror("server bind");
-		exit(1);
-	}
-
-	/*  now find out what local port number was assigned to this server  */
-	len = sizeof(address);
-	if (getsockname(fd, (struct sockaddr *)&address, &len) < 0)
-	{
-		perror("server getsockname");
-		exit(1);
-	}
-
-	/*  we are now successfully established as a server  */
-	fprintf(stderr, "server at internet address %s, port %d\n",
-					inet_ntoa(address.sin_addr), ntohs(address.sin_port));
-
-	/*  start listening for connect requests from clients  */
-	if (listen(fd, listening_depth) < 0)
-	{
-		perror("server listen");
-		exit(1);
-	}
-
-	/*  now accept a client connection (we'll block until one arrives)  */
-	len = sizeof(client);
-	if ((client_fd = accept(fd, (struct sockaddr *)&client, &len)) < 0)
-	{
-		perror("server accept");
-		exit(1);
-	}
-
-	clear_screen();
-	print_message("SYSTEM", "Chat server started! Type 'help' for commands.\n", COLOR_CYAN);
-	/*  we are now successfully connected to a remote client  */
-	fprintf(stderr, "server connected to client at Internet address %s, port %d\n",
-					inet_ntoa(client.sin_addr), ntohs(client.sin_port));
-
-	while (!chat_over)
-	{
-		if (server_turn == 0)
-		{
-			// ----- Client's Turn: Receive messages in a loop -----
-			print_message("SYSTEM", "Waiting for client's messages...\n", COLOR_CYAN);
-			while (1)
-			{
-				n = recv(client_fd, buffer, BUFSIZE - 1, 0);
-
-				if (n < 0)
-				{
-					// System call error: print and send error message back to client.
-					fprintf(stderr, "Error in file %s: %s\n", __FILE__, strerror(errno));
-					snprintf(reply, BUFSIZE, "ERROR in file %s: %s", __FILE__, strerror(errno));
-					send_reply(client_fd, reply);
-					exit(1);
-				}
-				buffer[n] = '\0'; // Ensure null-termination
-
-				// Check for control signals.
-				if (strcmp(buffer, "xx\n") == 0)
-				{
-					print_message("SYSTEM", "Client ended the chat.\n", COLOR_CYAN);
-					send_reply(client_fd, "server received: xx\n");
-					chat_over = 1;
-					break; // Exit the inner loop; chat will terminate.
-				}
-				if (strcmp(buffer, "x\n") == 0)
-				{
-					print_message("SYSTEM", "Client ended its turn.\n", COLOR_CYAN);
-					send_reply(client_fd, "server received: x\n");
-					break; // End of client's turn; exit inner loop to switch turns.
-				}
-
-				// For a normal message, print it and reply.
-				print_message("Client", buffer, COLOR_BLUE);
-				snprintf(reply, BUFSIZE, "Server received: %s", buffer);
-				send_reply(client_fd, reply);
-			} // End inner while for client's turn
-
-			if (chat_over)
-
-				break;
-
-			// Switch to server's turn.
-			server_turn = 1;
-		}
-		else
-		{ // server_turn == 1
-			// ----- Server's Turn: Send messages until "x" or "xx" is entered -----
-			print_message("SYSTEM", "Your turn to speak (enter 'x' to end your turn, 'xx' to quit):\n", COLOR_GREEN);
-			printf(COLOR_GREEN "> " COLOR_RESET);
-			while (1)
-			{
-				if (fgets(buffer, BUFSIZE, stdin) == NULL)
-				{
-					fprintf(stderr, "Error reading input\n");
-					continue;
-				}
-				int len = strlen(buffer);
-
-				if (strcmp(buffer, "help\n") == 0)
-				{
-					display_help();
-					printf(COLOR_GREEN "> " COLOR_RESET);
-					continue;
-				}
-
-				if (strcmp(buffer, "clear\n") == 0)
-				{
-					clear_screen();
-					printf(COLOR_GREEN "> " COLOR_RESET);
-					continue;
-				}
-
-				// Check for server control signals.
-				if (strcmp(buffer, "xx\n") == 0)
-				{
-					send_reply(client_fd, buffer);
-					chat_over = 1;
-					break; // End server's turn and chat.
-				}
-				if (strcmp(buffer, "x\n") == 0)
-				{
-					send_reply(client_fd, buffer);
-					break; // End server's turn.
-				}
-
-				// For a normal message, send it.
-				send_reply(client_fd, buffer);
-				print_message("You", buffer, COLOR_GREEN);
-				// The protocol does not require waiting for an acknowledgement here.
-				// (Every message from the client already receives a reply.)
-			} // End inner while for server's turn
-
-			if (chat_over)
-				break;
-
-			// Switch back to client's turn.
-			server_turn = 0;
-		}
-	}
-
-	if (n < 0)
-		perror("server read");
-
-	/*  close the connection to the client  */
-	if (close(client_fd) < 0)
-	{
-		perror("server close connection to client");
-		exit(1);
-	}
-
-	/*  close the "listening post" socket by which server made connections  */
-	if (close(fd) < 0)
-	{
-		perror("server close");
-		exit(1);
-	}
-}
+/**
+ ** server.c  -  a server program that uses the socket interface to tcp
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "server.h"
+#include "resolve.h"
+#include "duplex.h"
+#include <errno.h>
+
+#define BUFSIZE 81
+#define listening_depth 2
+#define ACK_EVERY 32  /* client lines per cumulative acknowledgement, at most */
+#define ACK_MS 200    /* ...or this long after the first line not yet acknowledged */
+#define DRAIN_MS 2000 /* how long queued replies may take to go out at the end */
+
+// ANSI color codes for prettier output
+#define COLOR_RESET "\x1b[0m"
+#define COLOR_GREEN "\x1b[32m"
+#define COLOR_BLUE "\x1b[34m"
+#define COLOR_CYAN "\x1b[36m"
+
+// Helper function to clear the screen
+void clear_screen()
+{
+	printf("\033[2J\033[H");
+}
+
+// Helper function to print colored messages
+void print_message(const char *prefix, const char *message, const char *color)
+{
+	printf("%s%s: %s%s", color, prefix, message, COLOR_RESET);
+}
+
+// Replies the socket has not taken yet: pending[pending_off..pending_len)
+static char *pending;
+static size_t pending_off, pending_len, pending_cap;
+
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Send as much of the reply queue as the socket takes without blocking.
+// Returns -1 if the connection is broken.
+static int flush_replies(int client_fd)
+{
+	while (pending_off < pending_len)
+	{
+		ssize_t n = send(client_fd, pending + pending_off, pending_len - pending_off,
+										 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0; // short write: the rest stays queued
+			fprintf(stderr, "Error: %s\n", strerror(errno));
+			return -1;
+		}
+		pending_off += n;
+	}
+	pending_off = pending_len = 0;
+	return 0;
+}
+
+// Queue a reply and send what the socket takes; a short write no longer
+// ends the chat. Returns -1 if the connection is broken.
+int send_reply(int client_fd, const char *message)
+{
+	size_t len = strlen(message);
+	if (pending_len + len > pending_cap)
+	{
+		size_t cap = pending_cap ? pending_cap : 1024;
+		while (cap < pending_len + len)
+			cap *= 2;
+		char *grown = realloc(pending, cap);
+		if (grown == NULL)
+		{
+			perror("server reply queue");
+			return -1;
+		}
+		pending = grown;
+		pending_cap = cap;
+	}
+	memcpy(pending + pending_len, message, len);
+	pending_len += len;
+	return flush_replies(client_fd);
+}
+
+// Wait up to timeout_ms for queued replies to go out before closing.
+static void drain_replies(int client_fd, int timeout_ms)
+{
+	long long deadline = now_ms() + timeout_ms;
+	while (pending_off < pending_len)
+	{
+		struct pollfd pfd = {client_fd, POLLOUT, 0};
+		int left = (int)(deadline - now_ms());
+		if (left <= 0 || poll(&pfd, 1, left) <= 0 || flush_replies(client_fd) < 0)
+			break;
+	}
+}
+
+// Acknowledge every client line up to and including line number seq.
+static int send_ack(int client_fd, long seq)
+{
+	char reply[BUFSIZE + 1];
+	snprintf(reply, sizeof(reply), "Server received through line %ld\n", seq);
+	return send_reply(client_fd, reply);
+}
+
+/*
+ *  receive_turn: take the client's lines until it sends "x" (returns 0) or
+ *  "xx", hangs up or fails (returns 1). Instead of echoing every line, the
+ *  highest line number received so far (*received) is acknowledged once
+ *  per ACK_EVERY lines, ACK_MS after the first unacknowledged line, and at
+ *  the end of the turn.
+ */
+static int receive_turn(int client_fd, long *received)
+{
+	char buffer[BUFSIZE + 1];
+	char line[BUFSIZE + 1];
+	size_t have = 0;
+	long acked = *received;
+	long long ack_due = 0;
+
+	while (1)
+	{
+		struct pollfd pfd;
+		int timeout = -1;
+		pfd.fd = client_fd;
+		pfd.events = POLLIN | (pending_off < pending_len ? POLLOUT : 0);
+		if (*received > acked)
+		{
+			long long left = ack_due - now_ms();
+			timeout = left > 0 ? (int)left : 0;
+		}
+
+		int n = poll(&pfd, 1, timeout);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("server poll");
+			return 1;
+		}
+		if (n == 0)
+		{
+			// the client paused: acknowledge what it has sent so far
+			if (send_ack(client_fd, *received) < 0)
+				return 1;
+			acked = *received;
+			continue;
+		}
+		if ((pfd.revents & POLLOUT) && flush_replies(client_fd) < 0)
+			return 1;
+		if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		n = recv(client_fd, buffer + have, BUFSIZE - 1 - have, 0);
+		if (n < 0)
+		{
+			// System call error: print and send error message back to client.
+			fprintf(stderr, "Error in file %s: %s\n", __FILE__, strerror(errno));
+			snprintf(line, BUFSIZE, "ERROR in file %s: %s", __FILE__, strerror(errno));
+			send_reply(client_fd, line);
+			return 1;
+		}
+		if (n == 0)
+		{
+			print_message("SYSTEM", "Client disconnected.\n", COLOR_CYAN);
+			return 1;
+		}
+		have += n;
+
+		/* handle each complete line; several may arrive in one recv */
+		size_t start = 0;
+		while (start < have)
+		{
+			char *nl = memchr(buffer + start, '\n', have - start);
+			size_t len;
+			if (nl != NULL)
+				len = nl - (buffer + start) + 1;
+			else if (start == 0 && have == BUFSIZE - 1)
+				len = have; // the client sends a long line in BUFSIZE - 1 pieces
+			else
+				break;
+			memcpy(line, buffer + start, len);
+			line[len] = '\0';
+			start += len;
+
+			// Check for control signals.
+			if (strcmp(line, "xx\n") == 0 || strcmp(line, "x\n") == 0)
+			{
+				int quit = line[1] == 'x';
+				if (*received > acked && send_ack(client_fd, *received) < 0)
+					return 1;
+				print_message("SYSTEM", quit ? "Client ended the chat.\n" : "Client ended its turn.\n",
+											COLOR_CYAN);
+				if (send_reply(client_fd, quit ? "server received: xx\n" : "server received: x\n") < 0)
+					return 1;
+				return quit;
+			}
+
+			// For a normal message, print it; the acknowledgement comes in a batch.
+			print_message("Client", line, COLOR_BLUE);
+			(*received)++;
+			if (*received - acked >= ACK_EVERY)
+			{
+				if (send_ack(client_fd, *received) < 0)
+					return 1;
+				acked = *received;
+			}
+			else if (*received - acked == 1)
+			{
+				ack_due = now_ms() + ACK_MS;
+			}
+		}
+		memmove(buffer, buffer + start, have - start);
+		have -= start;
+	}
+}
+
+void display_help()
+{
+	printf("\n%sAvailable commands:%s\n", COLOR_CYAN, COLOR_RESET);
+	printf("  x    - End your turn\n");
+	printf("  xx   - End chat session\n");
+	printf("  clear- Clear screen\n");
+	printf("  help - Show this help message\n\n");
+}
+
+int server_listen(int server_number, int depth)
+{
+	int fd = -1, off = 0, err;
+	socklen_t len;
+	struct sockaddr_storage address;
+	struct addrinfo hints, *addrs, *ai;
+	char service[16], host[NI_MAXHOST];
+
+	/*  the wildcard addresses (every interface); no host name lookup at all  */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	snprintf(service, sizeof(service), "%d", server_number);
+	if ((err = getaddrinfo(NULL, service, &hints, &addrs)) != 0)
+	{
+		fprintf(stderr, "server getaddrinfo: %s\n", gai_strerror(err));
+		exit(1);
+	}
+
+	/*  open and bind a tcp socket: one dual-stack IPv6 socket, which takes
+	    IPv4 clients as well, or plain IPv4 where there is no IPv6  */
+	for (int pass = 0; pass < 2 && fd < 0; pass++)
+	{
+		for (ai = addrs; ai != NULL; ai = ai->ai_next)
+		{
+			if (ai->ai_family != (pass == 0 ? AF_INET6 : AF_INET))
+				continue;
+			if ((fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+				continue;
+			if (ai->ai_family == AF_INET6)
+				setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			err = errno;
+			close(fd);
+			fd = -1;
+			errno = err;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (fd < 0)
+	{
+		perror("server bind");
+		exit(1);
+	}
+
+	/*  now find out what local port number was assigned to this server  */
+	len = sizeof(address);
+	if (getsockname(fd, (struct sockaddr *)&address, &len) < 0)
+	{
+		perror("server getsockname");
+		exit(1);
+	}
+
+	/*  we are now successfully established as a server  */
+	int port = resolve_text((struct sockaddr *)&address, len, host, sizeof(host));
+	fprintf(stderr, "server at internet address %s, port %d\n", host, port);
+
+	/*  start listening for connect requests from clients  */
+	if (listen(fd, depth) < 0)
+	{
+		perror("server listen");
+		exit(1);
+	}
+
+	return fd;
+}
+
+void server(int server_number, int duplex)
+{
+	socklen_t len;
+	short fd, client_fd;
+	struct sockaddr_storage client;
+	char host[NI_MAXHOST];
+	char buffer[BUFSIZE + 1];
+	long received = 0; // client lines so far, the sequence number acked
+	int chat_over = 0;
+	int server_turn = 0;
+
+	/*  bind the "listening post" socket through which clients connect  */
+	fd = server_listen(server_number, listening_depth);
+
+	/*  now accept a client connection (we'll block until one arrives)  */
+	len = sizeof(client);
+	if ((client_fd = accept(fd, (struct sockaddr *)&client, &len)) < 0)
+	{
+		perror("server accept");
+		exit(1);
+	}
+
+	clear_screen();
+	if (!duplex)
+		print_message("SYSTEM", "Chat server started! Type 'help' for commands.\n", COLOR_CYAN);
+	/*  we are now successfully connected to a remote client  */
+	int port = resolve_text((struct sockaddr *)&client, len, host, sizeof(host));
+	fprintf(stderr, "server connected to client at Internet address %s, port %d\n", host, port);
+
+	/*  in full-duplex mode both sides talk whenever they like  */
+	if (duplex)
+	{
+		duplex_secure(client_fd, NULL);
+		duplex_chat(client_fd, "Client");
+		chat_over = 1;
+	}
+
+	while (!chat_over)
+	{
+		if (server_turn == 0)
+		{
+			// ----- Client's Turn: Receive messages until "x" or "xx" -----
+			print_message("SYSTEM", "Waiting for client's messages...\n", COLOR_CYAN);
+			chat_over = receive_turn(client_fd, &received);
+			if (chat_over)
+				break;
+
+			// Switch to server's turn.
+			server_turn = 1;
+		}
+		else
+		{ // server_turn == 1
+			// ----- Server's Turn: Send messages until "x" or "xx" is entered -----
+			print_message("SYSTEM", "Your turn to speak (enter 'x' to end your turn, 'xx' to quit):\n", COLOR_GREEN);
+			printf(COLOR_GREEN "> " COLOR_RESET);
+			while (1)
+			{
+				if (fgets(buffer, BUFSIZE, stdin) == NULL)
+				{
+					// end of input: leave the chat rather than spin on EOF
+					strcpy(buffer, "xx\n");
+				}
+
+				if (strcmp(buffer, "help\n") == 0)
+				{
+					display_help();
+					printf(COLOR_GREEN "> " COLOR_RESET);
+					continue;
+				}
+
+				if (strcmp(buffer, "clear\n") == 0)
+				{
+					clear_screen();
+					printf(COLOR_GREEN "> " COLOR_RESET);
+					continue;
+				}
+
+				// Check for server control signals.
+				if (strcmp(buffer, "xx\n") == 0)
+				{
+					send_reply(client_fd, buffer);
+					chat_over = 1;
+					break; // End server's turn and chat.
+				}
+				if (strcmp(buffer, "x\n") == 0)
+				{
+					send_reply(client_fd, buffer);
+					break; // End server's turn.
+				}
+
+				// For a normal message, send it.
+				if (send_reply(client_fd, buffer) < 0)
+				{
+					chat_over = 1;
+					break;
+				}
+				print_message("You", buffer, COLOR_GREEN);
+				// The protocol does not require waiting for an acknowledgement here.
+				// (Client lines are acknowledged in batches by receive_turn.)
+			} // End inner while for server's turn
+
+			if (chat_over)
+				break;
+
+			// Switch back to client's turn.
+			server_turn = 0;
+		}
+	}
+
+	/*  let queued replies go out before closing  */
+	drain_replies(client_fd, DRAIN_MS);
+
+	/*  close the connection to the client  */
+	if (duplex)
+		duplex_close(client_fd);
+	else if (close(client_fd) < 0)
+	{
+		perror("server close connection to client");
+		exit(1);
+	}
+
+	/*  close the "listening post" socket by which server made connections  */
+	if (close(fd) < 0)
+	{
+		perror("server close");
+		exit(1);
+	}
+}
@@ -1,6 +1,13 @@
-/**
- **  header for server.c
- **
- **/
-
-void server( int server_number );
+/**
+ **  header for server.c
+ **
+ **/
+
+/*  duplex: chat in full-duplex framed mode (see duplex.h) instead of taking turns  */
+void server( int server_number, int duplex );
+
+/*
+ *  bind a listening tcp socket to server_number (0 = any free port) on the
+ *  local node and print where it is; exits on error
+ */
+int server_listen( int server_number, int depth );
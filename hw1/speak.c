@@ -1,43 +1,78 @@
-/**
- **  unix client access program
- **
- **/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include "client.h"
-
-
-#define default_server_number	233+1024
-
-
-int main( int argc, char*argv[] )
-{
-char	*server_node;
-int	server_number;
-
-/*  there must be one or two command line arguments  */
-if( argc > 3 || argc < 2 )
-	{
-	fprintf(stderr, "usage: client server-number [server-node]\n");
-	exit(1);
-	}
-
-/*  get the server's port number from the first parameter  */
-server_number = atoi(argv[1]);
-
-/*  get the server's node name from the second parameter  */
-if( argc <= 2 )
-	server_node = NULL;
-else
-	server_node = argv[2];
-
-/*  now let the common client do the real work  */
-client( server_number, server_node );
-
-return(0);
-}
-
-
+/**
+ **  unix client access program
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "client.h"
+#include "duplex.h"
+#include "transfer.h"
+
+
+#define default_server_number	233+1024
+
+
+int main( int argc, char*argv[] )
+{
+char	*server_node;
+int	server_number;
+int	duplex = 0;
+char	*send_path = NULL;
+
+/*  --tls ca-file secures the -d and --send modes, trusting the CAs in ca-file  */
+if( argc > 2 && strcmp(argv[1], "--tls") == 0 )
+	{
+	if( argc < 4 || (strcmp(argv[3], "-d") != 0 && strcmp(argv[3], "--send") != 0) )
+		{
+		fprintf(stderr, "speak: --tls works with -d and --send\n");
+		exit(1);
+		}
+	duplex_use_tls( NULL, NULL, argv[2] );
+	argc -= 2;
+	argv += 2;
+	}
+
+/*  an optional -d selects full-duplex mode, --send file a bulk transfer  */
+if( argc > 1 && strcmp(argv[1], "-d") == 0 )
+	{
+	duplex = 1;
+	argc--;
+	argv++;
+	}
+else if( argc > 2 && strcmp(argv[1], "--send") == 0 )
+	{
+	send_path = argv[2];
+	argc -= 2;
+	argv += 2;
+	}
+
+/*  there must be one or two more command line arguments  */
+if( argc > 3 || argc < 2 )
+	{
+	fprintf(stderr, "usage: client [--tls ca-file] [-d | --send file] server-number [server-node]\n");
+	exit(1);
+	}
+
+/*  get the server's port number from the first parameter  */
+server_number = atoi(argv[1]);
+
+/*  get the server's node name from the second parameter  */
+if( argc <= 2 )
+	server_node = NULL;
+else
+	server_node = argv[2];
+
+/*  a transfer streams the file ("-" = stdin) instead of chatting  */
+if( send_path != NULL )
+	return( transfer_send( client_connect( server_number, server_node ), send_path ) < 0 );
+
+/*  now let the common client do the real work  */
+client( server_number, server_node, duplex );
+
+return(0);
+}
+
+
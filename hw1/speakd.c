@@ -1,32 +1,106 @@
-/**
- **  unix server access program
- **
- **/
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include "server.h"
-
-#define default_server_number 0
-
-int main(int argc, char *argv[])
-{
-	int server_number;
-
-	/*  there must be zero or one command line argument  */
-	if (argc > 1)
-	{
-		fprintf(stderr, "usage: server [server-number]\n");
-		exit(1);
-	}
-
-	/*  get the server's port number from the first parameter  */
-	server_number = default_server_number;
-
-	/*  now let the common server do the real work  */
-	server(server_number);
-
-	return (0);
-}
+/**
+ **  unix server access program
+ **
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "duplex.h"
+#include "room.h"
+#include "transfer.h"
+
+#define default_server_number 0
+
+int main(int argc, char *argv[])
+{
+	int server_number;
+	int duplex = 0;
+	int chat_room = 0;
+	int receive = 0;
+	int io_uring = 0;
+	char *recv_path = NULL;
+
+	/*  --tls cert key secures the -d and --recv modes with TLS  */
+	if (argc > 3 && strcmp(argv[1], "--tls") == 0)
+	{
+		if (argc < 5 || (strcmp(argv[4], "-d") != 0 && strcmp(argv[4], "--recv") != 0))
+		{
+			fprintf(stderr, "speakd: --tls works with -d and --recv\n");
+			exit(1);
+		}
+		duplex_use_tls(argv[2], argv[3], NULL);
+		argc -= 3;
+		argv += 3;
+	}
+
+	/*  --io-uring runs the -r chat room's event loop on io_uring  */
+	if (argc > 1 && strcmp(argv[1], "--io-uring") == 0)
+	{
+		if (argc < 3 || strcmp(argv[2], "-r") != 0)
+		{
+			fprintf(stderr, "speakd: --io-uring works with -r\n");
+			exit(1);
+		}
+		io_uring = 1;
+		argc--;
+		argv++;
+	}
+
+	/*  -d selects full-duplex mode, -r a chat room for many clients,
+	    --recv [file] one bulk transfer from "speak --send" (default stdout)  */
+	if (argc > 1 && strcmp(argv[1], "-d") == 0)
+		duplex = 1;
+	else if (argc > 1 && strcmp(argv[1], "-r") == 0)
+		chat_room = 1;
+	else if (argc > 1 && strcmp(argv[1], "--recv") == 0)
+		receive = 1;
+	if (duplex || chat_room || receive)
+	{
+		argc--;
+		argv++;
+	}
+	if (receive && argc > 1)
+	{
+		recv_path = argv[1];
+		argc--;
+		argv++;
+	}
+
+	/*  there must be zero or one command line argument  */
+	if (argc > 1)
+	{
+		fprintf(stderr, "usage: server [--tls cert key] [-d | [--io-uring] -r | --recv [file]]\n");
+		exit(1);
+	}
+
+	/*  get the server's port number from the first parameter  */
+	server_number = default_server_number;
+
+	/*  now let the common server do the real work  */
+	if (receive)
+	{
+		/*  accept one client and take its transfer  */
+		int fd = server_listen(server_number, 1);
+		int client_fd = accept(fd, NULL, NULL);
+		if (client_fd < 0)
+		{
+			perror("server accept");
+			exit(1);
+		}
+		duplex_secure(client_fd, NULL);
+		int rc = transfer_recv(client_fd, recv_path);
+		duplex_close(client_fd);
+		close(fd);
+		return rc < 0;
+	}
+	if (chat_room)
+		room(server_number, io_uring);
+	else
+		server(server_number, duplex);
+
+	return (0);
+}
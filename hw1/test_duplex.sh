@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+#  test_duplex.sh  -  full-duplex mode: a typed line longer than one
+#  message (DUPLEX_MAX_MSG) reaches the peer in pieces, and the chat goes on
+#
+#  run from hw1 after make:  make test
+#
+
+MAX=65536
+LONG=66000
+dir=$(mktemp -d)
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+
+#  the server keeps its stdin open until the client is done
+sleep 5 | ./speakd -d > "$dir/server.out" 2> "$dir/server.err" &
+server=$!
+
+port=
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+	port=$(sed -n 's/^server at internet address .*, port \([0-9]*\)$/\1/p' "$dir/server.err")
+	[ -n "$port" ] && break
+	sleep 0.2
+done
+if [ -z "$port" ]
+then
+	echo "FAIL: speakd did not start"
+	exit 1
+fi
+
+#  a short line, an overlong one, another short one, then end of input
+#  (QUIT); read from a file, so the newline after the long line comes in
+#  the same read that takes it past DUPLEX_MAX_MSG
+{ echo before; head -c $LONG /dev/zero | tr '\0' a; echo; echo after; } > "$dir/input"
+./speak -d "$port" 127.0.0.1 < "$dir/input" > "$dir/client.out" 2> "$dir/client.err"
+wait $server
+
+pieces=$(grep -o 'a\{100,\}' "$dir/server.out" | awk '{ printf "%s%d", sep, length($0); sep = "," }')
+if [ "$pieces" != "$MAX,$((LONG - MAX))" ]
+then
+	echo "FAIL: the long line arrived as [$pieces], want [$MAX,$((LONG - MAX))]"
+	cat "$dir/server.err"
+	exit 1
+fi
+if ! grep -q ': after' "$dir/server.out" || ! grep -q 'ended the chat' "$dir/server.out"
+then
+	echo "FAIL: the chat did not go on after the long line"
+	cat "$dir/server.err"
+	exit 1
+fi
+echo "PASS: a $LONG-byte line arrived as $MAX + $((LONG - MAX)) bytes"
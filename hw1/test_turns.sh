@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+#  test_turns.sh  -  half-duplex mode: the client still sees the server's
+#  "x"/"xx" when they share a segment with an acknowledgement
+#
+#  run from hw1 after make:  make test
+#
+
+dir=$(mktemp -d)
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+
+#  the server has one line ready, then its stdin ends and it sends "xx"
+echo hello | ./speakd > "$dir/server.out" 2> "$dir/server.err" &
+server=$!
+
+port=
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+	port=$(sed -n 's/^server at internet address .*, port \([0-9]*\)$/\1/p' "$dir/server.err")
+	[ -n "$port" ] && break
+	sleep 0.2
+done
+if [ -z "$port" ]
+then
+	echo "FAIL: speakd did not start"
+	exit 1
+fi
+
+#  two lines and "x": the ack, "server received: x", the server's line
+#  and its "xx" all go out at once
+printf 'hi\nthere\nx\n' | timeout 5 ./speak "$port" 127.0.0.1 > "$dir/client.out" 2> "$dir/client.err"
+if [ $? -ne 0 ]
+then
+	echo "FAIL: the client did not leave the chat when the server sent xx"
+	cat "$dir/client.out"
+	exit 1
+fi
+wait $server
+if ! grep -q 'through line 2' "$dir/client.out" || ! grep -q 'hello' "$dir/client.out"
+then
+	echo "FAIL: the client missed the server's lines"
+	cat "$dir/client.out"
+	exit 1
+fi
+echo "PASS: the client took the server's turn and its xx line by line"
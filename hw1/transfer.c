@@ -0,0 +1,516 @@
+/**
+ ** transfer.c  -  zero-copy bulk transfer for speak --send / speakd --recv
+ **
+ **/
+
+#define _GNU_SOURCE /* splice, tee, F_SETPIPE_SZ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "duplex.h"
+#include "tls.h"
+#include "transfer.h"
+
+#define CHUNK (1 << 20)     /* most bytes moved per splice() or sendfile() */
+#define WINDOW (8 << 20)    /* bytes of a file mapped and checksummed at a time */
+#define PIPE_SIZE (1 << 20) /* requested capacity of the splice pipes */
+#define COPY_SIZE 65536     /* buffer for the checksum copy and copy fallback */
+
+#define ADLER_MOD 65521
+#define ADLER_NMAX 5552 /* bytes before the sums must be reduced (as in zlib) */
+
+/* the running Adler-32 of everything seen so far */
+static uint32_t adler32(uint32_t adler, const unsigned char *p, size_t n)
+{
+  uint32_t a = adler & 0xFFFF, b = adler >> 16;
+  while (n > 0)
+  {
+    size_t k = n < ADLER_NMAX ? n : ADLER_NMAX;
+    n -= k;
+    while (k >= 8)
+    {
+      a += p[0]; b += a;
+      a += p[1]; b += a;
+      a += p[2]; b += a;
+      a += p[3]; b += a;
+      a += p[4]; b += a;
+      a += p[5]; b += a;
+      a += p[6]; b += a;
+      a += p[7]; b += a;
+      p += 8;
+      k -= 8;
+    }
+    while (k-- > 0)
+    {
+      a += *p++;
+      b += a;
+    }
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+  }
+  return (b << 16) | a;
+}
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, unsigned long long bytes, double secs, uint32_t sum)
+{
+  if (secs <= 0)
+    secs = 1e-9;
+  fprintf(stderr, "%s %llu bytes in %.3f s (%.1f MB/s), adler32 %08x\n",
+          what, bytes, secs, bytes / secs / 1e6, sum);
+}
+
+static void put_be(unsigned char *p, uint64_t v, int n)
+{
+  while (n-- > 0)
+  {
+    p[n] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t get_be(const unsigned char *p, int n)
+{
+  uint64_t v = 0;
+  while (n-- > 0)
+    v = (v << 8) | *p++;
+  return v;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* write_all() to the connection, through TLS if it is secured */
+static int send_all(int fd, const char *buf, size_t len)
+{
+  TlsConn *tls = duplex_tls();
+  if (tls == NULL)
+    return write_all(fd, buf, len);
+  while (len > 0)
+  {
+    ssize_t n = tls_send(tls, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int make_pipe(int p[2])
+{
+  if (pipe(p) < 0)
+    return -1;
+  fcntl(p[1], F_SETPIPE_SZ, PIPE_SIZE); // best effort: 64 KiB works too
+  return 0;
+}
+
+/* move exactly len bytes already in pipe_fd on to out with splice() */
+static int splice_out(int pipe_fd, int out, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = splice(pipe_fd, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    len -= n;
+  }
+  return 0;
+}
+
+/* read len bytes from pipe_fd only to checksum them */
+static int checksum_pipe(int pipe_fd, size_t len, uint32_t *sum)
+{
+  static unsigned char buf[COPY_SIZE];
+  while (len > 0)
+  {
+    ssize_t n = read(pipe_fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    *sum = adler32(*sum, buf, n);
+    len -= n;
+  }
+  return 0;
+}
+
+/* a regular file: checksum each window through mmap(), then sendfile() it */
+static int send_file(int fd, int in, off_t start, uint64_t size, uint32_t *sum)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  off_t end = start + size;
+
+  for (off_t off = start; off < end;)
+  {
+    size_t len = end - off < WINDOW ? end - off : WINDOW;
+    off_t map_off = off & ~(off_t)(page - 1);
+    size_t delta = off - map_off;
+    unsigned char *map = mmap(NULL, len + delta, PROT_READ, MAP_SHARED, in, map_off);
+    if (map == MAP_FAILED)
+    {
+      perror("speak mmap");
+      return -1;
+    }
+    madvise(map, len + delta, MADV_SEQUENTIAL);
+    *sum = adler32(*sum, map + delta, len);
+    munmap(map, len + delta);
+
+    off_t pos = off;
+    while (pos < off + (off_t)len)
+    {
+      size_t want = off + len - pos < CHUNK ? off + len - pos : CHUNK;
+      ssize_t n = sendfile(fd, in, &pos, want);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        perror(n < 0 ? "speak sendfile" : "speak sendfile (file shrank)");
+        return -1;
+      }
+    }
+    off += len;
+  }
+  return 0;
+}
+
+/*
+ *  a pipe: tee() each batch into a side pipe for the checksum, and splice()
+ *  the batch itself straight to the socket
+ */
+static int send_pipe(int fd, int in, unsigned long long *sent, uint32_t *sum)
+{
+  int side[2];
+  if (make_pipe(side) < 0)
+  {
+    perror("speak pipe");
+    return -1;
+  }
+  int rc = 0;
+  while (1)
+  {
+    ssize_t n = tee(in, side[1], CHUNK, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      perror("speak tee");
+      rc = -1;
+      break;
+    }
+    if (n == 0)
+      break; // end of input
+    if (splice_out(in, fd, n) < 0 || checksum_pipe(side[0], n, sum) < 0)
+    {
+      perror("speak splice");
+      rc = -1;
+      break;
+    }
+    *sent += n;
+  }
+  close(side[0]);
+  close(side[1]);
+  return rc;
+}
+
+/* anything else (a terminal), or TLS in user space: plain read() and send() */
+static int send_copy(int fd, int in, unsigned long long *sent, uint32_t *sum)
+{
+  static char buf[COPY_SIZE];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) != 0)
+  {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || send_all(fd, buf, n) < 0)
+    {
+      perror("speak send");
+      return -1;
+    }
+    *sum = adler32(*sum, (unsigned char *)buf, n);
+    *sent += n;
+  }
+  return 0;
+}
+
+/*  TLS is decrypted in user space, so the receiver reads, writes and checksums  */
+static int recv_copy(TlsConn *tls, int out, uint64_t size, unsigned long long *got, uint32_t *sum)
+{
+  static char buf[COPY_SIZE];
+  while (size == XFER_SIZE_UNKNOWN || *got < size)
+  {
+    size_t want = COPY_SIZE;
+    if (size != XFER_SIZE_UNKNOWN && size - *got < want)
+      want = size - *got;
+    ssize_t n = tls_recv(tls, buf, want);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0)
+      break; // the sender closed its end
+    if (n < 0 || write_all(out, buf, n) < 0)
+    {
+      perror(n < 0 ? "speakd recv" : "speakd write");
+      return -1;
+    }
+    *sum = adler32(*sum, (unsigned char *)buf, n);
+    *got += n;
+  }
+  return 0;
+}
+
+int transfer_send(int fd, const char *path)
+{
+  int in = STDIN_FILENO;
+  const char *name = "stdin";
+  unsigned char msg[8 + XFER_NAME_MAX];
+  char type;
+  size_t len;
+  struct stat st;
+
+  signal(SIGPIPE, SIG_IGN); // a receiver that goes away is an error, not a signal
+  if (strcmp(path, "-") != 0)
+  {
+    if ((in = open(path, O_RDONLY)) < 0)
+    {
+      perror(path);
+      return -1;
+    }
+    name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  }
+  if (fstat(in, &st) < 0)
+  {
+    perror(path);
+    return -1;
+  }
+
+  off_t start = 0;
+  uint64_t size = XFER_SIZE_UNKNOWN;
+  if (S_ISREG(st.st_mode))
+  {
+    start = lseek(in, 0, SEEK_CUR); // "speak --send - < file" may start mid-way
+    if (start < 0)
+      start = 0;
+    size = st.st_size > start ? st.st_size - start : 0;
+  }
+
+  /* negotiate */
+  size_t name_len = strlen(name) < XFER_NAME_MAX ? strlen(name) : XFER_NAME_MAX;
+  put_be(msg, size, 8);
+  memcpy(msg + 8, name, name_len);
+  if (duplex_send(fd, XFER_OFFER, (char *)msg, 8 + name_len) < 0 ||
+      duplex_recv(fd, &type, (char *)msg, sizeof(msg) - 1, &len) < 0)
+  {
+    fprintf(stderr, "speak: the server did not answer the transfer offer (is it speakd --recv?)\n");
+    return -1;
+  }
+  if (type != XFER_ACCEPT)
+  {
+    msg[len] = '\0';
+    fprintf(stderr, "speak: transfer refused: %s\n", type == XFER_REFUSE ? (char *)msg : "?");
+    return -1;
+  }
+
+  /*
+   *  stream: sendfile() and splice() bypass user space, so with TLS they
+   *  only work once the kernel encrypts the socket's records itself
+   */
+  TlsConn *tls = duplex_tls();
+  int zero_copy = tls == NULL || tls_ktls_send(tls);
+  unsigned long long sent = 0;
+  uint32_t sum = 1;
+  double t0 = now_sec();
+  int rc;
+  if (S_ISREG(st.st_mode) && zero_copy)
+  {
+    rc = send_file(fd, in, start, size, &sum);
+    sent = size;
+  }
+  else
+  {
+    rc = S_ISFIFO(st.st_mode) && zero_copy ? send_pipe(fd, in, &sent, &sum)
+                                           : send_copy(fd, in, &sent, &sum);
+    if (size == XFER_SIZE_UNKNOWN)
+    {
+      // the receiver reads to EOF
+      if (tls != NULL)
+        tls_shutdown(tls);
+      else
+        shutdown(fd, SHUT_WR);
+    }
+  }
+  if (rc < 0)
+    return -1;
+  report("sent", sent, now_sec() - t0, sum);
+
+  /* confirm */
+  if (duplex_recv(fd, &type, (char *)msg, sizeof(msg), &len) < 0 || type != XFER_SUMMARY || len != 12)
+  {
+    fprintf(stderr, "speak: no transfer summary from the server\n");
+    return -1;
+  }
+  unsigned long long got = get_be(msg, 8);
+  uint32_t their_sum = get_be(msg + 8, 4);
+  if (got != sent || their_sum != sum)
+  {
+    fprintf(stderr, "speak: MISMATCH: server received %llu bytes, adler32 %08x\n", got, their_sum);
+    return -1;
+  }
+  fprintf(stderr, "server confirms %llu bytes, adler32 %08x\n", got, their_sum);
+  if (in != STDIN_FILENO)
+    close(in);
+  return 0;
+}
+
+int transfer_recv(int fd, const char *path)
+{
+  unsigned char msg[8 + XFER_NAME_MAX + 1];
+  char type;
+  size_t len;
+  int out = STDOUT_FILENO;
+  struct stat st;
+
+  if (duplex_recv(fd, &type, (char *)msg, sizeof(msg) - 1, &len) < 0 || type != XFER_OFFER || len < 8)
+  {
+    fprintf(stderr, "speakd: the client did not offer a transfer (start it with speak --send)\n");
+    return -1;
+  }
+  uint64_t size = get_be(msg, 8);
+  msg[len] = '\0';
+  const char *name = (char *)msg + 8;
+
+  if (path != NULL && (out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    const char *why = strerror(errno);
+    fprintf(stderr, "speakd: %s: %s\n", path, why);
+    duplex_send(fd, XFER_REFUSE, why, strlen(why));
+    return -1;
+  }
+  if (size == XFER_SIZE_UNKNOWN)
+    fprintf(stderr, "receiving %s (streamed) into %s\n", name, path ? path : "stdout");
+  else
+    fprintf(stderr, "receiving %s (%llu bytes) into %s\n", name, (unsigned long long)size,
+            path ? path : "stdout");
+  if (duplex_send(fd, XFER_ACCEPT, NULL, 0) < 0)
+    return -1;
+
+  /*
+   *  socket -> pipe -> output with splice(); a tee() of the pipe feeds the
+   *  checksum. Outputs splice() can't write to (a terminal) get a copy,
+   *  and so does everything received through TLS.
+   */
+  int pipe_fds[2], side[2];
+  if (make_pipe(pipe_fds) < 0 || make_pipe(side) < 0)
+  {
+    perror("speakd pipe");
+    return -1;
+  }
+  fstat(out, &st);
+  int can_splice = S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+
+  unsigned long long got = 0;
+  uint32_t sum = 1;
+  double t0 = now_sec();
+  int rc = 0;
+  if (duplex_tls() != NULL)
+    rc = recv_copy(duplex_tls(), out, size, &got, &sum);
+  while (duplex_tls() == NULL && (size == XFER_SIZE_UNKNOWN || got < size))
+  {
+    size_t want = CHUNK;
+    if (size != XFER_SIZE_UNKNOWN && size - got < want)
+      want = size - got;
+    ssize_t n = splice(fd, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      perror("speakd splice");
+      rc = -1;
+      break;
+    }
+    if (n == 0)
+      break; // the sender closed its end
+
+    if (can_splice)
+    {
+      ssize_t t = tee(pipe_fds[0], side[1], n, 0);
+      if (t != n || splice_out(pipe_fds[0], out, n) < 0 || checksum_pipe(side[0], n, &sum) < 0)
+      {
+        perror("speakd write");
+        rc = -1;
+        break;
+      }
+    }
+    else
+    {
+      static char buf[COPY_SIZE];
+      for (ssize_t left = n; left > 0;)
+      {
+        ssize_t r = read(pipe_fds[0], buf, left < COPY_SIZE ? left : COPY_SIZE);
+        if (r <= 0 || write_all(out, buf, r) < 0)
+        {
+          perror("speakd write");
+          rc = -1;
+          break;
+        }
+        sum = adler32(sum, (unsigned char *)buf, r);
+        left -= r;
+      }
+      if (rc < 0)
+        break;
+    }
+    got += n;
+  }
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  close(side[0]);
+  close(side[1]);
+  if (out != STDOUT_FILENO)
+    close(out);
+  if (rc < 0)
+    return -1;
+
+  report("received", got, now_sec() - t0, sum);
+  if (size != XFER_SIZE_UNKNOWN && got != size)
+  {
+    fprintf(stderr, "speakd: transfer cut short after %llu of %llu bytes\n", got,
+            (unsigned long long)size);
+    rc = -1;
+  }
+
+  put_be(msg, got, 8);
+  put_be(msg + 8, sum, 4);
+  duplex_send(fd, XFER_SUMMARY, (char *)msg, 12);
+  return rc;
+}
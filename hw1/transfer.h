@@ -0,0 +1,33 @@
+/**
+ **  header for transfer.c
+ **
+ **  Bulk transfer mode: "speak --send file" streams a file (or stdin) to
+ **  "speakd --recv" without copying it through user space.
+ **
+ **  The two sides negotiate with duplex.h frames, then the payload follows
+ **  as raw bytes:
+ **
+ **    sender:   OFFER [size: 8 bytes, big endian][name]
+ **    receiver: ACCEPT                (or REFUSE [reason])
+ **    sender:   <size bytes>          (size XFER_SIZE_UNKNOWN: until EOF)
+ **    receiver: SUMMARY [bytes: 8][adler32: 4]
+ **
+ **  Files go out with sendfile(), pipes with splice(); the receiver
+ **  splices from the socket into its output. Both ends compute an Adler-32
+ **  checksum (as zlib does) and report it with the throughput.
+ **
+ **/
+
+#define XFER_OFFER 'F'
+#define XFER_ACCEPT 'A'
+#define XFER_REFUSE 'N'
+#define XFER_SUMMARY 'S'
+
+#define XFER_SIZE_UNKNOWN 0xFFFFFFFFFFFFFFFFULL /* streamed from a pipe */
+#define XFER_NAME_MAX 255
+
+/*  offer path ("-" = stdin) on the connected fd; returns 0 if it arrived intact  */
+int transfer_send( int fd, const char *path );
+
+/*  receive one transfer from fd into path (NULL = stdout); returns 0 on success  */
+int transfer_recv( int fd, const char *path );
@@ -0,0 +1,204 @@
+/******************************************************************************
+ * admin.c
+ *
+ * HTTP endpoint for metrics and other reports (see admin.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "admin.h"
+
+#define ADMIN_REQUEST_MAX 2048
+#define ADMIN_SEND_TIMEOUT_MS 1000
+
+typedef struct
+{
+    Admin *admin;
+    int fd;
+    size_t len;
+    char buf[ADMIN_REQUEST_MAX + 1];
+} AdminConn;
+
+static void on_admin_accept(Reactor *r, int fd, unsigned events, void *arg);
+static void on_admin_event(Reactor *r, int fd, unsigned events, void *arg);
+static void admin_respond(AdminConn *ac);
+static const AdminRoute *admin_find(const Admin *a, const char *request);
+static void admin_close(AdminConn *ac);
+static void send_all(int fd, const char *buf, size_t n);
+
+int admin_init(Admin *a, Reactor *r, int listen_fd, admin_render_cb render, void *arg)
+{
+    a->reactor = r;
+    a->listen_fd = listen_fd;
+    a->render = render;
+    a->arg = arg;
+    a->nroutes = 0;
+
+    if (set_nonblocking(listen_fd) < 0 ||
+        reactor_add(r, listen_fd, REACTOR_READ, on_admin_accept, a) < 0)
+    {
+        perror("admin listener");
+        return -1;
+    }
+    return 0;
+}
+
+int admin_route(Admin *a, const char *path, admin_render_cb render, void *arg)
+{
+    if (a->nroutes == ADMIN_MAX_ROUTES)
+    {
+        return -1;
+    }
+    a->routes[a->nroutes++] = (AdminRoute){path, render, arg};
+    return 0;
+}
+
+static void on_admin_accept(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)events;
+    Admin *a = arg;
+
+    while (1)
+    {
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept (admin)");
+            return;
+        }
+
+        AdminConn *ac = calloc(1, sizeof(*ac));
+        if (!ac || set_nonblocking(cfd) < 0 ||
+            reactor_add(r, cfd, REACTOR_READ, on_admin_event, ac) < 0)
+        {
+            free(ac);
+            close(cfd);
+            continue;
+        }
+        ac->admin = a;
+        ac->fd = cfd;
+    }
+}
+
+/* on_admin_event: collect the request headers; answer once they are complete. */
+static void on_admin_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    AdminConn *ac = arg;
+
+    while (1)
+    {
+        ssize_t n = recv(fd, ac->buf + ac->len, ADMIN_REQUEST_MAX - ac->len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            admin_close(ac);
+            return;
+        }
+        ac->len += (size_t)n;
+        ac->buf[ac->len] = '\0';
+        if (strstr(ac->buf, "\r\n\r\n") || strstr(ac->buf, "\n\n"))
+        {
+            admin_respond(ac);
+            return;
+        }
+        if (ac->len == ADMIN_REQUEST_MAX)
+        {
+            admin_close(ac); // no sane scrape sends this much
+            return;
+        }
+    }
+}
+
+static void admin_respond(AdminConn *ac)
+{
+    Admin *a = ac->admin;
+    int metrics = strncmp(ac->buf, "GET /metrics", 12) == 0 || strncmp(ac->buf, "GET / ", 6) == 0;
+    const AdminRoute *route = metrics ? NULL : admin_find(a, ac->buf);
+    int found = metrics || route;
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (!out)
+    {
+        admin_close(ac);
+        return;
+    }
+    if (metrics)
+        a->render(out, a->arg);
+    else if (route)
+        route->render(out, route->arg);
+    else
+        fputs("not found\n", out);
+    fclose(out);
+
+    char header[160];
+    int hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.0 %s\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n",
+                        found ? "200 OK" : "404 Not Found", body_len);
+
+    /* the response is small: write it out blocking, but never for long */
+    int flags = fcntl(ac->fd, F_GETFL, 0);
+    fcntl(ac->fd, F_SETFL, flags & ~O_NONBLOCK);
+    struct timeval tv = {ADMIN_SEND_TIMEOUT_MS / 1000, (ADMIN_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(ac->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    send_all(ac->fd, header, (size_t)hlen);
+    send_all(ac->fd, body, body_len);
+    free(body);
+    admin_close(ac);
+}
+
+/* admin_find: the route a "GET <path>[?query] ..." request names, or NULL. */
+static const AdminRoute *admin_find(const Admin *a, const char *request)
+{
+    if (strncmp(request, "GET ", 4) != 0)
+    {
+        return NULL;
+    }
+    const char *path = request + 4;
+    size_t len = strcspn(path, " ?\r\n");
+    for (int i = 0; i < a->nroutes; i++)
+    {
+        if (strlen(a->routes[i].path) == len && strncmp(a->routes[i].path, path, len) == 0)
+            return &a->routes[i];
+    }
+    return NULL;
+}
+
+static void admin_close(AdminConn *ac)
+{
+    reactor_del(ac->admin->reactor, ac->fd);
+    close(ac->fd);
+    free(ac);
+}
+
+static void send_all(int fd, const char *buf, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = send(fd, buf, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return;
+        buf += w;
+        n -= (size_t)w;
+    }
+}
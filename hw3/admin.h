@@ -0,0 +1,52 @@
+/******************************************************************************
+ * admin.h
+ *
+ * Minimal HTTP endpoint for operators (e.g. a Prometheus scraper).
+ *
+ *   - Runs on its own Reactor, off the game threads: a scrape never
+ *     delays a round.
+ *   - "GET /metrics" (or "/") answers 200 with whatever the render
+ *     callback prints, and so does a path added with admin_route();
+ *     anything else gets 404. One request per connection (HTTP/1.0
+ *     style), then the connection is closed.
+ ******************************************************************************/
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <stdio.h>
+
+#include "reactor.h"
+
+#define ADMIN_MAX_ROUTES 4
+
+/* Print the response body (Prometheus text format) to out. */
+typedef void (*admin_render_cb)(FILE *out, void *arg);
+
+typedef struct
+{
+    const char *path; /* e.g. "/leaderboard" */
+    admin_render_cb render;
+    void *arg;
+} AdminRoute;
+
+typedef struct
+{
+    Reactor *reactor;
+    int listen_fd;
+    admin_render_cb render;
+    void *arg;
+    AdminRoute routes[ADMIN_MAX_ROUTES];
+    int nroutes;
+} Admin;
+
+/*
+ * admin_init:
+ *   Serve requests arriving on the (listening) socket listen_fd from
+ *   reactor r. Returns 0 or -1.
+ */
+int admin_init(Admin *a, Reactor *r, int listen_fd, admin_render_cb render, void *arg);
+
+/* admin_route: also serve path (a query string is ignored). Returns 0 or -1 if full. */
+int admin_route(Admin *a, const char *path, admin_render_cb render, void *arg);
+
+#endif /* ADMIN_H */
@@ -0,0 +1,165 @@
+/******************************************************************************
+ * batch.c
+ *
+ * Scalar and AVX2 kernels for RoundBatch resolution.
+ *
+ * Both kernels do the same three steps per table:
+ *   1) OR together MOVE_BIT(move) of every seat  -> present-moves mask
+ *   2) dominant_moves(present)                   -> dominant-moves mask
+ *   3) seat p wins if MOVE_BIT(its move) is in the dominant mask
+ * The AVX2 kernel runs them for 32 tables at once, one byte lane per table.
+ ******************************************************************************/
+#include "batch.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BATCH_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+static void resolve_range(const RoundBatch *b, int from, int to);
+
+void batch_resolve_scalar(const RoundBatch *b)
+{
+    resolve_range(b, 0, b->numTables);
+}
+
+/* resolve_range: the reference kernel, for tables [from, to). */
+static void resolve_range(const RoundBatch *b, int from, int to)
+{
+    for (int t = from; t < to; t++)
+    {
+        unsigned present = 0;
+        for (int p = 0; p < b->numPlayers; p++)
+        {
+            unsigned m = b->moves[p * b->stride + t];
+            if (m < MOVE_INVALID)
+            {
+                present |= MOVE_BIT(m);
+            }
+        }
+
+        unsigned dominant = dominant_moves(present);
+        unsigned won = 0;
+        for (int p = 0; dominant && p < b->numPlayers; p++)
+        {
+            unsigned m = b->moves[p * b->stride + t];
+            if (m < MOVE_INVALID && (dominant & MOVE_BIT(m)))
+            {
+                won |= 1u << p;
+                if (b->scores)
+                {
+                    b->scores[p * b->stride + t]++;
+                }
+            }
+        }
+        b->winners[t] = (uint16_t)won;
+    }
+}
+
+#ifdef BATCH_HAVE_AVX2
+
+/* add_wins: scores[0..31] -= win[0..31] (win bytes are 0 or -1). */
+__attribute__((target("avx2"))) static void add_wins(int32_t *scores, __m256i win)
+{
+    __m128i lo = _mm256_castsi256_si128(win);
+    __m128i hi = _mm256_extracti128_si256(win, 1);
+    __m128i part[4] = {lo, _mm_srli_si128(lo, 8), hi, _mm_srli_si128(hi, 8)};
+    for (int k = 0; k < 4; k++)
+    {
+        __m256i *s = (__m256i *)(scores + 8 * k);
+        __m256i v = _mm256_loadu_si256(s);
+        v = _mm256_sub_epi32(v, _mm256_cvtepi8_epi32(part[k]));
+        _mm256_storeu_si256(s, v);
+    }
+}
+
+__attribute__((target("avx2"))) static void resolve_avx2(const RoundBatch *b)
+{
+    /* MOVE_BIT() lookup: indexes >= MOVE_INVALID map to 0 */
+    const __m256i move_bit = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 4, 8, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i invalid = _mm256_set1_epi8(MOVE_INVALID);
+
+    /* dominant_moves() as two 16-entry shuffle tables (present < 16, >= 16) */
+    uint8_t dom[32];
+    for (unsigned i = 0; i < 32; i++)
+    {
+        dom[i] = (uint8_t)dominant_moves(i);
+    }
+    const __m256i dom_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)dom));
+    const __m256i dom_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(dom + 16)));
+    const __m256i bit4 = _mm256_set1_epi8(16);
+    const __m256i low4 = _mm256_set1_epi8(15);
+
+    int t = 0;
+    for (; t + 32 <= b->numTables; t += 32)
+    {
+        __m256i bits[MAX_PLAYERS];
+        __m256i present = _mm256_setzero_si256();
+        for (int p = 0; p < b->numPlayers; p++)
+        {
+            __m256i m = _mm256_loadu_si256((const __m256i *)(b->moves + p * b->stride + t));
+            bits[p] = _mm256_shuffle_epi8(move_bit, _mm256_min_epu8(m, invalid));
+            present = _mm256_or_si256(present, bits[p]);
+        }
+
+        __m256i d_lo = _mm256_shuffle_epi8(dom_lo, present);
+        __m256i d_hi = _mm256_shuffle_epi8(dom_hi, _mm256_and_si256(present, low4));
+        __m256i high = _mm256_cmpeq_epi8(_mm256_and_si256(present, bit4), bit4);
+        __m256i dominant = _mm256_blendv_epi8(d_lo, d_hi, high);
+
+        /* winner bitmasks: seats 0-7 in acc[0], seats 8-15 in acc[1] */
+        __m256i acc[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        const __m256i zero = _mm256_setzero_si256();
+        for (int p = 0; p < b->numPlayers; p++)
+        {
+            __m256i hit = _mm256_and_si256(bits[p], dominant);
+            __m256i win = _mm256_xor_si256(_mm256_cmpeq_epi8(hit, zero),
+                                           _mm256_set1_epi8(-1));
+            acc[p >> 3] = _mm256_or_si256(acc[p >> 3],
+                                          _mm256_and_si256(win, _mm256_set1_epi8((char)(1 << (p & 7)))));
+            if (b->scores)
+            {
+                add_wins(b->scores + p * b->stride + t, win);
+            }
+        }
+
+        /* interleave the two byte halves into 16-bit masks, in table order */
+        __m256i lo = _mm256_permute4x64_epi64(acc[0], 0xD8);
+        __m256i hi = _mm256_permute4x64_epi64(acc[1], 0xD8);
+        _mm256_storeu_si256((__m256i *)(b->winners + t), _mm256_unpacklo_epi8(lo, hi));
+        _mm256_storeu_si256((__m256i *)(b->winners + t + 16), _mm256_unpackhi_epi8(lo, hi));
+    }
+    resolve_range(b, t, b->numTables);
+}
+
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* BATCH_HAVE_AVX2 */
+
+void batch_resolve(const RoundBatch *b)
+{
+#ifdef BATCH_HAVE_AVX2
+    if (have_avx2())
+    {
+        resolve_avx2(b);
+        return;
+    }
+#endif
+    batch_resolve_scalar(b);
+}
+
+const char *batch_kernel_name(void)
+{
+#ifdef BATCH_HAVE_AVX2
+    if (have_avx2())
+    {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
@@ -0,0 +1,42 @@
+/******************************************************************************
+ * batch.h
+ *
+ * Bulk round resolution for offline simulation and replay (part of
+ * libspock.a, together with rules.c).
+ *
+ *   - A RoundBatch holds one round for many tables that all have the same
+ *     number of players, laid out struct-of-arrays: the moves of seat p for
+ *     every table are contiguous, so a kernel can read one seat of 32
+ *     tables with a single load.
+ *   - batch_resolve_scalar() is the reference; batch_resolve() uses the
+ *     fastest kernel the CPU supports (AVX2 on x86-64) and must produce
+ *     exactly the same results.
+ ******************************************************************************/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rules.h"
+
+typedef struct
+{
+    int numTables;
+    int numPlayers;       /* 1..MAX_PLAYERS, the same for every table */
+    size_t stride;        /* distance between two seats' rows, >= numTables */
+    const uint8_t *moves; /* moves[p * stride + t]: Move of seat p at table t */
+    int32_t *scores;      /* scores[p * stride + t]: +1 per win (may be NULL) */
+    uint16_t *winners;    /* out: winners[t], bit p set if seat p won */
+} RoundBatch;
+
+/* batch_resolve_scalar: resolve every table one at a time. */
+void batch_resolve_scalar(const RoundBatch *b);
+
+/* batch_resolve: same results as batch_resolve_scalar, using SIMD if it can. */
+void batch_resolve(const RoundBatch *b);
+
+/* batch_kernel_name: "avx2" or "scalar", whichever batch_resolve() uses. */
+const char *batch_kernel_name(void);
+
+#endif /* BATCH_H */
@@ -0,0 +1,194 @@
+/******************************************************************************
+ * bot.c
+ *
+ * Bot move strategies and the per-thread generator behind them (see bot.h).
+ ******************************************************************************/
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "bot.h"
+
+#define NUM_MOVES MOVE_INVALID
+
+typedef struct
+{
+    uint32_t counts[NUM_MOVES]; /* the others' moves so far */
+} Frequency;
+
+typedef struct
+{
+    uint32_t next[NUM_MOVES][NUM_MOVES]; /* [previous][next], all opponents */
+    uint8_t last[MAX_PLAYERS];           /* each seat's last move + 1, 0 = none */
+} Markov;
+
+static Move uniform_choose(void *state, const Table *t, int seat);
+static Move frequency_choose(void *state, const Table *t, int seat);
+static void frequency_observe(void *state, const Table *t, int seat);
+static Move markov_choose(void *state, const Table *t, int seat);
+static void markov_observe(void *state, const Table *t, int seat);
+static Move best_reply(const int32_t score[NUM_MOVES]);
+
+static const BotStrategy strategies[] = {
+    {"uniform", 0, uniform_choose, NULL},
+    {"frequency", sizeof(Frequency), frequency_choose, frequency_observe},
+    {"markov", sizeof(Markov), markov_choose, markov_observe},
+};
+
+#define NUM_STRATEGIES (sizeof(strategies) / sizeof(strategies[0]))
+
+/* splitmix64: one add and a few multiplies per draw, any seed is fine */
+static _Thread_local uint64_t rng_state;
+static _Thread_local int rng_seeded;
+
+const BotStrategy *bot_strategy(const char *name)
+{
+    for (size_t i = 0; i < NUM_STRATEGIES; i++)
+    {
+        if (strcmp(strategies[i].name, name) == 0)
+        {
+            return &strategies[i];
+        }
+    }
+    return NULL;
+}
+
+const char *bot_strategy_names(void)
+{
+    return "uniform, frequency or markov";
+}
+
+uint32_t bot_random(void)
+{
+    if (!rng_seeded)
+    {
+        if (getrandom(&rng_state, sizeof(rng_state), GRND_NONBLOCK) != (ssize_t)sizeof(rng_state))
+        {
+            rng_state = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&rng_state;
+        }
+        rng_seeded = 1;
+    }
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+uint32_t bot_random_below(uint32_t n)
+{
+    return (uint32_t)(((uint64_t)bot_random() * n) >> 32); // no division
+}
+
+static Move uniform_choose(void *state, const Table *t, int seat)
+{
+    (void)state;
+    (void)t;
+    (void)seat;
+    return (Move)bot_random_below(NUM_MOVES);
+}
+
+/* frequency_choose: the move that scores best against the others' history. */
+static Move frequency_choose(void *state, const Table *t, int seat)
+{
+    (void)t;
+    (void)seat;
+    Frequency *f = state;
+    int32_t score[NUM_MOVES] = {0};
+
+    for (int m = 0; m < NUM_MOVES; m++)
+    {
+        for (int x = 0; x < NUM_MOVES; x++)
+        {
+            score[m] += (int32_t)f->counts[x] * (beats((Move)m, (Move)x) - beats((Move)x, (Move)m));
+        }
+    }
+    return best_reply(score);
+}
+
+static void frequency_observe(void *state, const Table *t, int seat)
+{
+    Frequency *f = state;
+    for (int j = 0; j < t->numPlayers; j++)
+    {
+        if (j != seat && t->moves[j] < NUM_MOVES)
+        {
+            f->counts[t->moves[j]]++;
+        }
+    }
+}
+
+/* markov_choose: predict each opponent's move from their last one; reply. */
+static Move markov_choose(void *state, const Table *t, int seat)
+{
+    Markov *mk = state;
+    int32_t score[NUM_MOVES] = {0};
+
+    for (int j = 0; j < t->numPlayers; j++)
+    {
+        if (j == seat || mk->last[j] == 0)
+        {
+            continue;
+        }
+        const uint32_t *row = mk->next[mk->last[j] - 1];
+        int pred = 0;
+        for (int x = 1; x < NUM_MOVES; x++)
+        {
+            if (row[x] > row[pred])
+                pred = x;
+        }
+        if (row[pred] == 0)
+        {
+            continue; // nothing learned after that move yet
+        }
+        for (int m = 0; m < NUM_MOVES; m++)
+        {
+            score[m] += beats((Move)m, (Move)pred) - beats((Move)pred, (Move)m);
+        }
+    }
+    return best_reply(score);
+}
+
+static void markov_observe(void *state, const Table *t, int seat)
+{
+    Markov *mk = state;
+    for (int j = 0; j < t->numPlayers; j++)
+    {
+        if (j == seat)
+        {
+            continue;
+        }
+        uint8_t cur = t->moves[j];
+        if (cur >= NUM_MOVES)
+        {
+            mk->last[j] = 0; // a forfeit breaks the chain
+            continue;
+        }
+        if (mk->last[j])
+        {
+            mk->next[mk->last[j] - 1][cur]++;
+        }
+        mk->last[j] = (uint8_t)(cur + 1);
+    }
+}
+
+/* best_reply: the highest scoring move, ties broken at random. */
+static Move best_reply(const int32_t score[NUM_MOVES])
+{
+    int32_t best = score[0];
+    for (int m = 1; m < NUM_MOVES; m++)
+    {
+        if (score[m] > best)
+            best = score[m];
+    }
+    uint32_t ties = 0;
+    Move pick = MOVE_ROCK;
+    for (int m = 0; m < NUM_MOVES; m++)
+    {
+        // reservoir sampling over the tied moves, one pass
+        if (score[m] == best && bot_random_below(++ties) == 0)
+        {
+            pick = (Move)m;
+        }
+    }
+    return pick;
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ * bot.h
+ *
+ * Move strategies for in-process bot seats (seat.h).
+ *
+ *   - A strategy is a pair of callbacks over a few bytes of private state:
+ *     choose() picks the bot's move when a round starts, and observe()
+ *     sees every round once it is resolved. Both read the table directly
+ *     (t->moves[], t->scores[]); nothing is parsed from a message.
+ *   - Built in: "uniform" (random), "frequency" (best reply to how often
+ *     the others have played each move) and "markov" (predicts each
+ *     opponent's next move from their last one, first-order, and plays
+ *     what beats the most predictions).
+ *   - Randomness comes from bot_random(), a per-thread generator; bots on
+ *     different shards never share state or contend on a lock.
+ ******************************************************************************/
+#ifndef BOT_H
+#define BOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rules.h"
+#include "table.h"
+
+struct bot_strategy
+{
+    const char *name;
+    size_t state_size; /* zeroed bytes each bot gets for its own use */
+
+    /* choose: the move of the bot in seat `seat` for the round starting at t. */
+    Move (*choose)(void *state, const Table *t, int seat);
+
+    /*
+     * observe: the round at t was just resolved; t->moves[] holds every
+     * seat's move (MOVE_INVALID for a forfeit). May be NULL.
+     */
+    void (*observe)(void *state, const Table *t, int seat);
+};
+
+typedef struct bot_strategy BotStrategy;
+
+/* bot_strategy: a built-in strategy by name, or NULL. */
+const BotStrategy *bot_strategy(const char *name);
+
+/* bot_strategy_names: the built-in names, for usage messages. */
+const char *bot_strategy_names(void);
+
+/* bot_random: 32 random bits from this thread's generator (not for secrets). */
+uint32_t bot_random(void);
+
+/* bot_random_below: uniform in [0, n), n > 0. */
+uint32_t bot_random_below(uint32_t n);
+
+#endif /* BOT_H */
@@ -0,0 +1,738 @@
+/******************************************************************************
+ * dgram.c
+ *
+ * UDP endpoint for spock_server (see dgram.h; wire format in udp.h).
+ *
+ *   - Peers are found by connection id in a chained hash; the bucket index
+ *     is salted so clients can't pick ids that pile into one chain.
+ *   - A reliable datagram sits in flight[seq % UDP_WINDOW] until acked.
+ *     Nothing new is sent while the oldest one is UDP_WINDOW sequence
+ *     numbers behind, so slots never collide and every datagram in flight
+ *     is within reach of the client's ack bits.
+ *   - The outgoing batch holds its own OutBuf references from when a
+ *     datagram is staged until sendmmsg() has taken it.
+ *   - A cookie is HMAC-SHA256 (keyed with a secret drawn at startup) of
+ *     the source address and port, the connection id and the current
+ *     DGRAM_COOKIE_MS period, cut to UDP_COOKIE_SIZE bytes. One from the
+ *     period before is still taken, so a cookie lasts at least that long.
+ ******************************************************************************/
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "dgram.h"
+#include "udp.h"
+
+#define DGRAM_BATCH 64       /* datagrams per recvmmsg() / sendmmsg() */
+#define DGRAM_BUCKET_BITS 12 /* peer hash: 4096 chains */
+#define DGRAM_FRAMES 8       /* messages packed into one datagram, at most */
+#define DGRAM_COOKIE_MS 10000 /* cookie period */
+#define DGRAM_SECRET_SIZE 32
+
+/* A reliable datagram waiting for its ack. */
+typedef struct
+{
+    uint32_t seq; /* 0 = free slot */
+    uint8_t tries;
+    uint8_t nbufs;
+    long long sent_ms;
+    OutBuf *bufs[DGRAM_FRAMES];
+} Flight;
+
+struct udp_peer
+{
+    uint32_t id;
+    struct sockaddr_storage addr; /* latest source address */
+    socklen_t addr_len;
+    UdpWindow rx;
+    UdpRtt rtt;
+    uint32_t next_seq;
+    int in_flight;
+    Flight flight[UDP_WINDOW];
+    uint8_t ack_due; /* the client is owed an ack */
+    uint8_t failed;  /* drop at the next timer tick */
+    long long heard_ms;
+    Timer timer;     /* retransmission, idle and failure deadline */
+    Conn *conn;
+    Dgram *d;
+    UdpPeer *hnext;
+    UdpPeer *dirty_next, **dirty_pprev; /* on d->dirty while pprev is set */
+};
+
+/* One datagram of the outgoing batch. */
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint8_t header[UDP_HEADER_SIZE + UDP_COOKIE_SIZE]; /* and a cookie answer's cookie */
+    struct iovec iov[1 + DGRAM_FRAMES];
+    int niov;
+    OutBuf *bufs[DGRAM_FRAMES]; /* references held until sent */
+} OutDatagram;
+
+struct dgram
+{
+    int fd;
+    Lobby *lobby;
+    uint32_t salt;
+    uint8_t secret[DGRAM_SECRET_SIZE]; /* cookie key */
+    UdpPeer *buckets[1 << DGRAM_BUCKET_BITS];
+    UdpPeer *dirty; /* peers with output or an ack to send */
+
+    int nout;
+    OutDatagram out[DGRAM_BATCH];
+    struct mmsghdr out_msgs[DGRAM_BATCH];
+
+    struct mmsghdr in_msgs[DGRAM_BATCH];
+    struct iovec in_iov[DGRAM_BATCH];
+    struct sockaddr_storage in_addr[DGRAM_BATCH];
+    uint8_t in_buf[DGRAM_BATCH][UDP_MTU];
+};
+
+static void on_dgram_event(Reactor *r, int fd, unsigned events, void *arg);
+static void dgram_input(Dgram *d, const uint8_t *data, size_t len,
+                        const struct sockaddr_storage *addr, socklen_t addr_len);
+static void dgram_send(Dgram *d);
+static void stage(Dgram *d, UdpPeer *p, uint8_t flags, uint32_t seq, OutBuf *bufs[], int nbufs);
+static void stage_close(Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        socklen_t addr_len, const uint8_t *cookie);
+static void make_cookie(const Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        long long period, uint8_t out[UDP_COOKIE_SIZE]);
+static int cookie_valid(const Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        const uint8_t *cookie);
+static UdpPeer **peer_slot(Dgram *d, uint32_t id);
+static UdpPeer *peer_new(Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                         socklen_t addr_len);
+static void peer_acked(UdpPeer *p, const UdpHeader *h, long long now);
+static void peer_dirty(UdpPeer *p);
+static void peer_undirty(UdpPeer *p);
+static void peer_arm(UdpPeer *p);
+static int peer_window_full(const UdpPeer *p);
+static void flight_release(Flight *f);
+static void on_peer_timer(Timer *tm, void *arg);
+
+Dgram *dgram_open(Lobby *l, int fd)
+{
+    Dgram *d = calloc(1, sizeof(*d));
+    if (!d)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    d->fd = fd;
+    d->lobby = l;
+    if (getrandom(&d->salt, sizeof(d->salt), 0) != sizeof(d->salt) ||
+        getrandom(d->secret, sizeof(d->secret), 0) != sizeof(d->secret))
+    {
+        fprintf(stderr, "UDP: no random secret for cookies\n");
+        free(d);
+        return NULL;
+    }
+    if (set_nonblocking(fd) < 0 || reactor_add(l->reactor, fd, REACTOR_READ, on_dgram_event, d) < 0)
+    {
+        perror("UDP socket");
+        free(d);
+        return NULL;
+    }
+    l->udp = d;
+    return d;
+}
+
+/*
+ * on_dgram_event:
+ *   Reactor callback for the UDP socket: read every waiting datagram
+ *   (edge-triggered), then send whatever they caused in one batch.
+ */
+static void on_dgram_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    Dgram *d = arg;
+    Metrics *m = &d->lobby->metrics;
+
+    while (1)
+    {
+        for (int i = 0; i < DGRAM_BATCH; i++)
+        {
+            d->in_iov[i].iov_base = d->in_buf[i];
+            d->in_iov[i].iov_len = sizeof(d->in_buf[i]);
+            struct msghdr *h = &d->in_msgs[i].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            h->msg_name = &d->in_addr[i];
+            h->msg_namelen = sizeof(d->in_addr[i]);
+            h->msg_iov = &d->in_iov[i];
+            h->msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, d->in_msgs, DGRAM_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("recvmmsg");
+            }
+            break;
+        }
+        metric_add(m, METRIC_UDP_SYSCALLS, 1);
+        metric_add(m, METRIC_UDP_DATAGRAMS_IN, (unsigned long)n);
+        for (int i = 0; i < n; i++)
+        {
+            const struct msghdr *h = &d->in_msgs[i].msg_hdr;
+            if (h->msg_flags & MSG_TRUNC)
+            {
+                metric_add(m, METRIC_PARSE_ERRORS, 1);
+                continue;
+            }
+            metric_add(m, METRIC_BYTES_IN, d->in_msgs[i].msg_len);
+            dgram_input(d, d->in_buf[i], d->in_msgs[i].msg_len, &d->in_addr[i], h->msg_namelen);
+        }
+        if (n < DGRAM_BATCH)
+        {
+            break; // drained: a later datagram raises a new edge
+        }
+    }
+    dgram_flush(d);
+}
+
+/* dgram_input: one datagram from addr. */
+static void dgram_input(Dgram *d, const uint8_t *data, size_t len,
+                        const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+    UdpHeader h;
+    if (udp_read_header(data, len, &h) < 0)
+    {
+        metric_add(&d->lobby->metrics, METRIC_PARSE_ERRORS, 1);
+        return;
+    }
+
+    size_t start = UDP_HEADER_SIZE; // of the frames
+    if (h.flags & UDP_COOKIE)
+    {
+        if (len < UDP_HEADER_SIZE + UDP_COOKIE_SIZE)
+        {
+            metric_add(&d->lobby->metrics, METRIC_PARSE_ERRORS, 1);
+            return;
+        }
+        start += UDP_COOKIE_SIZE;
+    }
+
+    UdpPeer *p = *peer_slot(d, h.conn);
+    if (!p)
+    {
+        if (h.flags & UDP_CLOSE)
+        {
+            return;
+        }
+        int opening = (h.flags & UDP_OPEN) && h.seq != 0;
+        if (!(h.flags & UDP_COOKIE))
+        {
+            if (opening)
+            {
+                metric_add(&d->lobby->metrics, METRIC_UDP_COOKIE_REJECTS, 1);
+            }
+            stage_close(d, h.conn, addr, addr_len, NULL); // e.g. we restarted
+            return;
+        }
+        if (!opening || !cookie_valid(d, h.conn, addr, data + UDP_HEADER_SIZE))
+        {
+            // a probe, or a stale or forged cookie: answer with a fresh one,
+            // the same size as what came in at the least
+            uint8_t cookie[UDP_COOKIE_SIZE];
+            if (opening)
+            {
+                metric_add(&d->lobby->metrics, METRIC_UDP_COOKIE_REJECTS, 1);
+            }
+            make_cookie(d, h.conn, addr, reactor_now_ms() / DGRAM_COOKIE_MS, cookie);
+            stage_close(d, h.conn, addr, addr_len, cookie);
+            return;
+        }
+        if (!(p = peer_new(d, h.conn, addr, addr_len)))
+        {
+            return;
+        }
+    }
+
+    long long now = reactor_now_ms();
+    p->heard_ms = now;
+    memcpy(&p->addr, addr, addr_len); // the client may have moved
+    p->addr_len = addr_len;
+    peer_acked(p, &h, now);
+    if (h.flags & UDP_CLOSE)
+    {
+        conn_drop(p->conn);
+        return;
+    }
+    if (h.flags & (UDP_RELIABLE | UDP_PING))
+    {
+        p->ack_due = 1; // duplicates too: our ack may be what got lost
+        peer_dirty(p);
+    }
+    if (udp_window_mark(&p->rx, h.seq) && len > start)
+    {
+        conn_input(p->conn, data + start, len - start); // may free p
+    }
+}
+
+void dgram_flush(Dgram *d)
+{
+    UdpPeer *p;
+    while ((p = d->dirty) != NULL)
+    {
+        peer_undirty(p);
+        dgram_write(p);
+        if (p->ack_due)
+        {
+            stage(d, p, 0, 0, NULL, 0);
+        }
+    }
+    if (d->nout > 0)
+    {
+        dgram_send(d);
+    }
+}
+
+void dgram_queue(UdpPeer *p)
+{
+    peer_dirty(p);
+}
+
+int dgram_write(UdpPeer *p)
+{
+    OutQueue *q = &p->conn->outq;
+    int reliable_sent = 0;
+
+    while (!outq_empty(q))
+    {
+        if (peer_window_full(p))
+        {
+            return 0; // acks reopen it and mark p dirty
+        }
+
+        OutBuf *bufs[DGRAM_FRAMES];
+        int n = 0;
+        size_t size = 0;
+        int reliable = 0;
+        while (n < DGRAM_FRAMES && !outq_empty(q))
+        {
+            OutBuf *b = q->refs[q->head].buf;
+            if (n > 0 && size + outbuf_len(b) > UDP_MAX_PAYLOAD)
+            {
+                break;
+            }
+            bufs[n++] = outq_pop(q);
+            size += outbuf_len(b);
+            reliable |= udp_reliable_op(b->data[b->start]);
+        }
+
+        uint32_t seq = p->next_seq++;
+        stage(p->d, p, reliable ? UDP_RELIABLE : 0, seq, bufs, n);
+        if (!reliable)
+        {
+            for (int i = 0; i < n; i++)
+                outbuf_unref(bufs[i]);
+            continue;
+        }
+        Flight *f = &p->flight[seq % UDP_WINDOW];
+        f->seq = seq;
+        f->tries = 1;
+        f->sent_ms = reactor_now_ms();
+        f->nbufs = (uint8_t)n;
+        memcpy(f->bufs, bufs, n * sizeof(bufs[0])); // the queue's references
+        p->in_flight++;
+        reliable_sent = 1;
+    }
+    if (reliable_sent)
+    {
+        peer_arm(p);
+    }
+    return 1;
+}
+
+void dgram_fail(UdpPeer *p)
+{
+    p->failed = 1;
+    timer_arm(reactor_timers(p->d->lobby->reactor), &p->timer, reactor_now_ms());
+}
+
+void dgram_close(UdpPeer *p)
+{
+    Dgram *d = p->d;
+    stage_close(d, p->id, &p->addr, p->addr_len, NULL);
+    timer_cancel(reactor_timers(d->lobby->reactor), &p->timer);
+    peer_undirty(p);
+    UdpPeer **pp = peer_slot(d, p->id);
+    while (*pp != p)
+    {
+        pp = &(*pp)->hnext;
+    }
+    *pp = p->hnext;
+    for (int i = 0; i < UDP_WINDOW; i++)
+    {
+        flight_release(&p->flight[i]);
+    }
+    free(p);
+}
+
+uint32_t dgram_peer_id(const UdpPeer *p)
+{
+    return p->id;
+}
+
+/*
+ * stage:
+ *   Add a datagram for p to the outgoing batch: the header (acking what we
+ *   have from p) and bufs[], which the batch takes its own references to.
+ *   A full batch is sent first.
+ */
+static void stage(Dgram *d, UdpPeer *p, uint8_t flags, uint32_t seq, OutBuf *bufs[], int nbufs)
+{
+    if (d->nout == DGRAM_BATCH)
+    {
+        dgram_send(d);
+    }
+    OutDatagram *o = &d->out[d->nout++];
+    UdpHeader h = {flags, p->id, seq, 0, 0};
+    udp_window_ack(&p->rx, &h);
+    udp_write_header(o->header, &h);
+    memcpy(&o->addr, &p->addr, p->addr_len);
+    o->addr_len = p->addr_len;
+    o->iov[0].iov_base = o->header;
+    o->iov[0].iov_len = UDP_HEADER_SIZE;
+    o->niov = 1 + nbufs;
+    for (int i = 0; i < nbufs; i++)
+    {
+        OutBuf *b = bufs[i];
+        outbuf_ref(b);
+        o->bufs[i] = b;
+        o->iov[1 + i].iov_base = b->data + b->start;
+        o->iov[1 + i].iov_len = outbuf_len(b);
+    }
+    p->ack_due = 0;
+}
+
+/* stage_close: a bare UDP_CLOSE for connection id at addr, with cookie unless NULL. */
+static void stage_close(Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        socklen_t addr_len, const uint8_t *cookie)
+{
+    if (d->nout == DGRAM_BATCH)
+    {
+        dgram_send(d);
+    }
+    OutDatagram *o = &d->out[d->nout++];
+    UdpHeader h = {cookie ? UDP_CLOSE | UDP_COOKIE : UDP_CLOSE, id, 0, 0, 0};
+    udp_write_header(o->header, &h);
+    if (cookie)
+    {
+        memcpy(o->header + UDP_HEADER_SIZE, cookie, UDP_COOKIE_SIZE);
+    }
+    memcpy(&o->addr, addr, addr_len);
+    o->addr_len = addr_len;
+    o->iov[0].iov_base = o->header;
+    o->iov[0].iov_len = UDP_HEADER_SIZE + (cookie ? UDP_COOKIE_SIZE : 0);
+    o->niov = 1;
+}
+
+/* make_cookie: what a client at addr echoes to open connection id in this period. */
+static void make_cookie(const Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        long long period, uint8_t out[UDP_COOKIE_SIZE])
+{
+    uint8_t msg[1 + 2 + 16 + 4 + 8]; // family, port, address, id, period
+    size_t n = 0;
+    msg[n++] = (uint8_t)addr->ss_family;
+    if (addr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)addr;
+        memcpy(msg + n, &a->sin6_port, 2);
+        memcpy(msg + n + 2, &a->sin6_addr, 16);
+        n += 18;
+    }
+    else
+    {
+        const struct sockaddr_in *a = (const struct sockaddr_in *)addr;
+        memcpy(msg + n, &a->sin_port, 2);
+        memcpy(msg + n + 2, &a->sin_addr, 4);
+        n += 6;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        msg[n++] = (uint8_t)(id >> (24 - 8 * i));
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        msg[n++] = (uint8_t)((unsigned long long)period >> (56 - 8 * i));
+    }
+    uint8_t mac[EVP_MAX_MD_SIZE];
+    unsigned mac_len = 0;
+    HMAC(EVP_sha256(), d->secret, sizeof(d->secret), msg, n, mac, &mac_len);
+    memcpy(out, mac, UDP_COOKIE_SIZE);
+}
+
+/* cookie_valid: whether cookie was made for id at addr in this period or the one before. */
+static int cookie_valid(const Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                        const uint8_t *cookie)
+{
+    long long period = reactor_now_ms() / DGRAM_COOKIE_MS;
+    for (long long p = period; p >= period - 1; p--)
+    {
+        uint8_t want[UDP_COOKIE_SIZE];
+        make_cookie(d, id, addr, p, want);
+        if (CRYPTO_memcmp(want, cookie, UDP_COOKIE_SIZE) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * dgram_send:
+ *   sendmmsg() the outgoing batch and drop the batch's references. When
+ *   the socket buffer is full the rest is dropped as if the network had
+ *   lost it; reliable datagrams are retransmitted.
+ */
+static void dgram_send(Dgram *d)
+{
+    Metrics *m = &d->lobby->metrics;
+    unsigned long bytes = 0;
+    for (int i = 0; i < d->nout; i++)
+    {
+        OutDatagram *o = &d->out[i];
+        struct msghdr *h = &d->out_msgs[i].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_name = &o->addr;
+        h->msg_namelen = o->addr_len;
+        h->msg_iov = o->iov;
+        h->msg_iovlen = o->niov;
+    }
+
+    int sent = 0;
+    while (sent < d->nout)
+    {
+        int n = sendmmsg(d->fd, d->out_msgs + sent, d->nout - sent, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("sendmmsg");
+            }
+            break;
+        }
+        metric_add(m, METRIC_UDP_SYSCALLS, 1);
+        sent += n;
+    }
+
+    for (int i = 0; i < d->nout; i++)
+    {
+        OutDatagram *o = &d->out[i];
+        if (i < sent)
+        {
+            bytes += d->out_msgs[i].msg_len;
+        }
+        for (int k = 1; k < o->niov; k++)
+        {
+            outbuf_unref(o->bufs[k - 1]);
+        }
+    }
+    metric_add(m, METRIC_UDP_DATAGRAMS_OUT, (unsigned long)sent);
+    metric_add(m, METRIC_BYTES_OUT, bytes);
+    d->nout = 0;
+}
+
+static UdpPeer **peer_slot(Dgram *d, uint32_t id)
+{
+    uint32_t h = (id ^ d->salt) * 0x9E3779B1u; // Fibonacci hashing
+    UdpPeer **pp = &d->buckets[h >> (32 - DGRAM_BUCKET_BITS)];
+    while (*pp && (*pp)->id != id)
+    {
+        pp = &(*pp)->hnext;
+    }
+    return pp;
+}
+
+/* peer_new: a connection the client just opened, with its Conn. */
+static UdpPeer *peer_new(Dgram *d, uint32_t id, const struct sockaddr_storage *addr,
+                         socklen_t addr_len)
+{
+    UdpPeer *p = calloc(1, sizeof(*p));
+    if (!p)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    p->id = id;
+    p->d = d;
+    p->next_seq = 1;
+    p->heard_ms = reactor_now_ms();
+    memcpy(&p->addr, addr, addr_len);
+    p->addr_len = addr_len;
+    udp_rtt_init(&p->rtt);
+    timer_init(&p->timer, on_peer_timer, p);
+    if (!(p->conn = lobby_open_udp(d->lobby, p)))
+    {
+        free(p);
+        return NULL;
+    }
+    UdpPeer **pp = peer_slot(d, id);
+    p->hnext = *pp;
+    *pp = p;
+    peer_arm(p);
+    return p;
+}
+
+/* peer_acked: retire every flight h acknowledges. */
+static void peer_acked(UdpPeer *p, const UdpHeader *h, long long now)
+{
+    int freed = 0;
+    for (int i = 0; i < UDP_WINDOW && p->in_flight > 0; i++)
+    {
+        Flight *f = &p->flight[i];
+        if (f->seq && udp_acked(h, f->seq))
+        {
+            if (f->tries == 1)
+            {
+                udp_rtt_sample(&p->rtt, now - f->sent_ms); // Karn: no retransmits
+            }
+            flight_release(f);
+            p->in_flight--;
+            freed = 1;
+        }
+    }
+    if (freed)
+    {
+        if (!outq_empty(&p->conn->outq))
+            peer_dirty(p); // the window may have been holding it
+        peer_arm(p);
+    }
+}
+
+static void peer_dirty(UdpPeer *p)
+{
+    Dgram *d = p->d;
+    if (p->dirty_pprev)
+    {
+        return;
+    }
+    p->dirty_next = d->dirty;
+    if (d->dirty)
+        d->dirty->dirty_pprev = &p->dirty_next;
+    d->dirty = p;
+    p->dirty_pprev = &d->dirty;
+}
+
+static void peer_undirty(UdpPeer *p)
+{
+    if (!p->dirty_pprev)
+    {
+        return;
+    }
+    *p->dirty_pprev = p->dirty_next;
+    if (p->dirty_next)
+        p->dirty_next->dirty_pprev = p->dirty_pprev;
+    p->dirty_next = NULL;
+    p->dirty_pprev = NULL;
+}
+
+/* peer_arm: wake at the next retransmission, or when p would count as gone. */
+static void peer_arm(UdpPeer *p)
+{
+    if (p->failed)
+    {
+        return; // dgram_fail() armed it for now
+    }
+    long long when = p->heard_ms + UDP_IDLE_MS;
+    for (int i = 0; i < UDP_WINDOW; i++)
+    {
+        const Flight *f = &p->flight[i];
+        if (f->seq && f->sent_ms + p->rtt.rto_ms < when)
+        {
+            when = f->sent_ms + p->rtt.rto_ms;
+        }
+    }
+    timer_arm(reactor_timers(p->d->lobby->reactor), &p->timer, when);
+}
+
+/* peer_window_full: whether one more sequence number could collide with a flight. */
+static int peer_window_full(const UdpPeer *p)
+{
+    for (int i = 0; i < UDP_WINDOW && p->in_flight > 0; i++)
+    {
+        const Flight *f = &p->flight[i];
+        if (f->seq && p->next_seq - f->seq >= UDP_WINDOW)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void flight_release(Flight *f)
+{
+    if (!f->seq)
+    {
+        return;
+    }
+    for (int i = 0; i < f->nbufs; i++)
+    {
+        outbuf_unref(f->bufs[i]);
+    }
+    f->seq = 0;
+    f->nbufs = 0;
+}
+
+/*
+ * on_peer_timer:
+ *   Retransmit every flight whose timeout passed (same sequence number,
+ *   fresh acks), backing off once per tick. A peer that failed, has been
+ *   silent for UDP_IDLE_MS, or ran out of tries is lost.
+ */
+static void on_peer_timer(Timer *tm, void *arg)
+{
+    (void)tm;
+    UdpPeer *p = arg;
+    long long now = reactor_now_ms();
+
+    if (p->failed || now - p->heard_ms >= UDP_IDLE_MS)
+    {
+        conn_drop(p->conn);
+        return;
+    }
+    int retransmitted = 0;
+    for (int i = 0; i < UDP_WINDOW; i++)
+    {
+        Flight *f = &p->flight[i];
+        if (!f->seq || f->sent_ms + p->rtt.rto_ms > now)
+        {
+            continue;
+        }
+        if (f->tries >= UDP_MAX_TRIES)
+        {
+            conn_drop(p->conn);
+            return;
+        }
+        stage(p->d, p, UDP_RELIABLE, f->seq, f->bufs, f->nbufs);
+        f->tries++;
+        f->sent_ms = now;
+        retransmitted++;
+    }
+    if (retransmitted)
+    {
+        metric_add(&p->d->lobby->metrics, METRIC_UDP_RETRANSMITS, (unsigned long)retransmitted);
+        udp_rtt_backoff(&p->rtt);
+    }
+    peer_arm(p);
+}
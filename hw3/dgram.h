@@ -0,0 +1,56 @@
+/******************************************************************************
+ * dgram.h
+ *
+ * spock_server's UDP endpoint: players over the transport in udp.h.
+ *
+ *   - One Dgram serves a bound UDP socket for one lobby. Each connection
+ *     id it hears a UDP_OPEN from becomes a UdpPeer with an ordinary Conn
+ *     (fd -1), so tables, sessions and metrics treat it like any player.
+ *   - Datagrams are read with recvmmsg() in batches. Output is not sent
+ *     when it is queued: a peer's queue is marked dirty, and once per loop
+ *     iteration dgram_flush() packs every dirty queue into datagrams (as
+ *     many frames as fit in each, acks piggybacked) and sends them all
+ *     with sendmmsg(). A broadcast to a whole table is then one syscall.
+ *   - Reliable datagrams keep references to their OutBufs until acked;
+ *     each peer's timer retransmits them and notices silent peers.
+ *   - Single-threaded, like the lobby it belongs to.
+ ******************************************************************************/
+#ifndef DGRAM_H
+#define DGRAM_H
+
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * dgram_open:
+ *   Serve UDP players on fd (bound, not connected) for lobby l, which
+ *   must not route connections to other lobbies: sets l->udp.
+ *   Returns NULL on error.
+ */
+Dgram *dgram_open(Lobby *l, int fd);
+
+/* dgram_flush: pack and send what every peer has queued. */
+void dgram_flush(Dgram *d);
+
+/* The Conn side, for table.c */
+
+/* dgram_queue: p's Conn queued output; it goes out at the next dgram_flush. */
+void dgram_queue(UdpPeer *p);
+
+/*
+ * dgram_write:
+ *   Pack p's queued output into datagrams now (sent at the next flush).
+ *   Returns 1 if the queue is empty, 0 if the send window is full.
+ */
+int dgram_write(UdpPeer *p);
+
+/* dgram_fail: p's Conn can't keep up; report it lost from the event loop. */
+void dgram_fail(UdpPeer *p);
+
+/* dgram_close: tell the client the connection is over, and free p. */
+void dgram_close(UdpPeer *p);
+
+uint32_t dgram_peer_id(const UdpPeer *p);
+
+#endif /* DGRAM_H */
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * evlog.c
+ *
+ * SPSC event rings and their background writer (see evlog.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "evlog.h"
+#include "reactor.h"
+
+#define BATCH_RECORDS 2048 /* records per write() */
+
+static void *evlog_main(void *arg);
+static size_t evlog_drain(EvLog *log, EvRecord *batch, size_t max);
+static int write_all(int fd, const void *buf, size_t n);
+
+int evlog_open(EvLog *log, const char *path, int nrings, EvlogFsync fsync, int fsync_ms)
+{
+    memset(log, 0, sizeof(*log));
+    log->fsync = fsync;
+    log->fsync_ms = fsync_ms;
+    log->nrings = nrings;
+
+    log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log->fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(log->fd, &st) == 0 && st.st_size == 0)
+    {
+        EvlogHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, EVLOG_MAGIC, sizeof(h.magic));
+        h.version = EVLOG_VERSION;
+        h.record_size = EVLOG_RECORD_SIZE;
+        if (write_all(log->fd, &h, sizeof(h)) < 0)
+        {
+            perror(path);
+            close(log->fd);
+            return -1;
+        }
+    }
+
+    log->rings = aligned_alloc(_Alignof(EvRing), nrings * sizeof(EvRing));
+    if (!log->rings)
+    {
+        perror("aligned_alloc");
+        close(log->fd);
+        return -1;
+    }
+    for (int i = 0; i < nrings; i++)
+    {
+        atomic_init(&log->rings[i].head, 0);
+        atomic_init(&log->rings[i].tail, 0);
+        atomic_init(&log->rings[i].dropped, 0);
+    }
+    return 0;
+}
+
+int evlog_start(EvLog *log)
+{
+    int err = pthread_create(&log->thread, NULL, evlog_main, log);
+    if (err)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+void evlog_stop(EvLog *log)
+{
+    if (log->fd < 0)
+    {
+        return;
+    }
+    atomic_store(&log->stop, 1);
+    pthread_join(log->thread, NULL);
+    fdatasync(log->fd);
+    close(log->fd);
+    log->fd = -1;
+}
+
+void evlog_close(EvLog *log)
+{
+    evlog_stop(log);
+    free(log->rings);
+    log->rings = NULL;
+}
+
+/*
+ * evlog_main:
+ *   The writer thread: drain the rings into one batch, append it with one
+ *   write(), sync as the policy says, and nap only when nothing came in.
+ */
+static void *evlog_main(void *arg)
+{
+    EvLog *log = arg;
+    static EvRecord batch[BATCH_RECORDS];
+    long long last_sync = reactor_now_ms();
+    int dirty = 0;
+
+    while (1)
+    {
+        int stopping = atomic_load(&log->stop);
+        size_t n = evlog_drain(log, batch, BATCH_RECORDS);
+        if (n > 0)
+        {
+            if (write_all(log->fd, batch, n * sizeof(EvRecord)) < 0)
+            {
+                perror("[Server] event log write");
+            }
+            dirty = 1;
+        }
+
+        long long now = reactor_now_ms();
+        if (dirty && (log->fsync == EVLOG_FSYNC_BATCH ||
+                      (log->fsync == EVLOG_FSYNC_INTERVAL && now - last_sync >= log->fsync_ms)))
+        {
+            fdatasync(log->fd);
+            last_sync = now;
+            dirty = 0;
+        }
+
+        if (n == BATCH_RECORDS)
+        {
+            continue; // more is waiting
+        }
+        if (stopping)
+        {
+            break; // everything pushed before stop was set is written
+        }
+        struct timespec ts = {0, EVLOG_DRAIN_MS * 1000000L};
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+/* evlog_drain: move up to max records out of the rings, oldest first per ring. */
+static size_t evlog_drain(EvLog *log, EvRecord *batch, size_t max)
+{
+    size_t n = 0;
+
+    for (int i = 0; i < log->nrings && n < max; i++)
+    {
+        EvRing *r = &log->rings[i];
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+        while (tail != head && n < max)
+        {
+            batch[n++] = r->slots[tail & (EVLOG_RING_SIZE - 1)];
+            tail++;
+        }
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+    return n;
+}
+
+static int write_all(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0)
+    {
+        ssize_t w = write(fd, p, n);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************
+ * evlog.h
+ *
+ * Durable per-game event log for spock_server.
+ *
+ *   - Each shard thread appends fixed-size EvRecords to its own lock-free
+ *     single-producer/single-consumer ring. Appending is a few stores and
+ *     one release store, never a syscall; when a ring is full the record
+ *     is dropped and counted instead of stalling the game.
+ *   - One background writer thread drains every ring, batches the records
+ *     into one write() per pass, and fsyncs according to the EvlogFsync
+ *     policy.
+ *   - The file is append-only: an EvlogHeader, then EvRecords back to back
+ *     (host byte order, EVLOG_RECORD_SIZE bytes each). spock_logdump turns
+ *     it back into text.
+ ******************************************************************************/
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define EVLOG_MAGIC "SPOCKLOG"
+#define EVLOG_VERSION 1
+#define EVLOG_RING_SIZE 4096 /* records per shard ring; a power of two */
+#define EVLOG_DRAIN_MS 10    /* writer's sleep when every ring is empty */
+#define EVLOG_RECORD_SIZE 24
+
+typedef enum
+{
+    EV_START = 1, /* table full; value = players */
+    EV_JOIN,      /* seated; value = seats taken so far */
+    EV_RESUME,    /* took an away seat back */
+    EV_LEAVE,     /* connection lost */
+    EV_MOVE,      /* value = Move */
+    EV_RESULT,    /* round resolved; arg = winners bitmask */
+    EV_RESET,
+    EV_QUIT,
+    EV_END        /* table closed */
+} EvType;
+
+typedef struct
+{
+    uint64_t time_us;  /* wall clock, microseconds since the epoch */
+    uint32_t table;
+    uint32_t round;    /* rounds completed when the event happened */
+    uint8_t type;      /* EvType */
+    uint8_t shard;
+    uint8_t seat;      /* 0-based; 0xFF if not about one player */
+    uint8_t value;
+    uint32_t arg;
+} EvRecord;
+
+_Static_assert(sizeof(EvRecord) == EVLOG_RECORD_SIZE, "EvRecord layout is the file format");
+
+typedef struct
+{
+    char magic[8];     /* EVLOG_MAGIC, not NUL-terminated */
+    uint32_t version;
+    uint32_t record_size;
+} EvlogHeader;
+
+typedef struct
+{
+    _Alignas(64) atomic_uint head; /* next slot to write (producer) */
+    _Alignas(64) atomic_uint tail; /* next slot to read (writer thread) */
+    _Alignas(64) atomic_ulong dropped;
+    EvRecord slots[EVLOG_RING_SIZE];
+} EvRing;
+
+typedef enum
+{
+    EVLOG_FSYNC_NEVER,    /* leave it to the kernel */
+    EVLOG_FSYNC_BATCH,    /* fdatasync after every batch written */
+    EVLOG_FSYNC_INTERVAL  /* fdatasync at most every fsync_ms */
+} EvlogFsync;
+
+typedef struct
+{
+    int fd;
+    EvRing *rings;
+    int nrings;
+    EvlogFsync fsync;
+    int fsync_ms;
+    pthread_t thread;
+    atomic_int stop;
+} EvLog;
+
+/*
+ * evlog_open:
+ *   Open (or create) path for appending, writing the header to a new
+ *   file, and allocate nrings rings. Returns 0 or -1.
+ */
+int evlog_open(EvLog *log, const char *path, int nrings, EvlogFsync fsync, int fsync_ms);
+
+/* evlog_start: run the background writer. */
+int evlog_start(EvLog *log);
+
+/*
+ * evlog_stop:
+ *   Stop the writer after it has written everything pushed so far, then
+ *   sync and close the file. The rings stay valid (later pushes are just
+ *   never written), so producers need not be stopped first.
+ */
+void evlog_stop(EvLog *log);
+
+/* evlog_close: evlog_stop(), then free the rings; nobody may push anymore. */
+void evlog_close(EvLog *log);
+
+/*
+ * evring_push:
+ *   Append rec (producer thread only). Returns 0, or -1 if the ring was
+ *   full and the record was dropped.
+ */
+static inline int evring_push(EvRing *r, const EvRecord *rec)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == EVLOG_RING_SIZE)
+    {
+        atomic_store_explicit(&r->dropped,
+                              atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return -1;
+    }
+    r->slots[head & (EVLOG_RING_SIZE - 1)] = *rec;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+#endif /* EVLOG_H */
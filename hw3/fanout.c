@@ -0,0 +1,725 @@
+/******************************************************************************
+ * fanout.c
+ *
+ * Shard feeds and the fan-out threads that serve spectators (see fanout.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "fanout.h"
+#include "proto.h"
+
+struct spectator
+{
+    int fd;
+    uint8_t dirty;   /* on the thread's dirty list */
+    uint8_t slow;    /* queue overflowed: drop at the next write pass */
+    uint8_t ending;  /* the table ended: close at the next write pass */
+    uint8_t waiting; /* REACTOR_WRITE requested */
+    FanoutThread *owner;
+    FanoutChannel *chan;      /* NULL until WATCH */
+    Spectator *prev, *next;   /* the channel's spectators */
+    Spectator *next_dirty;
+    ProtoParser *in;          /* from the thread's slab until WATCH */
+    OutQueue outq;
+};
+
+/* The spectators of one watched table, on one fan-out thread. */
+struct fanout_channel
+{
+    uint32_t table;
+    int count;
+    uint8_t pending;     /* on the thread's pending list this pass */
+    uint8_t ended;       /* the table sent QUIT */
+    uint8_t missing;     /* the table did not exist at the last check */
+    int batched;         /* messages in batch */
+    Spectator *list;
+    OutBuf *batch;       /* this pass's messages, encoded back to back */
+    OutBuf *last_result; /* for spectators who join between rounds */
+    FanoutChannel *next; /* hash bucket chain */
+    FanoutChannel *next_pending;
+};
+
+static void *fanout_main(void *arg);
+static void on_fanout_tick(Timer *t, void *arg);
+static void fanout_read_feed(FanoutThread *ft, int i);
+static void fanout_take(FanoutThread *ft, FanoutChannel *ch, const FanoutSlot *s,
+                        uint64_t seq);
+static void fanout_deliver(FanoutThread *ft, FanoutChannel *ch);
+static void fanout_write_pass(FanoutThread *ft);
+static void fanout_check_tables(FanoutThread *ft);
+static int table_exists(const Fanout *f, uint32_t table);
+static FanoutChannel *channel_find(FanoutThread *ft, uint32_t table);
+static FanoutChannel *channel_get(FanoutThread *ft, uint32_t table);
+static void channel_free(FanoutThread *ft, FanoutChannel *ch);
+static void on_spectator_accept(Reactor *r, int fd, unsigned events, void *arg);
+static void on_spectator_event(Reactor *r, int fd, unsigned events, void *arg);
+static int spectator_read(Spectator *sp);
+static void spectator_watch(Spectator *sp, const uint8_t *payload, size_t len);
+static void spectator_queue(Spectator *sp, OutBuf *b);
+static void spectator_message(Spectator *sp, uint8_t op, const char *text);
+static int spectator_write(Spectator *sp);
+static void spectator_close(Spectator *sp);
+static uint32_t latest_table(const Fanout *f);
+static void stat_add(atomic_long *v, long delta);
+
+int fanout_open(Fanout *f, int nfeeds, int nthreads, const int listen_fds[],
+                ReactorBackend backend)
+{
+    memset(f, 0, sizeof(*f));
+    f->nfeeds = nfeeds;
+    f->nthreads = nthreads;
+    f->feeds = aligned_alloc(_Alignof(FanoutFeed), nfeeds * sizeof(FanoutFeed));
+    f->interest = calloc(FANOUT_INTEREST, sizeof(atomic_uint));
+    f->live = calloc(FANOUT_INTEREST, sizeof(atomic_uint));
+    f->threads = calloc(nthreads, sizeof(FanoutThread));
+    if (!f->feeds || !f->interest || !f->live || !f->threads)
+    {
+        perror("fanout");
+        return -1;
+    }
+    memset(f->feeds, 0, nfeeds * sizeof(FanoutFeed));
+    for (int i = 0; i < nfeeds; i++)
+    {
+        f->feeds[i].interest = f->interest;
+        f->feeds[i].live = f->live;
+    }
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        FanoutThread *ft = &f->threads[i];
+        ft->index = i;
+        ft->tier = f;
+        ft->reactor = reactor_create(backend);
+        ft->cursor = calloc(nfeeds, sizeof(uint64_t));
+        if (!ft->reactor || !ft->cursor)
+        {
+            fprintf(stderr, "fanout: could not create event loop %d.\n", i);
+            return -1;
+        }
+        outpool_init(&ft->pool);
+        slab_init(&ft->spectators, "spectator", sizeof(Spectator));
+        slab_init(&ft->channels, "watched_table", sizeof(FanoutChannel));
+        slab_init(&ft->inputs, "spectator_input", sizeof(ProtoParser));
+        timer_init(&ft->tick, on_fanout_tick, ft);
+        if (set_nonblocking(listen_fds[i]) < 0 ||
+            reactor_add(ft->reactor, listen_fds[i], REACTOR_READ, on_spectator_accept, ft) < 0)
+        {
+            perror("watch listener");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int fanout_start(Fanout *f)
+{
+    for (int i = 0; i < f->nthreads; i++)
+    {
+        int err = pthread_create(&f->threads[i].thread, NULL, fanout_main, &f->threads[i]);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void fanout_publish(FanoutFeed *feed, uint32_t table, uint8_t op,
+                    const void *payload, size_t len)
+{
+    if (len > FANOUT_MSG_MAX)
+    {
+        return; // a RESULT for 16 seats is under 400 bytes
+    }
+    unsigned long n = atomic_load_explicit(&feed->head, memory_order_relaxed);
+    FanoutSlot *s = &feed->slots[n & (FANOUT_FEED_SIZE - 1)];
+
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // a reader that sees any new byte then sees 0
+    atomic_store_explicit(&s->table, table, memory_order_relaxed);
+    atomic_store_explicit(&s->op, op, memory_order_relaxed);
+    atomic_store_explicit(&s->len, (uint16_t)len, memory_order_relaxed);
+    const uint8_t *p = payload;
+    for (size_t i = 0; i < len; i++)
+    {
+        atomic_store_explicit(&s->payload[i], p[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+    atomic_store_explicit(&feed->head, n + 1, memory_order_release);
+}
+
+static void *fanout_main(void *arg)
+{
+    FanoutThread *ft = arg;
+
+    timer_arm(reactor_timers(ft->reactor), &ft->tick, reactor_now_ms() + FANOUT_TICK_MS);
+    while (1)
+    {
+        if (reactor_poll(ft->reactor, -1) < 0)
+        {
+            fprintf(stderr, "[Server] Fan-out thread %d event loop failed.\n", ft->index);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * on_fanout_tick:
+ *   Take in every feed's new messages, give each watched table's batch to
+ *   its spectators, then write them out. Every FANOUT_CHECK_MS, also see
+ *   that the watched tables still exist.
+ */
+static void on_fanout_tick(Timer *t, void *arg)
+{
+    FanoutThread *ft = arg;
+
+    for (int i = 0; i < ft->tier->nfeeds; i++)
+    {
+        fanout_read_feed(ft, i);
+    }
+    FanoutChannel *ch = ft->pending;
+    ft->pending = NULL;
+    while (ch)
+    {
+        FanoutChannel *next = ch->next_pending;
+        ch->pending = 0;
+        ch->next_pending = NULL;
+        fanout_deliver(ft, ch);
+        ch = next;
+    }
+    long long now = reactor_now_ms();
+    if (now >= ft->next_check_ms)
+    {
+        fanout_check_tables(ft);
+        ft->next_check_ms = now + FANOUT_CHECK_MS;
+    }
+    fanout_write_pass(ft);
+    timer_arm(reactor_timers(ft->reactor), t, now + FANOUT_TICK_MS);
+}
+
+/* fanout_read_feed: add feed i's messages since the last pass to the watched tables' batches. */
+static void fanout_read_feed(FanoutThread *ft, int i)
+{
+    FanoutFeed *feed = &ft->tier->feeds[i];
+    uint64_t head = atomic_load_explicit(&feed->head, memory_order_acquire);
+    uint64_t n = ft->cursor[i];
+    long lapped = 0;
+
+    if (head - n > FANOUT_FEED_SIZE)
+    {
+        lapped += head - FANOUT_FEED_SIZE - n;
+        n = head - FANOUT_FEED_SIZE;
+    }
+    for (; n < head; n++)
+    {
+        FanoutSlot *s = &feed->slots[n & (FANOUT_FEED_SIZE - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != n + 1)
+        {
+            lapped++;
+            continue;
+        }
+        FanoutChannel *ch = channel_find(ft, atomic_load_explicit(&s->table, memory_order_relaxed));
+        if (ch)
+        {
+            fanout_take(ft, ch, s, n + 1);
+        }
+        else if (atomic_load_explicit(&s->seq, memory_order_relaxed) != n + 1)
+        {
+            lapped++; // whatever it was, we would not have missed it
+        }
+    }
+    ft->cursor[i] = n;
+    if (lapped)
+    {
+        stat_add(&ft->stat_lapped, lapped);
+    }
+}
+
+/*
+ * fanout_take:
+ *   Encode slot s onto the end of ch's batch. The copy only counts if the
+ *   slot still holds message seq - 1 afterwards; otherwise the shard has
+ *   lapped us and the bytes are taken back off.
+ */
+static void fanout_take(FanoutThread *ft, FanoutChannel *ch, const FanoutSlot *s,
+                        uint64_t seq)
+{
+    uint8_t op = atomic_load_explicit(&s->op, memory_order_relaxed);
+    size_t len = atomic_load_explicit(&s->len, memory_order_relaxed);
+    uint8_t payload[FANOUT_MSG_MAX];
+    if (len > FANOUT_MSG_MAX)
+    {
+        return; // torn; the check below would fail anyway
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        payload[i] = atomic_load_explicit(&s->payload[i], memory_order_relaxed);
+    }
+    if (ch->batch && OUTBUF_SIZE - ch->batch->end < PROTO_MAX_HEADER + len)
+    {
+        fanout_deliver(ft, ch); // a full buffer goes out as it is
+    }
+    if (!ch->batch && !(ch->batch = outbuf_get(&ft->pool)))
+    {
+        return;
+    }
+    if (!ch->pending)
+    {
+        ch->pending = 1;
+        ch->next_pending = ft->pending;
+        ft->pending = ch;
+    }
+
+    OutBuf *b = ch->batch;
+    uint32_t at = b->end;
+    size_t n = proto_encode(PROTO_BINARY, op, payload, len, b->data + at, OUTBUF_SIZE - at);
+    OutBuf *result = NULL;
+    if (op == PROTO_OP_RESULT && (result = outbuf_get(&ft->pool)))
+    {
+        memcpy(result->data, b->data + at, n);
+        result->end = n;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) != seq)
+    {
+        stat_add(&ft->stat_lapped, 1);
+        if (result)
+            outbuf_unref(result);
+        return;
+    }
+    b->end = at + n;
+    ch->batched++;
+    if (op == PROTO_OP_QUIT)
+    {
+        ch->ended = 1;
+    }
+    if (result)
+    {
+        if (ch->last_result)
+            outbuf_unref(ch->last_result);
+        ch->last_result = result;
+    }
+}
+
+/*
+ * fanout_deliver:
+ *   Queue ch's batch on every spectator of ch. Nobody is closed here
+ *   (that waits for the write pass), so the channel's list stays intact.
+ */
+static void fanout_deliver(FanoutThread *ft, FanoutChannel *ch)
+{
+    OutBuf *b = ch->batch;
+    if (!b)
+    {
+        return;
+    }
+    long queued = 0;
+    if (b->end > 0)
+    {
+        for (Spectator *sp = ch->list; sp; sp = sp->next)
+        {
+            if (sp->slow || sp->ending)
+            {
+                continue;
+            }
+            spectator_queue(sp, b);
+            sp->ending = ch->ended;
+            queued++;
+        }
+    }
+    stat_add(&ft->stat_messages, queued * ch->batched);
+    outbuf_unref(b);
+    ch->batch = NULL;
+    ch->batched = 0;
+}
+
+/* fanout_write_pass: one writev() per spectator that got something this pass. */
+static void fanout_write_pass(FanoutThread *ft)
+{
+    Spectator *sp = ft->dirty;
+    ft->dirty = NULL;
+
+    while (sp)
+    {
+        Spectator *next = sp->next_dirty;
+        sp->dirty = 0;
+        sp->next_dirty = NULL;
+        if (sp->slow)
+        {
+            stat_add(&ft->stat_slow, 1);
+            spectator_close(sp);
+        }
+        else if (spectator_write(sp) < 0 || sp->ending)
+        {
+            spectator_close(sp);
+        }
+        sp = next;
+    }
+}
+
+/*
+ * fanout_check_tables:
+ *   End the channels of tables that did not exist at this check or the
+ *   last one. Two checks, because a shard frees a table right after
+ *   publishing its QUIT, which this thread may not have read yet; a
+ *   second later, a QUIT would have ended the channel itself.
+ */
+static void fanout_check_tables(FanoutThread *ft)
+{
+    for (int i = 0; i < FANOUT_CHANNELS; i++)
+    {
+        for (FanoutChannel *ch = ft->buckets[i]; ch; ch = ch->next)
+        {
+            if (ch->ended || table_exists(ft->tier, ch->table))
+            {
+                ch->missing = 0;
+                continue;
+            }
+            if (!ch->missing)
+            {
+                ch->missing = 1;
+                continue;
+            }
+            OutBuf *b = outbuf_get(&ft->pool);
+            if (!b)
+            {
+                continue; // next time
+            }
+            char text[64];
+            int n = snprintf(text, sizeof(text), "Table %u is not running.", ch->table);
+            b->end = proto_encode(PROTO_BINARY, PROTO_OP_INFO, text, (size_t)n, b->data, OUTBUF_SIZE);
+            ch->ended = 1;
+            for (Spectator *sp = ch->list; sp; sp = sp->next)
+            {
+                if (!sp->slow && !sp->ending)
+                {
+                    spectator_queue(sp, b);
+                    sp->ending = 1; // the write pass closes it, and the last one the channel
+                }
+            }
+            outbuf_unref(b);
+        }
+    }
+}
+
+static FanoutChannel *channel_find(FanoutThread *ft, uint32_t table)
+{
+    FanoutChannel *ch = ft->buckets[table & (FANOUT_CHANNELS - 1)];
+    while (ch && ch->table != table)
+    {
+        ch = ch->next;
+    }
+    return ch;
+}
+
+/* channel_get: table's channel, created (and counted as watched) if new. */
+static FanoutChannel *channel_get(FanoutThread *ft, uint32_t table)
+{
+    FanoutChannel *ch = channel_find(ft, table);
+    if (ch)
+    {
+        return ch;
+    }
+    if (!(ch = slab_alloc(&ft->channels)))
+    {
+        return NULL;
+    }
+    ch->table = table;
+    FanoutChannel **bucket = &ft->buckets[table & (FANOUT_CHANNELS - 1)];
+    ch->next = *bucket;
+    *bucket = ch;
+    atomic_fetch_add_explicit(&ft->tier->interest[table & (FANOUT_INTEREST - 1)], 1,
+                              memory_order_relaxed);
+    stat_add(&ft->stat_channels, 1);
+    return ch;
+}
+
+/* channel_free: the last spectator left; the shard may stop publishing. */
+static void channel_free(FanoutThread *ft, FanoutChannel *ch)
+{
+    FanoutChannel **p = &ft->buckets[ch->table & (FANOUT_CHANNELS - 1)];
+    while (*p != ch)
+    {
+        p = &(*p)->next;
+    }
+    *p = ch->next;
+    atomic_fetch_sub_explicit(&ft->tier->interest[ch->table & (FANOUT_INTEREST - 1)], 1,
+                              memory_order_relaxed);
+    if (ch->last_result)
+    {
+        outbuf_unref(ch->last_result);
+    }
+    if (ch->batch)
+    {
+        outbuf_unref(ch->batch);
+    }
+    stat_add(&ft->stat_channels, -1);
+    slab_free(&ft->channels, ch);
+}
+
+static void on_spectator_accept(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)events;
+    FanoutThread *ft = arg;
+
+    while (1)
+    {
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept (watch)");
+            return;
+        }
+        if (ft->tier->sock)
+        {
+            sockopt_apply(cfd, ft->tier->sock);
+        }
+
+        Spectator *sp = slab_alloc(&ft->spectators);
+        ProtoParser *in = sp ? slab_alloc(&ft->inputs) : NULL;
+        if (!in || set_nonblocking(cfd) < 0 ||
+            reactor_add(r, cfd, REACTOR_READ, on_spectator_event, sp) < 0)
+        {
+            slab_free(&ft->inputs, in);
+            slab_free(&ft->spectators, sp);
+            close(cfd);
+            continue;
+        }
+        sp->fd = cfd;
+        sp->owner = ft;
+        sp->in = in;
+        proto_parser_init(in);
+        outq_init(&sp->outq);
+        stat_add(&ft->stat_spectators, 1);
+    }
+}
+
+/*
+ * on_spectator_event:
+ *   Finish queued output, then read: the WATCH request while there is a
+ *   parser, and after that nothing but the hangup.
+ */
+static void on_spectator_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)fd;
+    Spectator *sp = arg;
+
+    if ((events & REACTOR_WRITE) && spectator_write(sp) < 0)
+    {
+        spectator_close(sp);
+        return;
+    }
+    if (spectator_read(sp) < 0)
+    {
+        spectator_close(sp);
+    }
+}
+
+/* spectator_read: drain the socket (edge-triggered). Returns -1 to close. */
+static int spectator_read(Spectator *sp)
+{
+    while (1)
+    {
+        uint8_t scratch[256];
+        size_t avail = sizeof(scratch);
+        uint8_t *space = sp->in ? proto_parser_space(sp->in, &avail) : scratch;
+        ssize_t n = recv(sp->fd, space, avail, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return -1;
+        if (!sp->in)
+            continue; // watching: their bytes mean nothing
+
+        proto_parser_commit(sp->in, (size_t)n);
+        ProtoFrame f;
+        int rc = 0;
+        while (sp->in && (rc = proto_next(sp->in, &f)) > 0)
+        {
+            if (f.op == PROTO_OP_HELLO)
+            {
+                spectator_message(sp, PROTO_OP_HELLO, ""); // framed both ways from here
+                continue;
+            }
+            if (f.op != PROTO_OP_WATCH)
+                return -1;
+            spectator_watch(sp, f.payload, f.len);
+            if (sp->ending)
+                return -1;
+        }
+        if (sp->in && rc < 0)
+            return -1;
+    }
+}
+
+/*
+ * spectator_watch:
+ *   Subscribe sp to the table WATCH names ("" = the latest to start), and
+ *   send it the table's last RESULT if this thread has one.
+ */
+static void spectator_watch(Spectator *sp, const uint8_t *payload, size_t len)
+{
+    FanoutThread *ft = sp->owner;
+    char text[64];
+    uint32_t table = 0;
+    int bad = 0;
+
+    for (size_t i = 0; i < len && !bad; i++)
+    {
+        bad = payload[i] < '0' || payload[i] > '9' || table > UINT32_MAX / 10 - 1;
+        table = table * 10 + (payload[i] - '0');
+    }
+    if (bad)
+    {
+        table = 0;
+    }
+    else if (len == 0)
+    {
+        table = latest_table(ft->tier);
+    }
+
+    FanoutChannel *ch = table && table_exists(ft->tier, table) ? channel_get(ft, table) : NULL;
+    if (!ch)
+    {
+        if (bad || !table)
+            snprintf(text, sizeof(text), "%s",
+                     len ? "WATCH takes a table id." : "No table has started yet.");
+        else
+            snprintf(text, sizeof(text), "Table %u is not running.", table);
+        spectator_message(sp, PROTO_OP_INFO, text);
+        spectator_write(sp);
+        sp->ending = 1;
+        return;
+    }
+    slab_free(&ft->inputs, sp->in);
+    sp->in = NULL;
+    sp->chan = ch;
+    sp->next = ch->list;
+    if (ch->list)
+        ch->list->prev = sp;
+    ch->list = sp;
+    ch->count++;
+
+    snprintf(text, sizeof(text), "Watching table %u.", table);
+    spectator_message(sp, PROTO_OP_INFO, text);
+    if (ch->last_result)
+    {
+        outq_push(&sp->outq, ch->last_result);
+    }
+    if (spectator_write(sp) < 0)
+    {
+        sp->ending = 1;
+    }
+}
+
+/* spectator_queue: add b to sp's queue for the next write pass. */
+static void spectator_queue(Spectator *sp, OutBuf *b)
+{
+    FanoutThread *ft = sp->owner;
+
+    if (outq_push(&sp->outq, b) < 0)
+    {
+        outq_clear(&sp->outq);
+        sp->slow = 1;
+    }
+    if (!sp->dirty)
+    {
+        sp->dirty = 1;
+        sp->next_dirty = ft->dirty;
+        ft->dirty = sp;
+    }
+}
+
+/* spectator_message: queue one message of sp's own (written by the caller). */
+static void spectator_message(Spectator *sp, uint8_t op, const char *text)
+{
+    OutBuf *b = outbuf_get(&sp->owner->pool);
+    if (!b)
+    {
+        return;
+    }
+    b->end = proto_encode(PROTO_BINARY, op, text, strlen(text), b->data, OUTBUF_SIZE);
+    outq_push(&sp->outq, b);
+    outbuf_unref(b);
+}
+
+/* spectator_write: flush sp's queue, watching for writability if it is not all out. */
+static int spectator_write(Spectator *sp)
+{
+    int rc = outq_flush(&sp->outq, sp->fd, NULL);
+    if (rc < 0)
+    {
+        return -1;
+    }
+    if (sp->waiting != (rc == 0))
+    {
+        sp->waiting = (rc == 0);
+        reactor_mod(sp->owner->reactor, sp->fd, rc ? REACTOR_READ : REACTOR_READ | REACTOR_WRITE);
+    }
+    return 0;
+}
+
+/* spectator_close: never called while sp is on the dirty list. */
+static void spectator_close(Spectator *sp)
+{
+    FanoutThread *ft = sp->owner;
+    FanoutChannel *ch = sp->chan;
+
+    if (ch)
+    {
+        if (sp->prev)
+            sp->prev->next = sp->next;
+        else
+            ch->list = sp->next;
+        if (sp->next)
+            sp->next->prev = sp->prev;
+        if (--ch->count == 0)
+            channel_free(ft, ch);
+    }
+    reactor_del(ft->reactor, sp->fd);
+    close(sp->fd);
+    outq_clear(&sp->outq);
+    slab_free(&ft->inputs, sp->in);
+    slab_free(&ft->spectators, sp);
+    stat_add(&ft->stat_spectators, -1);
+}
+
+/* latest_table: the most recent table to start on any shard (ids only grow). */
+static uint32_t latest_table(const Fanout *f)
+{
+    uint32_t best = 0;
+    for (int i = 0; i < f->nfeeds; i++)
+    {
+        uint32_t id = atomic_load_explicit(&f->feeds[i].latest, memory_order_relaxed);
+        if (id > best)
+            best = id;
+    }
+    return best;
+}
+
+/* table_exists: whether a shard holds table (or, rarely, one that collides with it). */
+static int table_exists(const Fanout *f, uint32_t table)
+{
+    return atomic_load_explicit(&f->live[table & (FANOUT_INTEREST - 1)], memory_order_relaxed) != 0;
+}
+
+/* stat_add: single-writer update of a published count. */
+static void stat_add(atomic_long *v, long delta)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + delta,
+                          memory_order_relaxed);
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+ * fanout.h
+ *
+ * Spectators: watching live tables without taking a seat.
+ *
+ *   - A spectator connects to the watch port, opens the framed protocol
+ *     and sends WATCH with a table id (or nothing, for the table that
+ *     started most recently). From then on it gets what the table's
+ *     players get (RESULT, RESET, QUIT) plus INFO lines for the table's
+ *     state changes (started, a player away or back).
+ *   - Spectators are served by fan-out threads of their own, never by the
+ *     game shards. A shard publishes each message for a watched table
+ *     once, into its FanoutFeed: a broadcast ring that every fan-out
+ *     thread reads at its own pace. Publishing is a copy into one slot and
+ *     two release stores, whatever the number of spectators, and never
+ *     waits: a fan-out thread that falls a whole ring behind skips what it
+ *     missed (and counts it) rather than holding the writer back.
+ *   - Slots are seqlocked: the writer clears a slot's sequence number,
+ *     fills it and then stores the new number; a reader copies the slot
+ *     and keeps the copy only if the number is the one it expected before
+ *     and after. Every field a reader may race with is a relaxed atomic
+ *     (the payload byte by byte), with a release fence after the clear
+ *     and an acquire fence before the second check, so a torn read is
+ *     always caught and is never a data race.
+ *   - Which tables are watched is a shared array of counters, indexed by
+ *     table id modulo FANOUT_INTEREST: a fan-out thread counts a table in
+ *     while it has spectators for it. A shard checks it with one relaxed
+ *     load per message, so unwatched tables publish nothing; a collision
+ *     only publishes a message nobody takes.
+ *   - Which tables exist is a second such array, counted by the shards as
+ *     tables are created and freed. A WATCH for a table that does not
+ *     exist is refused, and a channel whose table is gone without its QUIT
+ *     reaching us (or that a collision let in) is closed within
+ *     2 * FANOUT_CHECK_MS.
+ *   - Every FANOUT_TICK_MS a fan-out thread reads all feeds and encodes
+ *     the messages for each watched table back to back into one pooled
+ *     buffer (outbuf.h), then queues one reference to it on each of the
+ *     table's spectators and writes every spectator that got something
+ *     with one writev(). However many rounds a pass covers, a spectator
+ *     costs one queue entry and one system call; one whose queue fills up
+ *     anyway is disconnected. The last RESULT of each watched table is
+ *     kept for spectators who join later.
+ ******************************************************************************/
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outbuf.h"
+#include "reactor.h"
+#include "slab.h"
+#include "sockopt.h"
+
+#define FANOUT_FEED_SIZE 4096 /* messages per shard feed; a power of two */
+#define FANOUT_MSG_MAX 496    /* payload bytes a feed slot holds */
+#define FANOUT_TICK_MS 5      /* fan-out threads' pass interval */
+#define FANOUT_INTEREST 65536 /* watched-table counters; a power of two */
+#define FANOUT_CHANNELS 4096  /* per-thread hash buckets of watched tables */
+#define FANOUT_CHECK_MS 1000  /* how often channels are checked for a table that is gone */
+
+typedef struct fanout Fanout;
+typedef struct spectator Spectator;
+typedef struct fanout_channel FanoutChannel;
+
+typedef struct
+{
+    atomic_ulong seq; /* message number + 1 once written, 0 while being written */
+    atomic_uint table;
+    atomic_uchar op;
+    atomic_ushort len;
+    atomic_uchar payload[FANOUT_MSG_MAX]; /* copied with relaxed loads and stores */
+} FanoutSlot;
+
+_Static_assert(sizeof(FanoutSlot) == 512, "FanoutSlot is eight cache lines");
+
+/* One shard's messages for the fan-out threads (single writer). */
+typedef struct
+{
+    _Alignas(64) atomic_ulong head;   /* messages published */
+    _Alignas(64) atomic_uint latest;  /* id of the table that started last, 0 = none */
+    atomic_uint *interest;            /* the Fanout's watched-table counters */
+    atomic_uint *live;                /* and its existing-table counters */
+    _Alignas(64) FanoutSlot slots[FANOUT_FEED_SIZE];
+} FanoutFeed;
+
+/* One fan-out thread. */
+typedef struct
+{
+    int index;
+    pthread_t thread;
+    Reactor *reactor;
+    Fanout *tier;
+    uint64_t *cursor;      /* per feed: the next message to read */
+    OutPool pool;
+    Slab spectators;       /* Spectator */
+    Slab channels;         /* FanoutChannel */
+    Slab inputs;           /* ProtoParser, until WATCH arrives */
+    FanoutChannel *buckets[FANOUT_CHANNELS];
+    FanoutChannel *pending; /* watched tables with messages this pass */
+    Spectator *dirty;      /* got messages since the last write pass */
+    Timer tick;
+    long long next_check_ms; /* of the channels' tables */
+
+    /* published for the metrics (written only by this thread) */
+    atomic_long stat_spectators;
+    atomic_long stat_channels;
+    atomic_long stat_messages; /* messages queued to spectators */
+    atomic_long stat_slow;     /* spectators dropped for not reading */
+    atomic_long stat_lapped;   /* feed messages overwritten before this thread read them */
+} FanoutThread;
+
+struct fanout
+{
+    FanoutFeed *feeds;   /* one per shard */
+    int nfeeds;
+    FanoutThread *threads;
+    int nthreads;
+    atomic_uint *interest; /* FANOUT_INTEREST counters */
+    atomic_uint *live;     /* FANOUT_INTEREST counters of the tables that exist */
+    const SockProfile *sock; /* options for accepted spectators, or NULL */
+};
+
+/*
+ * fanout_open:
+ *   Allocate nfeeds feeds and nthreads fan-out threads, thread i taking
+ *   spectators from listen_fds[i] (SO_REUSEPORT listeners on one port).
+ *   Returns 0 or -1.
+ */
+int fanout_open(Fanout *f, int nfeeds, int nthreads, const int listen_fds[],
+                ReactorBackend backend);
+
+/* fanout_start: run the fan-out threads. */
+int fanout_start(Fanout *f);
+
+/* fanout_watched: whether anyone may be watching table (shard thread). */
+static inline int fanout_watched(const FanoutFeed *feed, uint32_t table)
+{
+    return atomic_load_explicit(&feed->interest[table & (FANOUT_INTEREST - 1)],
+                                memory_order_relaxed) != 0;
+}
+
+/*
+ * fanout_publish:
+ *   Append a message for table's spectators (the feed's shard only).
+ *   Never blocks; a payload over FANOUT_MSG_MAX is dropped.
+ */
+void fanout_publish(FanoutFeed *feed, uint32_t table, uint8_t op,
+                    const void *payload, size_t len);
+
+/* fanout_table_live: count table in (delta 1, created) or out (-1, freed). */
+static inline void fanout_table_live(FanoutFeed *feed, uint32_t table, int delta)
+{
+    atomic_fetch_add_explicit(&feed->live[table & (FANOUT_INTEREST - 1)], (unsigned)delta,
+                              memory_order_relaxed);
+}
+
+/* fanout_started: table has just started; an empty WATCH picks the latest. */
+static inline void fanout_started(FanoutFeed *feed, uint32_t table)
+{
+    atomic_store_explicit(&feed->latest, table, memory_order_relaxed);
+}
+
+#endif /* FANOUT_H */
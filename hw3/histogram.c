@@ -0,0 +1,115 @@
+/******************************************************************************
+ * histogram.c
+ *
+ * Log-linear (HDR-style) histogram, see histogram.h.
+ *
+ * Bucket layout: values below HIST_SUB_BUCKETS map to themselves. A larger
+ * value whose top bit is b keeps its top HIST_SUB_BITS bits; the bit below
+ * the top selects one of HIST_SUB_BUCKETS / 2 buckets in the band for b.
+ ******************************************************************************/
+#include <string.h>
+
+#include "histogram.h"
+
+#define HALF (HIST_SUB_BUCKETS / 2)
+#define MAX_VALUE ((1ULL << HIST_MAX_BITS) - 1)
+
+static int bucket_of(uint64_t v);
+static uint64_t bucket_high(int idx);
+
+void hist_init(Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static int bucket_of(uint64_t v)
+{
+    if (v < HIST_SUB_BUCKETS)
+    {
+        return (int)v;
+    }
+    int shift = 63 - __builtin_clzll(v) - (HIST_SUB_BITS - 1); // >= 1
+    return HIST_SUB_BUCKETS + (shift - 1) * HALF + (int)(v >> shift) - HALF;
+}
+
+/* bucket_high: the largest value that lands in bucket idx. */
+static uint64_t bucket_high(int idx)
+{
+    if (idx < HIST_SUB_BUCKETS)
+    {
+        return (uint64_t)idx;
+    }
+    int shift = (idx - HIST_SUB_BUCKETS) / HALF + 1;
+    uint64_t top = (uint64_t)((idx - HIST_SUB_BUCKETS) % HALF + HALF);
+    return ((top + 1) << shift) - 1;
+}
+
+void hist_record(Histogram *h, uint64_t value)
+{
+    if (value > MAX_VALUE)
+    {
+        value = MAX_VALUE;
+    }
+    h->buckets[bucket_of(value)]++;
+    if (h->count == 0 || value < h->min)
+    {
+        h->min = value;
+    }
+    if (value > h->max)
+    {
+        h->max = value;
+    }
+    h->count++;
+    h->sum += (double)value;
+}
+
+void hist_merge(Histogram *dst, const Histogram *src)
+{
+    if (src->count == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        dst->buckets[i] += src->buckets[i];
+    }
+    if (dst->count == 0 || src->min < dst->min)
+    {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+}
+
+uint64_t hist_percentile(const Histogram *h, double pct)
+{
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(pct / 100.0 * (double)h->count + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t high = bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+double hist_mean(const Histogram *h)
+{
+    return h->count ? h->sum / (double)h->count : 0.0;
+}
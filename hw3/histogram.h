@@ -0,0 +1,47 @@
+/******************************************************************************
+ * histogram.h
+ *
+ * HDR-style latency histogram used by spock_bench.
+ *
+ *   - Values (e.g. microseconds) are counted in log-linear buckets: exact
+ *     below HIST_SUB_BUCKETS, and above that HIST_SUB_BUCKETS / 2 buckets
+ *     per power of two, so any recorded value is off by less than 1/128.
+ *   - Recording is one clz and one increment; no allocation after init.
+ *   - One histogram per thread; merge them with hist_merge() at the end.
+ ******************************************************************************/
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 8
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 /* larger values are recorded as 2^40 - 1 */
+#define HIST_BUCKETS \
+    (HIST_SUB_BUCKETS + (HIST_MAX_BITS - HIST_SUB_BITS) * (HIST_SUB_BUCKETS / 2))
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t min, max;
+    double sum;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+void hist_init(Histogram *h);
+void hist_record(Histogram *h, uint64_t value);
+
+/* hist_merge: add every value recorded in src to dst. */
+void hist_merge(Histogram *dst, const Histogram *src);
+
+/*
+ * hist_percentile:
+ *   The value below which pct percent (0..100) of the recordings fall,
+ *   as the highest value of its bucket (never below the true value).
+ *   Returns 0 for an empty histogram.
+ */
+uint64_t hist_percentile(const Histogram *h, double pct);
+
+double hist_mean(const Histogram *h);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,81 @@
+/******************************************************************************
+ * metrics.c
+ *
+ * Aggregation and Prometheus text exposition of the per-shard counters.
+ ******************************************************************************/
+#include "metrics.h"
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counter_info[METRIC_COUNTERS] = {
+    [METRIC_ACCEPTS] = {"spock_accepts_total", "Connections accepted."},
+    [METRIC_ROUNDS] = {"spock_rounds_total", "Rounds resolved."},
+    [METRIC_MOVES] = {"spock_moves_total", "Valid moves received."},
+    [METRIC_BYTES_IN] = {"spock_bytes_in_total", "Bytes received from players."},
+    [METRIC_BYTES_OUT] = {"spock_bytes_out_total", "Bytes sent to players."},
+    [METRIC_SHORT_WRITES] = {"spock_short_writes_total",
+                             "Flushes that left data queued because the socket was full."},
+    [METRIC_PARSE_ERRORS] = {"spock_parse_errors_total", "Malformed frames received."},
+    [METRIC_TLS_HANDSHAKES] = {"spock_tls_handshakes_total", "TLS handshakes completed."},
+    [METRIC_TLS_RESUMED] = {"spock_tls_resumed_total",
+                            "TLS handshakes that resumed a session instead of a full handshake."},
+    [METRIC_TLS_KTLS] = {"spock_tls_ktls_total",
+                         "TLS connections whose record encryption the kernel took over."},
+    [METRIC_UDP_DATAGRAMS_IN] = {"spock_udp_datagrams_in_total", "UDP datagrams received."},
+    [METRIC_UDP_DATAGRAMS_OUT] = {"spock_udp_datagrams_out_total", "UDP datagrams sent."},
+    [METRIC_UDP_RETRANSMITS] = {"spock_udp_retransmits_total",
+                                "Reliable UDP datagrams sent again after their timeout."},
+    [METRIC_UDP_SYSCALLS] = {"spock_udp_syscalls_total",
+                             "recvmmsg() and sendmmsg() calls on the UDP socket."},
+    [METRIC_UDP_COOKIE_REJECTS] = {"spock_udp_cookie_rejects_total",
+                                   "UDP opens refused for a missing, stale or forged cookie."},
+    [METRIC_SOCKOPT_ERRORS] = {"spock_sockopt_errors_total",
+                               "Socket profile options that failed on an accepted connection."},
+    [METRIC_BOT_MOVES] = {"spock_bot_moves_total", "Moves made by in-process bot seats."},
+    [METRIC_SOCKET_SYSCALLS] = {"spock_socket_syscalls_total",
+                                "recv() and send calls on TCP players' sockets."},
+    [METRIC_FRAMES_REJECTED] = {"spock_frames_rejected_total",
+                                "Invalid or repeated moves and unknown commands, dropped unread."},
+    [METRIC_RATE_LIMITED] = {"spock_rate_limited_total",
+                             "Connections dropped for sending frames faster than --frame-rate."},
+    [METRIC_ABUSE_DROPS] = {"spock_abuse_drops_total",
+                            "Connections dropped for sending too many unusable frames."},
+};
+
+void metrics_collect(MetricsSnapshot *acc, const Metrics *m)
+{
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+    {
+        acc->counters[i] += atomic_load_explicit(&m->counters[i], memory_order_relaxed);
+    }
+    for (int i = 0; i <= METRICS_LATENCY_BUCKETS; i++)
+    {
+        acc->latency[i] += atomic_load_explicit(&m->latency[i], memory_order_relaxed);
+    }
+    acc->latency_sum_us += atomic_load_explicit(&m->latency_sum_us, memory_order_relaxed);
+}
+
+void metrics_write(FILE *out, const MetricsSnapshot *acc)
+{
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+    {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+                counter_info[i].name, counter_info[i].help,
+                counter_info[i].name, counter_info[i].name, acc->counters[i]);
+    }
+
+    const char *name = "spock_move_result_latency_seconds";
+    fprintf(out, "# HELP %s Time from a move arriving to its round's RESULT being sent.\n"
+                 "# TYPE %s histogram\n", name, name);
+    unsigned long cumulative = 0;
+    for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        cumulative += acc->latency[i];
+        fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name, (double)(1UL << i) / 1e6, cumulative);
+    }
+    cumulative += acc->latency[METRICS_LATENCY_BUCKETS];
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+    fprintf(out, "%s_sum %.6f\n%s_count %lu\n", name, acc->latency_sum_us / 1e6, name, cumulative);
+}
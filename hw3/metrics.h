@@ -0,0 +1,99 @@
+/******************************************************************************
+ * metrics.h
+ *
+ * Hot-path counters for spock_server, exported in Prometheus text format.
+ *
+ *   - Every shard owns one Metrics block and is its only writer, so an
+ *     update is a relaxed load and store: no locked instruction, no
+ *     shared cache line (a block is aligned to and padded out to whole
+ *     cache lines).
+ *   - Readers (the admin endpoint) sum the blocks only when scraped.
+ *   - Move-to-RESULT latency is a histogram with power-of-two buckets
+ *     from 1 us to 2^(METRICS_LATENCY_BUCKETS - 1) us, plus +Inf.
+ ******************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_LATENCY_BUCKETS 24 /* le = 1 us .. ~8.4 s */
+
+typedef enum
+{
+    METRIC_ACCEPTS,
+    METRIC_ROUNDS,
+    METRIC_MOVES,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_SHORT_WRITES, /* flushes that left data queued (socket full) */
+    METRIC_PARSE_ERRORS,
+    METRIC_TLS_HANDSHAKES,
+    METRIC_TLS_RESUMED, /* handshakes that resumed a session */
+    METRIC_TLS_KTLS,    /* connections whose sends the kernel encrypts */
+    METRIC_UDP_DATAGRAMS_IN,
+    METRIC_UDP_DATAGRAMS_OUT,
+    METRIC_UDP_RETRANSMITS,
+    METRIC_UDP_SYSCALLS, /* recvmmsg() and sendmmsg() calls */
+    METRIC_UDP_COOKIE_REJECTS, /* UDP opens without a valid cookie (not seated) */
+    METRIC_SOCKOPT_ERRORS, /* socket options an accepted connection refused */
+    METRIC_BOT_MOVES,      /* moves made by in-process bots (also in METRIC_MOVES) */
+    METRIC_SOCKET_SYSCALLS, /* recv() and send calls on TCP players' sockets */
+    METRIC_FRAMES_REJECTED, /* bad or repeated moves, unknown commands (dropped) */
+    METRIC_RATE_LIMITED,    /* connections dropped for exceeding the frame rate */
+    METRIC_ABUSE_DROPS,     /* connections dropped for too many rejected frames */
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef struct
+{
+    _Alignas(METRICS_CACHE_LINE) atomic_ulong counters[METRIC_COUNTERS];
+    atomic_ulong latency[METRICS_LATENCY_BUCKETS + 1]; /* last one is +Inf */
+    atomic_ulong latency_sum_us;
+} Metrics;
+
+/* A plain-integer copy of one or more Metrics blocks, for reporting. */
+typedef struct
+{
+    unsigned long counters[METRIC_COUNTERS];
+    unsigned long latency[METRICS_LATENCY_BUCKETS + 1];
+    unsigned long latency_sum_us;
+} MetricsSnapshot;
+
+/* metric_bump: single-writer add; only the owning thread may call it. */
+static inline void metric_bump(atomic_ulong *p, unsigned long n)
+{
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void metric_add(Metrics *m, MetricCounter c, unsigned long n)
+{
+    metric_bump(&m->counters[c], n);
+}
+
+static inline void metric_observe_us(Metrics *m, long long us)
+{
+    int b = 0;
+    if (us > 1)
+    {
+        b = 64 - __builtin_clzll((unsigned long long)us - 1); // ceil(log2(us))
+        if (b > METRICS_LATENCY_BUCKETS)
+            b = METRICS_LATENCY_BUCKETS;
+    }
+    else if (us < 0)
+    {
+        us = 0;
+    }
+    metric_bump(&m->latency[b], 1);
+    metric_bump(&m->latency_sum_us, (unsigned long)us);
+}
+
+/* metrics_collect: add the current values of m to acc (any thread). */
+void metrics_collect(MetricsSnapshot *acc, const Metrics *m);
+
+/* metrics_write: print acc as Prometheus counters and a histogram. */
+void metrics_write(FILE *out, const MetricsSnapshot *acc);
+
+#endif /* METRICS_H */
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * mpsc.h
+ *
+ * Intrusive lock-free multi-producer / single-consumer queue (Vyukov).
+ *
+ *   - Any thread may mpsc_push(); only the owning thread may mpsc_pop().
+ *   - push is one atomic exchange plus one store, and never blocks.
+ *   - pop can return NULL while a producer is half-way through a push; the
+ *     producer is expected to wake the consumer afterwards, so the consumer
+ *     simply tries again on its next wakeup.
+ ******************************************************************************/
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct mpsc_node
+{
+    _Atomic(struct mpsc_node *) next;
+} MpscNode;
+
+typedef struct
+{
+    _Atomic(MpscNode *) head; /* producers append here */
+    MpscNode *tail;           /* consumer pops here */
+    MpscNode stub;
+} MpscQueue;
+
+static inline void mpsc_init(MpscQueue *q)
+{
+    atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(MpscQueue *q, MpscNode *n)
+{
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    MpscNode *prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+static inline MpscNode *mpsc_pop(MpscQueue *q)
+{
+    MpscNode *tail = q->tail;
+    MpscNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub)
+    {
+        if (!next)
+        {
+            return NULL; // empty
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+    {
+        return NULL; // a producer is mid-push; retry on the next wakeup
+    }
+
+    /* tail is the last node: re-insert the stub behind it so it can go */
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* container_of-style helper for intrusive nodes */
+#define MPSC_ENTRY(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#endif /* MPSC_H */
@@ -0,0 +1,695 @@
+/******************************************************************************
+ * net.c
+ *
+ * Client-side socket helpers (see net.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "net.h"
+#include "proto.h"
+#include "reactor.h"
+#include "sockopt.h"
+#include "tls.h"
+#include "udp.h"
+
+#define NET_UDP_LINGER_MS 1000 /* net_close() waits this long for acks */
+
+/* A reliable datagram we sent, kept until the server acks it. */
+typedef struct
+{
+    uint32_t seq; /* 0 = free slot */
+    uint8_t tries;
+    long long sent_ms;
+    size_t len;
+    uint8_t data[UDP_MAX_PAYLOAD];
+} UdpFlight;
+
+/* One UDP connection to the server (see udp.h). */
+typedef struct
+{
+    uint32_t id;
+    uint32_t next_seq;
+    int open;   /* the server answered: stop sending UDP_OPEN */
+    int closed; /* the server sent UDP_CLOSE */
+    uint8_t cookie[UDP_COOKIE_SIZE]; /* the server's latest, echoed until open */
+    UdpWindow rx;
+    UdpRtt rtt;
+    long long sent_ms; /* last datagram sent, for keepalives */
+    long long heard_ms;
+    int in_flight;
+    UdpFlight flight[UDP_WINDOW];
+} UdpLink;
+
+/* What a descriptor carries besides plain TCP. */
+typedef struct
+{
+    TlsConn *tls;
+    UdpLink *udp;
+} NetFd;
+
+static TlsCtx *tls_ctx;                 /* NULL = cleartext */
+static int use_udp;
+static const SockProfile *sock_profile; /* NULL = sockopt_default() */
+static NetFd *net_fds;                  /* by fd; grown by grow_fds() */
+static int net_nfds;
+
+static int grow_fds(int fd);
+static int send_all(int sockfd, const uint8_t *buf, size_t n);
+static int start_tls(int sockfd, const char *host);
+static int udp_connect(const char *host, int port);
+static UdpLink *udp_of(int sockfd);
+static int udp_probe(int sockfd);
+static int udp_send(int sockfd, UdpLink *u, const uint8_t *buf, size_t n);
+static int udp_transmit(int sockfd, UdpLink *u, uint8_t flags, uint32_t seq,
+                        const uint8_t *payload, size_t n);
+static ssize_t udp_recv(int sockfd, UdpLink *u, void *buf, size_t len);
+static void udp_take_acks(UdpLink *u, const UdpHeader *h, long long now);
+static void udp_take_cookie(UdpLink *u, const UdpHeader *h, const uint8_t *dgram, size_t n);
+static const SockProfile *profile(void);
+
+/*
+ * connect_to_server:
+ *   The connect() itself is non-blocking so an unreachable server costs at
+ *   most NET_CONNECT_TIMEOUT_MS; the socket is blocking again once connected.
+ */
+int connect_to_server(const char *host, int port)
+{
+    if (use_udp)
+    {
+        return udp_connect(host, port);
+    }
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, host, &srv.sin_addr) <= 0)
+    {
+        perror("inet_pton");
+        close(sockfd);
+        return -1;
+    }
+    sockopt_apply(sockfd, profile()); // before connect(): buffer sizes set the window scale
+
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(sockfd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
+    {
+        if (errno != EINPROGRESS)
+        {
+            perror("connect");
+            close(sockfd);
+            return -1;
+        }
+
+        // poll(), not select(): spock_bench's sockets go past FD_SETSIZE
+        struct pollfd pfd = {sockfd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        int ret = poll(&pfd, 1, NET_CONNECT_TIMEOUT_MS);
+        if (ret <= 0 || getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+        {
+            fprintf(stderr, "connect: %s\n", ret == 0 ? "timed out" : strerror(err ? err : errno));
+            close(sockfd);
+            return -1;
+        }
+    }
+    fcntl(sockfd, F_SETFL, flags);
+    if (tls_ctx && start_tls(sockfd, host) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+int net_use_tls(const char *ca_file)
+{
+    if (!tls_ctx)
+    {
+        tls_ctx = tls_client_ctx(ca_file);
+    }
+    return tls_ctx ? 0 : -1;
+}
+
+/* grow_fds: make sure net_fds[fd] exists, however high fd is (past FD_SETSIZE too). */
+static int grow_fds(int fd)
+{
+    if (fd < net_nfds)
+    {
+        return 0;
+    }
+    int n = net_nfds ? net_nfds : 64;
+    while (n <= fd)
+    {
+        n *= 2;
+    }
+    NetFd *f = realloc(net_fds, n * sizeof(*f));
+    if (!f)
+    {
+        perror("realloc");
+        return -1;
+    }
+    memset(f + net_nfds, 0, (n - net_nfds) * sizeof(*f));
+    net_fds = f;
+    net_nfds = n;
+    return 0;
+}
+
+/* start_tls: blocking handshake on sockfd, within NET_CONNECT_TIMEOUT_MS. */
+static int start_tls(int sockfd, const char *host)
+{
+    if (grow_fds(sockfd) < 0)
+    {
+        return -1;
+    }
+    TlsConn *t = tls_conn_new(tls_ctx, sockfd, host);
+    if (!t)
+    {
+        return -1;
+    }
+    struct timeval tv = {NET_CONNECT_TIMEOUT_MS / 1000, (NET_CONNECT_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int rc = tls_handshake(t);
+    struct timeval off = {0, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &off, sizeof(off));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &off, sizeof(off));
+    if (rc != 1)
+    {
+        if (rc == 0)
+            fprintf(stderr, "TLS handshake: timed out\n");
+        tls_conn_free(t);
+        return -1;
+    }
+    net_fds[sockfd].tls = t;
+    return 0;
+}
+
+static TlsConn *tls_of(int sockfd)
+{
+    return (sockfd >= 0 && sockfd < net_nfds) ? net_fds[sockfd].tls : NULL;
+}
+
+ssize_t net_recv(int sockfd, void *buf, size_t len)
+{
+    UdpLink *u = udp_of(sockfd);
+    if (u)
+    {
+        return udp_recv(sockfd, u, buf, len);
+    }
+    TlsConn *t = tls_of(sockfd);
+    ssize_t n = t ? tls_recv(t, buf, len) : recv(sockfd, buf, len, 0);
+    if (n > 0)
+    {
+        sockopt_quickack(sockfd, profile());
+    }
+    return n;
+}
+
+int net_pending(int sockfd)
+{
+    TlsConn *t = tls_of(sockfd);
+    return t && tls_pending(t);
+}
+
+const char *net_describe(int sockfd, char *buf, size_t size)
+{
+    TlsConn *t = tls_of(sockfd);
+    return t ? tls_describe(t, buf, size) : NULL;
+}
+
+void net_close(int sockfd)
+{
+    TlsConn *t = tls_of(sockfd);
+    if (t)
+    {
+        tls_conn_free(t);
+        net_fds[sockfd].tls = NULL;
+    }
+    UdpLink *u = udp_of(sockfd);
+    if (u)
+    {
+        // let e.g. a final QUIT get through, then say goodbye
+        long long deadline = reactor_now_ms() + NET_UDP_LINGER_MS;
+        while (u->in_flight > 0 && !u->closed && reactor_now_ms() < deadline)
+        {
+            int wait = net_timeout_ms(sockfd);
+            struct pollfd pfd = {sockfd, POLLIN, 0};
+            uint8_t scratch[UDP_MAX_PAYLOAD];
+            if (poll(&pfd, 1, wait) > 0 && udp_recv(sockfd, u, scratch, sizeof(scratch)) < 0 &&
+                errno != EAGAIN)
+            {
+                break;
+            }
+            if (net_tick(sockfd) < 0)
+            {
+                break;
+            }
+        }
+        if (!u->closed)
+        {
+            udp_transmit(sockfd, u, UDP_CLOSE, 0, NULL, 0);
+        }
+        free(u);
+        net_fds[sockfd].udp = NULL;
+    }
+    close(sockfd);
+}
+
+void net_use_profile(const SockProfile *p)
+{
+    sock_profile = p;
+}
+
+static const SockProfile *profile(void)
+{
+    return sock_profile ? sock_profile : sockopt_default();
+}
+
+void net_use_udp(void)
+{
+    use_udp = 1;
+}
+
+int net_udp(int sockfd)
+{
+    return udp_of(sockfd) != NULL;
+}
+
+int net_timeout_ms(int sockfd)
+{
+    UdpLink *u = udp_of(sockfd);
+    if (!u)
+    {
+        return -1;
+    }
+    long long when = u->sent_ms + UDP_KEEPALIVE_MS;
+    if (u->heard_ms + UDP_IDLE_MS < when)
+    {
+        when = u->heard_ms + UDP_IDLE_MS;
+    }
+    for (int i = 0; i < UDP_WINDOW; i++)
+    {
+        const UdpFlight *f = &u->flight[i];
+        if (f->seq && f->sent_ms + u->rtt.rto_ms < when)
+        {
+            when = f->sent_ms + u->rtt.rto_ms;
+        }
+    }
+    long long left = when - reactor_now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+int net_tick(int sockfd)
+{
+    UdpLink *u = udp_of(sockfd);
+    if (!u)
+    {
+        return 0;
+    }
+    long long now = reactor_now_ms();
+    if (now - u->heard_ms >= UDP_IDLE_MS)
+    {
+        fprintf(stderr, "UDP: nothing from the server for %d ms\n", UDP_IDLE_MS);
+        return -1;
+    }
+    int retransmitted = 0;
+    for (int i = 0; i < UDP_WINDOW; i++)
+    {
+        UdpFlight *f = &u->flight[i];
+        if (!f->seq || f->sent_ms + u->rtt.rto_ms > now)
+        {
+            continue;
+        }
+        if (f->tries >= UDP_MAX_TRIES)
+        {
+            fprintf(stderr, "UDP: no ack after %d tries\n", UDP_MAX_TRIES);
+            return -1;
+        }
+        if (udp_transmit(sockfd, u, UDP_RELIABLE, f->seq, f->data, f->len) < 0)
+        {
+            return -1;
+        }
+        f->tries++;
+        f->sent_ms = now;
+        retransmitted = 1;
+    }
+    if (retransmitted)
+    {
+        udp_rtt_backoff(&u->rtt);
+    }
+    if (now - u->sent_ms >= UDP_KEEPALIVE_MS)
+    {
+        return udp_transmit(sockfd, u, UDP_PING, 0, NULL, 0);
+    }
+    return 0;
+}
+
+int send_join(int sockfd, const char *token)
+{
+    uint8_t msg[PROTO_BUF_SIZE];
+    // over UDP, framed from the first datagram (see udp.h)
+    size_t n = udp_of(sockfd) ? 0 : proto_encode(PROTO_BINARY, PROTO_OP_HELLO, NULL, 0, msg, sizeof(msg));
+    n += proto_encode(PROTO_BINARY, PROTO_OP_JOIN, token, strlen(token), msg + n, sizeof(msg) - n);
+    return send_all(sockfd, msg, n);
+}
+
+int send_watch(int sockfd, const char *table)
+{
+    uint8_t msg[PROTO_BUF_SIZE];
+    size_t n = proto_encode(PROTO_BINARY, PROTO_OP_HELLO, NULL, 0, msg, sizeof(msg));
+    n += proto_encode(PROTO_BINARY, PROTO_OP_WATCH, table, strlen(table), msg + n, sizeof(msg) - n);
+    return send_all(sockfd, msg, n);
+}
+
+int send_frame(int sockfd, uint8_t op, const void *payload, size_t len)
+{
+    uint8_t msg[PROTO_BUF_SIZE];
+    size_t n = proto_encode(PROTO_BINARY, op, payload, len, msg, sizeof(msg));
+    return send_all(sockfd, msg, n);
+}
+
+static int send_all(int sockfd, const uint8_t *buf, size_t n)
+{
+    UdpLink *u = udp_of(sockfd);
+    if (u)
+    {
+        return udp_send(sockfd, u, buf, n);
+    }
+    TlsConn *t = tls_of(sockfd);
+    size_t sent = 0;
+    while (sent < n)
+    {
+        ssize_t w = t ? tls_send(t, buf + sent, n - sent)
+                      : send(sockfd, buf + sent, n - sent, MSG_NOSIGNAL);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("send");
+            return -1;
+        }
+        sent += w;
+    }
+    return 0;
+}
+
+/*
+ * udp_connect:
+ *   A connected UDP socket and a new link with a random connection id.
+ *   A probe makes sure something answers at host:port and fetches the
+ *   server's cookie (see udp_probe); the JOIN, echoing it, then opens the
+ *   connection.
+ */
+static int udp_connect(const char *host, int port)
+{
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (grow_fds(sockfd) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &srv.sin_addr) <= 0)
+    {
+        perror("inet_pton");
+        close(sockfd);
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
+    {
+        perror("connect");
+        close(sockfd);
+        return -1;
+    }
+
+    UdpLink *u = calloc(1, sizeof(*u));
+    if (!u)
+    {
+        perror("calloc");
+        close(sockfd);
+        return -1;
+    }
+    while (u->id == 0)
+    {
+        if (getrandom(&u->id, sizeof(u->id), 0) != sizeof(u->id))
+        {
+            u->id = (uint32_t)reactor_now_ms() ^ (uint32_t)getpid() << 16;
+        }
+    }
+    u->next_seq = 1;
+    udp_rtt_init(&u->rtt);
+    u->heard_ms = reactor_now_ms();
+    net_fds[sockfd].udp = u;
+    if (udp_probe(sockfd) < 0)
+    {
+        net_close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static UdpLink *udp_of(int sockfd)
+{
+    return (sockfd >= 0 && sockfd < net_nfds) ? net_fds[sockfd].udp : NULL;
+}
+
+/*
+ * udp_probe:
+ *   Ping with a connection id the server does not know yet; it answers
+ *   UDP_CLOSE with a cookie. Like a TCP connect: fails when the port is
+ *   closed (ICMP) or nothing answers within NET_CONNECT_TIMEOUT_MS.
+ */
+static int udp_probe(int sockfd)
+{
+    UdpLink *u = udp_of(sockfd);
+    long long deadline = reactor_now_ms() + NET_CONNECT_TIMEOUT_MS;
+    int wait = UDP_RTO_INITIAL_MS;
+
+    while (1)
+    {
+        if (udp_transmit(sockfd, u, UDP_PING, 0, NULL, 0) < 0)
+        {
+            return -1;
+        }
+        long long left = deadline - reactor_now_ms();
+        struct pollfd pfd = {sockfd, POLLIN, 0};
+        int ret = poll(&pfd, 1, left < wait ? (int)left : wait);
+        if (ret > 0)
+        {
+            uint8_t dgram[UDP_MTU];
+            UdpHeader h;
+            ssize_t n = recv(sockfd, dgram, sizeof(dgram), MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                perror("connect");
+                return -1;
+            }
+            if (n > 0 && udp_read_header(dgram, (size_t)n, &h) == 0 && h.conn == u->id)
+            {
+                u->heard_ms = reactor_now_ms();
+                udp_take_cookie(u, &h, dgram, (size_t)n);
+                return 0;
+            }
+        }
+        if (reactor_now_ms() >= deadline)
+        {
+            fprintf(stderr, "connect: timed out\n");
+            return -1;
+        }
+        wait = (wait * 2 < UDP_RTO_MAX_MS) ? wait * 2 : UDP_RTO_MAX_MS;
+    }
+}
+
+/* udp_send: one datagram carrying buf; tracked for retransmission if it matters. */
+static int udp_send(int sockfd, UdpLink *u, const uint8_t *buf, size_t n)
+{
+    if (n > UDP_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "send: %zu bytes do not fit in a datagram\n", n);
+        return -1;
+    }
+    int reliable = udp_payload_reliable(buf, n);
+    if (reliable)
+    {
+        for (int i = 0; i < UDP_WINDOW; i++)
+        {
+            if (u->flight[i].seq && u->next_seq - u->flight[i].seq >= UDP_WINDOW)
+            {
+                fprintf(stderr, "send: %d datagrams unacknowledged\n", u->in_flight);
+                return -1;
+            }
+        }
+    }
+
+    uint32_t seq = u->next_seq++;
+    if (reliable)
+    {
+        UdpFlight *f = &u->flight[seq % UDP_WINDOW];
+        f->seq = seq;
+        f->tries = 1;
+        f->sent_ms = reactor_now_ms();
+        f->len = n;
+        memcpy(f->data, buf, n);
+        u->in_flight++;
+    }
+    return udp_transmit(sockfd, u, reliable ? UDP_RELIABLE : 0, seq, buf, n);
+}
+
+/*
+ * udp_transmit:
+ *   Send one datagram, acking everything received so far. Until the
+ *   connection is open it echoes the server's cookie (zeros at first).
+ */
+static int udp_transmit(int sockfd, UdpLink *u, uint8_t flags, uint32_t seq,
+                        const uint8_t *payload, size_t n)
+{
+    uint8_t dgram[UDP_MTU];
+    size_t start = UDP_HEADER_SIZE;
+    UdpHeader h = {flags, u->id, seq, 0, 0};
+    if (!u->open && !(flags & UDP_CLOSE))
+    {
+        h.flags |= seq != 0 ? UDP_COOKIE | UDP_OPEN : UDP_COOKIE;
+        memcpy(dgram + start, u->cookie, UDP_COOKIE_SIZE);
+        start += UDP_COOKIE_SIZE;
+    }
+    udp_window_ack(&u->rx, &h);
+    udp_write_header(dgram, &h);
+    if (n > 0)
+    {
+        memcpy(dgram + start, payload, n);
+    }
+    u->sent_ms = reactor_now_ms();
+    while (send(sockfd, dgram, start + n, MSG_NOSIGNAL) < 0)
+    {
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno == ENOBUFS || errno == EAGAIN)
+        {
+            return 0; // lost at our end; retransmitted like any loss
+        }
+        perror("send");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * udp_recv:
+ *   Read one datagram: take its acks, ack it back if it is reliable, and
+ *   copy out its frames if they are new. A datagram that would not fit in
+ *   buf is neither read into it nor acked, so the server sends it again.
+ */
+static ssize_t udp_recv(int sockfd, UdpLink *u, void *buf, size_t len)
+{
+    uint8_t dgram[UDP_MTU];
+    ssize_t n;
+    do
+    {
+        n = recv(sockfd, dgram, sizeof(dgram), MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        return -1;
+    }
+
+    UdpHeader h;
+    if (udp_read_header(dgram, (size_t)n, &h) < 0 || h.conn != u->id)
+    {
+        errno = EAGAIN; // not ours (e.g. a late probe answer)
+        return -1;
+    }
+    long long now = reactor_now_ms();
+    u->heard_ms = now;
+    udp_take_acks(u, &h, now);
+    if (h.flags & UDP_CLOSE)
+    {
+        if (!u->open)
+        {
+            udp_take_cookie(u, &h, dgram, (size_t)n); // our cookie went stale
+            errno = EAGAIN; // the probe's answer, or our JOIN is still on its way
+            return -1;
+        }
+        u->closed = 1;
+        return 0;
+    }
+    u->open = 1; // only known connections get anything but UDP_CLOSE
+
+    size_t plen = (size_t)n - UDP_HEADER_SIZE;
+    if (plen > len)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    int fresh = udp_window_mark(&u->rx, h.seq);
+    if ((h.flags & (UDP_RELIABLE | UDP_PING)) &&
+        udp_transmit(sockfd, u, 0, 0, NULL, 0) < 0) // duplicates too: our ack got lost
+    {
+        return -1;
+    }
+    if (!fresh || plen == 0)
+    {
+        errno = EAGAIN; // ack, keepalive answer or duplicate
+        return -1;
+    }
+    memcpy(buf, dgram + UDP_HEADER_SIZE, plen);
+    return (ssize_t)plen;
+}
+
+/* udp_take_acks: retire every flight h acknowledges. */
+static void udp_take_acks(UdpLink *u, const UdpHeader *h, long long now)
+{
+    for (int i = 0; i < UDP_WINDOW && u->in_flight > 0; i++)
+    {
+        UdpFlight *f = &u->flight[i];
+        if (f->seq && udp_acked(h, f->seq))
+        {
+            if (f->tries == 1)
+            {
+                udp_rtt_sample(&u->rtt, now - f->sent_ms);
+            }
+            f->seq = 0;
+            u->in_flight--;
+        }
+    }
+}
+
+/* udp_take_cookie: keep the cookie a server's UDP_CLOSE carries, if any. */
+static void udp_take_cookie(UdpLink *u, const UdpHeader *h, const uint8_t *dgram, size_t n)
+{
+    if ((h->flags & UDP_COOKIE) && n >= UDP_HEADER_SIZE + UDP_COOKIE_SIZE)
+    {
+        memcpy(u->cookie, dgram + UDP_HEADER_SIZE, UDP_COOKIE_SIZE);
+    }
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * net.h
+ *
+ * Client-side socket helpers shared by spock_client and spock_bench.
+ *
+ *   - connect_to_server() bounds the TCP handshake by NET_CONNECT_TIMEOUT_MS
+ *     and returns a blocking socket.
+ *   - send_join(), send_watch() and send_frame() speak the framed protocol of proto.h.
+ *   - After net_use_tls(), connect_to_server() also runs the TLS handshake
+ *     (bounded by the same timeout); read with net_recv() and close with
+ *     net_close() so the TLS state goes too.
+ *   - TCP connections get the socket profile from net_use_profile(), by
+ *     default sockopt_default() (Nagle off, quick ACKs, keepalive).
+ *   - After net_use_udp(), connections use UDP instead (see udp.h); they
+ *     speak framed messages from the start, and need net_tick() whenever
+ *     net_timeout_ms() runs out.
+ *   - TLS and UDP connections keep per-descriptor state that is not locked:
+ *     open and use them from one thread.
+ *   - Errors are reported with perror()/stderr and a -1 return.
+ ******************************************************************************/
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sockopt.h"
+
+#define NET_CONNECT_TIMEOUT_MS 3000
+
+/* connect_to_server: TCP connection to host:port (dotted IPv4), or -1. */
+int connect_to_server(const char *host, int port);
+
+/*
+ * net_use_tls:
+ *   Speak TLS on every later connection, trusting the CAs in ca_file (NULL =
+ *   the system's). Reconnects resume the previous session. Returns 0 or -1.
+ */
+int net_use_tls(const char *ca_file);
+
+/*
+ * net_recv:
+ *   recv() on a connection from connect_to_server(). Over UDP this reads
+ *   one datagram, and fails with EAGAIN when it held nothing new (an ack,
+ *   a keepalive or a duplicate).
+ */
+ssize_t net_recv(int sockfd, void *buf, size_t len);
+
+/* net_pending: bytes already read and decrypted, which select() won't report. */
+int net_pending(int sockfd);
+
+/* net_describe: e.g. "TLSv1.3 TLS_AES_256_GCM_SHA384, resumed", or NULL. */
+const char *net_describe(int sockfd, char *buf, size_t size);
+
+/* net_close: over UDP, first waits up to a second for unacked messages. */
+void net_close(int sockfd);
+
+/* net_use_profile: TCP options for later connections; p must stay valid. */
+void net_use_profile(const SockProfile *p);
+
+/* net_use_udp: connect_to_server() opens UDP connections from now on. */
+void net_use_udp(void);
+
+/* net_udp: whether sockfd is a UDP connection (framed without PROTO_MAGIC). */
+int net_udp(int sockfd);
+
+/* net_timeout_ms: how long until net_tick() is due, or -1 for never (TCP). */
+int net_timeout_ms(int sockfd);
+
+/*
+ * net_tick:
+ *   Retransmit what the server hasn't acked and send keepalives. Returns
+ *   -1 when the connection is lost (silent server, retries used up).
+ */
+int net_tick(int sockfd);
+
+/*
+ * send_join:
+ *   Open the framed protocol and ask for a seat in one write: PROTO_MAGIC
+ *   followed by JOIN, carrying the session token if token is not empty.
+ */
+int send_join(int sockfd, const char *token);
+
+/*
+ * send_watch:
+ *   Open the framed protocol on a server's watch port and ask to watch a
+ *   table ("" = the one that started last). TCP only.
+ */
+int send_watch(int sockfd, const char *table);
+
+/* send_frame: encode one framed message and send all of it. Returns 0 or -1. */
+int send_frame(int sockfd, uint8_t op, const void *payload, size_t len);
+
+#endif /* NET_H */
@@ -0,0 +1,178 @@
+/******************************************************************************
+ * outbuf.c
+ *
+ * Buffer pool, reference counting and writev() flushing.
+ ******************************************************************************/
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+void outpool_init(OutPool *p)
+{
+    p->free_list = NULL;
+    p->allocated = 0;
+    p->free_count = 0;
+}
+
+void outpool_destroy(OutPool *p)
+{
+    while (p->free_list)
+    {
+        OutBuf *b = p->free_list;
+        p->free_list = b->next_free;
+        free(b);
+    }
+    p->allocated -= p->free_count;
+    p->free_count = 0;
+}
+
+OutBuf *outbuf_get(OutPool *p)
+{
+    OutBuf *b = p->free_list;
+    if (b)
+    {
+        p->free_list = b->next_free;
+        p->free_count--;
+    }
+    else
+    {
+        b = malloc(sizeof(*b));
+        if (!b)
+        {
+            return NULL;
+        }
+        b->pool = p;
+        p->allocated++;
+    }
+    b->refs = 1;
+    b->start = 0;
+    b->end = 0;
+    b->next_free = NULL;
+    return b;
+}
+
+void outbuf_ref(OutBuf *b)
+{
+    b->refs++;
+}
+
+void outbuf_unref(OutBuf *b)
+{
+    if (--b->refs > 0)
+    {
+        return;
+    }
+    OutPool *p = b->pool;
+    b->next_free = p->free_list;
+    p->free_list = b;
+    p->free_count++;
+}
+
+void outq_init(OutQueue *q)
+{
+    q->head = 0;
+    q->count = 0;
+}
+
+int outq_push(OutQueue *q, OutBuf *b)
+{
+    if (q->count == OUTQ_LEN)
+    {
+        return -1;
+    }
+    OutRef *r = &q->refs[(q->head + q->count) % OUTQ_LEN];
+    r->buf = b;
+    r->off = 0;
+    outbuf_ref(b);
+    q->count++;
+    return 0;
+}
+
+/* send_socket: the default outq_sendv, a plain socket */
+static ssize_t send_socket(void *arg, const struct iovec *iov, int iovcnt)
+{
+    /* sendmsg() rather than writev() so a dead peer can't raise SIGPIPE */
+    struct msghdr msg = {0};
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(*(int *)arg, &msg, MSG_NOSIGNAL);
+}
+
+int outq_flush(OutQueue *q, int fd, size_t *written)
+{
+    return outq_flush_via(q, send_socket, &fd, written);
+}
+
+int outq_flush_via(OutQueue *q, outq_sendv send, void *arg, size_t *written)
+{
+    while (q->count > 0)
+    {
+        struct iovec iov[OUTQ_LEN];
+        int n = 0;
+        for (int i = 0; i < q->count; i++)
+        {
+            OutRef *r = &q->refs[(q->head + i) % OUTQ_LEN];
+            iov[n].iov_base = r->buf->data + r->buf->start + r->off;
+            iov[n].iov_len = outbuf_len(r->buf) - r->off;
+            n++;
+        }
+
+        ssize_t w = send(arg, iov, n);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        if (written)
+        {
+            *written += (size_t)w;
+        }
+
+        /* retire fully written buffers; remember where a partial one stopped */
+        size_t left = (size_t)w;
+        while (q->count > 0 && left > 0)
+        {
+            OutRef *r = &q->refs[q->head];
+            size_t remain = outbuf_len(r->buf) - r->off;
+            if (left < remain)
+            {
+                r->off += left;
+                return 0; // short write: the socket is full
+            }
+            left -= remain;
+            outbuf_unref(r->buf);
+            q->head = (q->head + 1) % OUTQ_LEN;
+            q->count--;
+        }
+    }
+    return 1;
+}
+
+OutBuf *outq_pop(OutQueue *q)
+{
+    if (q->count == 0)
+    {
+        return NULL;
+    }
+    OutBuf *b = q->refs[q->head].buf;
+    q->head = (q->head + 1) % OUTQ_LEN;
+    q->count--;
+    return b;
+}
+
+void outq_clear(OutQueue *q)
+{
+    while (q->count > 0)
+    {
+        outbuf_unref(q->refs[q->head].buf);
+        q->head = (q->head + 1) % OUTQ_LEN;
+        q->count--;
+    }
+}
@@ -0,0 +1,108 @@
+/******************************************************************************
+ * outbuf.h
+ *
+ * Reference-counted output buffers and per-connection output queues.
+ *
+ *   - A message is serialized once into an OutBuf; every recipient queues
+ *     a reference to it instead of its own copy, so a broadcast is one
+ *     encode plus N cheap enqueues.
+ *   - Released buffers go back to their OutPool's free list and are reused,
+ *     so the steady state does no malloc/free.
+ *   - An OutQueue is flushed with writev(); partial writes resume from the
+ *     same offset, and EAGAIN simply leaves the rest queued.
+ *   - Pools are single-threaded: use one per event-loop thread.
+ ******************************************************************************/
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define OUTBUF_SIZE 1024
+#define OUTQ_LEN 32 /* pending messages per connection before it is "slow" */
+
+typedef struct outpool OutPool;
+
+typedef struct outbuf
+{
+    uint32_t refs;
+    uint32_t start; /* first byte of the message in data[] */
+    uint32_t end;   /* one past the last byte */
+    OutPool *pool;
+    struct outbuf *next_free;
+    uint8_t data[OUTBUF_SIZE];
+} OutBuf;
+
+struct outpool
+{
+    OutBuf *free_list;
+    int allocated;
+    int free_count;
+};
+
+typedef struct
+{
+    OutBuf *buf;
+    uint32_t off; /* bytes of buf already written */
+} OutRef;
+
+typedef struct
+{
+    OutRef refs[OUTQ_LEN];
+    uint8_t head;
+    uint8_t count;
+} OutQueue;
+
+void outpool_init(OutPool *p);
+void outpool_destroy(OutPool *p);
+
+/* outbuf_get: an empty buffer holding one reference. NULL if out of memory. */
+OutBuf *outbuf_get(OutPool *p);
+void outbuf_ref(OutBuf *b);
+void outbuf_unref(OutBuf *b);
+
+static inline size_t outbuf_len(const OutBuf *b)
+{
+    return b->end - b->start;
+}
+
+void outq_init(OutQueue *q);
+
+/* outq_push: queue a reference to b. Returns -1 if the queue is full. */
+int outq_push(OutQueue *q, OutBuf *b);
+
+/*
+ * outq_flush:
+ *   writev() as much as the socket takes, adding the bytes written to
+ *   *written (if not NULL). Returns 1 when the queue is empty, 0 if data
+ *   is still pending (socket full), -1 on a write error.
+ */
+int outq_flush(OutQueue *q, int fd, size_t *written);
+
+/*
+ * outq_flush_via:
+ *   The same, writing through send (e.g. a TLS layer), which behaves like
+ *   sendmsg(): bytes taken, or -1 with errno EAGAIN when it would block.
+ */
+typedef ssize_t (*outq_sendv)(void *arg, const struct iovec *iov, int iovcnt);
+int outq_flush_via(OutQueue *q, outq_sendv send, void *arg, size_t *written);
+
+/*
+ * outq_pop:
+ *   Take the oldest message off q, passing its reference to the caller
+ *   (NULL if q is empty). For transports that send whole messages, never
+ *   part of one; don't mix with a partially flushed queue.
+ */
+OutBuf *outq_pop(OutQueue *q);
+
+/* outq_clear: drop everything still queued. */
+void outq_clear(OutQueue *q);
+
+static inline int outq_empty(const OutQueue *q)
+{
+    return q->count == 0;
+}
+
+#endif /* OUTBUF_H */
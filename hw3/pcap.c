@@ -0,0 +1,420 @@
+/******************************************************************************
+ * pcap.c
+ *
+ * pcap and pcapng readers and the packet decoder (see pcap.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap.h"
+
+#define PCAP_MAGIC_US 0xa1b2c3d4u
+#define PCAP_MAGIC_NS 0xa1b23c4du
+#define PCAPNG_SHB 0x0a0d0d0au
+#define PCAPNG_IDB 1u
+#define PCAPNG_PB 2u  /* obsolete packet block */
+#define PCAPNG_SPB 3u
+#define PCAPNG_EPB 6u
+#define PCAPNG_BOM 0x1a2b3c4du
+#define PCAPNG_OPT_TSRESOL 9
+
+/* link-layer header types (tcpdump.org/linktypes.html) */
+#define LINK_NULL 0
+#define LINK_ETHERNET 1
+#define LINK_RAW 101
+#define LINK_LOOP 108
+#define LINK_SLL 113
+#define LINK_IPV4 228
+#define LINK_IPV6 229
+#define LINK_SLL2 276
+
+static uint16_t get16(const PcapReader *r, const uint8_t *p);
+static uint32_t get32(const PcapReader *r, const uint8_t *p);
+static uint16_t be16(const uint8_t *p);
+static uint32_t be32(const uint8_t *p);
+static int ng_section(PcapReader *r, const uint8_t *b, uint32_t len);
+static void ng_iface(PcapReader *r, const uint8_t *b, uint32_t len);
+static long long ng_time(const PcapIface *ifc, uint64_t ts);
+static void release_read(PcapReader *r);
+static int decode_ip(const uint8_t *p, uint32_t caplen, int version, PcapTcp *seg);
+
+int pcap_open(PcapReader *r, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 24)
+    {
+        fprintf(stderr, "%s: too short for a capture.\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    r->map = map;
+    r->size = (size_t)st.st_size;
+
+    uint32_t magic;
+    memcpy(&magic, r->map, 4);
+    if (magic == PCAPNG_SHB)
+    {
+        r->ng = 1; // pcap_next reads the section header like any block
+        return 0;
+    }
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+    {
+        r->nanos = magic == PCAP_MAGIC_NS;
+    }
+    else if (magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS))
+    {
+        r->swapped = 1;
+        r->nanos = magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    }
+    else
+    {
+        fprintf(stderr, "%s: not a pcap or pcapng capture.\n", path);
+        pcap_close(r);
+        return -1;
+    }
+    r->linktype = (uint16_t)get32(r, r->map + 20);
+    r->pos = 24;
+    return 0;
+}
+
+int pcap_next(PcapReader *r, PcapPacket *p)
+{
+    release_read(r);
+    if (!r->ng)
+    {
+        if (r->size - r->pos < 16)
+        {
+            return r->pos == r->size ? 0 : -1;
+        }
+        const uint8_t *h = r->map + r->pos;
+        uint32_t caplen = get32(r, h + 8);
+        if (caplen > r->size - r->pos - 16)
+        {
+            return -1;
+        }
+        p->ts_us = (long long)get32(r, h) * 1000000 +
+                   (r->nanos ? get32(r, h + 4) / 1000 : get32(r, h + 4));
+        p->linktype = r->linktype;
+        p->data = h + 16;
+        p->caplen = caplen;
+        p->len = get32(r, h + 12);
+        r->pos += 16 + caplen;
+        return 1;
+    }
+
+    while (r->size - r->pos >= 12)
+    {
+        const uint8_t *b = r->map + r->pos;
+        uint32_t type = get32(r, b);
+        if (type == PCAPNG_SHB && ng_section(r, b, (uint32_t)(r->size - r->pos)) < 0)
+        {
+            return -1;
+        }
+        uint32_t len = get32(r, b + 4);
+        if (len < 12 || len % 4 != 0 || len > r->size - r->pos)
+        {
+            return -1;
+        }
+        r->pos += len;
+
+        const uint8_t *body = b + 8;
+        uint32_t body_len = len - 12;
+        uint32_t iface = 0, caplen, hdr;
+        uint64_t ts = 0;
+        switch (type)
+        {
+        case PCAPNG_IDB:
+            ng_iface(r, body, body_len);
+            continue;
+        case PCAPNG_EPB:
+        case PCAPNG_PB:
+            if (body_len < 20)
+                return -1;
+            if (type == PCAPNG_EPB)
+                iface = get32(r, body);
+            else
+                iface = get16(r, body);
+            ts = (uint64_t)get32(r, body + 4) << 32 | get32(r, body + 8);
+            caplen = get32(r, body + 12);
+            p->len = get32(r, body + 16);
+            hdr = 20;
+            break;
+        case PCAPNG_SPB:
+            if (body_len < 4)
+                return -1;
+            p->len = get32(r, body);
+            caplen = p->len < body_len - 4 ? p->len : body_len - 4;
+            hdr = 4;
+            break;
+        default:
+            continue; // name resolution, statistics, custom...
+        }
+        if ((int)iface >= r->nifaces || caplen > body_len - hdr)
+        {
+            return -1;
+        }
+        const PcapIface *ifc = &r->ifaces[iface];
+        p->ts_us = type == PCAPNG_SPB ? r->last_us : ng_time(ifc, ts); // simple blocks carry no time
+        r->last_us = p->ts_us;
+        p->linktype = ifc->linktype;
+        p->data = body + hdr;
+        p->caplen = caplen;
+        return 1;
+    }
+    return r->pos == r->size ? 0 : -1;
+}
+
+void pcap_close(PcapReader *r)
+{
+    if (r->map)
+    {
+        munmap((void *)r->map, r->size);
+    }
+    memset(r, 0, sizeof(*r));
+}
+
+int pcap_tcp(const PcapPacket *p, PcapTcp *seg)
+{
+    const uint8_t *d = p->data;
+    uint32_t n = p->caplen;
+    uint16_t ethertype;
+    int version = 0;
+
+    memset(seg, 0, sizeof(*seg));
+    switch (p->linktype)
+    {
+    case LINK_ETHERNET:
+        if (n < 14)
+            return -1;
+        ethertype = be16(d + 12);
+        d += 14;
+        n -= 14;
+        while ((ethertype == 0x8100 || ethertype == 0x88a8) && n >= 4)
+        {
+            ethertype = be16(d + 2); // VLAN tag
+            d += 4;
+            n -= 4;
+        }
+        version = ethertype == 0x0800 ? 4 : ethertype == 0x86dd ? 6 : 0;
+        break;
+    case LINK_SLL:
+        if (n < 16)
+            return -1;
+        ethertype = be16(d + 14);
+        version = ethertype == 0x0800 ? 4 : ethertype == 0x86dd ? 6 : 0;
+        d += 16;
+        n -= 16;
+        break;
+    case LINK_SLL2:
+        if (n < 20)
+            return -1;
+        ethertype = be16(d);
+        version = ethertype == 0x0800 ? 4 : ethertype == 0x86dd ? 6 : 0;
+        d += 20;
+        n -= 20;
+        break;
+    case LINK_NULL:
+    case LINK_LOOP:
+    {
+        if (n < 4)
+            return -1;
+        uint32_t family;
+        memcpy(&family, d, 4);
+        if (p->linktype == LINK_LOOP)
+            family = be32(d);
+        else if (family > 0xffff)
+            family = __builtin_bswap32(family); // written on a host of the other byte order
+        version = family == 2 ? 4 : (family == 24 || family == 28 || family == 30) ? 6 : 0;
+        d += 4;
+        n -= 4;
+        break;
+    }
+    case LINK_RAW:
+    case LINK_IPV4:
+    case LINK_IPV6:
+        version = n > 0 ? d[0] >> 4 : 0;
+        break;
+    default:
+        return -1;
+    }
+    return (version == 4 || version == 6) ? decode_ip(d, n, version, seg) : -1;
+}
+
+/* decode_ip: the TCP segment in the IP packet p (caplen bytes captured). */
+static int decode_ip(const uint8_t *p, uint32_t caplen, int version, PcapTcp *seg)
+{
+    uint32_t hlen, total;
+    uint8_t proto;
+
+    if (version == 4)
+    {
+        if (caplen < 20 || (p[0] >> 4) != 4 || (hlen = (p[0] & 0x0f) * 4u) < 20 || hlen > caplen)
+            return -1;
+        if (be16(p + 6) & 0x1fff)
+            return -1; // a later fragment: no TCP header
+        total = be16(p + 2);
+        proto = p[9];
+        seg->family = 4;
+        memcpy(seg->src, p + 12, 4);
+        memcpy(seg->dst, p + 16, 4);
+    }
+    else
+    {
+        if (caplen < 40 || (p[0] >> 4) != 6)
+            return -1;
+        hlen = 40;
+        total = 40 + be16(p + 4);
+        proto = p[6];
+        seg->family = 6;
+        memcpy(seg->src, p + 8, 16);
+        memcpy(seg->dst, p + 24, 16);
+        // hop-by-hop, routing, fragment and destination options headers
+        while ((proto == 0 || proto == 43 || proto == 44 || proto == 60) && hlen + 8 <= caplen)
+        {
+            if (proto == 44 && (be16(p + hlen + 2) & 0xfff8))
+                return -1; // not the first fragment
+            uint32_t ext = proto == 44 ? 8 : (p[hlen + 1] + 1u) * 8;
+            proto = p[hlen];
+            hlen += ext;
+        }
+    }
+    if (proto != 6 || hlen + 20 > caplen || total < hlen + 20)
+    {
+        return -1;
+    }
+    const uint8_t *t = p + hlen;
+    uint32_t thlen = (t[12] >> 4) * 4u;
+    if (thlen < 20 || hlen + thlen > total)
+    {
+        return -1;
+    }
+    seg->sport = be16(t);
+    seg->dport = be16(t + 2);
+    seg->seq = be32(t + 4);
+    seg->ack = be32(t + 8);
+    seg->flags = t[13];
+    seg->len = total - hlen - thlen; // the IP length, not the capture: Ethernet pads short frames
+    seg->payload = t + thlen;
+    if (hlen + thlen > caplen || seg->len > caplen - hlen - thlen)
+    {
+        seg->truncated = 1;
+    }
+    return 0;
+}
+
+/* ng_section: a section header block; it sets the byte order of what follows. */
+static int ng_section(PcapReader *r, const uint8_t *b, uint32_t avail)
+{
+    uint32_t bom;
+    if (avail < 28)
+    {
+        return -1;
+    }
+    memcpy(&bom, b + 8, 4);
+    if (bom == PCAPNG_BOM)
+        r->swapped = 0;
+    else if (bom == __builtin_bswap32(PCAPNG_BOM))
+        r->swapped = 1;
+    else
+        return -1;
+    r->nifaces = 0; // interface ids are per section
+    return 0;
+}
+
+/* ng_iface: an interface description block: link type and timestamp resolution. */
+static void ng_iface(PcapReader *r, const uint8_t *b, uint32_t len)
+{
+    if (len < 8 || r->nifaces == PCAP_MAX_IFACES)
+    {
+        return;
+    }
+    PcapIface *ifc = &r->ifaces[r->nifaces++];
+    ifc->linktype = get16(r, b);
+    ifc->tsresol = 6;
+    for (uint32_t off = 8; off + 4 <= len;)
+    {
+        uint16_t code = get16(r, b + off);
+        uint16_t olen = get16(r, b + off + 2);
+        if (code == 0 || off + 4 + olen > len)
+            break;
+        if (code == PCAPNG_OPT_TSRESOL && olen >= 1)
+            ifc->tsresol = b[off + 4];
+        off += 4 + ((olen + 3u) & ~3u);
+    }
+}
+
+/* ng_time: an interface's timestamp in microseconds. */
+static long long ng_time(const PcapIface *ifc, uint64_t ts)
+{
+    uint8_t res = ifc->tsresol;
+    if (res & 0x80)
+    {
+        return (long long)(((unsigned __int128)ts * 1000000) >> (res & 0x7f));
+    }
+    for (; res > 6; res--)
+    {
+        ts /= 10;
+    }
+    for (; res < 6; res++)
+    {
+        ts *= 10;
+    }
+    return (long long)ts;
+}
+
+/* release_read: give back the pages behind the reader, PCAP_DROP_BYTES at a time. */
+static void release_read(PcapReader *r)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (r->pos - r->dropped < PCAP_DROP_BYTES)
+    {
+        return;
+    }
+    size_t upto = r->pos / page * page;
+    madvise((void *)(r->map + r->dropped), upto - r->dropped, MADV_DONTNEED);
+    r->dropped = upto;
+}
+
+static uint16_t get16(const PcapReader *r, const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return r->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t get32(const PcapReader *r, const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return r->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ * pcap.h
+ *
+ * Reading packet captures (tcpdump's pcap and Wireshark's pcapng) for
+ * spock_replay.
+ *
+ *   - The file is memory-mapped and read front to back: pcap_next() hands
+ *     out each packet in place, without copying, and the pages already
+ *     read are dropped every PCAP_DROP_BYTES so a capture of any size
+ *     stays cheap to scan.
+ *   - Either byte order; classic pcap in micro- or nanoseconds, pcapng
+ *     with several sections, interfaces and timestamp resolutions
+ *     (enhanced, simple and obsolete packet blocks). Timestamps come out
+ *     in microseconds.
+ *   - pcap_tcp() decodes a packet down to its TCP segment: Ethernet (with
+ *     VLAN tags), Linux cooked (SLL and SLL2), BSD loopback or raw IP
+ *     links; IPv4 (first fragments only) or IPv6.
+ ******************************************************************************/
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAP_MAX_IFACES 64
+#define PCAP_DROP_BYTES (64u << 20) /* read pages released this often */
+
+#define PCAP_TCP_FIN 0x01
+#define PCAP_TCP_SYN 0x02
+#define PCAP_TCP_RST 0x04
+#define PCAP_TCP_ACK 0x10
+
+typedef struct
+{
+    uint16_t linktype;
+    uint8_t tsresol; /* 10^-n seconds, or 2^-(n & 0x7f) with the top bit set */
+} PcapIface;
+
+typedef struct
+{
+    const uint8_t *map;
+    size_t size;
+    size_t pos;      /* next block or record */
+    size_t dropped;  /* pages released below this offset */
+    int ng;          /* pcapng */
+    int swapped;     /* the file's byte order is not ours */
+    int nanos;       /* classic pcap with nanosecond timestamps */
+    uint16_t linktype; /* classic pcap */
+    PcapIface ifaces[PCAP_MAX_IFACES]; /* pcapng: this section's */
+    int nifaces;
+    long long last_us; /* the latest timestamp, for blocks without one */
+} PcapReader;
+
+typedef struct
+{
+    long long ts_us;
+    uint16_t linktype;
+    const uint8_t *data;
+    uint32_t caplen; /* bytes in data */
+    uint32_t len;    /* bytes on the wire */
+} PcapPacket;
+
+typedef struct
+{
+    uint8_t family;  /* 4 or 6 */
+    uint8_t src[16]; /* IPv4 addresses in the first four bytes */
+    uint8_t dst[16];
+    uint16_t sport, dport;
+    uint32_t seq, ack;
+    uint8_t flags;   /* PCAP_TCP_* */
+    const uint8_t *payload;
+    uint32_t len;
+    int truncated;   /* the capture lost part of the payload (len is what was sent) */
+} PcapTcp;
+
+/* pcap_open: map the capture at path and read its header. Returns 0 or -1. */
+int pcap_open(PcapReader *r, const char *path);
+
+/* pcap_next: the next packet. Returns 1, 0 at the end, or -1 if the file is malformed. */
+int pcap_next(PcapReader *r, PcapPacket *p);
+
+/* pcap_tcp: decode p's TCP segment. Returns 0, or -1 if it is not TCP over IP. */
+int pcap_tcp(const PcapPacket *p, PcapTcp *seg);
+
+void pcap_close(PcapReader *r);
+
+#endif /* PCAP_H */
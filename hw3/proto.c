@@ -0,0 +1,288 @@
+/******************************************************************************
+ * proto.c
+ *
+ * Incremental frame parser and encoder for the spock wire protocol.
+ ******************************************************************************/
+#include <string.h>
+
+#include "proto.h"
+
+/* Legacy text commands and the frames they map to */
+typedef struct
+{
+    const char *text;
+    size_t len;
+    uint8_t op;
+} TextCommand;
+
+static const TextCommand text_commands[] = {
+    {"MOVE:", 5, PROTO_OP_MOVE},
+    {"QUIT", 4, PROTO_OP_QUIT},
+    {"RESET", 5, PROTO_OP_RESET},
+    {"RESULT:", 7, PROTO_OP_RESULT},
+    {"INFO:", 5, PROTO_OP_INFO},
+};
+#define NUM_TEXT_COMMANDS (sizeof(text_commands) / sizeof(text_commands[0]))
+
+static int next_binary(ProtoParser *p, ProtoFrame *f);
+static int next_text(ProtoParser *p, ProtoFrame *f);
+
+void proto_parser_init(ProtoParser *p)
+{
+    p->mode = PROTO_TEXT;
+    p->start = 0;
+    p->end = 0;
+}
+
+uint8_t *proto_parser_space(ProtoParser *p, size_t *avail)
+{
+    /* move a partial frame (if any) to the front of the buffer */
+    if (p->start > 0)
+    {
+        memmove(p->buf, p->buf + p->start, p->end - p->start);
+        p->end -= p->start;
+        p->start = 0;
+    }
+    *avail = PROTO_BUF_SIZE - p->end;
+    return p->buf + p->end;
+}
+
+void proto_parser_commit(ProtoParser *p, size_t n)
+{
+    p->end += n;
+}
+
+int proto_next(ProtoParser *p, ProtoFrame *f)
+{
+    if (p->mode == PROTO_BINARY)
+    {
+        return next_binary(p, f);
+    }
+    return next_text(p, f);
+}
+
+static int next_binary(ProtoParser *p, ProtoFrame *f)
+{
+    const uint8_t *b = p->buf + p->start;
+    size_t avail = p->end - p->start;
+    if (avail < 2)
+    {
+        return 0;
+    }
+
+    /* opcode, then LEB128 length */
+    uint32_t len = 0;
+    size_t pos = 1;
+    int shift = 0;
+    while (1)
+    {
+        if (pos >= avail)
+        {
+            return 0;
+        }
+        uint8_t byte = b[pos++];
+        len |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+        shift += 7;
+        if (pos >= PROTO_MAX_HEADER)
+        {
+            return -1; // varint too long
+        }
+    }
+    if (len > PROTO_MAX_PAYLOAD)
+    {
+        return -1;
+    }
+    if (avail - pos < len)
+    {
+        return 0;
+    }
+
+    f->op = b[0];
+    f->len = len;
+    f->payload = b + pos;
+    p->start += pos + len;
+    return 1;
+}
+
+/* text_payload_end: a legacy RESULT/INFO runs until the next command. */
+static size_t text_payload_end(const uint8_t *b, size_t from, size_t avail)
+{
+    for (size_t i = from; i < avail; i++)
+    {
+        if (b[i] == PROTO_MAGIC)
+        {
+            return i;
+        }
+        for (size_t k = 0; k < NUM_TEXT_COMMANDS; k++)
+        {
+            const TextCommand *tc = &text_commands[k];
+            if (avail - i >= tc->len && memcmp(b + i, tc->text, tc->len) == 0)
+            {
+                return i;
+            }
+        }
+    }
+    return avail;
+}
+
+static int next_text(ProtoParser *p, ProtoFrame *f)
+{
+    /* skip separators (e.g. from a line-based tool like netcat) */
+    while (p->start < p->end &&
+           (p->buf[p->start] == '\n' || p->buf[p->start] == '\r' ||
+            p->buf[p->start] == ' ' || p->buf[p->start] == '\t'))
+    {
+        p->start++;
+    }
+
+    const uint8_t *b = p->buf + p->start;
+    size_t avail = p->end - p->start;
+    if (avail == 0)
+    {
+        return 0;
+    }
+
+    if (b[0] == PROTO_MAGIC)
+    {
+        p->start++;
+        p->mode = PROTO_BINARY;
+        f->op = PROTO_OP_HELLO;
+        f->len = 0;
+        f->payload = b + 1;
+        return 1;
+    }
+
+    for (size_t k = 0; k < NUM_TEXT_COMMANDS; k++)
+    {
+        const TextCommand *tc = &text_commands[k];
+        if (avail < tc->len)
+        {
+            if (memcmp(b, tc->text, avail) == 0)
+            {
+                return 0; // could still become this command
+            }
+            continue;
+        }
+        if (memcmp(b, tc->text, tc->len) != 0)
+        {
+            continue;
+        }
+
+        f->op = tc->op;
+        f->payload = b + tc->len;
+        if (tc->op == PROTO_OP_MOVE)
+        {
+            if (avail < tc->len + 1)
+            {
+                return 0;
+            }
+            f->len = 1;
+        }
+        else if (tc->op == PROTO_OP_RESULT || tc->op == PROTO_OP_INFO)
+        {
+            f->len = text_payload_end(b, tc->len, avail) - tc->len;
+        }
+        else
+        {
+            f->len = 0;
+        }
+        p->start += tc->len + f->len;
+        return 1;
+    }
+
+    /* not a command we know: hand it up as one UNKNOWN frame */
+    size_t end = text_payload_end(b, 1, avail);
+    f->op = PROTO_OP_UNKNOWN;
+    f->len = end;
+    f->payload = b;
+    p->start += end;
+    return 1;
+}
+
+size_t proto_put_varint(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static const char *text_prefix(uint8_t op)
+{
+    for (size_t k = 0; k < NUM_TEXT_COMMANDS; k++)
+    {
+        if (text_commands[k].op == op)
+        {
+            return text_commands[k].text;
+        }
+    }
+    return NULL;
+}
+
+size_t proto_header_size(ProtoMode mode, uint8_t op, size_t len)
+{
+    if (mode == PROTO_BINARY)
+    {
+        size_t n = 2;
+        for (uint32_t v = (uint32_t)len; v >= 0x80; v >>= 7)
+        {
+            n++;
+        }
+        return n;
+    }
+    const char *prefix = text_prefix(op);
+    return prefix ? strlen(prefix) : 0;
+}
+
+size_t proto_write_header(ProtoMode mode, uint8_t op, size_t len, uint8_t *out)
+{
+    if (mode == PROTO_BINARY)
+    {
+        out[0] = op;
+        return 1 + proto_put_varint(out + 1, (uint32_t)len);
+    }
+    const char *prefix = text_prefix(op);
+    if (!prefix)
+    {
+        return 0;
+    }
+    size_t plen = strlen(prefix);
+    memcpy(out, prefix, plen);
+    return plen;
+}
+
+size_t proto_encode(ProtoMode mode, uint8_t op, const void *payload, size_t len,
+                    uint8_t *out, size_t cap)
+{
+    if (op == PROTO_OP_HELLO)
+    {
+        if (cap < 1)
+            return 0;
+        out[0] = PROTO_MAGIC;
+        return 1;
+    }
+    if (mode == PROTO_BINARY && len > PROTO_MAX_PAYLOAD)
+    {
+        return 0;
+    }
+
+    size_t hlen = proto_header_size(mode, op, len);
+    if (hlen == 0 || cap < hlen + len)
+    {
+        return 0;
+    }
+    proto_write_header(mode, op, len, out);
+    if (len > 0)
+    {
+        memcpy(out + hlen, payload, len);
+    }
+    return hlen + len;
+}
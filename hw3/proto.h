@@ -0,0 +1,113 @@
+/******************************************************************************
+ * proto.h
+ *
+ * Wire protocol shared by spock_server and spock_client.
+ *
+ * Binary (framed) protocol:
+ *   - A connection opts in by sending the negotiation byte PROTO_MAGIC
+ *     first; the server answers with PROTO_MAGIC and both sides then send
+ *     frames:  [opcode: 1 byte][length: varint][payload: length bytes]
+ *   - The varint is LEB128 (7 bits per byte, low bits first).
+ *
+ *   - Framed clients send JOIN right after PROTO_MAGIC. The server answers
+ *     with SESSION once the player is seated; sending that token in a later
+ *     JOIN resumes the seat after a dropped connection (see table.c). A
+ *     JOIN of "@<player id>" takes a new seat and keeps the player's
+ *     scores under that id across games (see scores.h).
+ *   - A spectator sends WATCH instead, on the server's watch port, and
+ *     then only receives (see fanout.h).
+ *
+ * Legacy text protocol:
+ *   - Peers that never send PROTO_MAGIC keep the old unframed commands
+ *     ("MOVE:R", "QUIT", "RESET", "RESULT:...").  The parser still turns
+ *     them into frames, and splits commands that arrive coalesced.
+ *
+ * The parser is incremental: bytes are received straight into the
+ * parser's buffer and frames are returned as pointers into it, so nothing
+ * is copied except a partial frame left at the end of a read.
+ ******************************************************************************/
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTO_MAGIC 0xF5
+#define PROTO_BUF_SIZE 1024
+#define PROTO_MAX_HEADER 6 /* opcode + up to 5 varint bytes */
+#define PROTO_MAX_PAYLOAD (PROTO_BUF_SIZE - PROTO_MAX_HEADER)
+
+/* Opcodes */
+#define PROTO_OP_HELLO 0x00   /* negotiation; always encoded as PROTO_MAGIC */
+#define PROTO_OP_MOVE 0x01    /* payload: one move character, e.g. 'R' */
+#define PROTO_OP_QUIT 0x02
+#define PROTO_OP_RESET 0x03
+#define PROTO_OP_RESULT 0x04  /* payload: "<winners>:<moves>:<scores>" */
+#define PROTO_OP_INFO 0x05    /* payload: free text */
+#define PROTO_OP_JOIN 0x06    /* payload: empty or "@<player id>" (new seat), or a session token */
+#define PROTO_OP_SESSION 0x07 /* payload: "<token>:<seat>:<moved 0|1>" */
+#define PROTO_OP_WATCH 0x08   /* payload: table id, or empty for the latest table */
+#define PROTO_OP_UNKNOWN 0xFF /* unparsable legacy text (parser only) */
+
+typedef enum
+{
+    PROTO_TEXT,  /* legacy commands; switches to BINARY on PROTO_MAGIC */
+    PROTO_BINARY
+} ProtoMode;
+
+typedef struct
+{
+    uint8_t op;
+    uint32_t len;
+    const uint8_t *payload; /* points into the parser's buffer */
+} ProtoFrame;
+
+typedef struct
+{
+    ProtoMode mode;
+    size_t start; /* first unparsed byte */
+    size_t end;   /* one past the last received byte */
+    uint8_t buf[PROTO_BUF_SIZE];
+} ProtoParser;
+
+void proto_parser_init(ProtoParser *p);
+
+/*
+ * proto_parser_space:
+ *   Where to recv() the next bytes, and how many fit (*avail).
+ *   Frames returned earlier are invalidated by the next call.
+ */
+uint8_t *proto_parser_space(ProtoParser *p, size_t *avail);
+
+/* proto_parser_commit: n bytes were written into the space. */
+void proto_parser_commit(ProtoParser *p, size_t n);
+
+/*
+ * proto_next:
+ *   Return 1 and fill *f for the next complete frame, 0 if more bytes are
+ *   needed, or -1 on a protocol error (the connection should be dropped).
+ */
+int proto_next(ProtoParser *p, ProtoFrame *f);
+
+/*
+ * proto_encode:
+ *   Serialize one message for a peer speaking the given mode into out[].
+ *   Returns the number of bytes written, or 0 if it does not fit.
+ */
+size_t proto_encode(ProtoMode mode, uint8_t op, const void *payload, size_t len,
+                    uint8_t *out, size_t cap);
+
+/*
+ * proto_header_size / proto_write_header:
+ *   Size of, and bytes of, what goes in front of a len-byte payload (the
+ *   opcode and varint, or the legacy text prefix). Lets a caller build the
+ *   payload in place first and put the header right in front of it.
+ *   Both return 0 for an opcode the mode cannot express.
+ */
+size_t proto_header_size(ProtoMode mode, uint8_t op, size_t len);
+size_t proto_write_header(ProtoMode mode, uint8_t op, size_t len, uint8_t *out);
+
+/* proto_put_varint: write v as LEB128 into out (>= 5 bytes). Returns size. */
+size_t proto_put_varint(uint8_t *out, uint32_t v);
+
+#endif /* PROTO_H */
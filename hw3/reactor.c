@@ -0,0 +1,1355 @@
+/******************************************************************************
+ * reactor.c
+ *
+ * Readiness event loop with an edge-triggered epoll backend, an io_uring
+ * backend and a poll() fallback. Registrations live in a table indexed by
+ * fd, so looking up the callback for a ready fd is O(1) for all of them.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/* io_uring needs the 6.0 uapi (multishot recv); no liburing required */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define REACTOR_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#include "reactor.h"
+
+#define REACTOR_MAX_EVENTS 256
+
+#define URING_ENTRIES 1024   /* submission queue */
+#define URING_CQ_ENTRIES 8192
+#define URING_RECV_BUFS 1024 /* provided receive buffers, a power of two */
+#define URING_RECV_SIZE 1024
+#define URING_SEND_DATA 480  /* bytes per queued send buffer */
+
+/* What a registration is; SLOT_FREE means the slot is unused. */
+enum
+{
+    SLOT_FREE,
+    SLOT_READY,  /* readiness callbacks */
+    SLOT_ACCEPT, /* io_uring: multishot accept */
+    SLOT_STREAM  /* io_uring: multishot recv and queued sends */
+};
+
+typedef struct sendbuf SendBuf;
+
+/* Bytes for a stream, copied by reactor_send(). */
+struct sendbuf
+{
+    SendBuf *next;
+    int fd;
+    uint32_t gen; /* the registration it belongs to */
+    uint32_t len;
+    uint32_t off; /* bytes the kernel has taken */
+    int poll_first; /* the socket was full: wait until it is writable */
+    uint8_t data[URING_SEND_DATA];
+};
+
+/* One registration. */
+typedef struct
+{
+    reactor_cb cb;
+    void *arg;
+    unsigned events;
+    int pidx; /* index into pfds[] (poll backend only) */
+    int kind;
+
+    /* io_uring backend */
+    uint32_t gen; /* bumped by reactor_del; tags this registration's requests */
+    reactor_accept_cb on_accept;
+    reactor_data_cb on_data;
+    SendBuf *out_head, *out_tail; /* not yet handed to the kernel */
+    SendBuf *in_flight;           /* the one send the kernel has */
+    uint32_t out_bytes;           /* both, for REACTOR_SEND_MAX */
+    int out_error;                /* errno of a failed send, or 0 */
+    uint8_t receiving;            /* a stream's multishot recv is armed */
+    uint8_t paused;               /* reactor_stream_pause(): not re-armed */
+} Slot;
+
+/* A ready fd copied out of the kernel's answer before dispatching */
+typedef struct
+{
+    int fd;
+    unsigned events;
+} Ready;
+
+#ifdef REACTOR_URING
+/*
+ * A request's user_data: a SendBuf pointer (low bits clear) for sends,
+ * otherwise fd, registration generation and request type.
+ */
+enum
+{
+    UD_SEND,
+    UD_POLL,
+    UD_ACCEPT,
+    UD_RECV,
+    UD_IGNORE /* cancellations and poll updates */
+};
+#define UD_TYPE_MASK 7u
+#define UD_GEN_MASK 0xffffffu
+
+typedef struct
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_entries;
+    unsigned sq_local;    /* our tail: SQEs written, maybe not yet published */
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring;
+    size_t ring_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring *bufs; /* provided receive buffers, group 0 */
+    uint8_t *buf_mem;
+    uint16_t buf_tail;
+
+    SendBuf *free_sends;
+} Uring;
+#endif
+
+struct reactor
+{
+    ReactorBackend backend;
+    Slot *slots;
+    int nslots;
+    atomic_ulong syscalls;
+
+    /* epoll backend */
+    int epfd;
+
+    /* poll backend: dense array of registered fds */
+    struct pollfd *pfds;
+    int npfds;
+    int cap_pfds;
+
+#ifdef REACTOR_URING
+    Uring uring;
+#endif
+
+    Ready ready[REACTOR_MAX_EVENTS];
+    TimerWheel timers;
+};
+
+static int grow_slots(Reactor *r, int fd);
+static void count_syscall(Reactor *r);
+#ifdef REACTOR_URING
+static int uring_init(Reactor *r);
+static void uring_destroy(Reactor *r);
+static int uring_probe(int fd);
+static struct io_uring_sqe *uring_sqe(Reactor *r);
+static int uring_enter(Reactor *r, unsigned min_complete, int timeout_ms);
+static int uring_poll(Reactor *r, int timeout_ms);
+static int uring_complete(Reactor *r, const struct io_uring_cqe *cqe);
+static int uring_sent(Reactor *r, SendBuf *b, int res);
+static uint64_t uring_ud(int fd, uint32_t gen, unsigned type);
+static void uring_arm(Reactor *r, int fd);
+static void uring_cancel(Reactor *r, uint64_t target, int poll);
+static void uring_send_next(Reactor *r, int fd);
+static void uring_stream_end(Reactor *r, int fd);
+static void uring_buf_return(Uring *u, unsigned bid);
+static SendBuf *uring_sendbuf_get(Uring *u);
+static void uring_sendbuf_put(Uring *u, SendBuf *b);
+#endif
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+    {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+long long reactor_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long reactor_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Reactor *reactor_create(ReactorBackend backend)
+{
+    Reactor *r = calloc(1, sizeof(*r));
+    if (!r)
+    {
+        return NULL;
+    }
+    r->epfd = -1;
+    atomic_init(&r->syscalls, 0);
+    timer_wheel_init(&r->timers, reactor_now_ms());
+
+#ifdef REACTOR_URING
+    r->uring.fd = -1;
+    if (backend == REACTOR_BACKEND_URING)
+    {
+        if (uring_init(r) == 0)
+        {
+            r->backend = REACTOR_BACKEND_URING;
+            return r;
+        }
+        // too old, or disabled (kernel.io_uring_disabled): the usual choice
+    }
+#endif
+    if (backend == REACTOR_BACKEND_URING)
+    {
+        backend = REACTOR_BACKEND_AUTO;
+    }
+
+#ifdef __linux__
+    if (backend == REACTOR_BACKEND_AUTO || backend == REACTOR_BACKEND_EPOLL)
+    {
+        r->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (r->epfd >= 0)
+        {
+            r->backend = REACTOR_BACKEND_EPOLL;
+            return r;
+        }
+        if (backend == REACTOR_BACKEND_EPOLL)
+        {
+            perror("epoll_create1");
+            free(r);
+            return NULL;
+        }
+        // AUTO: fall through to poll()
+    }
+#else
+    if (backend == REACTOR_BACKEND_EPOLL)
+    {
+        fprintf(stderr, "reactor: epoll is not available on this system\n");
+        free(r);
+        return NULL;
+    }
+#endif
+
+    r->backend = REACTOR_BACKEND_POLL;
+    return r;
+}
+
+void reactor_destroy(Reactor *r)
+{
+    if (!r)
+    {
+        return;
+    }
+    if (r->epfd >= 0)
+    {
+        close(r->epfd);
+    }
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        uring_destroy(r);
+    }
+#endif
+    free(r->pfds);
+    free(r->slots);
+    free(r);
+}
+
+const char *reactor_backend_name(const Reactor *r)
+{
+    switch (r->backend)
+    {
+    case REACTOR_BACKEND_EPOLL:
+        return "epoll";
+    case REACTOR_BACKEND_POLL:
+        return "poll";
+    case REACTOR_BACKEND_URING:
+        return "io_uring";
+    default:
+        return "auto";
+    }
+}
+
+unsigned long reactor_syscalls(const Reactor *r)
+{
+    return atomic_load_explicit(&r->syscalls, memory_order_relaxed);
+}
+
+/* count_syscall: single-writer update, so readers on other threads see it. */
+static void count_syscall(Reactor *r)
+{
+    atomic_store_explicit(&r->syscalls,
+                          atomic_load_explicit(&r->syscalls, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+/* grow_slots: make sure slots[fd] exists. */
+static int grow_slots(Reactor *r, int fd)
+{
+    if (fd < r->nslots)
+    {
+        return 0;
+    }
+    int n = r->nslots ? r->nslots : 64;
+    while (n <= fd)
+    {
+        n *= 2;
+    }
+    Slot *s = realloc(r->slots, n * sizeof(*s));
+    if (!s)
+    {
+        return -1;
+    }
+    memset(s + r->nslots, 0, (n - r->nslots) * sizeof(*s));
+    r->slots = s;
+    r->nslots = n;
+    return 0;
+}
+
+static short to_poll_events(unsigned events)
+{
+    short pe = 0;
+    if (events & REACTOR_READ)
+        pe |= POLLIN;
+    if (events & REACTOR_WRITE)
+        pe |= POLLOUT;
+    return pe;
+}
+
+#ifdef __linux__
+static uint32_t to_epoll_events(unsigned events)
+{
+    uint32_t ee = EPOLLET | EPOLLRDHUP;
+    if (events & REACTOR_READ)
+        ee |= EPOLLIN;
+    if (events & REACTOR_WRITE)
+        ee |= EPOLLOUT;
+    return ee;
+}
+
+static unsigned from_epoll_events(uint32_t ee)
+{
+    unsigned e = 0;
+    if (ee & (EPOLLIN | EPOLLRDHUP))
+        e |= REACTOR_READ;
+    if (ee & EPOLLOUT)
+        e |= REACTOR_WRITE;
+    if (ee & (EPOLLERR | EPOLLHUP))
+        e |= REACTOR_ERROR;
+    return e;
+}
+#endif
+
+int reactor_add(Reactor *r, int fd, unsigned events, reactor_cb cb, void *arg)
+{
+    if (fd < 0 || !cb || grow_slots(r, fd) < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (r->slots[fd].kind != SLOT_FREE)
+    {
+        errno = EEXIST;
+        return -1;
+    }
+
+#ifdef __linux__
+    if (r->backend == REACTOR_BACKEND_EPOLL)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = to_epoll_events(events);
+        ev.data.fd = fd;
+        count_syscall(r);
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            return -1;
+        }
+    }
+#endif
+    if (r->backend == REACTOR_BACKEND_POLL)
+    {
+        if (r->npfds == r->cap_pfds)
+        {
+            int n = r->cap_pfds ? r->cap_pfds * 2 : 64;
+            struct pollfd *p = realloc(r->pfds, n * sizeof(*p));
+            if (!p)
+            {
+                return -1;
+            }
+            r->pfds = p;
+            r->cap_pfds = n;
+        }
+        r->pfds[r->npfds].fd = fd;
+        r->pfds[r->npfds].events = to_poll_events(events);
+        r->pfds[r->npfds].revents = 0;
+        r->slots[fd].pidx = r->npfds++;
+    }
+
+    r->slots[fd].kind = SLOT_READY;
+    r->slots[fd].cb = cb;
+    r->slots[fd].arg = arg;
+    r->slots[fd].events = events;
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        uring_arm(r, fd);
+    }
+#endif
+    return 0;
+}
+
+int reactor_mod(Reactor *r, int fd, unsigned events)
+{
+    if (fd < 0 || fd >= r->nslots || r->slots[fd].kind == SLOT_FREE)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    if (r->slots[fd].events == events)
+    {
+        return 0;
+    }
+
+#ifdef __linux__
+    if (r->backend == REACTOR_BACKEND_EPOLL)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = to_epoll_events(events);
+        ev.data.fd = fd;
+        count_syscall(r);
+        if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+        {
+            return -1;
+        }
+    }
+#endif
+    if (r->backend == REACTOR_BACKEND_POLL)
+    {
+        r->pfds[r->slots[fd].pidx].events = to_poll_events(events);
+    }
+
+    r->slots[fd].events = events;
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING && r->slots[fd].kind == SLOT_READY)
+    {
+        // update the multishot poll in place; it re-checks readiness like EPOLL_CTL_MOD
+        struct io_uring_sqe *sqe = uring_sqe(r);
+        if (!sqe)
+        {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_ud(fd, r->slots[fd].gen, UD_POLL);
+        sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = to_epoll_events(events);
+        sqe->user_data = UD_IGNORE;
+    }
+#endif
+    return 0;
+}
+
+int reactor_del(Reactor *r, int fd)
+{
+    if (fd < 0 || fd >= r->nslots || r->slots[fd].kind == SLOT_FREE)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+#ifdef __linux__
+    if (r->backend == REACTOR_BACKEND_EPOLL)
+    {
+        count_syscall(r);
+        epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+#endif
+    if (r->backend == REACTOR_BACKEND_POLL)
+    {
+        /* swap the last pollfd into the hole to keep the array dense */
+        int idx = r->slots[fd].pidx;
+        r->pfds[idx] = r->pfds[--r->npfds];
+        if (idx < r->npfds)
+        {
+            r->slots[r->pfds[idx].fd].pidx = idx;
+        }
+    }
+
+    uint32_t gen = r->slots[fd].gen;
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        Slot *s = &r->slots[fd];
+        if (s->kind == SLOT_STREAM)
+            uring_stream_end(r, fd);
+        else
+            uring_cancel(r, uring_ud(fd, gen, s->kind == SLOT_READY ? UD_POLL : UD_ACCEPT),
+                         s->kind == SLOT_READY);
+        // queued requests name fd by number: submit them before it can be reused
+        uring_enter(r, 0, 0);
+    }
+#endif
+    memset(&r->slots[fd], 0, sizeof(Slot));
+    r->slots[fd].gen = gen + 1; // what is still in flight for it is now stale
+    return 0;
+}
+
+int reactor_add_acceptor(Reactor *r, int fd, reactor_accept_cb cb, void *arg)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        if (fd < 0 || !cb || grow_slots(r, fd) < 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        if (r->slots[fd].kind != SLOT_FREE)
+        {
+            errno = EEXIST;
+            return -1;
+        }
+        r->slots[fd].kind = SLOT_ACCEPT;
+        r->slots[fd].on_accept = cb;
+        r->slots[fd].arg = arg;
+        r->slots[fd].events = REACTOR_READ;
+        uring_arm(r, fd);
+        return 0;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    (void)cb;
+    (void)arg;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int reactor_stream(Reactor *r, int fd, reactor_data_cb cb)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        if (fd < 0 || fd >= r->nslots || r->slots[fd].kind != SLOT_READY || !cb)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        Slot *s = &r->slots[fd];
+        uring_cancel(r, uring_ud(fd, s->gen, UD_POLL), 1);
+        s->kind = SLOT_STREAM;
+        s->on_data = cb;
+        uring_arm(r, fd);
+        return 0;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    (void)cb;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int reactor_stream_pause(Reactor *r, int fd)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING && fd >= 0 && fd < r->nslots &&
+        r->slots[fd].kind == SLOT_STREAM)
+    {
+        Slot *s = &r->slots[fd];
+        if (!s->paused && s->receiving)
+        {
+            uring_cancel(r, uring_ud(fd, s->gen, UD_RECV), 0);
+        }
+        s->paused = 1;
+        return 0;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    errno = ENOENT;
+    return -1;
+}
+
+int reactor_stream_busy(const Reactor *r, int fd)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING && fd >= 0 && fd < r->nslots &&
+        r->slots[fd].kind == SLOT_STREAM)
+    {
+        const Slot *s = &r->slots[fd];
+        return s->receiving || s->in_flight || s->out_head;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    return 0;
+}
+
+int reactor_stream_resume(Reactor *r, int fd)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING && fd >= 0 && fd < r->nslots &&
+        r->slots[fd].kind == SLOT_STREAM)
+    {
+        Slot *s = &r->slots[fd];
+        s->paused = 0;
+        if (!s->receiving)
+        {
+            uring_arm(r, fd);
+        }
+        return 0;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    errno = ENOENT;
+    return -1;
+}
+
+ssize_t reactor_send(Reactor *r, int fd, const struct iovec *iov, int iovcnt)
+{
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        if (fd < 0 || fd >= r->nslots || r->slots[fd].kind != SLOT_STREAM)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        Uring *u = &r->uring;
+        Slot *s = &r->slots[fd];
+        if (s->out_error)
+        {
+            errno = s->out_error;
+            return -1;
+        }
+        size_t room = REACTOR_SEND_MAX - s->out_bytes;
+        size_t taken = 0;
+        for (int i = 0; i < iovcnt && taken < room; i++)
+        {
+            const uint8_t *p = iov[i].iov_base;
+            size_t n = iov[i].iov_len;
+            while (n > 0 && taken < room)
+            {
+                SendBuf *b = s->out_tail;
+                if (!b || b->len == URING_SEND_DATA)
+                {
+                    if (!(b = uring_sendbuf_get(u)))
+                    {
+                        break;
+                    }
+                    b->fd = fd;
+                    b->gen = s->gen;
+                    if (s->out_tail)
+                        s->out_tail->next = b;
+                    else
+                        s->out_head = b;
+                    s->out_tail = b;
+                }
+                size_t k = URING_SEND_DATA - b->len;
+                if (k > n)
+                    k = n;
+                if (k > room - taken)
+                    k = room - taken;
+                memcpy(b->data + b->len, p, k);
+                b->len += (uint32_t)k;
+                p += k;
+                n -= k;
+                taken += k;
+            }
+        }
+        s->out_bytes += (uint32_t)taken;
+        if (!s->in_flight)
+        {
+            uring_send_next(r, fd);
+        }
+        if (taken == 0)
+        {
+            errno = (room == 0) ? EAGAIN : ENOMEM;
+            return -1;
+        }
+        return (ssize_t)taken;
+    }
+#endif
+    (void)r;
+    (void)fd;
+    (void)iov;
+    (void)iovcnt;
+    errno = ENOTSUP;
+    return -1;
+}
+
+/* collect: ask the backend for ready fds and copy them into r->ready[]. */
+static int collect(Reactor *r, int timeout_ms)
+{
+    int count = 0;
+
+#ifdef __linux__
+    if (r->backend == REACTOR_BACKEND_EPOLL)
+    {
+        struct epoll_event evs[REACTOR_MAX_EVENTS];
+        count_syscall(r);
+        int n = epoll_wait(r->epfd, evs, REACTOR_MAX_EVENTS, timeout_ms);
+        if (n < 0)
+        {
+            return (errno == EINTR) ? 0 : -1;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            r->ready[count].fd = evs[i].data.fd;
+            r->ready[count].events = from_epoll_events(evs[i].events);
+            count++;
+        }
+        return count;
+    }
+#endif
+
+    count_syscall(r);
+    int n = poll(r->pfds, r->npfds, timeout_ms);
+    if (n < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < r->npfds && count < n && count < REACTOR_MAX_EVENTS; i++)
+    {
+        short re = r->pfds[i].revents;
+        if (!re)
+        {
+            continue;
+        }
+        unsigned e = 0;
+        if (re & POLLIN)
+            e |= REACTOR_READ;
+        if (re & POLLOUT)
+            e |= REACTOR_WRITE;
+        if (re & (POLLERR | POLLHUP | POLLNVAL))
+            e |= REACTOR_ERROR;
+        r->ready[count].fd = r->pfds[i].fd;
+        r->ready[count].events = e;
+        count++;
+    }
+    return count;
+}
+
+TimerWheel *reactor_timers(Reactor *r)
+{
+    return &r->timers;
+}
+
+int reactor_poll(Reactor *r, int timeout_ms)
+{
+    /* never sleep past the nearest deadline */
+    int next = timer_wheel_timeout(&r->timers, reactor_now_ms());
+    if (next >= 0 && (timeout_ms < 0 || next < timeout_ms))
+    {
+        timeout_ms = next;
+    }
+
+#ifdef REACTOR_URING
+    if (r->backend == REACTOR_BACKEND_URING)
+    {
+        int ran = uring_poll(r, timeout_ms);
+        if (ran < 0)
+        {
+            perror("reactor_poll");
+            return -1;
+        }
+        timer_wheel_advance(&r->timers, reactor_now_ms());
+        return ran;
+    }
+#endif
+
+    int n = collect(r, timeout_ms);
+    if (n < 0)
+    {
+        perror("reactor_poll");
+        return -1;
+    }
+
+    /*
+     * Dispatch from the copied list: a callback may add or delete other
+     * registrations, so re-check that the fd is still registered first.
+     */
+    int ran = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int fd = r->ready[i].fd;
+        if (fd >= r->nslots || r->slots[fd].kind != SLOT_READY)
+        {
+            continue;
+        }
+        r->slots[fd].cb(r, fd, r->ready[i].events, r->slots[fd].arg);
+        ran++;
+    }
+
+    timer_wheel_advance(&r->timers, reactor_now_ms());
+    return ran;
+}
+
+#ifdef REACTOR_URING
+/*
+ * uring_init:
+ *   Set up the rings and the provided receive buffers. Fails (and leaves
+ *   nothing behind) if the kernel lacks any feature the backend relies on.
+ */
+static int uring_init(Reactor *r)
+{
+    Uring *u = &r->uring;
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    p.cq_entries = URING_CQ_ENTRIES;
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0)
+    {
+        return -1;
+    }
+    unsigned need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & need) != need || !uring_probe(u->fd))
+    {
+        uring_destroy(r);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->ring == MAP_FAILED || u->sqes == MAP_FAILED)
+    {
+        uring_destroy(r);
+        return -1;
+    }
+    char *ring = u->ring;
+    u->sq_head = (unsigned *)(ring + p.sq_off.head);
+    u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned *)(ring + p.sq_off.flags);
+    u->sq_entries = p.sq_entries;
+    u->sq_local = *u->sq_tail;
+    unsigned *array = (unsigned *)(ring + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+    {
+        array[i] = i; // SQE i sits in slot i, always
+    }
+    u->cq_head = (unsigned *)(ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+    /* the buffer ring must be page aligned; the buffers need not be */
+    u->bufs = mmap(NULL, URING_RECV_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->buf_mem = malloc((size_t)URING_RECV_BUFS * URING_RECV_SIZE);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)u->bufs;
+    reg.ring_entries = URING_RECV_BUFS;
+    reg.bgid = 0;
+    if (u->bufs == MAP_FAILED || !u->buf_mem ||
+        syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        uring_destroy(r);
+        return -1;
+    }
+    for (unsigned i = 0; i < URING_RECV_BUFS; i++)
+    {
+        uring_buf_return(u, i);
+    }
+    return 0;
+}
+
+static void uring_destroy(Reactor *r)
+{
+    Uring *u = &r->uring;
+
+    if (u->fd >= 0)
+    {
+        close(u->fd); // cancels whatever is still in flight
+    }
+    for (int fd = 0; fd < r->nslots; fd++)
+    {
+        Slot *s = &r->slots[fd];
+        if (s->in_flight)
+        {
+            s->in_flight->next = s->out_head;
+            s->out_head = s->in_flight;
+        }
+        for (SendBuf *b = s->out_head, *next; b; b = next)
+        {
+            next = b->next;
+            free(b);
+        }
+        s->in_flight = s->out_head = s->out_tail = NULL;
+    }
+    while (u->free_sends)
+    {
+        SendBuf *b = u->free_sends;
+        u->free_sends = b->next;
+        free(b);
+    }
+    if (u->ring && u->ring != MAP_FAILED)
+    {
+        munmap(u->ring, u->ring_size);
+    }
+    if (u->sqes && u->sqes != MAP_FAILED)
+    {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->bufs && u->bufs != MAP_FAILED)
+    {
+        munmap(u->bufs, URING_RECV_BUFS * sizeof(struct io_uring_buf));
+    }
+    free(u->buf_mem);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+/*
+ * uring_probe:
+ *   Whether the kernel has the opcodes this backend uses. Multishot recv
+ *   has no opcode of its own; it came in 6.0 together with SEND_ZC.
+ */
+static int uring_probe(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, len);
+    if (!p)
+    {
+        return 0;
+    }
+    int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, IORING_OP_LAST) == 0 &&
+             p->last_op >= IORING_OP_SEND_ZC &&
+             (p->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    free(p);
+    return ok;
+}
+
+/*
+ * uring_sqe:
+ *   A zeroed submission queue entry, handed to the kernel at the next
+ *   io_uring_enter(). If the queue is full, what is in it is submitted
+ *   first. NULL only if that fails.
+ */
+static struct io_uring_sqe *uring_sqe(Reactor *r)
+{
+    Uring *u = &r->uring;
+    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries)
+    {
+        uring_enter(r, 0, 0);
+        if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries)
+        {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_local & *u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local++;
+    return sqe;
+}
+
+/*
+ * uring_enter:
+ *   Submit everything queued and, if min_complete, wait up to timeout_ms
+ *   (-1 = forever) for a completion. Returns 0 or -1 (EINTR and a timeout
+ *   are not errors).
+ */
+static int uring_enter(Reactor *r, unsigned min_complete, int timeout_ms)
+{
+    Uring *u = &r->uring;
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    unsigned pending = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned sq_flags = __atomic_load_n(u->sq_flags, __ATOMIC_RELAXED);
+
+    if (!pending && !min_complete &&
+        !(sq_flags & (IORING_SQ_CQ_OVERFLOW | IORING_SQ_TASKRUN)))
+    {
+        return 0; // nothing for the kernel to do
+    }
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete && timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uintptr_t)&ts;
+    }
+    count_syscall(r);
+    long rc = syscall(__NR_io_uring_enter, u->fd, pending, min_complete,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rc < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * uring_poll:
+ *   One loop pass: submit, wait unless completions are already waiting,
+ *   and handle the completions that were there. Returns the callbacks run.
+ */
+static int uring_poll(Reactor *r, int timeout_ms)
+{
+    Uring *u = &r->uring;
+    unsigned head = *u->cq_head;
+    int waiting = head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (uring_enter(r, (timeout_ms != 0 && !waiting) ? 1 : 0, timeout_ms) < 0)
+    {
+        return -1;
+    }
+
+    /* what a callback's own submissions complete is left for the next pass */
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    int ran = 0;
+    while (head != tail)
+    {
+        struct io_uring_cqe cqe = u->cqes[head & *u->cq_mask];
+        __atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+        ran += uring_complete(r, &cqe);
+    }
+    return ran;
+}
+
+/* uring_complete: act on one completion. Returns 1 if a callback ran. */
+static int uring_complete(Reactor *r, const struct io_uring_cqe *cqe)
+{
+    uint64_t ud = cqe->user_data;
+    unsigned type = ud & UD_TYPE_MASK;
+    if (type == UD_SEND)
+    {
+        return uring_sent(r, (SendBuf *)(uintptr_t)ud, cqe->res);
+    }
+    if (type == UD_IGNORE)
+    {
+        return 0;
+    }
+
+    Uring *u = &r->uring;
+    int fd = (int)(ud >> 32);
+    uint32_t gen = (uint32_t)(ud >> 8) & UD_GEN_MASK;
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    Slot *s = fd < r->nslots ? &r->slots[fd] : NULL;
+    int kind = (s && (s->gen & UD_GEN_MASK) == gen) ? s->kind : SLOT_FREE;
+    int ran = 0;
+
+    switch (type)
+    {
+    case UD_POLL:
+        if (kind != SLOT_READY)
+        {
+            return 0; // removed, or now a stream
+        }
+        if (cqe->res >= 0)
+        {
+            s->cb(r, fd, from_epoll_events((uint32_t)cqe->res), s->arg);
+            ran = 1;
+        }
+        break;
+
+    case UD_ACCEPT:
+        if (kind != SLOT_ACCEPT)
+        {
+            if (cqe->res >= 0)
+                close(cqe->res); // accepted just before the listener went
+            return 0;
+        }
+        if (cqe->res != -ECANCELED)
+        {
+            errno = cqe->res < 0 ? -cqe->res : 0;
+            s->on_accept(r, fd, cqe->res < 0 ? -1 : cqe->res, s->arg);
+            ran = 1;
+        }
+        break;
+
+    case UD_RECV:
+    {
+        const void *data = NULL;
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            data = u->buf_mem + (size_t)bid * URING_RECV_SIZE;
+            if (kind == SLOT_STREAM && cqe->res > 0)
+            {
+                s->on_data(r, fd, data, cqe->res, s->arg);
+                ran = 1;
+            }
+            uring_buf_return(u, bid);
+        }
+        if (kind != SLOT_STREAM)
+        {
+            return ran;
+        }
+        if ((s->gen & UD_GEN_MASK) != gen || s->kind != SLOT_STREAM)
+        {
+            return ran; // on_data closed it
+        }
+        if (!more)
+        {
+            s->receiving = 0;
+            if (s->paused)
+                return ran; // cancelled on purpose, or ended: the next reader sees why
+        }
+        if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS))
+        {
+            s->on_data(r, fd, NULL, cqe->res, s->arg); // end of stream, or failed
+            return 1;
+        }
+        break; // data, or out of buffers (returned by now): keep receiving
+    }
+
+    default:
+        return 0;
+    }
+
+    /* a multishot request that ended (e.g. ring overflow) is re-armed */
+    s = fd < r->nslots ? &r->slots[fd] : NULL;
+    if (!more && s && (s->gen & UD_GEN_MASK) == gen && s->kind == kind)
+    {
+        uring_arm(r, fd);
+    }
+    return ran;
+}
+
+/*
+ * uring_sent:
+ *   A send finished. Resubmit what the kernel did not take, or start on
+ *   the next buffer, and tell a writer waiting for room (REACTOR_WRITE).
+ */
+static int uring_sent(Reactor *r, SendBuf *b, int res)
+{
+    Uring *u = &r->uring;
+    Slot *s = b->fd < r->nslots ? &r->slots[b->fd] : NULL;
+    if (!s || s->kind != SLOT_STREAM || s->gen != b->gen || s->in_flight != b)
+    {
+        uring_sendbuf_put(u, b); // its stream is gone
+        return 0;
+    }
+    int fd = b->fd;
+    s->in_flight = NULL;
+
+    if (res < 0 && res != -EAGAIN && res != -EINTR)
+    {
+        s->out_error = -res;
+        s->out_bytes = 0;
+        uring_sendbuf_put(u, b);
+        while (s->out_head)
+        {
+            SendBuf *next = s->out_head->next;
+            uring_sendbuf_put(u, s->out_head);
+            s->out_head = next;
+        }
+        s->out_tail = NULL;
+        s->on_data(r, fd, NULL, res, s->arg);
+        return 1;
+    }
+    if (res > 0)
+    {
+        b->off += (uint32_t)res;
+        s->out_bytes -= (uint32_t)res;
+    }
+    if (b->off < b->len)
+    {
+        // short send: the rest goes first, once there is room
+        b->poll_first = 1;
+        b->next = s->out_head;
+        s->out_head = b;
+        if (!s->out_tail)
+            s->out_tail = b;
+    }
+    else
+    {
+        uring_sendbuf_put(u, b);
+    }
+    uring_send_next(r, fd);
+
+    if ((s->events & REACTOR_WRITE) && s->out_bytes < REACTOR_SEND_MAX)
+    {
+        s->cb(r, fd, REACTOR_WRITE, s->arg);
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t uring_ud(int fd, uint32_t gen, unsigned type)
+{
+    return ((uint64_t)(uint32_t)fd << 32) | ((uint64_t)(gen & UD_GEN_MASK) << 8) | type;
+}
+
+/* uring_arm: start fd's multishot request: poll, accept or recv by kind. */
+static void uring_arm(Reactor *r, int fd)
+{
+    Slot *s = &r->slots[fd];
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (!sqe)
+    {
+        perror("io_uring");
+        return;
+    }
+    sqe->fd = fd;
+    switch (s->kind)
+    {
+    case SLOT_READY:
+        // io_uring polls are edge-triggered unless asked otherwise, like our epoll
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = to_epoll_events(s->events);
+        sqe->user_data = uring_ud(fd, s->gen, UD_POLL);
+        break;
+    case SLOT_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = uring_ud(fd, s->gen, UD_ACCEPT);
+        break;
+    case SLOT_STREAM:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = uring_ud(fd, s->gen, UD_RECV);
+        s->receiving = 1;
+        break;
+    }
+}
+
+/* uring_cancel: end the request tagged target (a poll, or anything else). */
+static void uring_cancel(Reactor *r, uint64_t target, int poll)
+{
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->opcode = poll ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = UD_IGNORE;
+}
+
+/* uring_send_next: hand fd's oldest queued buffer to the kernel. */
+static void uring_send_next(Reactor *r, int fd)
+{
+    Slot *s = &r->slots[fd];
+    SendBuf *b = s->out_head;
+    if (!b || s->in_flight)
+    {
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (!sqe)
+    {
+        return; // stays queued; the next reactor_send() tries again
+    }
+    s->out_head = b->next;
+    if (!s->out_head)
+        s->out_tail = NULL;
+    b->next = NULL;
+    s->in_flight = b;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)(b->data + b->off);
+    sqe->len = b->len - b->off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->ioprio = b->poll_first ? IORING_RECVSEND_POLL_FIRST : 0;
+    sqe->user_data = (uintptr_t)b;
+}
+
+/*
+ * uring_stream_end:
+ *   fd stops being a stream. Its receive is cancelled; output the kernel
+ *   has not started on is written now if it fits the socket, else dropped,
+ *   as a closing epoll connection's would be.
+ */
+static void uring_stream_end(Reactor *r, int fd)
+{
+    Uring *u = &r->uring;
+    Slot *s = &r->slots[fd];
+
+    uring_cancel(r, uring_ud(fd, s->gen, UD_RECV), 0);
+    if (s->in_flight)
+    {
+        // it was queued before any cancel, so it usually completes first
+        uring_cancel(r, (uintptr_t)s->in_flight, 0);
+    }
+    while (s->out_head)
+    {
+        SendBuf *b = s->out_head;
+        if (!s->in_flight && !s->out_error)
+        {
+            count_syscall(r);
+            if (send(fd, b->data + b->off, b->len - b->off, MSG_DONTWAIT | MSG_NOSIGNAL) <
+                (ssize_t)(b->len - b->off))
+                s->out_error = EAGAIN;
+        }
+        s->out_head = b->next;
+        uring_sendbuf_put(u, b);
+    }
+}
+
+/* uring_buf_return: give receive buffer bid back to the kernel. */
+static void uring_buf_return(Uring *u, unsigned bid)
+{
+    struct io_uring_buf *b = &u->bufs->bufs[u->buf_tail & (URING_RECV_BUFS - 1)];
+    b->addr = (uintptr_t)(u->buf_mem + (size_t)bid * URING_RECV_SIZE);
+    b->len = URING_RECV_SIZE;
+    b->bid = (uint16_t)bid; // leaves resv alone: entry 0's is the ring tail
+    u->buf_tail++;
+    __atomic_store_n(&u->bufs->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
+
+static SendBuf *uring_sendbuf_get(Uring *u)
+{
+    SendBuf *b = u->free_sends;
+    if (b)
+        u->free_sends = b->next;
+    else if (!(b = malloc(sizeof(*b))))
+        return NULL;
+    b->next = NULL;
+    b->len = 0;
+    b->off = 0;
+    b->poll_first = 0;
+    return b;
+}
+
+static void uring_sendbuf_put(Uring *u, SendBuf *b)
+{
+    b->next = u->free_sends;
+    u->free_sends = b;
+}
+#endif /* REACTOR_URING */
@@ -0,0 +1,140 @@
+/******************************************************************************
+ * reactor.h
+ *
+ * A small readiness-based event loop used by spock_server.
+ *
+ *   - Each fd is registered ONCE (reactor_add) together with a callback and
+ *     an opaque argument; there is no per-iteration fd_set rebuild.
+ *   - reactor_poll() waits for activity and dispatches only the ready fds,
+ *     so a wakeup costs O(ready fds) instead of O(registered fds).
+ *   - The epoll backend is edge-triggered: a READ callback must drain its
+ *     socket until recv() returns EAGAIN, otherwise it will not fire again.
+ *     Registered fds should therefore be non-blocking (see set_nonblocking).
+ *   - A poll() backend is kept as a fallback for systems without epoll.
+ *   - Each reactor drives a timer wheel (timer.h): reactor_poll() never
+ *     sleeps past the nearest deadline and fires due timers after I/O.
+ *   - An io_uring backend (REACTOR_BACKEND_URING, Linux 6.0+) keeps the
+ *     same readiness callbacks, as multishot edge-triggered polls, and adds
+ *     completion I/O on top: multishot accept for listeners, and streams
+ *     whose bytes arrive in a provided buffer ring and whose sends are
+ *     queued in the submission ring. Registration changes, sends and the
+ *     wait all go to the kernel in one io_uring_enter() per loop pass, so
+ *     a whole table's RESULT broadcast costs no syscall of its own. Where
+ *     io_uring is missing or too old, URING behaves like AUTO.
+ ******************************************************************************/
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "timer.h"
+
+/* Event bits passed to reactor_add / reactor_mod and to callbacks */
+#define REACTOR_READ 0x1
+#define REACTOR_WRITE 0x2
+#define REACTOR_ERROR 0x4 /* hangup/error; always reported, never requested */
+
+typedef enum
+{
+    REACTOR_BACKEND_AUTO,
+    REACTOR_BACKEND_EPOLL,
+    REACTOR_BACKEND_POLL,
+    REACTOR_BACKEND_URING /* io_uring where the kernel has it, else AUTO */
+} ReactorBackend;
+
+typedef struct reactor Reactor;
+
+/* Callback invoked for each ready fd with the REACTOR_* bits that fired. */
+typedef void (*reactor_cb)(Reactor *r, int fd, unsigned events, void *arg);
+
+/* Callback for a connection accepted on listener fd: client_fd, or -1 with errno. */
+typedef void (*reactor_accept_cb)(Reactor *r, int fd, int client_fd, void *arg);
+
+/*
+ * Callback for a stream: len > 0 bytes arrived at data (valid only during
+ * the call), 0 is end of stream, < 0 is -errno of a failed receive or send.
+ */
+typedef void (*reactor_data_cb)(Reactor *r, int fd, const void *data, ssize_t len, void *arg);
+
+Reactor *reactor_create(ReactorBackend backend);
+void reactor_destroy(Reactor *r);
+
+int reactor_add(Reactor *r, int fd, unsigned events, reactor_cb cb, void *arg);
+int reactor_mod(Reactor *r, int fd, unsigned events);
+int reactor_del(Reactor *r, int fd);
+
+/*
+ * Completion I/O, io_uring backend only: elsewhere these fail with
+ * ENOTSUP and the caller keeps using readiness callbacks.
+ */
+
+/* reactor_add_acceptor: register a listening fd whose connections go to cb. */
+int reactor_add_acceptor(Reactor *r, int fd, reactor_accept_cb cb, void *arg);
+
+/*
+ * reactor_stream:
+ *   Switch a registered socket to completion I/O. From the next loop pass
+ *   its bytes go to cb (with the registration's arg), so the caller must
+ *   have drained it and must not read it any more; the readiness callback
+ *   then only reports REACTOR_WRITE, when requested and reactor_send() has
+ *   room again. Bytes received but not yet delivered are lost at
+ *   reactor_del(), so a stream must not move to another reactor.
+ */
+int reactor_stream(Reactor *r, int fd, reactor_data_cb cb);
+
+/*
+ * reactor_stream_pause:
+ *   Stop receiving on a stream, e.g. before its socket is handed to
+ *   another process. Bytes the kernel already took still reach cb in the
+ *   next loop passes; an end of stream seen meanwhile is left for the
+ *   socket's next reader. Queued sends carry on.
+ */
+int reactor_stream_pause(Reactor *r, int fd);
+
+/*
+ * reactor_stream_busy:
+ *   1 while a paused stream still has a receive or sends with the kernel,
+ *   i.e. until nothing more will come in or go out on its own.
+ */
+int reactor_stream_busy(const Reactor *r, int fd);
+
+/* reactor_stream_resume: receive on a paused stream again. */
+int reactor_stream_resume(Reactor *r, int fd);
+
+/*
+ * reactor_send:
+ *   Copy bytes for a stream into its send queue; they are written in
+ *   order, in the background. Returns the bytes taken (short once
+ *   REACTOR_SEND_MAX are waiting), -1 with EAGAIN if none fit, or -1 with
+ *   the errno of an earlier failed send.
+ */
+#define REACTOR_SEND_MAX (64 * 1024)
+ssize_t reactor_send(Reactor *r, int fd, const struct iovec *iov, int iovcnt);
+
+/*
+ * reactor_poll:
+ *   Wait up to timeout_ms (-1 = forever), or until the next timer is due,
+ *   then dispatch the ready callbacks and the expired timers.
+ *   Returns the number of fd callbacks run, or -1 on error (EINTR returns 0).
+ */
+int reactor_poll(Reactor *r, int timeout_ms);
+
+/* reactor_timers: the reactor's timer wheel, to arm deadlines on. */
+TimerWheel *reactor_timers(Reactor *r);
+
+const char *reactor_backend_name(const Reactor *r);
+
+/* reactor_syscalls: system calls the reactor has made (readable from any thread). */
+unsigned long reactor_syscalls(const Reactor *r);
+
+/* reactor_now_ms: monotonic clock in milliseconds, for loop deadlines. */
+long long reactor_now_ms(void);
+
+/* reactor_now_us: the same clock in microseconds, for latency metrics. */
+long long reactor_now_us(void);
+
+/* set_nonblocking: put fd into O_NONBLOCK mode. Returns 0 or -1. */
+int set_nonblocking(int fd);
+
+#endif /* REACTOR_H */
@@ -0,0 +1,332 @@
+/******************************************************************************
+ * restart.c
+ *
+ * Hot restart images and their transfer over a Unix socket (see restart.h).
+ ******************************************************************************/
+#define _GNU_SOURCE /* struct ucred */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "restart.h"
+
+static int unix_addr(const char *path, struct sockaddr_un *addr);
+static int send_chunk(int sock, const uint8_t *data, size_t len, const int *fds, int nfds);
+
+void restart_image_init(RestartImage *im)
+{
+    memset(im, 0, sizeof(*im));
+}
+
+int restart_put(RestartImage *im, const void *p, size_t len)
+{
+    if (im->len + len > im->cap)
+    {
+        size_t cap = im->cap ? im->cap : 4096;
+        while (cap < im->len + len)
+        {
+            cap *= 2;
+        }
+        uint8_t *data = realloc(im->data, cap);
+        if (!data)
+        {
+            perror("realloc");
+            return -1;
+        }
+        im->data = data;
+        im->cap = cap;
+    }
+    memcpy(im->data + im->len, p, len);
+    im->len += len;
+    return 0;
+}
+
+int restart_put_rec(RestartImage *im, RestartRecType type, const void *rec, size_t len)
+{
+    uint8_t tag = (uint8_t)type;
+    return (restart_put(im, &tag, 1) < 0 || restart_put(im, rec, len) < 0) ? -1 : 0;
+}
+
+int restart_put_fd(RestartImage *im, int fd)
+{
+    if (im->nfds == im->cap_fds)
+    {
+        int cap = im->cap_fds ? im->cap_fds * 2 : 256;
+        int *fds = realloc(im->fds, cap * sizeof(int));
+        if (!fds)
+        {
+            perror("realloc");
+            return -1;
+        }
+        im->fds = fds;
+        im->cap_fds = cap;
+    }
+    im->fds[im->nfds] = fd;
+    return im->nfds++;
+}
+
+int restart_get(RestartImage *im, void *out, size_t len)
+{
+    if (len > im->len - im->pos)
+    {
+        return -1;
+    }
+    if (out)
+    {
+        memcpy(out, im->data + im->pos, len);
+    }
+    im->pos += len;
+    return 0;
+}
+
+int restart_take_fd(RestartImage *im, int index)
+{
+    if (index < 0 || index >= im->nfds)
+    {
+        return -1;
+    }
+    int fd = im->fds[index];
+    im->fds[index] = -1;
+    return fd;
+}
+
+void restart_image_free(RestartImage *im)
+{
+    for (int i = 0; im->owns_fds && i < im->nfds; i++)
+    {
+        if (im->fds[i] >= 0)
+            close(im->fds[i]);
+    }
+    free(im->fds);
+    free(im->data);
+    restart_image_init(im);
+}
+
+int restart_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) < 0)
+    {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    unlink(path); // left by a server that did not exit cleanly
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int restart_accept(int listen_fd)
+{
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid())
+    {
+        fprintf(stderr, "[Server] Refused a hot restart from another user.\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int restart_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) < 0)
+    {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int restart_send(int sock, const RestartImage *im)
+{
+    RestartHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RESTART_MAGIC, sizeof(h.magic));
+    h.version = RESTART_VERSION;
+    h.nfds = (uint32_t)im->nfds;
+    h.len = im->len;
+    if (send_chunk(sock, (const uint8_t *)&h, sizeof(h), NULL, 0) < 0)
+    {
+        return -1;
+    }
+
+    size_t off = 0;
+    int fd_off = 0;
+    while (off < im->len || fd_off < im->nfds)
+    {
+        size_t n = im->len - off < RESTART_CHUNK ? im->len - off : RESTART_CHUNK;
+        int k = im->nfds - fd_off < RESTART_FDS_PER_MSG ? im->nfds - fd_off : RESTART_FDS_PER_MSG;
+        static const uint8_t pad = 0; // descriptors need at least one byte to ride on
+        if (send_chunk(sock, n ? im->data + off : &pad, n ? n : 1, im->fds + fd_off, k) < 0)
+        {
+            return -1;
+        }
+        off += n;
+        fd_off += k;
+    }
+    return 0;
+}
+
+int restart_recv(int sock, RestartImage *im)
+{
+    RestartHeader h;
+    restart_image_init(im);
+    if (recv(sock, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, RESTART_MAGIC, sizeof(h.magic)) != 0)
+    {
+        fprintf(stderr, "[Server] Hot restart: no image from the old server.\n");
+        return -1;
+    }
+    if (h.version != RESTART_VERSION)
+    {
+        fprintf(stderr, "[Server] Hot restart: image version %u, expected %d.\n",
+                h.version, RESTART_VERSION);
+        return -1;
+    }
+    im->data = malloc(h.len ? h.len : 1);
+    im->fds = malloc((h.nfds ? h.nfds : 1) * sizeof(int));
+    if (!im->data || !im->fds)
+    {
+        perror("malloc");
+        return -1;
+    }
+    im->cap = h.len;
+    im->cap_fds = (int)h.nfds;
+    im->owns_fds = 1;
+
+    static uint8_t chunk[RESTART_CHUNK];
+    union
+    {
+        char buf[CMSG_SPACE(RESTART_FDS_PER_MSG * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    while (im->len < h.len || im->nfds < (int)h.nfds)
+    {
+        struct iovec iov = {chunk, sizeof(chunk)};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        {
+            fprintf(stderr, "[Server] Hot restart: the image was cut short.\n");
+            return -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+                continue;
+            int k = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            if (im->nfds + k > im->cap_fds)
+            {
+                return -1;
+            }
+            memcpy(im->fds + im->nfds, CMSG_DATA(cm), k * sizeof(int));
+            im->nfds += k;
+        }
+        size_t take = (size_t)n < h.len - im->len ? (size_t)n : h.len - im->len;
+        memcpy(im->data + im->len, chunk, take); // the rest is padding
+        im->len += take;
+    }
+    return 0;
+}
+
+int restart_signal(int sock, char what)
+{
+    return send(sock, &what, 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+int restart_wait(int sock, char what, int timeout_ms)
+{
+    struct pollfd p = {sock, POLLIN, 0};
+    char got;
+    int rc;
+    while ((rc = poll(&p, 1, timeout_ms)) < 0 && errno == EINTR)
+    {
+    }
+    return (rc == 1 && recv(sock, &got, 1, 0) == 1 && got == what) ? 0 : -1;
+}
+
+static int unix_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/* send_chunk: one message of len bytes, with nfds descriptors attached. */
+static int send_chunk(int sock, const uint8_t *data, size_t len, const int *fds, int nfds)
+{
+    union
+    {
+        char buf[CMSG_SPACE(RESTART_FDS_PER_MSG * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {(void *)data, len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    {
+    }
+    if (n != (ssize_t)len)
+    {
+        perror("hot restart: sendmsg");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+ * restart.h
+ *
+ * Hot restart: handing a running spock_server over to a new process.
+ *
+ *   - A server started with --hot-restart PATH listens on the Unix socket
+ *     PATH. A new server started with the same option finds it there and
+ *     takes over: the old one pauses its shards, sends a RestartImage and
+ *     exits; the new one carries on with the same listening sockets and
+ *     the same players, at the same tables, in the middle of the round.
+ *   - A RestartImage is a byte stream of tagged records (a tag byte, then
+ *     the record) plus the file descriptors they refer to by index. It is
+ *     sent over a SOCK_SEQPACKET socket: a RestartHeader, then messages of
+ *     up to RESTART_CHUNK bytes, each carrying up to RESTART_FDS_PER_MSG
+ *     descriptors (SCM_RIGHTS). Both ends are the same machine, so records
+ *     are in host byte order.
+ *   - The exchange: the new process connects and receives the image, then
+ *     acknowledges it (RESTART_ACK). Until then the old one can still back
+ *     out and resume its shards. After the ack, the old process writes out
+ *     its event log and score store and says so (RESTART_DONE), so the new
+ *     one opens them only once they are complete.
+ *   - Only the same user may take over (SO_PEERCRED).
+ ******************************************************************************/
+#ifndef RESTART_H
+#define RESTART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rules.h"
+#include "scores.h"
+
+#define RESTART_MAGIC "SPOCKHOT"
+#define RESTART_VERSION 1
+#define RESTART_CHUNK 32768        /* image bytes per message */
+#define RESTART_FDS_PER_MSG 250    /* below the kernel's SCM_MAX_FD (253) */
+#define RESTART_ACK 'A'
+#define RESTART_DONE 'D'
+#define RESTART_ACK_MS 10000       /* how long the old process waits for the ack */
+#define RESTART_DONE_MS 60000      /* and the new one for the old one's files */
+
+typedef enum
+{
+    RESTART_REC_END = 0,
+    RESTART_REC_LISTENER, /* RestartListener */
+    RESTART_REC_TABLE     /* RestartTable, its RestartSeats, then its last RESULT */
+} RestartRecType;
+
+typedef enum
+{
+    RESTART_LISTEN_GAME,  /* a shard's TCP listener */
+    RESTART_LISTEN_UDP,
+    RESTART_LISTEN_WATCH, /* a fan-out thread's listener */
+    RESTART_LISTEN_ADMIN
+} RestartListenKind;
+
+typedef enum
+{
+    RESTART_SEAT_CONN, /* a player's socket: fd, then in_len and out_len bytes */
+    RESTART_SEAT_AWAY, /* nobody there now; may resume with the session */
+    RESTART_SEAT_BOT
+} RestartSeatKind;
+
+typedef struct
+{
+    char magic[8]; /* RESTART_MAGIC, not NUL-terminated */
+    uint32_t version;
+    uint32_t nfds;
+    uint64_t len;  /* image bytes */
+} RestartHeader;
+
+typedef struct
+{
+    uint8_t kind;  /* RestartListenKind */
+    int32_t port;
+    int32_t fd;    /* index into the image's fds */
+} RestartListener;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t round;
+    uint8_t state;          /* TableState */
+    uint8_t numPlayers;
+    uint8_t seated;         /* RestartSeats that follow */
+    uint8_t moves_received;
+    uint16_t away;
+    uint16_t last_result_len; /* bytes of the framed RESULT after the seats */
+    int32_t deadline_ms;    /* left before the move deadline, -1 = not armed */
+    uint8_t moves[MAX_PLAYERS];
+    int32_t scores[MAX_PLAYERS];
+} RestartTable;
+
+typedef struct
+{
+    uint8_t kind;       /* RestartSeatKind */
+    uint8_t mode;       /* ProtoMode */
+    int32_t fd;         /* index into the image's fds, or -1 */
+    uint64_t session;
+    uint64_t player;    /* score store id, 0 = unranked */
+    int64_t away_ms;    /* how long the seat has been away */
+    uint32_t in_len;    /* unparsed input that follows */
+    uint32_t out_len;   /* then output not yet written */
+    char name[SCORES_NAME_MAX];
+} RestartSeat;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    size_t pos;  /* reading: next byte */
+    int *fds;    /* reading: -1 once taken */
+    int nfds;
+    int cap_fds;
+    int owns_fds; /* received: fds nobody took are closed with the image */
+} RestartImage;
+
+/* Building an image (old process) */
+
+void restart_image_init(RestartImage *im);
+
+/* restart_put: append len bytes. Returns 0 or -1 if out of memory. */
+int restart_put(RestartImage *im, const void *p, size_t len);
+
+/* restart_put_rec: append a tag and its record. Returns 0 or -1. */
+int restart_put_rec(RestartImage *im, RestartRecType type, const void *rec, size_t len);
+
+/* restart_put_fd: add fd (not duplicated). Returns its index, or -1. */
+int restart_put_fd(RestartImage *im, int fd);
+
+/* Reading one (new process) */
+
+/* restart_get: copy the next len bytes to out (NULL skips). Returns 0 or -1 past the end. */
+int restart_get(RestartImage *im, void *out, size_t len);
+
+/* restart_take_fd: the fd at index, which the caller now owns; -1 if none. */
+int restart_take_fd(RestartImage *im, int index);
+
+/* restart_image_free: release the image (and a received one's fds nobody took). */
+void restart_image_free(RestartImage *im);
+
+/* The handover */
+
+/* restart_listen: the old process's socket at path (a stale one is replaced). */
+int restart_listen(const char *path);
+
+/* restart_accept: a taker from listen_fd, or -1 (also for another user's process). */
+int restart_accept(int listen_fd);
+
+/*
+ * restart_connect:
+ *   Connect to the server at path. Returns the socket, or -1 with errno
+ *   ENOENT or ECONNREFUSED if nobody is serving there.
+ */
+int restart_connect(const char *path);
+
+/* restart_send: the whole image and its fds. Returns 0 or -1. */
+int restart_send(int sock, const RestartImage *im);
+
+/* restart_recv: receive an image into im (initialized here). Returns 0 or -1. */
+int restart_recv(int sock, RestartImage *im);
+
+/* restart_signal / restart_wait: one byte each way, RESTART_ACK or _DONE. */
+int restart_signal(int sock, char what);
+int restart_wait(int sock, char what, int timeout_ms);
+
+#endif /* RESTART_H */
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * rules.c
+ *
+ * Game rules for "Rock, Paper, Scissors, Lizard, Spock": move parsing,
+ * naming, the "beats" relation and multi-player winner resolution.
+ ******************************************************************************/
+#include "rules.h"
+
+/* char_to_move: map single character to Move enum. */
+Move char_to_move(char c)
+{
+    switch (c)
+    {
+    case 'R':
+    case 'r':
+        return MOVE_ROCK;
+    case 'P':
+    case 'p':
+        return MOVE_PAPER;
+    case 'S':
+    case 's':
+        return MOVE_SCISSORS;
+    case 'L':
+    case 'l':
+        return MOVE_LIZARD;
+    case 'K':
+    case 'k':
+        return MOVE_SPOCK;
+    default:
+        return MOVE_INVALID;
+    }
+}
+
+/* move_to_string: return human-readable name of move. */
+const char *move_to_string(Move m)
+{
+    switch (m)
+    {
+    case MOVE_ROCK:
+        return "Rock";
+    case MOVE_PAPER:
+        return "Paper";
+    case MOVE_SCISSORS:
+        return "Scissors";
+    case MOVE_LIZARD:
+        return "Lizard";
+    case MOVE_SPOCK:
+        return "Spock";
+    default:
+        return "Invalid";
+    }
+}
+
+/*
+ * beats_mask[m]: bit n is set if move m beats move n.
+ *   Rock beats Scissors, Lizard      Paper beats Rock, Spock
+ *   Scissors beats Paper, Lizard     Lizard beats Paper, Spock
+ *   Spock beats Rock, Scissors
+ */
+static const unsigned char beats_mask[MOVE_INVALID] = {
+    [MOVE_ROCK] = MOVE_BIT(MOVE_SCISSORS) | MOVE_BIT(MOVE_LIZARD),
+    [MOVE_PAPER] = MOVE_BIT(MOVE_ROCK) | MOVE_BIT(MOVE_SPOCK),
+    [MOVE_SCISSORS] = MOVE_BIT(MOVE_PAPER) | MOVE_BIT(MOVE_LIZARD),
+    [MOVE_LIZARD] = MOVE_BIT(MOVE_PAPER) | MOVE_BIT(MOVE_SPOCK),
+    [MOVE_SPOCK] = MOVE_BIT(MOVE_ROCK) | MOVE_BIT(MOVE_SCISSORS),
+};
+
+/*
+ * dominant_mask[present]: for the set of moves played in a round (one bit
+ * per Move), the subset that is dominant, i.e. beats some played move and
+ * is beaten by none.  Derived from beats_mask; with five moves at most one
+ * move is ever dominant.
+ */
+static const unsigned char dominant_mask[1 << MOVE_INVALID] = {
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x01, 0x04, 0x00,
+    0x00, 0x01, 0x08, 0x00, 0x04, 0x01, 0x04, 0x00,
+    0x00, 0x10, 0x02, 0x02, 0x10, 0x10, 0x00, 0x00,
+    0x08, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* "beats": Return 1 if m1 beats m2 under RPSLS rules, else 0. */
+int beats(Move m1, Move m2)
+{
+    if ((unsigned)m1 >= MOVE_INVALID || (unsigned)m2 >= MOVE_INVALID)
+    {
+        return 0;
+    }
+    return (beats_mask[m1] >> m2) & 1;
+}
+
+/* dominant_moves: look up the dominant subset of a present-moves mask. */
+unsigned dominant_moves(unsigned present)
+{
+    return dominant_mask[present & ((1u << MOVE_INVALID) - 1)];
+}
+
+/*
+ * determine_multiplayer_winners:
+ *   Find all "dominant" moves. Each dominant move's players get +1.
+ *   A move is "dominant" if it is not beaten by any other move, and it beats
+ *   at least one other move in this round (so it’s not a pointless same-same scenario).
+ *
+ *   One pass collects the set of moves played, one table lookup gives the
+ *   dominant set, and a second pass picks out the players who played it,
+ *   so the cost is linear in numPlayers.
+ *
+ *   winners[] is an OUT array of indices of players who have a dominant move.
+ *   *pNumWinners is how many entries are in winners[].
+ */
+void determine_multiplayer_winners(Move moves[], int numPlayers,
+                                   int winners[], int *pNumWinners)
+{
+    // 1) Which moves were played at all (invalid moves are ignored)
+    unsigned present = 0;
+    for (int i = 0; i < numPlayers; i++)
+    {
+        if ((unsigned)moves[i] < MOVE_INVALID)
+        {
+            present |= MOVE_BIT(moves[i]);
+        }
+    }
+
+    // 2) Fill winners[] with everyone who played a dominant move
+    unsigned dominant = dominant_moves(present);
+    int count = 0;
+    if (dominant)
+    {
+        for (int i = 0; i < numPlayers; i++)
+        {
+            if ((unsigned)moves[i] < MOVE_INVALID && (dominant & MOVE_BIT(moves[i])))
+            {
+                winners[count++] = i;
+            }
+        }
+    }
+    *pNumWinners = count;
+}
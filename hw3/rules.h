@@ -0,0 +1,56 @@
+/******************************************************************************
+ * rules.h
+ *
+ * Game rules shared by the spock server modules.
+ ******************************************************************************/
+#ifndef RULES_H
+#define RULES_H
+
+#define MAX_PLAYERS 16
+
+/* Moves enumeration */
+typedef enum
+{
+    MOVE_ROCK,
+    MOVE_PAPER,
+    MOVE_SCISSORS,
+    MOVE_LIZARD,
+    MOVE_SPOCK,
+    MOVE_INVALID
+} Move;
+
+/* MOVE_BIT: a move's bit in a set of moves (see dominant_moves). */
+#define MOVE_BIT(m) (1u << (m))
+
+/* char_to_move: map single character to Move enum. */
+Move char_to_move(char c);
+
+/* move_to_string: return human-readable name of move. */
+const char *move_to_string(Move m);
+
+/* "beats": Return 1 if m1 beats m2 under RPSLS rules, else 0. */
+int beats(Move m1, Move m2);
+
+/*
+ * dominant_moves:
+ *   Given the set of moves played in a round (MOVE_BIT()s or-ed together),
+ *   return the subset that is dominant (see below). A single table lookup.
+ */
+unsigned dominant_moves(unsigned present);
+
+/*
+ * determine_multiplayer_winners:
+ *   Identifies all "dominant" moves in this round.
+ *   A move M_i is "dominant" if:
+ *      (1) It beats at least one other move in the round.
+ *      (2) It is NOT beaten by any other move in the round.
+ *   Everyone who played M_i gets +1 to score.
+ *
+ *   @param moves[]: array of size numPlayers with each player's Move.
+ *   @param winners[]: out-parameter to store the indices (0-based) of winners
+ *   @param pNumWinners: out-parameter storing how many winners found
+ */
+void determine_multiplayer_winners(Move moves[], int numPlayers,
+                                   int winners[], int *pNumWinners);
+
+#endif /* RULES_H */
@@ -0,0 +1,187 @@
+/******************************************************************************
+ * scores.h
+ *
+ * Persistent per-player scores and the leaderboard for spock_server.
+ *
+ *   - A player who joins under a player id ("@<id>" in JOIN; spock_client
+ *     --player) has their round wins and rounds played kept across games,
+ *     disconnects and restarts. Anonymous players are not recorded.
+ *   - Game threads never touch the store: as with the event log, each
+ *     shard appends ScoreEvents (the id once at join, then one per seat per
+ *     RESULT) to its own lock-free SPSC ring, and a full ring drops and
+ *     counts instead of stalling a table. The main thread drains the rings
+ *     every SCORES_DRAIN_MS and owns everything below.
+ *   - In memory, players live in a dense array reached through an open
+ *     addressing hash of their id. The SCORES_TOP_K players with the most
+ *     wins are kept in order as results come in: wins only grow, so a
+ *     player climbs by swaps with the one above and a newcomer only has to
+ *     beat last place. A leaderboard query never scans the players.
+ *   - On disk, FILE is an append log, memory-mapped and grown in steps: a
+ *     header, then a ScoreRecord with a player's new totals each time they
+ *     change (once per drain, however many rounds that was). Totals, not
+ *     deltas, so a record replayed twice does no harm.
+ *   - Once the log holds more records than there are players (and at
+ *     least SCORES_COMPACT_MIN), it is compacted: every player goes to
+ *     FILE.snap (written aside, synced and renamed into place, with the
+ *     next generation number) and the log starts over in that generation.
+ *   - Opening maps FILE.snap once and loads it, then replays the log tail
+ *     written since; a log from an older generation is already in the
+ *     snapshot. A record that fails its checksum (torn by a crash) ends the
+ *     replay, and the log continues from there.
+ ******************************************************************************/
+#ifndef SCORES_H
+#define SCORES_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SCORES_MAGIC "SPOCKSCR"   /* the log */
+#define SCORES_SNAP_MAGIC "SPOCKSNP"
+#define SCORES_VERSION 1
+#define SCORES_NAME_MAX 16        /* player id bytes, NUL included */
+#define SCORES_RING_SIZE 16384    /* events per shard ring; a power of two */
+#define SCORES_DRAIN_MS 10        /* main thread's drain interval */
+#define SCORES_SYNC_MS 1000       /* log writeback at most this often */
+#define SCORES_TOP_K 100
+#define SCORES_COMPACT_MIN 65536  /* log records before compaction is considered */
+
+typedef enum
+{
+    SCORE_NAME = 1, /* a player joined under name */
+    SCORE_ROUND     /* a player's round was resolved; won says how */
+} ScoreEventType;
+
+typedef struct
+{
+    uint64_t player;            /* scores_player_id() */
+    uint8_t type;               /* ScoreEventType */
+    uint8_t won;
+    char name[SCORES_NAME_MAX]; /* SCORE_NAME only, NUL-padded */
+} ScoreEvent;
+
+typedef struct
+{
+    _Alignas(64) atomic_uint head; /* next slot to write (shard) */
+    _Alignas(64) atomic_uint tail; /* next slot to read (main thread) */
+    _Alignas(64) atomic_ulong dropped;
+    ScoreEvent slots[SCORES_RING_SIZE];
+} ScoreRing;
+
+/* One player's totals, in the log and the snapshot (host byte order). */
+typedef struct
+{
+    char name[SCORES_NAME_MAX];
+    uint32_t wins;
+    uint32_t rounds;
+    uint32_t reserved;
+    uint32_t check; /* checksum of the fields above; never 0, which ends the log */
+} ScoreRecord;
+
+_Static_assert(sizeof(ScoreRecord) == 32, "ScoreRecord layout is the file format");
+
+typedef struct
+{
+    char magic[8];       /* SCORES_MAGIC or SCORES_SNAP_MAGIC, not NUL-terminated */
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t generation; /* log: the snapshot it continues; snapshot: its own */
+    uint64_t count;      /* snapshot: records that follow */
+} ScoreFileHeader;
+
+typedef struct
+{
+    uint64_t id;
+    char name[SCORES_NAME_MAX];
+    uint32_t wins;
+    uint32_t rounds;
+    int32_t rank;        /* index into the leaderboard, -1 if not on it */
+    uint32_t next_dirty; /* changed since the last drain: next one + 1, or 0 */
+    uint8_t dirty;
+} ScorePlayer;
+
+typedef struct
+{
+    ScoreRing *rings;
+    int nrings;
+    char *log_path;
+    char *snap_path;
+    int log_fd;
+    uint8_t *log_map;
+    size_t log_cap;       /* bytes mapped, the file's size */
+    size_t log_used;      /* header and valid records */
+    uint64_t generation;
+    long long synced_ms;  /* last writeback of the log */
+    int unsynced;
+
+    ScorePlayer *players;
+    uint32_t nplayers;
+    uint32_t players_cap;
+    uint32_t *index;      /* hash slots: player index + 1, 0 = empty */
+    uint32_t index_mask;
+    uint32_t dirty_head;  /* first changed player + 1, or 0 */
+    uint32_t top[SCORES_TOP_K]; /* player indices, most wins first */
+    int ntop;
+
+    unsigned long compactions;
+    unsigned long unknown; /* results for players whose SCORE_NAME was dropped */
+} ScoreStore;
+
+/*
+ * scores_open:
+ *   Load the store kept in path (and path.snap), creating it if missing,
+ *   and allocate nrings rings. Returns 0 or -1.
+ */
+int scores_open(ScoreStore *s, const char *path, int nrings);
+
+/*
+ * scores_drain:
+ *   Main thread: apply every event pushed so far, append the changed totals
+ *   to the log, and compact or write back when due. Returns events applied.
+ */
+int scores_drain(ScoreStore *s);
+
+/* scores_compact: snapshot every player and start a new log. Returns 0 or -1. */
+int scores_compact(ScoreStore *s);
+
+/*
+ * scores_stop:
+ *   Drain, compact and close the files. The rings stay valid (later pushes
+ *   are just never applied), so the shards need not be stopped first.
+ */
+void scores_stop(ScoreStore *s);
+
+/* scores_top: up to k leaderboard entries, most wins first. Returns how many. */
+int scores_top(const ScoreStore *s, const ScorePlayer **out, int k);
+
+/* scores_find: a player by id, or NULL. */
+const ScorePlayer *scores_find(const ScoreStore *s, const char *name);
+
+/* scores_valid_name: 1..SCORES_NAME_MAX-1 letters, digits, '.', '_' or '-'. */
+int scores_valid_name(const char *name, size_t len);
+
+/* scores_player_id: the hash a name is known by (never 0). */
+uint64_t scores_player_id(const char *name, size_t len);
+
+/*
+ * scoring_push:
+ *   Append e (shard thread only). Returns 0, or -1 if the ring was full
+ *   and the event was dropped.
+ */
+static inline int scoring_push(ScoreRing *r, const ScoreEvent *e)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == SCORES_RING_SIZE)
+    {
+        atomic_store_explicit(&r->dropped,
+                              atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return -1;
+    }
+    r->slots[head & (SCORES_RING_SIZE - 1)] = *e;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+#endif /* SCORES_H */
@@ -0,0 +1,361 @@
+/******************************************************************************
+ * seat.c
+ *
+ * In-process seats (see seat.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bot.h"
+#include "seat.h"
+
+#define CONSOLE_LINE 256
+
+typedef struct
+{
+    Conn *conn;        /* NULL until seated */
+    Lobby *lobby;
+    int stdin_flags;   /* restored when the seat closes */
+    int *closed;
+    size_t len;        /* bytes of a line not yet complete */
+    char line[CONSOLE_LINE];
+    ProtoParser in;    /* what the table sent, framed */
+} Console;
+
+typedef struct
+{
+    Conn *conn;
+    const BotStrategy *strategy;
+    Timer think;      /* armed when a round starts */
+    uint8_t state[];  /* the strategy's, strategy->state_size bytes */
+} Bot;
+
+static void console_deliver(void *arg, const OutBuf *b);
+static void console_close(void *arg);
+static void console_prompt(void);
+static int console_command(Console *s, const char *line);
+static void on_console_input(Reactor *r, int fd, unsigned events, void *arg);
+static void bot_deliver(void *arg, const OutBuf *b);
+static void bot_close(void *arg);
+static void on_bot_think(Timer *tm, void *arg);
+static int seat_send(Conn *c, uint8_t op, const void *payload, size_t len);
+
+static const SeatOps console_ops = {"console", 0, console_deliver, console_close};
+static const SeatOps bot_ops = {"bot", 1, bot_deliver, bot_close};
+
+Conn *seat_console_open(Lobby *l, int *closed)
+{
+    Console *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    s->lobby = l;
+    s->closed = closed;
+    proto_parser_init(&s->in);
+    s->in.mode = PROTO_BINARY;
+    s->stdin_flags = fcntl(STDIN_FILENO, F_GETFL);
+    if (s->stdin_flags < 0 || set_nonblocking(STDIN_FILENO) < 0 ||
+        reactor_add(l->reactor, STDIN_FILENO, REACTOR_READ, on_console_input, s) < 0)
+    {
+        // e.g. stdin redirected from a regular file, which epoll refuses
+        fprintf(stderr, "The console seat needs stdin to be a terminal or a pipe.\n");
+        if (s->stdin_flags >= 0)
+            fcntl(STDIN_FILENO, F_SETFL, s->stdin_flags);
+        free(s);
+        return NULL;
+    }
+
+    Conn *c = lobby_open_seat(l, &console_ops, s);
+    if (!c)
+    {
+        return NULL; // console_close freed s
+    }
+    s->conn = c;
+    printf("[Console] You are Player %d at Table %u.\n", c->seat + 1, c->table->id);
+    console_prompt();
+    return c;
+}
+
+Conn *seat_bot_open(Lobby *l)
+{
+    const BotStrategy *strategy = l->bot_strategy ? l->bot_strategy : bot_strategy("uniform");
+    Bot *b = calloc(1, sizeof(*b) + strategy->state_size);
+    if (!b)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    b->strategy = strategy;
+    timer_init(&b->think, on_bot_think, b);
+
+    Conn *c = lobby_open_seat(l, &bot_ops, b);
+    if (!c)
+    {
+        return NULL; // bot_close freed b
+    }
+    b->conn = c;
+    timer_arm(reactor_timers(l->reactor), &b->think, reactor_now_ms() + l->bot_think_ms);
+    return c;
+}
+
+Conn *seat_bot_restore(Table *t, int i)
+{
+    Lobby *l = t->lobby;
+    const BotStrategy *strategy = l->bot_strategy ? l->bot_strategy : bot_strategy("uniform");
+    Bot *b = calloc(1, sizeof(*b) + strategy->state_size);
+    if (!b)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    b->strategy = strategy;
+    timer_init(&b->think, on_bot_think, b);
+
+    Conn *c = table_open_seat(t, i, &bot_ops, b);
+    if (!c)
+    {
+        return NULL;
+    }
+    b->conn = c;
+    if (t->moves[i] == MOVE_INVALID)
+    {
+        timer_arm(reactor_timers(l->reactor), &b->think, reactor_now_ms() + l->bot_think_ms);
+    }
+    return c;
+}
+
+int seat_is_bot(const Conn *c)
+{
+    return c->ops == &bot_ops;
+}
+
+int seat_bot_table(Lobby *l)
+{
+    Conn *c;
+    do
+    {
+        if (!(c = seat_bot_open(l)))
+        {
+            return -1;
+        }
+    } while (c->table->state == TABLE_FORMING);
+    return 0;
+}
+
+/* console_deliver: print one message from the table. */
+static void console_deliver(void *arg, const OutBuf *b)
+{
+    Console *s = arg;
+    size_t avail;
+    uint8_t *space = proto_parser_space(&s->in, &avail);
+    size_t n = b->end - b->start;
+    if (n > avail)
+    {
+        return; // a frame never outgrows the parser
+    }
+    memcpy(space, b->data + b->start, n);
+    proto_parser_commit(&s->in, n);
+
+    ProtoFrame f;
+    while (proto_next(&s->in, &f) == 1)
+    {
+        int len = (int)f.len;
+        const char *p = (const char *)f.payload;
+        switch (f.op)
+        {
+        case PROTO_OP_RESULT:
+        {
+            // "<winners>:<moves>:<scores>"
+            const char *moves = memchr(p, ':', f.len);
+            const char *scores = moves ? memchr(moves + 1, ':', p + len - moves - 1) : NULL;
+            if (!scores)
+            {
+                printf("[Console] Round result: %.*s\n", len, p);
+            }
+            else
+            {
+                printf("[Console] Moves %.*s => winner(s) %.*s, scores %.*s\n",
+                       (int)(scores - moves - 1), moves + 1, (int)(moves - p), p,
+                       (int)(p + len - scores - 1), scores + 1);
+            }
+            console_prompt();
+            break;
+        }
+        case PROTO_OP_RESET:
+            printf("[Console] Scores reset.\n");
+            console_prompt();
+            break;
+        case PROTO_OP_QUIT:
+            printf("[Console] Game over.\n");
+            break;
+        case PROTO_OP_INFO:
+            printf("[Console] %.*s\n", len, p);
+            break;
+        default:
+            break;
+        }
+    }
+    fflush(stdout);
+}
+
+/* console_close: the table is done with us; give stdin back. */
+static void console_close(void *arg)
+{
+    Console *s = arg;
+    reactor_del(s->lobby->reactor, STDIN_FILENO);
+    fcntl(STDIN_FILENO, F_SETFL, s->stdin_flags);
+    if (s->conn)
+    {
+        printf("[Console] Left the table.\n");
+        fflush(stdout);
+    }
+    if (s->closed)
+    {
+        *s->closed = 1;
+    }
+    free(s);
+}
+
+static void console_prompt(void)
+{
+    printf("Enter move (R/P/S/L/K), T=reset, Q=quit: ");
+    fflush(stdout);
+}
+
+/* console_command: act on one typed line. Returns -1 if the seat is gone. */
+static int console_command(Console *s, const char *line)
+{
+    while (isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    char cmd = (char)toupper((unsigned char)*line);
+    if (cmd == '\0')
+    {
+        console_prompt();
+        return 0;
+    }
+    if (cmd == 'Q')
+    {
+        printf("[Console] You quit.\n");
+        return seat_send(s->conn, PROTO_OP_QUIT, NULL, 0);
+    }
+    if (cmd == 'T')
+    {
+        return seat_send(s->conn, PROTO_OP_RESET, NULL, 0);
+    }
+    if (char_to_move(cmd) == MOVE_INVALID)
+    {
+        printf("Invalid input. Try again.\n");
+        console_prompt();
+        return 0;
+    }
+    printf("[Console] Waiting for the other players...\n");
+    fflush(stdout);
+    return seat_send(s->conn, PROTO_OP_MOVE, &cmd, 1);
+}
+
+/*
+ * on_console_input:
+ *   Reactor callback for stdin. Read (edge-triggered: until it would
+ *   block) and run every complete line; end of input quits.
+ */
+static void on_console_input(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    Console *s = arg;
+
+    while (1)
+    {
+        ssize_t n = read(fd, s->line + s->len, sizeof(s->line) - 1 - s->len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            perror("read stdin");
+            n = 0;
+        }
+        if (n == 0)
+        {
+            seat_send(s->conn, PROTO_OP_QUIT, NULL, 0); // frees s
+            return;
+        }
+        s->len += (size_t)n;
+        s->line[s->len] = '\0';
+
+        char *start = s->line;
+        char *nl;
+        while ((nl = strchr(start, '\n')) != NULL)
+        {
+            *nl = '\0';
+            if (console_command(s, start) < 0)
+            {
+                return;
+            }
+            start = nl + 1;
+        }
+        s->len = strlen(start);
+        if (s->len == sizeof(s->line) - 1)
+        {
+            s->len = 0; // a line too long to be a command
+        }
+        memmove(s->line, start, s->len);
+    }
+}
+
+/*
+ * bot_deliver:
+ *   A RESULT ends a round: the table still holds its moves, so the
+ *   strategy looks at them now. A RESULT or RESET starts the next round.
+ */
+static void bot_deliver(void *arg, const OutBuf *b)
+{
+    Bot *bot = arg;
+    uint8_t op = b->data[b->start];
+    if (op == PROTO_OP_RESULT && bot->strategy->observe && bot->conn->table)
+    {
+        bot->strategy->observe(bot->state, bot->conn->table, bot->conn->seat);
+    }
+    if ((op == PROTO_OP_RESULT || op == PROTO_OP_RESET) && !timer_armed(&bot->think))
+    {
+        Lobby *l = bot->conn->lobby;
+        timer_arm(reactor_timers(l->reactor), &bot->think, reactor_now_ms() + l->bot_think_ms);
+    }
+}
+
+static void bot_close(void *arg)
+{
+    Bot *bot = arg;
+    if (bot->conn)
+    {
+        timer_cancel(reactor_timers(bot->conn->lobby->reactor), &bot->think);
+    }
+    free(bot);
+}
+
+static void on_bot_think(Timer *tm, void *arg)
+{
+    (void)tm;
+    Bot *bot = arg;
+    Conn *c = bot->conn;
+
+    char move = "RPSLK"[bot->strategy->choose(bot->state, c->table, c->seat)];
+    metric_add(&c->lobby->metrics, METRIC_BOT_MOVES, 1);
+    seat_send(c, PROTO_OP_MOVE, &move, 1);
+}
+
+/* seat_send: one command from a seat to its table. Returns -1 if c is gone. */
+static int seat_send(Conn *c, uint8_t op, const void *payload, size_t len)
+{
+    return conn_command(c, op, payload, len);
+}
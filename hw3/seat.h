@@ -0,0 +1,55 @@
+/******************************************************************************
+ * seat.h
+ *
+ * In-process seats: players that sit at a table without a socket.
+ *
+ *   - Every seat is a Conn (table.h) with SeatOps, so tables treat the
+ *     server's console, bots and network players alike. Each seat plays at
+ *     its own pace on the lobby's event loop; nobody waits for anybody to
+ *     collect their move.
+ *   - The console seat reads commands from stdin without blocking: R, P,
+ *     S, L or K to move, T to reset the scores, Q to quit. It prints what
+ *     the table sends it. End of input is a QUIT.
+ *   - A bot plays the lobby's bot_strategy (bot.h): it observes each
+ *     result straight from the table, and moves bot_think_ms after its
+ *     round starts (at the earliest on the next loop iteration: it may not
+ *     answer from inside the broadcast that started the round). Its move
+ *     goes to the table as a command, with no encoding or parsing.
+ *   - A table can be all bots (seat_bot_table()): it plays round after
+ *     round on its own, for capacity and soak tests. Bots log nothing.
+ *   - Like the lobby they sit in, seats are single-threaded.
+ ******************************************************************************/
+#ifndef SEAT_H
+#define SEAT_H
+
+#include "table.h"
+
+/*
+ * seat_console_open:
+ *   Seat the server's console at l's forming table. *closed (if not NULL)
+ *   is set once the seat has left, i.e. its table is over. Only one console
+ *   seat may be open at a time. Returns NULL on error.
+ */
+Conn *seat_console_open(Lobby *l, int *closed);
+
+/* seat_bot_open: seat a bot at l's forming table. Returns NULL on error. */
+Conn *seat_bot_open(Lobby *l);
+
+/*
+ * seat_bot_restore:
+ *   A bot in empty seat i of a table being restored after a hot restart,
+ *   with a fresh strategy state; it moves unless the seat already has.
+ */
+Conn *seat_bot_restore(Table *t, int i);
+
+/* seat_is_bot: whether c is a bot's seat. */
+int seat_is_bot(const Conn *c);
+
+/*
+ * seat_bot_table:
+ *   Seat bots at l's forming table until it starts (a new one if nobody is
+ *   waiting). Returns 0, or -1 on error.
+ */
+int seat_bot_table(Lobby *l);
+
+#endif /* SEAT_H */
@@ -0,0 +1,232 @@
+/******************************************************************************
+ * shard.c
+ *
+ * Per-thread event loop, cross-shard player handoff and stats publishing.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "shard.h"
+#include "dgram.h"
+
+#define HANDOFF_BATCH MAX_PLAYERS
+
+static void *shard_main(void *arg);
+static void on_wake(Reactor *r, int fd, unsigned events, void *arg);
+static void shard_handoff(Shard *s);
+static void shard_send(Shard *to, Conn *c);
+static void shard_route(void *arg, Conn *c, int owner);
+static void shard_publish(Shard *s);
+static void shard_wake(Shard *s);
+static void shard_drain(Shard *s);
+
+int shard_init(Shard *s, int index, int nshards, int listen_fd,
+               int numPlayers, ReactorBackend backend, Shard *peers)
+{
+    memset(s, 0, sizeof(*s));
+    s->index = index;
+    s->peers = peers ? peers : s;
+    s->nshards = peers ? nshards : 1;
+    s->home = &s->peers[0];
+    mpsc_init(&s->inbox);
+
+    s->reactor = reactor_create(backend);
+    if (!s->reactor)
+    {
+        return -1;
+    }
+
+    if (pipe(s->wake_fds) < 0)
+    {
+        perror("pipe");
+        reactor_destroy(s->reactor);
+        return -1;
+    }
+    if (set_nonblocking(s->wake_fds[0]) < 0 || set_nonblocking(s->wake_fds[1]) < 0 ||
+        reactor_add(s->reactor, s->wake_fds[0], REACTOR_READ, on_wake, s) < 0)
+    {
+        perror("shard wakeup");
+        close(s->wake_fds[0]);
+        close(s->wake_fds[1]);
+        reactor_destroy(s->reactor);
+        return -1;
+    }
+
+    if (lobby_init(&s->lobby, s->reactor, listen_fd, numPlayers) < 0)
+    {
+        close(s->wake_fds[0]);
+        close(s->wake_fds[1]);
+        reactor_destroy(s->reactor);
+        return -1;
+    }
+    /* table ids: shard i hands out i+1, i+1+n, i+1+2n, ... */
+    s->lobby.next_table_id = index + 1;
+    s->lobby.table_id_step = nshards;
+    s->lobby.route = shard_route;
+    s->lobby.route_arg = s;
+    return 0;
+}
+
+int shard_start(Shard *s)
+{
+    int err = pthread_create(&s->thread, NULL, shard_main, s);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+void shard_pause(Shard *s)
+{
+    atomic_store(&s->pause, 1);
+    shard_wake(s);
+}
+
+void shard_join(Shard *s)
+{
+    pthread_join(s->thread, NULL);
+}
+
+void shard_settle(Shard *s)
+{
+    shard_drain(s);
+}
+
+int shard_resume(Shard *s)
+{
+    atomic_store(&s->pause, 0);
+    lobby_unpause(&s->lobby);
+    return shard_start(s);
+}
+
+static void *shard_main(void *arg)
+{
+    Shard *s = arg;
+    Lobby *l = &s->lobby;
+
+    while (1)
+    {
+        /* sleep until the forming table's handoff deadline at most;
+         * reactor_poll() also wakes for the move and grace timers */
+        int timeout = -1;
+        if (s->home != s && l->forming && l->forming->seated > 0)
+        {
+            long long left = l->forming_since_ms + SHARD_HANDOFF_MS - reactor_now_ms();
+            timeout = (left > 0) ? (int)left : 0;
+        }
+
+        if (reactor_poll(s->reactor, timeout) < 0)
+        {
+            fprintf(stderr, "[Server] Shard %d event loop failed.\n", s->index);
+            break;
+        }
+        if (l->udp)
+        {
+            dgram_flush(l->udp); // everything this iteration queued for UDP players
+        }
+
+        if (s->home != s && l->forming && l->forming->seated > 0 &&
+            reactor_now_ms() - l->forming_since_ms >= SHARD_HANDOFF_MS)
+        {
+            shard_handoff(s);
+        }
+        shard_publish(s);
+
+        if (atomic_load(&s->pause))
+        {
+            // let the kernel finish the streams' receives and sends first
+            lobby_pause(l);
+            long long until = reactor_now_ms() + SHARD_PAUSE_MS;
+            while (lobby_busy(l) && reactor_now_ms() < until &&
+                   reactor_poll(s->reactor, 10) >= 0)
+            {
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * shard_handoff:
+ *   Nobody else showed up at this shard's forming table in time; move the
+ *   waiting players to the home shard so they can be matched there.
+ */
+static void shard_handoff(Shard *s)
+{
+    Conn *conns[HANDOFF_BATCH];
+    int n = lobby_release_forming(&s->lobby, conns, HANDOFF_BATCH);
+
+    for (int i = 0; i < n; i++)
+    {
+        shard_send(s->home, conns[i]);
+    }
+    if (n > 0)
+    {
+        atomic_fetch_add_explicit(&s->stat_handoffs_out, n, memory_order_relaxed);
+        printf("[Server] Shard %d: handed %d waiting player(s) to shard %d.\n",
+               s->index, n, s->home->index);
+    }
+}
+
+/* shard_send: queue a detached connection on another shard and wake it. */
+static void shard_send(Shard *to, Conn *c)
+{
+    mpsc_push(&to->inbox, &c->qnode);
+    shard_wake(to);
+}
+
+/* shard_wake: interrupt s's reactor_poll(). */
+static void shard_wake(Shard *s)
+{
+    /* a full pipe already means "wake up", so EAGAIN is fine */
+    ssize_t w = write(s->wake_fds[1], "h", 1);
+    (void)w;
+}
+
+/* shard_route: Lobby callback for a player resuming a session elsewhere. */
+static void shard_route(void *arg, Conn *c, int owner)
+{
+    Shard *s = arg;
+
+    atomic_fetch_add_explicit(&s->stat_handoffs_out, 1, memory_order_relaxed);
+    shard_send(&s->peers[owner], c);
+}
+
+/* on_wake: adopt every player other shards handed to us. */
+static void on_wake(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    Shard *s = arg;
+    char drain[64];
+
+    while (read(fd, drain, sizeof(drain)) > 0)
+    {
+    }
+    shard_drain(s);
+}
+
+/* shard_drain: adopt what is in s's inbox. */
+static void shard_drain(Shard *s)
+{
+    MpscNode *node;
+    while ((node = mpsc_pop(&s->inbox)) != NULL)
+    {
+        Conn *c = MPSC_ENTRY(node, Conn, qnode);
+        atomic_fetch_add_explicit(&s->stat_handoffs_in, 1, memory_order_relaxed);
+        lobby_adopt(&s->lobby, c);
+    }
+}
+
+static void shard_publish(Shard *s)
+{
+    atomic_store_explicit(&s->stat_live_tables, s->lobby.live_tables, memory_order_relaxed);
+    atomic_store_explicit(&s->stat_playing_tables, s->lobby.playing_tables, memory_order_relaxed);
+    atomic_store_explicit(&s->stat_connections, s->lobby.connections, memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ * shard.h
+ *
+ * One event-loop thread of spock_server.
+ *
+ *   - Every shard owns a Reactor, its own SO_REUSEPORT listening socket and
+ *     a Lobby with its own tables, so the hot path shares no locks: a table
+ *     lives on the thread that owns its players' fds.
+ *   - A player left waiting at a half-empty table for SHARD_HANDOFF_MS is
+ *     moved to the home shard (shard 0) through that shard's lock-free MPSC
+ *     handoff queue, so stragglers spread across shards still get matched.
+ *   - A player resuming a session that lives on another shard is routed to
+ *     it through the same MPSC queue (the table id names the shard).
+ *   - Table counts are published through relaxed atomics for reporting.
+ *   - For a hot restart (restart.h) the main thread pauses every shard:
+ *     the shard stops accepting, lets its io_uring streams finish what the
+ *     kernel has in hand (SHARD_PAUSE_MS at most) and its thread exits, so
+ *     the main thread can save its tables. They resume if it falls through.
+ ******************************************************************************/
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "mpsc.h"
+#include "reactor.h"
+#include "table.h"
+
+#define SHARD_HANDOFF_MS 100
+#define SHARD_PAUSE_MS 200 /* the longest a pausing shard waits for its streams */
+
+typedef struct shard
+{
+    int index;
+    pthread_t thread;
+    Reactor *reactor;
+    Lobby lobby;
+    struct shard *home; /* where stragglers are sent; home->home == home */
+    struct shard *peers; /* all shards, peers[index] == this one */
+    int nshards;
+
+    /* handoff inbox: other shards push, this shard pops */
+    MpscQueue inbox;
+    int wake_fds[2]; /* pipe: written after a push to wake the reactor */
+    atomic_int pause; /* shard_pause(): leave the event loop */
+
+    /* published for the stats reporter (written only by this shard) */
+    atomic_int stat_live_tables;
+    atomic_int stat_playing_tables;
+    atomic_int stat_connections;
+    atomic_long stat_handoffs_out;
+    atomic_long stat_handoffs_in;
+} Shard;
+
+/*
+ * shard_init:
+ *   Set up shard number index of the nshards in peers[] around an already
+ *   listening socket. peers[0] is the home shard. Returns 0 or -1.
+ */
+int shard_init(Shard *s, int index, int nshards, int listen_fd,
+               int numPlayers, ReactorBackend backend, Shard *peers);
+
+/* shard_start: run the shard's event loop on a new thread. */
+int shard_start(Shard *s);
+
+/* shard_pause: ask the shard's thread to pause its lobby and exit. */
+void shard_pause(Shard *s);
+
+/* shard_join: wait for a paused shard's thread to exit. */
+void shard_join(Shard *s);
+
+/*
+ * shard_settle:
+ *   Adopt the players other shards handed to s before they paused (every
+ *   shard's thread has exited), so they are saved with s.
+ */
+void shard_settle(Shard *s);
+
+/* shard_resume: undo shard_pause and run the event loop again. */
+int shard_resume(Shard *s);
+
+#endif /* SHARD_H */
@@ -0,0 +1,123 @@
+/******************************************************************************
+ * slab.c
+ *
+ * Fixed-size object pools (see slab.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+struct slab_free
+{
+    SlabFree *next;
+};
+
+/* Each chunk starts with one cache line naming its owner. */
+typedef struct
+{
+    Slab *owner;
+} SlabChunk;
+
+static void slab_grow(Slab *s);
+static void slab_publish(atomic_long *v, long delta);
+
+void slab_init(Slab *s, const char *name, size_t size)
+{
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->size = (size + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+    if (s->size > SLAB_CHUNK - SLAB_ALIGN)
+    {
+        fprintf(stderr, "slab %s: %zu-byte objects do not fit a chunk\n", name, size);
+        abort();
+    }
+    atomic_init(&s->remote, NULL);
+    atomic_init(&s->in_use, 0);
+    atomic_init(&s->capacity, 0);
+}
+
+void *slab_alloc(Slab *s)
+{
+    if (!s->free_list)
+    {
+        // what other threads freed, all at once
+        SlabFree *list = atomic_exchange_explicit(&s->remote, NULL, memory_order_acquire);
+        long n = 0;
+        for (SlabFree *f = list; f; f = f->next)
+            n++;
+        s->free_list = list;
+        slab_publish(&s->in_use, -n);
+    }
+    if (!s->free_list)
+    {
+        slab_grow(s);
+        if (!s->free_list)
+        {
+            return NULL;
+        }
+    }
+    SlabFree *f = s->free_list;
+    s->free_list = f->next;
+    slab_publish(&s->in_use, 1);
+    memset(f, 0, s->size);
+    return f;
+}
+
+void slab_free(Slab *mine, void *p)
+{
+    if (!p)
+    {
+        return;
+    }
+    SlabChunk *chunk = (SlabChunk *)((uintptr_t)p & ~(uintptr_t)(SLAB_CHUNK - 1));
+    Slab *owner = chunk->owner;
+    SlabFree *f = p;
+
+    if (owner == mine)
+    {
+        f->next = mine->free_list;
+        mine->free_list = f;
+        slab_publish(&mine->in_use, -1);
+        return;
+    }
+    // push only: the owner takes the whole list, so there is no ABA
+    SlabFree *head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+    do
+    {
+        f->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, f,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/* slab_grow: carve one more chunk into free objects. */
+static void slab_grow(Slab *s)
+{
+    SlabChunk *chunk = aligned_alloc(SLAB_CHUNK, SLAB_CHUNK);
+    if (!chunk)
+    {
+        perror("slab");
+        return;
+    }
+    chunk->owner = s;
+
+    char *base = (char *)chunk + SLAB_ALIGN;
+    size_t n = (SLAB_CHUNK - SLAB_ALIGN) / s->size;
+    for (size_t i = n; i-- > 0;)
+    {
+        SlabFree *f = (SlabFree *)(base + i * s->size);
+        f->next = s->free_list;
+        s->free_list = f; // lowest address first out
+    }
+    slab_publish(&s->capacity, (long)n);
+}
+
+/* slab_publish: single-writer update of a reported count. */
+static void slab_publish(atomic_long *v, long delta)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + delta,
+                          memory_order_relaxed);
+}
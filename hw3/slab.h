@@ -0,0 +1,56 @@
+/******************************************************************************
+ * slab.h
+ *
+ * Fixed-size object pools for per-connection and per-table state.
+ *
+ *   - A Slab hands out objects of one size class, carved from SLAB_CHUNK
+ *     sized, SLAB_CHUNK aligned chunks. Freed objects go on an intrusive
+ *     free list and are handed out again most-recently-freed first, while
+ *     they are still in cache; joins and leaves never reach malloc once
+ *     the pool has grown to the working set.
+ *   - Objects are rounded up to whole cache lines, so two never share one.
+ *   - A slab belongs to one thread (its lobby's). An object may be freed
+ *     by another thread, as a Conn that moved shards is: it goes on the
+ *     owner's remote list (one lock-free push), which the owner takes back
+ *     in one exchange when its own free list runs dry.
+ *   - Chunks live as long as the process: an object from one may still be
+ *     in use on another shard when its owner shuts down.
+ ******************************************************************************/
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SLAB_CHUNK (64 * 1024)
+#define SLAB_ALIGN 64 /* cache line */
+
+typedef struct slab_free SlabFree;
+
+typedef struct slab
+{
+    const char *name;
+    size_t size;               /* object size, a multiple of SLAB_ALIGN */
+    SlabFree *free_list;       /* owner only */
+    _Atomic(SlabFree *) remote; /* freed by other threads */
+
+    /* published for reporting (written only by the owner) */
+    atomic_long in_use;
+    atomic_long capacity;
+} Slab;
+
+/* slab_init: an empty pool of size-byte objects (up to a chunk each). */
+void slab_init(Slab *s, const char *name, size_t size);
+
+/* slab_alloc: a zeroed object, or NULL (errno set) if out of memory. */
+void *slab_alloc(Slab *s);
+
+/*
+ * slab_free:
+ *   Give p back to the slab it came from. mine is the calling thread's
+ *   slab of the same size class; p goes straight onto its free list if it
+ *   is mine, otherwise onto its owner's remote list.
+ */
+void slab_free(Slab *mine, void *p);
+
+#endif /* SLAB_H */
@@ -0,0 +1,184 @@
+/******************************************************************************
+ * sockopt.c
+ *
+ * TCP socket profiles (see sockopt.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sockopt.h"
+
+static const SockProfile profiles[] = {
+    {.name = "game", .nodelay = 1, .quickack = 1, .user_timeout_ms = 20000,
+     .keepidle_s = 60, .keepintvl_s = 10, .keepcnt = 5, .backlog = 4096},
+    {.name = "bulk", .sndbuf = 1 << 20, .rcvbuf = 1 << 20, .backlog = 4096},
+    {.name = "kernel", .backlog = 5}, // what spock_server did before profiles
+};
+
+/* Every field, by the key sockopt_parse() takes and the metrics show. */
+static const struct
+{
+    const char *key;
+    size_t offset;
+} fields[] = {
+    {"nodelay", offsetof(SockProfile, nodelay)},
+    {"quickack", offsetof(SockProfile, quickack)},
+    {"sndbuf", offsetof(SockProfile, sndbuf)},
+    {"rcvbuf", offsetof(SockProfile, rcvbuf)},
+    {"user-timeout", offsetof(SockProfile, user_timeout_ms)},
+    {"keepidle", offsetof(SockProfile, keepidle_s)},
+    {"keepintvl", offsetof(SockProfile, keepintvl_s)},
+    {"keepcnt", offsetof(SockProfile, keepcnt)},
+    {"backlog", offsetof(SockProfile, backlog)},
+};
+
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static int *field(SockProfile *p, size_t i)
+{
+    return (int *)((char *)p + fields[i].offset);
+}
+
+static int field_value(const SockProfile *p, size_t i)
+{
+    return *(const int *)((const char *)p + fields[i].offset);
+}
+
+static int set_int(int fd, int level, int name, int value);
+
+const SockProfile *sockopt_default(void)
+{
+    return &profiles[0];
+}
+
+int sockopt_parse(SockProfile *p, const char *spec)
+{
+    char copy[256];
+    if (snprintf(copy, sizeof(copy), "%s", spec) >= (int)sizeof(copy))
+    {
+        fprintf(stderr, "Socket profile too long: %s\n", spec);
+        return -1;
+    }
+
+    char *save = NULL;
+    char *tok = strtok_r(copy, ",", &save);
+    *p = profiles[0];
+    if (tok && !strchr(tok, '='))
+    {
+        size_t k = 0;
+        while (k < NUM_PROFILES && strcmp(profiles[k].name, tok) != 0)
+            k++;
+        if (k == NUM_PROFILES)
+        {
+            fprintf(stderr, "Unknown socket profile %s (game, bulk or kernel).\n", tok);
+            return -1;
+        }
+        *p = profiles[k];
+        tok = strtok_r(NULL, ",", &save);
+    }
+
+    for (; tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(tok, '=');
+        char *end = NULL;
+        long v = eq ? strtol(eq + 1, &end, 10) : 0;
+        if (!eq || end == eq + 1 || *end != '\0' || v < 0 || v > 0x7FFFFFFF)
+        {
+            fprintf(stderr, "Socket option %s: expected key=number.\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        size_t i = 0;
+        while (i < NUM_FIELDS && strcmp(fields[i].key, tok) != 0)
+            i++;
+        if (i == NUM_FIELDS)
+        {
+            fprintf(stderr, "Unknown socket option %s.\n", tok);
+            return -1;
+        }
+        *field(p, i) = (int)v;
+    }
+    if (p->backlog <= 0)
+    {
+        p->backlog = 1;
+    }
+    return 0;
+}
+
+int sockopt_listen(int fd, const SockProfile *p)
+{
+    if (p->sndbuf)
+        set_int(fd, SOL_SOCKET, SO_SNDBUF, p->sndbuf);
+    if (p->rcvbuf)
+        set_int(fd, SOL_SOCKET, SO_RCVBUF, p->rcvbuf);
+    return listen(fd, p->backlog);
+}
+
+int sockopt_apply(int fd, const SockProfile *p)
+{
+    int failed = 0;
+    if (p->nodelay)
+        failed += set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1) < 0;
+    if (p->quickack)
+        failed += set_int(fd, IPPROTO_TCP, TCP_QUICKACK, 1) < 0;
+    if (p->sndbuf)
+        failed += set_int(fd, SOL_SOCKET, SO_SNDBUF, p->sndbuf) < 0;
+    if (p->rcvbuf)
+        failed += set_int(fd, SOL_SOCKET, SO_RCVBUF, p->rcvbuf) < 0;
+    if (p->user_timeout_ms)
+        failed += set_int(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, p->user_timeout_ms) < 0;
+    if (p->keepidle_s)
+    {
+        failed += set_int(fd, SOL_SOCKET, SO_KEEPALIVE, 1) < 0;
+        failed += set_int(fd, IPPROTO_TCP, TCP_KEEPIDLE, p->keepidle_s) < 0;
+        if (p->keepintvl_s)
+            failed += set_int(fd, IPPROTO_TCP, TCP_KEEPINTVL, p->keepintvl_s) < 0;
+        if (p->keepcnt)
+            failed += set_int(fd, IPPROTO_TCP, TCP_KEEPCNT, p->keepcnt) < 0;
+    }
+    return failed;
+}
+
+void sockopt_quickack(int fd, const SockProfile *p)
+{
+    if (p->quickack)
+    {
+        set_int(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+}
+
+const char *sockopt_describe(const SockProfile *p, char *buf, size_t size)
+{
+    size_t n = (size_t)snprintf(buf, size, "%s", p->name);
+    for (size_t i = 0; i < NUM_FIELDS && n < size; i++)
+    {
+        int v = field_value(p, i);
+        if (v)
+            n += (size_t)snprintf(buf + n, size - n, " %s=%d", fields[i].key, v);
+    }
+    return buf;
+}
+
+void sockopt_write_metrics(FILE *out, const SockProfile *p)
+{
+    fprintf(out, "# HELP spock_socket_profile_info TCP socket profile of the game listeners.\n"
+                 "# TYPE spock_socket_profile_info gauge\n"
+                 "spock_socket_profile_info{profile=\"%s\"} 1\n", p->name);
+    fprintf(out, "# HELP spock_socket_option Option set on every game connection (0 = not set).\n"
+                 "# TYPE spock_socket_option gauge\n");
+    for (size_t i = 0; i < NUM_FIELDS; i++)
+    {
+        fprintf(out, "spock_socket_option{option=\"%s\"} %d\n", fields[i].key, field_value(p, i));
+    }
+}
+
+static int set_int(int fd, int level, int name, int value)
+{
+    return setsockopt(fd, level, name, &value, sizeof(value));
+}
@@ -0,0 +1,75 @@
+/******************************************************************************
+ * sockopt.h
+ *
+ * TCP socket profiles: the options every game connection is set up with.
+ *
+ *   - Game traffic is many tiny writes (a MOVE is 3 bytes framed), which
+ *     is the worst case for Nagle's algorithm meeting delayed ACKs: a
+ *     write can sit for up to one delayed-ACK timeout (40 ms on Linux)
+ *     waiting for the ACK of the previous one. The default profile turns
+ *     Nagle off and asks for quick ACKs.
+ *   - A profile is picked by name and can be adjusted key by key, e.g.
+ *     "game,sndbuf=262144,backlog=512" (see sockopt_parse()).
+ *   - The server applies it to its listeners (backlog; buffer sizes, so
+ *     the window scale offered in the SYN-ACK matches) and to every
+ *     accepted connection; the client applies it before connecting.
+ *   - TCP_QUICKACK is not sticky: the kernel returns to delayed ACKs on
+ *     its own, so a profile with quickack re-arms it after every read.
+ ******************************************************************************/
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+#include <stdio.h>
+
+typedef struct
+{
+    char name[16];
+    int nodelay;         /* TCP_NODELAY */
+    int quickack;        /* TCP_QUICKACK, re-armed after reads */
+    int sndbuf;          /* SO_SNDBUF bytes, 0 = kernel auto-tuning */
+    int rcvbuf;          /* SO_RCVBUF bytes, 0 = kernel auto-tuning */
+    int user_timeout_ms; /* TCP_USER_TIMEOUT: give up on unacked data, 0 = off */
+    int keepidle_s;      /* SO_KEEPALIVE after this idle time, 0 = off */
+    int keepintvl_s;     /* between keepalive probes */
+    int keepcnt;         /* unanswered probes before the connection is dead */
+    int backlog;         /* listen() backlog */
+} SockProfile;
+
+/*
+ * sockopt_parse:
+ *   Fill p from spec: a profile name ("game", the default; "bulk" for
+ *   throughput; "kernel" for no options and the old backlog of 5),
+ *   optionally followed by ",key=value" overrides for any field above
+ *   (user-timeout, not user_timeout_ms). Returns 0, or -1 with a message
+ *   on stderr.
+ */
+int sockopt_parse(SockProfile *p, const char *spec);
+
+/* sockopt_default: the "game" profile. */
+const SockProfile *sockopt_default(void);
+
+/*
+ * sockopt_listen:
+ *   Set the buffer sizes on a bound socket and listen() with the
+ *   profile's backlog. Returns 0, or -1 (errno set) if listen() failed.
+ */
+int sockopt_listen(int fd, const SockProfile *p);
+
+/*
+ * sockopt_apply:
+ *   Set the profile's options on a TCP socket (accepted, or about to
+ *   connect). Returns how many setsockopt() calls failed; the socket is
+ *   usable either way.
+ */
+int sockopt_apply(int fd, const SockProfile *p);
+
+/* sockopt_quickack: re-arm TCP_QUICKACK after a read, if p asks for it. */
+void sockopt_quickack(int fd, const SockProfile *p);
+
+/* sockopt_describe: p as its name plus the fields it sets, for logs. */
+const char *sockopt_describe(const SockProfile *p, char *buf, size_t size);
+
+/* sockopt_write_metrics: p as Prometheus gauges (spock_socket_*). */
+void sockopt_write_metrics(FILE *out, const SockProfile *p);
+
+#endif /* SOCKOPT_H */
@@ -0,0 +1,812 @@
+/******************************************************************************
+ * spock_bench.c
+ *
+ * Load generator for spock_server. It:
+ *   1) Opens <connections> framed connections from <threads> threads, each
+ *      running its own event loop (reactor.c), and joins a table with each.
+ *   2) Plays random moves (or a --script of moves, cycled) on every
+ *      connection:
+ *       - closed loop (default): the next move goes out as soon as the
+ *         previous round's RESULT arrives;
+ *       - open loop (--rate R): every connection moves R times a second on
+ *         a fixed schedule, whether or not the server keeps up.
+ *   3) After --warmup seconds, measures for --duration seconds and reports
+ *      rounds/sec and the RESULT latency percentiles (p50/p99/p999) from an
+ *      HDR-style histogram (histogram.c).
+ *   4) Connects with the --sock-profile TCP options (sockopt.h; default
+ *      "game"), so e.g. "kernel" shows what Nagle does to the latency.
+ *   5) With --admin-port, reads the server's syscall counters (/metrics) at
+ *      both ends of the measured window and reports them per round; with
+ *      --compare, repeats the same run against a second server (say one
+ *      started with --io-uring) and prints the two side by side.
+ *   6) With --spectators N and the server's --watch-port, also opens N
+ *      spectator connections that watch the most recently started tables
+ *      (the last of the bench's own, usually all the same one) and counts
+ *      the RESULTs they get. A --compare run has no spectators, so running
+ *      it against the same server shows what watching costs the players.
+ *
+ * Latency is the time from sending a move to receiving that round's RESULT.
+ * In open loop, a move that is overdue because the previous RESULT was late
+ * is timed from when it was due, so a stalled server is not hidden by the
+ * benchmark waiting along with it (coordinated omission).
+ *
+ * Usage example:
+ *   ./spock_bench --connections 300 --threads 4 127.0.0.1 5555
+ *   ./spock_bench --rate 50 --duration 30 127.0.0.1 5555
+ *   ./spock_bench --admin-port 9100 --compare 5556:9101 127.0.0.1 5555
+ *   ./spock_bench --spectators 10000 --watch-port 5556 --compare 5555 127.0.0.1 5555
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "histogram.h"
+#include "net.h"
+#include "proto.h"
+#include "reactor.h"
+
+#define MAX_THREADS 256
+#define MAX_SCRIPT 256
+
+typedef struct bench_thread BenchThread;
+
+/* One benchmark connection (one seat at some table, or a spectator). */
+typedef struct
+{
+    int fd;                 /* -1 once closed */
+    int spectator;          /* watching, not playing */
+    int index;              /* position in its thread's conns[] */
+    BenchThread *thread;
+    ProtoParser parser;
+    int pending;            /* a move is waiting for its RESULT */
+    long long sent_us;      /* when the pending move counts as sent */
+    long long due_us;       /* open loop: when the next move is due */
+    unsigned script_pos;
+    int table_size;         /* seats at our table, from the first RESULT */
+    Timer send_timer;       /* open loop: fires when the next move is due */
+} BenchConn;
+
+struct bench_thread
+{
+    pthread_t tid;
+    int index;
+    Reactor *reactor;
+    BenchConn *conns;
+    int nconns;
+    BenchConn *watchers;    /* spectator connections */
+    int nwatchers;
+    uint32_t rng;
+    uint64_t results;       /* RESULTs received in the measured window */
+    double rounds;          /* the same, as table rounds */
+    uint64_t watched;       /* RESULTs spectators received in the window */
+    int errors;             /* connections that failed or were dropped */
+    int idle;               /* connections that never saw a RESULT */
+    Histogram latency;      /* microseconds */
+};
+
+/* One run's headline numbers, for --compare. */
+typedef struct
+{
+    char label[16];            /* the server's event-loop backend, if known */
+    double rounds_per_sec;
+    unsigned long long p50, p99;
+    int errors;
+    int scraped;               /* syscalls_per_round is known */
+    double syscalls_per_round; /* the server's, event loop and socket */
+} BenchReport;
+
+/* A server's counters, from its admin endpoint's /metrics. */
+typedef struct
+{
+    int ok;
+    char backend[32];
+    unsigned long long reactor; /* spock_reactor_syscalls_total */
+    unsigned long long socket;  /* spock_socket_syscalls_total */
+} ServerCounters;
+
+/* Set in main() and per run; read-only while the threads run. */
+static struct
+{
+    const char *host;
+    int port;
+    int connections;
+    int threads;
+    double duration;
+    double warmup;
+    double rate;            /* moves/sec per connection, 0 = closed loop */
+    char script[MAX_SCRIPT];
+    int spectators;         /* this run's spectator connections */
+    int watch_port;
+    long long start_us;     /* set by bench_run once every thread has connected */
+    long long measure_from_us;
+    long long measure_until_us;
+    pthread_barrier_t barrier;
+} cfg;
+
+static void usage(const char *prog);
+static int bench_run(int port, int admin_port, uint32_t seed, BenchReport *rep);
+static int scrape_counters(int admin_port, ServerCounters *out);
+static void sleep_until_us(long long t_us);
+static void *bench_main(void *arg);
+static void bench_connect(BenchThread *bt, BenchConn *c);
+static void bench_watch(BenchThread *bt, BenchConn *c);
+static void bench_send_move(BenchConn *c, int overdue);
+static void bench_schedule(BenchConn *c);
+static void bench_handle_result(BenchConn *c, const ProtoFrame *f);
+static void bench_drop(BenchConn *c, int error);
+static void on_bench_event(Reactor *r, int fd, unsigned events, void *arg);
+static void on_move_due(Timer *t, void *arg);
+static int in_window(long long t_us);
+static char next_move(BenchConn *c);
+static uint32_t xorshift32(uint32_t *state);
+
+int main(int argc, char *argv[])
+{
+    cfg.connections = 30;
+    cfg.threads = 2;
+    cfg.duration = 10;
+    cfg.warmup = 1;
+    uint32_t seed = 1;
+    int admin_port = 0, compare_port = 0, compare_admin = 0, spectators = 0;
+    static SockProfile sock;
+
+    static const struct option long_opts[] = {
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"rate", required_argument, NULL, 'r'},
+        {"script", required_argument, NULL, 's'},
+        {"seed", required_argument, NULL, 'S'},
+        {"sock-profile", required_argument, NULL, 'p'},
+        {"admin-port", required_argument, NULL, 'a'},
+        {"compare", required_argument, NULL, 'C'},
+        {"spectators", required_argument, NULL, 'n'},
+        {"watch-port", required_argument, NULL, 'W'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:d:w:r:s:S:p:a:C:n:W:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            cfg.connections = atoi(optarg);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration = atof(optarg);
+            break;
+        case 'w':
+            cfg.warmup = atof(optarg);
+            break;
+        case 'r':
+            cfg.rate = atof(optarg);
+            break;
+        case 's':
+            snprintf(cfg.script, sizeof(cfg.script), "%s", optarg);
+            break;
+        case 'S':
+            seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            if (sockopt_parse(&sock, optarg) < 0)
+            {
+                exit(1);
+            }
+            net_use_profile(&sock);
+            break;
+        case 'a':
+            admin_port = atoi(optarg);
+            break;
+        case 'n':
+            spectators = atoi(optarg);
+            break;
+        case 'W':
+            cfg.watch_port = atoi(optarg);
+            break;
+        case 'C':
+        {
+            // PORT[:ADMIN_PORT]
+            char *colon = strchr(optarg, ':');
+            compare_port = atoi(optarg);
+            compare_admin = colon ? atoi(colon + 1) : 0;
+            if (compare_port <= 0 || (colon && compare_admin <= 0))
+            {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2 || cfg.connections < 1 || cfg.threads < 1 ||
+        cfg.threads > MAX_THREADS || cfg.duration <= 0 || cfg.warmup < 0 || cfg.rate < 0 ||
+        admin_port < 0 || spectators < 0 || (spectators > 0 && cfg.watch_port <= 0))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (cfg.script[0] && strspn(cfg.script, "RPSLK") != strlen(cfg.script))
+    {
+        fprintf(stderr, "--script may only contain the moves R, P, S, L and K.\n");
+        exit(1);
+    }
+    cfg.host = argv[optind];
+    if (cfg.threads > cfg.connections)
+    {
+        cfg.threads = cfg.connections;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchReport a, b;
+    cfg.spectators = spectators;
+    if (bench_run(atoi(argv[optind + 1]), admin_port, seed, &a) < 0)
+    {
+        return 1;
+    }
+    cfg.spectators = 0;
+    if (!compare_port)
+    {
+        return a.errors ? 1 : 0;
+    }
+
+    /* the same load, seed included, against the other server */
+    if (bench_run(compare_port, compare_admin, seed, &b) < 0)
+    {
+        return 1;
+    }
+    printf("[Bench] Compare:           %14s %14s\n", a.label, b.label);
+    printf("[Bench]   rounds/sec       %14.1f %14.1f  (%+.1f%%)\n", a.rounds_per_sec,
+           b.rounds_per_sec,
+           a.rounds_per_sec > 0 ? 100.0 * (b.rounds_per_sec / a.rounds_per_sec - 1) : 0.0);
+    printf("[Bench]   p50 latency (us) %14llu %14llu\n", a.p50, b.p50);
+    printf("[Bench]   p99 latency (us) %14llu %14llu\n", a.p99, b.p99);
+    if (a.scraped && b.scraped)
+    {
+        printf("[Bench]   syscalls/round   %14.2f %14.2f\n", a.syscalls_per_round,
+               b.syscalls_per_round);
+    }
+    return a.errors || b.errors ? 1 : 0;
+}
+
+/*
+ * bench_run:
+ *   One full run against cfg.host:port, reported as it ends. With an
+ *   admin port, the server's syscall counters are read at both ends of the
+ *   measured window. Returns -1 if the run could not start.
+ */
+static int bench_run(int port, int admin_port, uint32_t seed, BenchReport *rep)
+{
+    memset(rep, 0, sizeof(*rep));
+    cfg.port = port;
+
+    BenchThread *threads = calloc(cfg.threads, sizeof(BenchThread));
+    BenchConn *conns = calloc(cfg.connections, sizeof(BenchConn));
+    BenchConn *watchers = calloc(cfg.spectators + 1, sizeof(BenchConn));
+    if (!threads || !conns || !watchers)
+    {
+        perror("calloc");
+        free(threads);
+        free(conns);
+        return -1;
+    }
+    pthread_barrier_init(&cfg.barrier, NULL, cfg.threads + 1); // + this thread
+
+    printf("[Bench] %d connections, %d threads, %s, %.1f s (+%.1f s warmup) against %s:%d\n",
+           cfg.connections, cfg.threads, cfg.rate > 0 ? "open loop" : "closed loop",
+           cfg.duration, cfg.warmup, cfg.host, cfg.port);
+    if (cfg.rate > 0)
+    {
+        printf("[Bench] Open loop: %.1f moves/sec per connection\n", cfg.rate);
+    }
+    if (cfg.spectators > 0)
+    {
+        printf("[Bench] %d spectators on watch port %d\n", cfg.spectators, cfg.watch_port);
+    }
+
+    /* split the connections as evenly as possible */
+    int first = 0, first_watcher = 0;
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        BenchThread *bt = &threads[i];
+        bt->index = i;
+        bt->conns = conns + first;
+        bt->nconns = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads);
+        bt->rng = (seed ? seed : 1) * 2654435761u + i;
+        if (bt->rng == 0)
+            bt->rng = 1;
+        first += bt->nconns;
+        bt->watchers = watchers + first_watcher;
+        bt->nwatchers = cfg.spectators / cfg.threads + (i < cfg.spectators % cfg.threads);
+        first_watcher += bt->nwatchers;
+
+        int err = pthread_create(&bt->tid, NULL, bench_main, bt);
+        if (err)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+
+    /* keep step with the threads (see bench_main), sampling the server */
+    ServerCounters before = {0}, after = {0};
+    pthread_barrier_wait(&cfg.barrier); // all connected
+    cfg.start_us = reactor_now_us();
+    cfg.measure_from_us = cfg.start_us + (long long)(cfg.warmup * 1e6);
+    cfg.measure_until_us = cfg.measure_from_us + (long long)(cfg.duration * 1e6);
+    pthread_barrier_wait(&cfg.barrier);
+    if (admin_port > 0)
+    {
+        sleep_until_us(cfg.measure_from_us);
+        scrape_counters(admin_port, &before);
+        sleep_until_us(cfg.measure_until_us);
+        scrape_counters(admin_port, &after);
+    }
+    pthread_barrier_wait(&cfg.barrier);
+
+    Histogram total;
+    hist_init(&total);
+    uint64_t results = 0;
+    double rounds = 0;
+    uint64_t watched = 0;
+    int errors = 0, idle = 0;
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        hist_merge(&total, &threads[i].latency);
+        results += threads[i].results;
+        rounds += threads[i].rounds;
+        watched += threads[i].watched;
+        errors += threads[i].errors;
+        idle += threads[i].idle;
+    }
+
+    double secs = (cfg.measure_until_us - cfg.measure_from_us) / 1e6;
+    printf("[Bench] %llu results in %.2f s => %.1f rounds/sec (%.1f results/sec)\n",
+           (unsigned long long)results, secs, rounds / secs, results / secs);
+    printf("[Bench] RESULT latency (us): p50 %llu  p99 %llu  p999 %llu  max %llu  mean %.1f\n",
+           (unsigned long long)hist_percentile(&total, 50.0),
+           (unsigned long long)hist_percentile(&total, 99.0),
+           (unsigned long long)hist_percentile(&total, 99.9),
+           (unsigned long long)total.max, hist_mean(&total));
+    if (cfg.spectators > 0)
+    {
+        printf("[Bench] Spectators got %llu results => %.1f/sec\n",
+               (unsigned long long)watched, watched / secs);
+    }
+    if (errors)
+    {
+        printf("[Bench] %d connection(s) failed or were dropped.\n", errors);
+    }
+    if (idle)
+    {
+        printf("[Bench] %d connection(s) never got a RESULT "
+               "(is --connections a multiple of the table size?)\n", idle);
+    }
+
+    rep->rounds_per_sec = rounds / secs;
+    rep->p50 = (unsigned long long)hist_percentile(&total, 50.0);
+    rep->p99 = (unsigned long long)hist_percentile(&total, 99.0);
+    rep->errors = errors;
+    snprintf(rep->label, sizeof(rep->label), "port %d", port);
+    if (before.ok && after.ok)
+    {
+        unsigned long long loop = after.reactor - before.reactor;
+        unsigned long long sock = after.socket - before.socket;
+        printf("[Bench] Server syscalls (%s): %llu event loop + %llu socket = %.2f per round\n",
+               after.backend, loop, sock, rounds > 0 ? (loop + sock) / rounds : 0.0);
+        rep->scraped = 1;
+        rep->syscalls_per_round = rounds > 0 ? (loop + sock) / rounds : 0.0;
+        snprintf(rep->label, sizeof(rep->label), "%.14s", after.backend);
+    }
+    else if (admin_port > 0)
+    {
+        printf("[Bench] Could not read the server's counters from port %d.\n", admin_port);
+    }
+
+    pthread_barrier_destroy(&cfg.barrier);
+    free(watchers);
+    free(conns);
+    free(threads);
+    return 0;
+}
+
+/*
+ * scrape_counters:
+ *   GET /metrics from the server's admin port and pick out its syscall
+ *   counters. Returns -1 (out->ok stays 0) if they are not there.
+ */
+static int scrape_counters(int admin_port, ServerCounters *out)
+{
+    static const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    int fd = connect_to_server(cfg.host, admin_port);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    FILE *in = fdopen(fd, "r");
+    if (!in || send(fd, req, sizeof(req) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(req) - 1))
+    {
+        if (in)
+            fclose(in);
+        else
+            close(fd);
+        return -1;
+    }
+
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), in))
+    {
+        const char *label, *value;
+        if (strncmp(line, "spock_reactor_syscalls_total", 28) == 0 &&
+            (label = strstr(line, "backend=\"")) != NULL && (value = strrchr(line, ' ')) != NULL)
+        {
+            label += 9;
+            snprintf(out->backend, sizeof(out->backend), "%.*s",
+                     (int)strcspn(label, "\""), label);
+            out->reactor = strtoull(value + 1, NULL, 10);
+            found |= 1;
+        }
+        else if (strncmp(line, "spock_socket_syscalls_total ", 28) == 0)
+        {
+            out->socket = strtoull(line + 28, NULL, 10);
+            found |= 2;
+        }
+    }
+    fclose(in);
+    out->ok = (found == 3);
+    return out->ok ? 0 : -1;
+}
+
+static void sleep_until_us(long long t_us)
+{
+    long long left = t_us - reactor_now_us();
+    if (left > 0)
+    {
+        struct timespec ts = {left / 1000000, (left % 1000000) * 1000};
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--connections K] [--threads T] [--duration SECS] [--warmup SECS]\n"
+                    "       [--rate R] [--script MOVES] [--seed S] [--sock-profile SPEC]\n"
+                    "       [--admin-port PORT] [--compare PORT[:ADMIN_PORT]]\n"
+                    "       [--spectators N --watch-port PORT] <server_ip> <port>\n",
+            prog);
+    fprintf(stderr, "  --connections K  player connections to open (default 30)\n");
+    fprintf(stderr, "  --threads T      client event-loop threads (default 2)\n");
+    fprintf(stderr, "  --duration S     measured seconds (default 10)\n");
+    fprintf(stderr, "  --warmup S       unmeasured seconds first (default 1)\n");
+    fprintf(stderr, "  --rate R         open loop: moves/sec per connection (default: closed loop)\n");
+    fprintf(stderr, "  --script MOVES   cycle through these moves, e.g. RPSLK (default: random)\n");
+    fprintf(stderr, "  --sock-profile P TCP options, as for spock_server (default game)\n");
+    fprintf(stderr, "  --admin-port P   the server's --admin-port: report its syscalls per round\n");
+    fprintf(stderr, "  --compare P[:A]  then run again against port P (admin port A), side by side\n");
+    fprintf(stderr, "  --spectators N   also watch the latest tables with N spectators (first run only)\n");
+    fprintf(stderr, "  --watch-port P   the server's --watch-port, for --spectators\n");
+    fprintf(stderr, "Example: %s --connections 300 --threads 4 127.0.0.1 5555\n", prog);
+}
+
+/*
+ * bench_main:
+ *   One client thread: connect its share of the connections, wait for the
+ *   other threads, then play until the measured window is over.
+ */
+static void *bench_main(void *arg)
+{
+    BenchThread *bt = arg;
+
+    hist_init(&bt->latency);
+    bt->reactor = reactor_create(REACTOR_BACKEND_AUTO);
+    if (!bt->reactor)
+    {
+        fprintf(stderr, "[Bench] Thread %d: could not create event loop.\n", bt->index);
+        exit(1);
+    }
+    for (int i = 0; i < bt->nconns; i++)
+    {
+        bt->conns[i].index = i;
+        bench_connect(bt, &bt->conns[i]);
+    }
+    for (int i = 0; i < bt->nwatchers; i++)
+    {
+        bt->watchers[i].index = i;
+        bench_watch(bt, &bt->watchers[i]);
+    }
+
+    /* everyone starts, and measures, on the same clock (bench_run sets it) */
+    pthread_barrier_wait(&cfg.barrier);
+    pthread_barrier_wait(&cfg.barrier);
+
+    for (int i = 0; i < bt->nconns; i++)
+    {
+        BenchConn *c = &bt->conns[i];
+        if (c->fd < 0)
+            continue;
+        if (cfg.rate > 0)
+        {
+            c->due_us = cfg.start_us;
+            bench_schedule(c);
+        }
+        else
+        {
+            bench_send_move(c, 0);
+        }
+    }
+
+    long long end_ms = cfg.measure_until_us / 1000 + 1;
+    for (;;)
+    {
+        long long left = end_ms - reactor_now_ms();
+        if (left <= 0)
+            break;
+        if (reactor_poll(bt->reactor, (int)left) < 0)
+        {
+            fprintf(stderr, "[Bench] Thread %d: event loop failed.\n", bt->index);
+            break;
+        }
+    }
+
+    /* wait until nobody is measuring, then end the games instead of
+     * leaving the server to hold the seats for their grace period */
+    pthread_barrier_wait(&cfg.barrier);
+    for (int i = 0; i < bt->nconns; i++)
+    {
+        BenchConn *c = &bt->conns[i];
+        if (c->fd < 0)
+            continue;
+        if (c->table_size == 0)
+            bt->idle++;
+        send_frame(c->fd, PROTO_OP_QUIT, NULL, 0);
+        bench_drop(c, 0);
+    }
+    for (int i = 0; i < bt->nwatchers; i++)
+    {
+        bench_drop(&bt->watchers[i], 0);
+    }
+    reactor_destroy(bt->reactor);
+    return NULL;
+}
+
+static void bench_connect(BenchThread *bt, BenchConn *c)
+{
+    c->thread = bt;
+    c->script_pos = (unsigned)c->index;
+    proto_parser_init(&c->parser);
+    timer_init(&c->send_timer, on_move_due, c);
+
+    c->fd = connect_to_server(cfg.host, cfg.port);
+    if (c->fd < 0)
+    {
+        bt->errors++;
+        return;
+    }
+    if (send_join(c->fd, "") < 0 ||
+        reactor_add(bt->reactor, c->fd, REACTOR_READ, on_bench_event, c) < 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+        bt->errors++;
+    }
+}
+
+/* bench_watch: open a spectator connection to the latest table. */
+static void bench_watch(BenchThread *bt, BenchConn *c)
+{
+    c->thread = bt;
+    c->spectator = 1;
+    proto_parser_init(&c->parser);
+    timer_init(&c->send_timer, on_move_due, c);
+
+    c->fd = connect_to_server(cfg.host, cfg.watch_port);
+    if (c->fd < 0)
+    {
+        bt->errors++;
+        return;
+    }
+    if (send_watch(c->fd, "") < 0 ||
+        reactor_add(bt->reactor, c->fd, REACTOR_READ, on_bench_event, c) < 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+        bt->errors++;
+    }
+}
+
+/*
+ * bench_send_move:
+ *   Send this connection's next move. An overdue (open-loop) move is timed
+ *   from when it was due rather than from now.
+ */
+static void bench_send_move(BenchConn *c, int overdue)
+{
+    char m = next_move(c);
+    long long now = reactor_now_us();
+
+    if (send_frame(c->fd, PROTO_OP_MOVE, &m, 1) < 0)
+    {
+        bench_drop(c, 1);
+        return;
+    }
+    c->pending = 1;
+    c->sent_us = overdue ? c->due_us : now;
+    if (cfg.rate > 0)
+    {
+        c->due_us += (long long)(1e6 / cfg.rate);
+    }
+}
+
+/* bench_schedule: open loop; send the next move now if due, else arm a timer. */
+static void bench_schedule(BenchConn *c)
+{
+    if (c->due_us <= reactor_now_us())
+    {
+        bench_send_move(c, 0);
+        return;
+    }
+    timer_arm(reactor_timers(c->thread->reactor), &c->send_timer, c->due_us / 1000);
+}
+
+/* on_move_due: open loop; the schedule says this connection moves now. */
+static void on_move_due(Timer *t, void *arg)
+{
+    (void)t;
+    BenchConn *c = arg;
+
+    if (!c->pending)
+    {
+        // on time (within the wheel's 1 ms resolution)
+        bench_send_move(c, 0);
+    }
+    // else: still waiting for the last RESULT; sent, overdue, when it comes
+}
+
+static void bench_handle_result(BenchConn *c, const ProtoFrame *f)
+{
+    BenchThread *bt = c->thread;
+    long long now = reactor_now_us();
+
+    if (c->table_size == 0)
+    {
+        // "<winners>:<moves>:<scores>": one move per seat
+        const uint8_t *p = memchr(f->payload, ':', f->len);
+        c->table_size = 1;
+        for (p = p ? p + 1 : f->payload + f->len; p < f->payload + f->len && *p != ':'; p++)
+        {
+            if (*p == ',')
+                c->table_size++;
+        }
+    }
+    if (!c->pending)
+    {
+        return; // e.g. the last RESULT, resent; not ours to time
+    }
+    c->pending = 0;
+
+    if (in_window(now))
+    {
+        bt->results++;
+        bt->rounds += 1.0 / c->table_size;
+        if (in_window(c->sent_us))
+        {
+            hist_record(&bt->latency, (uint64_t)(now - c->sent_us));
+        }
+    }
+
+    if (cfg.rate > 0)
+    {
+        if (c->due_us <= now)
+            bench_send_move(c, 1);
+        else
+            bench_schedule(c);
+    }
+    else
+    {
+        bench_send_move(c, 0);
+    }
+}
+
+/* bench_drop: close c; error counts it as a failure. */
+static void bench_drop(BenchConn *c, int error)
+{
+    if (c->fd < 0)
+    {
+        return;
+    }
+    if (error && in_window(reactor_now_us()))
+    {
+        c->thread->errors++;
+    }
+    timer_cancel(reactor_timers(c->thread->reactor), &c->send_timer);
+    reactor_del(c->thread->reactor, c->fd);
+    close(c->fd);
+    c->fd = -1;
+}
+
+/*
+ * on_bench_event:
+ *   Reactor callback for one connection (edge-triggered): drain the socket
+ *   into the parser and handle every complete frame.
+ */
+static void on_bench_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    BenchConn *c = arg;
+
+    while (c->fd == fd)
+    {
+        size_t avail;
+        uint8_t *space = proto_parser_space(&c->parser, &avail);
+        ssize_t n = recv(fd, space, avail, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            bench_drop(c, 1);
+            break;
+        }
+        proto_parser_commit(&c->parser, (size_t)n);
+
+        ProtoFrame f;
+        int rc = 0;
+        while (c->fd == fd && (rc = proto_next(&c->parser, &f)) == 1)
+        {
+            if (f.op == PROTO_OP_RESULT && c->spectator)
+                c->thread->watched += in_window(reactor_now_us());
+            else if (f.op == PROTO_OP_RESULT)
+                bench_handle_result(c, &f);
+            else if (f.op == PROTO_OP_QUIT)
+                bench_drop(c, 1);
+            // HELLO, SESSION, INFO: nothing to do
+        }
+        if (c->fd == fd && rc < 0)
+        {
+            bench_drop(c, 1);
+        }
+    }
+}
+
+static int in_window(long long t_us)
+{
+    return t_us >= cfg.measure_from_us && t_us < cfg.measure_until_us;
+}
+
+static char next_move(BenchConn *c)
+{
+    if (cfg.script[0])
+    {
+        return cfg.script[c->script_pos++ % strlen(cfg.script)];
+    }
+    return "RPSLK"[xorshift32(&c->thread->rng) % 5];
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
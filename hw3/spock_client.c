@@ -2,41 +2,150 @@
  * spock_client.c
  *
  * A multi-player client that connects to the spock_server. The client:
- *   1) Receives "RESULT:" broadcasts after each round (and "RESET"/"QUIT").
- *   2) Only prints a prompt for a new command when needed (i.e., after round ends
+ *   1) Receives RESULT broadcasts after each round (and RESET/QUIT). It
+ *      speaks the framed protocol from proto.h: it sends PROTO_MAGIC on
+ *      connect, and parses whatever the server sends incrementally, so
+ *      messages split or merged by TCP are handled.
+ *   2) Survives dropped connections: the server hands out a session token
+ *      (SESSION) when the player is seated; if the connection drops, the
+ *      client reconnects with capped exponential backoff and sends the
+ *      token in its JOIN, and the server gives the seat back together with
+ *      the last round's RESULT.
+ *   3) Only prints a prompt for a new command when needed (i.e., after round ends
  *      or a reset), to avoid spamming the user while waiting for other players.
- *   3) Allows user to type:
+ *   4) Allows user to type:
  *       - R/P/S/L/K -> Move
  *       - T -> "RESET"
  *       - Q -> "QUIT"
  *       - M -> local score display (if you track it)
+ *   5) With --tls (or --tls-ca FILE to trust a self-signed server), talks
+ *      TLS to a server started with --tls-cert; reconnects resume the TLS
+ *      session instead of running the full handshake again.
+ *   6) With --sock-profile SPEC, connects with those TCP options (see
+ *      sockopt.h); the default turns Nagle off for the tiny command writes.
+ *   7) With --udp, plays over UDP to a server started with --udp (see
+ *      udp.h): lost moves and results are retransmitted, and a lost
+ *      connection is resumed just like a TCP one.
+ *   8) With --player ID, joins under that player id, so a server started
+ *      with --scores keeps this player's wins across games (see its
+ *      /leaderboard).
+ *   9) With --watch TABLE, connects to a server's --watch-port as a
+ *      spectator instead, and prints what table TABLE's players are told
+ *      ("latest" = the table that started last) until it ends.
  *
  * Usage example:
  *   ./spock_client 127.0.0.1 5555
+ *   ./spock_client --tls-ca cert.pem 127.0.0.1 5555
+ *   ./spock_client --udp 127.0.0.1 5555
+ *   ./spock_client --player alice 127.0.0.1 5555
+ *   ./spock_client --watch latest 127.0.0.1 5556
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
-#include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 
+#include "net.h"
+#include "proto.h"
+#include "reactor.h"
+
 #define BUF_SIZE 1024
+#define TOKEN_SIZE 64
+#define RECONNECT_FIRST_MS 100   /* first retry delay, doubled per attempt */
+#define RECONNECT_MAX_MS 2000    /* cap on the retry delay */
+#define RECONNECT_GIVE_UP_MS 30000 /* matches the server's default grace */
 
 static void usage(const char *prog);
-static int connect_to_server(const char *host, int port);
+static int reconnect(const char *host, int port, const char *token);
+static void print_tls(int sockfd);
+static int watch_table(int sockfd, const char *table);
 
 int main(int argc, char *argv[])
 {
-  if (argc != 3)
+  int tls = 0;
+  const char *tls_ca = NULL;
+  int udp = 0;
+  const char *player = NULL;
+  const char *watch = NULL;
+  static SockProfile sock;
+  static const struct option long_opts[] = {
+      {"tls", no_argument, NULL, 't'},
+      {"tls-ca", required_argument, NULL, 'c'},
+      {"udp", no_argument, NULL, 'u'},
+      {"sock-profile", required_argument, NULL, 'p'},
+      {"player", required_argument, NULL, 'n'},
+      {"watch", required_argument, NULL, 'w'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "tc:up:n:w:h", long_opts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 't':
+      tls = 1;
+      break;
+    case 'c':
+      tls = 1;
+      tls_ca = optarg;
+      break;
+    case 'u':
+      udp = 1;
+      break;
+    case 'p':
+      if (sockopt_parse(&sock, optarg) < 0)
+      {
+        exit(1);
+      }
+      net_use_profile(&sock);
+      break;
+    case 'n':
+      player = optarg;
+      break;
+    case 'w':
+      watch = strcmp(optarg, "latest") == 0 ? "" : optarg;
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (argc - optind != 2)
   {
     usage(argv[0]);
     exit(1);
   }
+  if (tls && udp)
+  {
+    fprintf(stderr, "--udp is cleartext; it can't be combined with --tls.\n");
+    exit(1);
+  }
+  if (watch && (tls || udp))
+  {
+    fprintf(stderr, "--watch connects over cleartext TCP; it can't be combined with --tls or --udp.\n");
+    exit(1);
+  }
+
+  const char *server_ip = argv[optind];
+  int port = atoi(argv[optind + 1]);
+  if (tls && net_use_tls(tls_ca) < 0)
+  {
+    return 1;
+  }
+  if (udp)
+  {
+    net_use_udp();
+  }
 
-  const char *server_ip = argv[1];
-  int port = atoi(argv[2]);
+  /* a dead connection must show up as a send() error, not kill us */
+  signal(SIGPIPE, SIG_IGN);
 
   int sockfd = connect_to_server(server_ip, port);
   if (sockfd < 0)
@@ -45,6 +154,32 @@ int main(int argc, char *argv[])
     return 1;
   }
   printf("[Client] Connected to server at %s:%d\n", server_ip, port);
+  print_tls(sockfd);
+  if (watch)
+  {
+    return watch_table(sockfd, watch);
+  }
+
+  /* Ask for the framed protocol and a seat; until the server confirms, it
+   * may still send legacy text, which the parser understands as well. */
+  char token[TOKEN_SIZE] = ""; /* session to resume after a drop */
+  char join[TOKEN_SIZE] = "";  /* "@<player id>" to keep score under it */
+  if (player)
+  {
+    snprintf(join, sizeof(join), "@%s", player);
+  }
+  if (send_join(sockfd, join) < 0)
+  {
+    net_close(sockfd);
+    return 1;
+  }
+  ProtoParser parser;
+  proto_parser_init(&parser);
+  if (net_udp(sockfd))
+  {
+    parser.mode = PROTO_BINARY; // no PROTO_MAGIC over UDP
+  }
+  int resuming = 0; /* reconnected, waiting for the server's SESSION */
 
   /* If you want to keep track of your own local score, create a variable here. */
   int local_score = 0; // purely optional local tracking
@@ -57,11 +192,12 @@ int main(int argc, char *argv[])
    * when the user is allowed to pick a new command (i.e., at round start).
    */
   int prompt_needed = 1;
+  int redraw = 1; /* 0 after wakeups that showed nothing (protocol ack) */
 
   while (1)
   {
     // If we need to prompt the user for input, do it once:
-    if (prompt_needed)
+    if (prompt_needed && redraw)
     {
       printf("\n--------------------------------------------------\n");
       printf("Enter command:\n"
@@ -77,56 +213,147 @@ int main(int argc, char *argv[])
     FD_SET(sockfd, &read_fds);
     FD_SET(fileno(stdin), &read_fds);
 
-    int ret = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+    // TLS may hold decrypted bytes already; select() only sees the socket.
+    // UDP has retransmissions and keepalives due (net_tick).
+    int wait_ms = net_pending(sockfd) ? 0 : net_timeout_ms(sockfd);
+    struct timeval wait = {wait_ms / 1000, (wait_ms % 1000) * 1000};
+    int ret = select(max_fd + 1, &read_fds, NULL, NULL, wait_ms >= 0 ? &wait : NULL);
     if (ret < 0)
     {
       perror("select");
       break;
     }
+    if (net_pending(sockfd))
+    {
+      FD_SET(sockfd, &read_fds);
+    }
+    redraw = FD_ISSET(fileno(stdin), &read_fds);
+    int lost = net_tick(sockfd) < 0;
 
     /* 1) Check if server sent something */
-    if (FD_ISSET(sockfd, &read_fds))
+    if (!lost && FD_ISSET(sockfd, &read_fds))
     {
-      memset(buffer, 0, BUF_SIZE);
-      int n = recv(sockfd, buffer, BUF_SIZE - 1, 0);
-      if (n <= 0)
+      size_t avail;
+      uint8_t *space = proto_parser_space(&parser, &avail);
+      int n = net_recv(sockfd, space, avail);
+      if (n < 0 && errno == EAGAIN)
       {
-        printf("[Client] Server closed connection.\n");
-        break;
+        // a datagram with nothing new: an ack or a duplicate
       }
-      buffer[n] = '\0';
-
-      // parse server message
-      if (strncmp(buffer, "QUIT", 4) == 0)
+      else if (n <= 0)
       {
-        printf("[Client] Server signaled QUIT. Exiting...\n");
-        break;
+        lost = 1;
       }
-      else if (strncmp(buffer, "RESET", 5) == 0)
+      else
       {
-        printf("[Client] Scores have been reset (server broadcast).\n");
-        // This means we start a new round => prompt again
-        prompt_needed = 1;
-        // If you keep local_score, set it to 0 or do nothing
-        local_score = 0;
+        proto_parser_commit(&parser, n);
+
+        // parse every complete server message in this read
+        int quit = 0;
+        int rc;
+        ProtoFrame f;
+        while (!quit && (rc = proto_next(&parser, &f)) > 0)
+        {
+          if (f.op == PROTO_OP_HELLO)
+          {
+            // server switched to framed messages; nothing to show
+            continue;
+          }
+          if (f.op == PROTO_OP_SESSION)
+          {
+            // "<token>:<seat>:<moved>" - remember the token for reconnects
+            char session[TOKEN_SIZE + 16];
+            int seat = 0, moved = 0;
+            size_t len = (f.len < sizeof(session)) ? f.len : sizeof(session) - 1;
+            memcpy(session, f.payload, len);
+            session[len] = '\0';
+            char *colon = strchr(session, ':');
+            if (colon && colon - session < TOKEN_SIZE)
+            {
+              *colon = '\0';
+              strcpy(token, session);
+              sscanf(colon + 1, "%d:%d", &seat, &moved);
+            }
+            if (resuming)
+            {
+              printf("\n[Client] Reconnected; back in seat %d.\n", seat);
+              // the server says whether it still has our move for this round
+              prompt_needed = !moved;
+              resuming = 0;
+              redraw = 1;
+            }
+            continue;
+          }
+          redraw = 1;
+          if (f.op == PROTO_OP_QUIT)
+          {
+            printf("[Client] Server signaled QUIT. Exiting...\n");
+            quit = 1;
+          }
+          else if (f.op == PROTO_OP_RESET)
+          {
+            printf("[Client] Scores have been reset (server broadcast).\n");
+            // This means we start a new round => prompt again
+            prompt_needed = 1;
+            // If you keep local_score, set it to 0 or do nothing
+            local_score = 0;
+          }
+          else if (f.op == PROTO_OP_RESULT)
+          {
+            // This indicates the round ended. Let's show the outcome.
+            printf("[Client] Round Result => %.*s\n", (int)f.len, (const char *)f.payload);
+            // Possibly parse out your new local score from the message, if you want.
+            // For now, just mention the round ended.
+            // Start a new round => re-prompt
+            prompt_needed = 1;
+          }
+          else
+          {
+            // some other server message
+            printf("[Client] Server says: %.*s\n", (int)f.len, (const char *)f.payload);
+          }
+        }
+        if (quit)
+        {
+          break;
+        }
+        if (rc < 0)
+        {
+          printf("[Client] Malformed message from server.\n");
+          break;
+        }
       }
-      else if (strncmp(buffer, "RESULT:", 7) == 0)
+    }
+
+    /* 2) Connection dropped without a QUIT: try to get our seat back */
+    if (lost)
+    {
+      if (token[0] == '\0')
       {
-        // This indicates the round ended. Let's show the outcome.
-        printf("[Client] Round Result => %s\n", buffer + 7);
-        // Possibly parse out your new local score from the message, if you want.
-        // For now, just mention the round ended.
-        // Start a new round => re-prompt
-        prompt_needed = 1;
+        printf("[Client] Server closed connection.\n");
+        break;
       }
-      else
+      printf("\n[Client] Connection lost; reconnecting...\n");
+      net_close(sockfd);
+      sockfd = reconnect(server_ip, port, token);
+      if (sockfd < 0)
+      {
+        printf("[Client] Could not reconnect. Exiting...\n");
+        return 1;
+      }
+      print_tls(sockfd);
+      max_fd = (sockfd > fileno(stdin)) ? sockfd : fileno(stdin);
+      proto_parser_init(&parser);
+      if (net_udp(sockfd))
       {
-        // some other server message
-        printf("[Client] Server says: %s\n", buffer);
+        parser.mode = PROTO_BINARY;
       }
+      resuming = 1;
+      redraw = 0;
+      continue;
     }
 
-    /* 2) Check if the user typed something */
+    /* 3) Check if the user typed something */
     if (FD_ISSET(fileno(stdin), &read_fds))
     {
       memset(buffer, 0, BUF_SIZE);
@@ -145,16 +372,17 @@ int main(int argc, char *argv[])
       }
 
       char cmd = buffer[0];
+      int rc = 0;
       if (cmd == 'Q' || cmd == 'q')
       {
-        send(sockfd, "QUIT", 4, 0);
+        send_frame(sockfd, PROTO_OP_QUIT, NULL, 0);
         printf("[Client] You chose to quit.\n");
         break;
       }
       else if (cmd == 'T' || cmd == 't')
       {
         // user requests RESET
-        send(sockfd, "RESET", 5, 0);
+        rc = send_frame(sockfd, PROTO_OP_RESET, NULL, 0);
         // We won't re-prompt until server confirms with a "RESET" msg
         prompt_needed = 0;
       }
@@ -167,55 +395,154 @@ int main(int argc, char *argv[])
       else
       {
         // probably a move: R/P/S/L/K
-        // We'll send as "MOVE:R"
-        char msg[BUF_SIZE];
-        snprintf(msg, BUF_SIZE, "MOVE:%c", cmd);
-        send(sockfd, msg, strlen(msg), 0);
+        // We'll send it as a MOVE frame carrying the character
+        rc = send_frame(sockfd, PROTO_OP_MOVE, &cmd, 1);
 
         // They have effectively made their move => we won't prompt again
         // until the server finishes the round (RESULT) or we get a RESET, etc.
         prompt_needed = 0;
       }
+      if (rc < 0)
+      {
+        // the next select() reports the dead socket; reconnect then
+        continue;
+      }
     }
   } // end while(1)
 
-  close(sockfd);
+  net_close(sockfd);
   return 0;
 }
 
 static void usage(const char *prog)
 {
-  fprintf(stderr, "Usage: %s <server_ip> <port>\n", prog);
+  fprintf(stderr, "Usage: %s [--tls] [--tls-ca FILE] [--udp] [--sock-profile SPEC] [--player ID]\n"
+                  "       [--watch TABLE] <server_ip> <port>\n",
+          prog);
+  fprintf(stderr, "  --tls          connect with TLS, trusting the system's CAs\n");
+  fprintf(stderr, "  --tls-ca FILE  connect with TLS, trusting the CAs in FILE\n");
+  fprintf(stderr, "  --udp          play over UDP (server needs --udp)\n");
+  fprintf(stderr, "  --sock-profile SPEC  TCP options, as for spock_server (default game)\n");
+  fprintf(stderr, "  --player ID    keep score under this player id (server needs --scores)\n");
+  fprintf(stderr, "  --watch TABLE  watch table TABLE (or \"latest\") from the server's --watch-port\n");
   fprintf(stderr, "Example: %s 127.0.0.1 5555\n", prog);
 }
 
-/* connect_to_server: create a TCP connection to server_ip:port. */
-static int connect_to_server(const char *host, int port)
+/*
+ * reconnect:
+ *   Retry the connection with exponential backoff (capped), and ask for
+ *   our old seat back. Gives up after RECONNECT_GIVE_UP_MS.
+ */
+static int reconnect(const char *host, int port, const char *token)
 {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0)
+  long long deadline = reactor_now_ms() + RECONNECT_GIVE_UP_MS;
+  int delay = RECONNECT_FIRST_MS;
+
+  while (reactor_now_ms() < deadline)
+  {
+    int sockfd = connect_to_server(host, port);
+    if (sockfd >= 0)
+    {
+      if (send_join(sockfd, token) == 0)
+      {
+        return sockfd;
+      }
+      net_close(sockfd);
+    }
+    struct timespec ts = {delay / 1000, (delay % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+    delay = (delay * 2 < RECONNECT_MAX_MS) ? delay * 2 : RECONNECT_MAX_MS;
+  }
+  return -1;
+}
+
+static void print_tls(int sockfd)
+{
+  char desc[128];
+  if (net_describe(sockfd, desc, sizeof(desc)))
   {
-    perror("socket");
-    return -1;
+    printf("[Client] TLS: %s\n", desc);
   }
+}
 
-  struct sockaddr_in srv;
-  memset(&srv, 0, sizeof(srv));
-  srv.sin_family = AF_INET;
-  srv.sin_port = htons(port);
 
-  if (inet_pton(AF_INET, host, &srv.sin_addr) <= 0)
+/*
+ * watch_table:
+ *   Spectator mode: ask the watch port for a table and print what its
+ *   players are told, until the table ends or the user types Q.
+ */
+static int watch_table(int sockfd, const char *table)
+{
+  if (send_watch(sockfd, table) < 0)
   {
-    perror("inet_pton");
-    close(sockfd);
-    return -1;
+    net_close(sockfd);
+    return 1;
   }
+  printf("[Client] Spectating; type Q to stop.\n");
 
-  if (connect(sockfd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
+  ProtoParser parser;
+  proto_parser_init(&parser);
+  int max_fd = (sockfd > fileno(stdin)) ? sockfd : fileno(stdin);
+  int done = 0;
+
+  while (!done)
   {
-    perror("connect");
-    close(sockfd);
-    return -1;
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(sockfd, &read_fds);
+    FD_SET(fileno(stdin), &read_fds);
+    if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0)
+    {
+      perror("select");
+      break;
+    }
+
+    if (FD_ISSET(sockfd, &read_fds))
+    {
+      size_t avail;
+      uint8_t *space = proto_parser_space(&parser, &avail);
+      int n = net_recv(sockfd, space, avail);
+      if (n <= 0)
+      {
+        printf("[Client] Server closed connection.\n");
+        break;
+      }
+      proto_parser_commit(&parser, n);
+
+      int rc;
+      ProtoFrame f;
+      while (!done && (rc = proto_next(&parser, &f)) > 0)
+      {
+        if (f.op == PROTO_OP_HELLO)
+          continue;
+        if (f.op == PROTO_OP_RESULT)
+          printf("[Client] Round Result => %.*s\n", (int)f.len, (const char *)f.payload);
+        else if (f.op == PROTO_OP_RESET)
+          printf("[Client] Scores have been reset.\n");
+        else if (f.op == PROTO_OP_QUIT)
+        {
+          printf("[Client] The game is over.\n");
+          done = 1;
+        }
+        else
+          printf("[Client] Server says: %.*s\n", (int)f.len, (const char *)f.payload);
+      }
+      fflush(stdout);
+      if (!done && rc < 0)
+      {
+        printf("[Client] Malformed message from server.\n");
+        break;
+      }
+    }
+
+    if (!done && FD_ISSET(fileno(stdin), &read_fds))
+    {
+      char line[BUF_SIZE];
+      if (!fgets(line, sizeof(line), stdin) || line[0] == 'Q' || line[0] == 'q')
+        break;
+    }
   }
-  return sockfd;
+
+  net_close(sockfd);
+  return 0;
 }
@@ -0,0 +1,194 @@
+/******************************************************************************
+ * spock_logdump.c
+ *
+ * Prints a spock_server event log (--event-log FILE) as text, one event
+ * per line, e.g.:
+ *
+ *   2026-10-14 03:37:01.123456 shard 0 table 3 round 2 MOVE player 1 Rock
+ *
+ * Usage example:
+ *   ./spock_logdump spock_events.log
+ *   ./spock_logdump --table 3 spock_events.log   => only table 3's events
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "evlog.h"
+#include "rules.h"
+
+#define READ_RECORDS 1024
+
+static void usage(const char *prog);
+static int check_header(FILE *in, const char *path);
+static void print_record(const EvRecord *r);
+static const char *type_name(uint8_t type);
+
+int main(int argc, char *argv[])
+{
+    long table = -1;
+
+    static const struct option long_opts[] = {
+        {"table", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            table = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    const char *path = argv[optind];
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return 1;
+    }
+    if (check_header(in, path) < 0)
+    {
+        fclose(in);
+        return 1;
+    }
+
+    static EvRecord recs[READ_RECORDS];
+    size_t n;
+    unsigned long total = 0;
+    while ((n = fread(recs, sizeof(EvRecord), READ_RECORDS, in)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (table < 0 || recs[i].table == (uint32_t)table)
+            {
+                print_record(&recs[i]);
+            }
+        }
+        total += n;
+    }
+    if (ferror(in))
+    {
+        perror(path);
+        fclose(in);
+        return 1;
+    }
+    long tail = ftell(in) - (long)sizeof(EvlogHeader) - (long)(total * sizeof(EvRecord));
+    if (tail > 0)
+    {
+        fprintf(stderr, "%s: ignoring %ld trailing bytes (partly written record)\n", path, tail);
+    }
+    fclose(in);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--table N] <event_log>\n", prog);
+    fprintf(stderr, "Example: %s spock_events.log\n", prog);
+}
+
+static int check_header(FILE *in, const char *path)
+{
+    EvlogHeader h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, EVLOG_MAGIC, sizeof(h.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a spock_server event log\n", path);
+        return -1;
+    }
+    if (h.version != EVLOG_VERSION || h.record_size != EVLOG_RECORD_SIZE)
+    {
+        fprintf(stderr, "%s: unsupported event log version %u (record size %u)\n",
+                path, h.version, h.record_size);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_record(const EvRecord *r)
+{
+    time_t secs = (time_t)(r->time_us / 1000000);
+    struct tm tm;
+    char when[32];
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf("%s.%06u shard %u table %u round %u %s", when,
+           (unsigned)(r->time_us % 1000000), r->shard, r->table, r->round, type_name(r->type));
+    if (r->seat != 0xFF)
+    {
+        printf(" player %u", r->seat + 1u);
+    }
+
+    switch (r->type)
+    {
+    case EV_START:
+        printf(" %u players", r->value);
+        break;
+    case EV_JOIN:
+        printf(" (%u seated)", r->value);
+        break;
+    case EV_MOVE:
+        printf(" %s", move_to_string((Move)r->value));
+        break;
+    case EV_RESULT:
+        if (r->arg == 0)
+        {
+            printf(" tie");
+            break;
+        }
+        printf(" winners");
+        for (int i = 0; i < 32; i++)
+        {
+            if (r->arg & (1u << i))
+            {
+                printf(" %d", i + 1);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    printf("\n");
+}
+
+static const char *type_name(uint8_t type)
+{
+    switch (type)
+    {
+    case EV_START:
+        return "START";
+    case EV_JOIN:
+        return "JOIN";
+    case EV_RESUME:
+        return "RESUME";
+    case EV_LEAVE:
+        return "LEAVE";
+    case EV_MOVE:
+        return "MOVE";
+    case EV_RESULT:
+        return "RESULT";
+    case EV_RESET:
+        return "RESET";
+    case EV_QUIT:
+        return "QUIT";
+    case EV_END:
+        return "END";
+    default:
+        return "?";
+    }
+}
@@ -0,0 +1,854 @@
+/******************************************************************************
+ * spock_microbench.c
+ *
+ * Micro-benchmarks of the server's hot paths, for tracking their speed
+ * from build to build. It:
+ *   1) Times winner resolution (determine_multiplayer_winners(), the
+ *      dominant_moves() lookup, and batch_resolve() with either kernel),
+ *      frame parsing and RESULT encoding in both protocol modes, a whole
+ *      round at a real table (three moves, resolution, the RESULT encoded
+ *      and delivered to in-process seats), a socket round trip through
+ *      each event loop backend, and timer wheel arm/cancel.
+ *   2) Runs each for at least --min-time seconds (doubling the iteration
+ *      count until it does), --repeat times, and reports the median and
+ *      the best time per operation.
+ *   3) With --json FILE, also writes the results as JSON, with the build
+ *      variant (SPOCK_BUILD, set by the top-level Makefile), the compiler
+ *      and a timestamp, so runs can be kept and compared.
+ *
+ * Usage example:
+ *   ./spock_microbench
+ *   ./spock_microbench --filter proto --min-time 0.5 --json bench.json
+ *   make -C .. bench VARIANT=release   => build/release/bench.json
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "proto.h"
+#include "reactor.h"
+#include "rules.h"
+#include "table.h"
+#include "timer.h"
+
+#ifndef SPOCK_BUILD
+#define SPOCK_BUILD "default" /* the top-level Makefile passes its VARIANT */
+#endif
+
+#define MAX_REPEAT 15
+#define ROUND_SETS 1024    /* pre-generated rounds, cycled (a power of two) */
+#define BATCH_TABLES 4096
+#define TIMER_COUNT 4096
+
+typedef struct
+{
+    const char *name;
+    const char *op; /* what one operation is */
+    int (*setup)(void **ctx);               /* 0, or -1 to skip the benchmark */
+    long (*run)(void *ctx, long iters);     /* returns the operations done */
+    void (*teardown)(void *ctx);
+    const char *(*detail)(void *ctx);       /* e.g. the kernel used, or NULL */
+} MicroBench;
+
+typedef struct
+{
+    const MicroBench *bench;
+    const char *detail;
+    long ops;         /* in the median run */
+    double ns_median; /* per operation */
+    double ns_min;
+} Result;
+
+/* One block: the moves (seat-major), then scores and winners for BATCH_TABLES three-seat tables. */
+typedef struct
+{
+    uint8_t moves[3 * BATCH_TABLES];
+    int32_t scores[3 * BATCH_TABLES];
+    uint16_t winners[BATCH_TABLES];
+} BatchCtx;
+
+static void usage(const char *prog);
+static int run_bench(const MicroBench *b, double min_time, int repeat, Result *out);
+static int cmp_double(const void *a, const void *b);
+static int write_json(const char *path, const Result *results, int n, double min_time, int repeat);
+static void json_string(FILE *out, const char *s);
+static double now_sec(void);
+static uint32_t xorshift32(uint32_t *state);
+static uint8_t *random_moves(int numPlayers, size_t count);
+
+static int setup_rounds3(void **ctx);
+static long run_winners(const uint8_t *rounds, int numPlayers, long iters);
+static int setup_rounds16(void **ctx);
+static long run_winners3(void *ctx, long iters);
+static long run_winners16(void *ctx, long iters);
+static long run_dominant(void *ctx, long iters);
+static int setup_batch(void **ctx);
+static long run_batch_with(BatchCtx *c, long iters, void (*resolve)(const RoundBatch *));
+static long run_batch(void *ctx, long iters);
+static long run_batch_scalar(void *ctx, long iters);
+static const char *detail_batch(void *ctx);
+static int setup_parse(void **ctx, ProtoMode mode);
+static int setup_parse_binary(void **ctx);
+static int setup_parse_text(void **ctx);
+static long run_parse(void *ctx, long iters);
+static long run_encode(ProtoMode mode, long iters);
+static long run_encode_binary(void *ctx, long iters);
+static long run_encode_text(void *ctx, long iters);
+static int setup_table(void **ctx);
+static long run_table(void *ctx, long iters);
+static void teardown_table(void *ctx);
+static void on_seat_message(void *arg, const OutBuf *b);
+static void on_seat_close(void *arg);
+static int setup_epoll(void **ctx);
+static int setup_poll(void **ctx);
+static int setup_uring(void **ctx);
+static int setup_pingpong(void **ctx, ReactorBackend backend, const char *want);
+static long run_pingpong(void *ctx, long iters);
+static void teardown_pingpong(void *ctx);
+static const char *detail_pingpong(void *ctx);
+static void on_ping(Reactor *r, int fd, unsigned events, void *arg);
+static void on_pong(Reactor *r, int fd, unsigned events, void *arg);
+static int setup_timers(void **ctx);
+static long run_timers(void *ctx, long iters);
+static void on_bench_timer(Timer *t, void *arg);
+static void teardown_free(void *ctx);
+
+static const MicroBench benches[] = {
+    {"rules.winners.3p", "round", setup_rounds3, run_winners3, teardown_free, NULL},
+    {"rules.winners.16p", "round", setup_rounds16, run_winners16, teardown_free, NULL},
+    {"rules.dominant_moves", "lookup", setup_rounds3, run_dominant, teardown_free, NULL},
+    {"batch.resolve.3p", "table-round", setup_batch, run_batch, teardown_free, detail_batch},
+    {"batch.resolve_scalar.3p", "table-round", setup_batch, run_batch_scalar, teardown_free, NULL},
+    {"proto.parse.binary", "frame", setup_parse_binary, run_parse, teardown_free, NULL},
+    {"proto.parse.text", "frame", setup_parse_text, run_parse, teardown_free, NULL},
+    {"proto.encode_result.binary", "message", NULL, run_encode_binary, NULL, NULL},
+    {"proto.encode_result.text", "message", NULL, run_encode_text, NULL, NULL},
+    {"table.round.3p", "round", setup_table, run_table, teardown_table, NULL},
+    {"reactor.pingpong.epoll", "round-trip", setup_epoll, run_pingpong, teardown_pingpong,
+     detail_pingpong},
+    {"reactor.pingpong.poll", "round-trip", setup_poll, run_pingpong, teardown_pingpong,
+     detail_pingpong},
+    {"reactor.pingpong.io_uring", "round-trip", setup_uring, run_pingpong, teardown_pingpong,
+     detail_pingpong},
+    {"timer.arm_cancel", "timer", setup_timers, run_timers, teardown_free, NULL},
+};
+#define NBENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+/* Results every benchmark folds into, so the compiler keeps the work. */
+static volatile unsigned long sink;
+
+int main(int argc, char *argv[])
+{
+    double min_time = 0.2;
+    int repeat = 3;
+    const char *filter = NULL;
+    const char *json = NULL;
+    int list = 0;
+
+    static const struct option long_opts[] = {
+        {"min-time", required_argument, NULL, 't'},
+        {"repeat", required_argument, NULL, 'r'},
+        {"filter", required_argument, NULL, 'f'},
+        {"json", required_argument, NULL, 'j'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:r:f:j:lh", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case 'l':
+            list = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind != argc || min_time <= 0 || repeat < 1 || repeat > MAX_REPEAT)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    Result results[NBENCHES];
+    int n = 0;
+    if (!list)
+    {
+        printf("[Micro] build %s, %d run%s of at least %.2f s each\n",
+               SPOCK_BUILD, repeat, repeat == 1 ? "" : "s", min_time);
+        printf("%-28s %12s %12s %14s  %s\n", "benchmark", "ns/op", "best ns/op", "ops/s", "op");
+    }
+    for (int i = 0; i < NBENCHES; i++)
+    {
+        const MicroBench *b = &benches[i];
+        if (filter && !strstr(b->name, filter))
+            continue;
+        if (list)
+        {
+            printf("%-28s %s\n", b->name, b->op);
+            continue;
+        }
+        if (run_bench(b, min_time, repeat, &results[n]) < 0)
+        {
+            printf("%-28s %12s\n", b->name, "skipped");
+            continue;
+        }
+        const Result *r = &results[n++];
+        printf("%-28s %12.1f %12.1f %14.0f  %s%s%s%s\n", b->name, r->ns_median, r->ns_min,
+               1e9 / r->ns_median, b->op, r->detail ? " (" : "", r->detail ? r->detail : "",
+               r->detail ? ")" : "");
+        fflush(stdout);
+    }
+    if (json && !list && write_json(json, results, n, min_time, repeat) < 0)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--min-time SECS] [--repeat N] [--filter TEXT] [--json FILE] [--list]\n",
+            prog);
+    fprintf(stderr, "  --min-time S   run each benchmark at least this long (default 0.2)\n");
+    fprintf(stderr, "  --repeat N     runs per benchmark, median reported (default 3, up to %d)\n",
+            MAX_REPEAT);
+    fprintf(stderr, "  --filter TEXT  only the benchmarks whose name contains TEXT\n");
+    fprintf(stderr, "  --json FILE    also write the results to FILE as JSON\n");
+    fprintf(stderr, "  --list         print the benchmarks and exit\n");
+    fprintf(stderr, "Example: %s --filter reactor --json reactor.json\n", prog);
+}
+
+/*
+ * run_bench:
+ *   Find an iteration count that takes at least min_time, then time that
+ *   many repeat times. Returns 0 with *out filled, or -1 if the benchmark
+ *   cannot run here.
+ */
+static int run_bench(const MicroBench *b, double min_time, int repeat, Result *out)
+{
+    void *ctx = NULL;
+    if (b->setup && b->setup(&ctx) < 0)
+    {
+        return -1;
+    }
+
+    long iters = 1, ops = 0;
+    double elapsed = 0;
+    for (;;)
+    {
+        double start = now_sec();
+        ops = b->run(ctx, iters);
+        elapsed = now_sec() - start;
+        if (elapsed >= min_time || iters > (1L << 40))
+            break;
+        // aim a little past min_time instead of doubling blindly
+        long next = elapsed > 0 ? (long)(iters * min_time * 1.2 / elapsed) : iters * 10;
+        iters = next > iters * 10 ? iters * 10 : (next > iters ? next : iters * 2);
+    }
+
+    double ns[MAX_REPEAT];
+    ns[0] = elapsed * 1e9 / (double)ops;
+    for (int k = 1; k < repeat; k++)
+    {
+        double start = now_sec();
+        ops = b->run(ctx, iters);
+        ns[k] = (now_sec() - start) * 1e9 / (double)ops;
+    }
+    qsort(ns, repeat, sizeof(double), cmp_double);
+
+    out->bench = b;
+    out->detail = b->detail ? b->detail(ctx) : NULL;
+    out->ops = ops;
+    out->ns_median = ns[repeat / 2];
+    out->ns_min = ns[0];
+    if (b->teardown)
+    {
+        b->teardown(ctx);
+    }
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* write_json: one object for the run, with a "benchmarks" array. */
+static int write_json(const char *path, const Result *results, int n, double min_time, int repeat)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        return -1;
+    }
+    char stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+    fprintf(out, "{\n  \"suite\": \"spock_microbench\",\n  \"version\": 1,\n");
+    fprintf(out, "  \"timestamp\": \"%s\",\n  \"build\": ", stamp);
+    json_string(out, SPOCK_BUILD);
+    fprintf(out, ",\n  \"compiler\": ");
+    json_string(out, __VERSION__);
+    fprintf(out, ",\n  \"cpus\": %ld,\n  \"min_time_s\": %g,\n  \"repeat\": %d,\n",
+            sysconf(_SC_NPROCESSORS_ONLN), min_time, repeat);
+    fprintf(out, "  \"benchmarks\": [");
+    for (int i = 0; i < n; i++)
+    {
+        const Result *r = &results[i];
+        fprintf(out, "%s\n    {\"name\": ", i ? "," : "");
+        json_string(out, r->bench->name);
+        fprintf(out, ", \"op\": ");
+        json_string(out, r->bench->op);
+        if (r->detail)
+        {
+            fprintf(out, ", \"detail\": ");
+            json_string(out, r->detail);
+        }
+        fprintf(out, ", \"ops\": %ld, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, "
+                     "\"ops_per_sec\": %.0f}",
+                r->ops, r->ns_median, r->ns_min, 1e9 / r->ns_median);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (fclose(out) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+    printf("[Micro] Results written to %s\n", path);
+    return 0;
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* random_moves: count rows of numPlayers valid moves, always the same ones. */
+static uint8_t *random_moves(int numPlayers, size_t count)
+{
+    uint8_t *moves = malloc(count * numPlayers);
+    if (!moves)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    uint32_t seed = 1;
+    for (size_t i = 0; i < count * numPlayers; i++)
+    {
+        moves[i] = (uint8_t)(xorshift32(&seed) % MOVE_INVALID);
+    }
+    return moves;
+}
+
+/* Winner resolution */
+
+static int setup_rounds3(void **ctx)
+{
+    return (*ctx = random_moves(3, ROUND_SETS)) ? 0 : -1;
+}
+
+static int setup_rounds16(void **ctx)
+{
+    return (*ctx = random_moves(16, ROUND_SETS)) ? 0 : -1;
+}
+
+static long run_winners(const uint8_t *rounds, int numPlayers, long iters)
+{
+    Move moves[MAX_PLAYERS];
+    int winners[MAX_PLAYERS];
+    int numWinners;
+    unsigned long acc = 0;
+
+    for (long i = 0; i < iters; i++)
+    {
+        const uint8_t *row = rounds + (i & (ROUND_SETS - 1)) * numPlayers;
+        for (int p = 0; p < numPlayers; p++)
+        {
+            moves[p] = (Move)row[p];
+        }
+        determine_multiplayer_winners(moves, numPlayers, winners, &numWinners);
+        acc += (unsigned long)numWinners;
+    }
+    sink += acc;
+    return iters;
+}
+
+static long run_winners3(void *ctx, long iters)
+{
+    return run_winners(ctx, 3, iters);
+}
+
+static long run_winners16(void *ctx, long iters)
+{
+    return run_winners(ctx, 16, iters);
+}
+
+static long run_dominant(void *ctx, long iters)
+{
+    const uint8_t *rounds = ctx;
+    unsigned long acc = 0;
+
+    for (long i = 0; i < iters; i++)
+    {
+        const uint8_t *row = rounds + (i & (ROUND_SETS - 1)) * 3;
+        acc += dominant_moves(MOVE_BIT(row[0]) | MOVE_BIT(row[1]) | MOVE_BIT(row[2]));
+    }
+    sink += acc;
+    return iters;
+}
+static int setup_batch(void **ctx)
+{
+    BatchCtx *b = calloc(1, sizeof(*b));
+    uint8_t *moves = random_moves(3, BATCH_TABLES);
+    if (!b || !moves)
+    {
+        free(b);
+        free(moves);
+        return -1;
+    }
+    memcpy(b->moves, moves, sizeof(b->moves));
+    free(moves);
+    *ctx = b;
+    return 0;
+}
+
+static long run_batch_with(BatchCtx *c, long iters, void (*resolve)(const RoundBatch *))
+{
+    RoundBatch b = {BATCH_TABLES, 3, BATCH_TABLES, c->moves, c->scores, c->winners};
+    long rounds = (iters + BATCH_TABLES - 1) / BATCH_TABLES;
+    for (long i = 0; i < rounds; i++)
+    {
+        resolve(&b);
+    }
+    sink += c->winners[0];
+    return rounds * BATCH_TABLES;
+}
+
+static long run_batch(void *ctx, long iters)
+{
+    return run_batch_with(ctx, iters, batch_resolve);
+}
+
+static long run_batch_scalar(void *ctx, long iters)
+{
+    return run_batch_with(ctx, iters, batch_resolve_scalar);
+}
+
+static const char *detail_batch(void *ctx)
+{
+    (void)ctx;
+    return batch_kernel_name();
+}
+
+/* Frame parsing: a parser buffer full of MOVE frames, parsed again each time */
+
+typedef struct
+{
+    ProtoMode mode;
+    size_t len;
+    int frames;
+    uint8_t wire[PROTO_BUF_SIZE];
+} ParseCtx;
+
+static int setup_parse(void **ctx, ProtoMode mode)
+{
+    ParseCtx *c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return -1;
+    }
+    static const char letters[] = "RPSLK";
+    c->mode = mode;
+    for (int i = 0;; i++)
+    {
+        uint8_t frame[16];
+        char mv = letters[i % 5];
+        size_t n = mode == PROTO_BINARY
+                       ? proto_encode(PROTO_BINARY, PROTO_OP_MOVE, &mv, 1, frame, sizeof(frame))
+                       : (size_t)snprintf((char *)frame, sizeof(frame), "MOVE:%c\n", mv);
+        if (c->len + n > sizeof(c->wire))
+            break;
+        memcpy(c->wire + c->len, frame, n);
+        c->len += n;
+        c->frames++;
+    }
+    *ctx = c;
+    return 0;
+}
+
+static int setup_parse_binary(void **ctx)
+{
+    return setup_parse(ctx, PROTO_BINARY);
+}
+
+static int setup_parse_text(void **ctx)
+{
+    return setup_parse(ctx, PROTO_TEXT);
+}
+
+static long run_parse(void *ctx, long iters)
+{
+    ParseCtx *c = ctx;
+    static ProtoParser p;
+    ProtoFrame f;
+    size_t avail;
+    long frames = 0;
+    unsigned long acc = 0;
+
+    long batches = (iters + c->frames - 1) / c->frames;
+    for (long i = 0; i < batches; i++)
+    {
+        proto_parser_init(&p);
+        p.mode = c->mode;
+        memcpy(proto_parser_space(&p, &avail), c->wire, c->len);
+        proto_parser_commit(&p, c->len);
+        while (proto_next(&p, &f) > 0)
+        {
+            acc += f.payload[0];
+            frames++;
+        }
+    }
+    sink += acc;
+    return frames;
+}
+
+/* RESULT encoding: a three-seat round's payload behind each mode's header */
+
+static const char result_payload[] = "1,3:Rock,Scissors,Rock:12,7,12";
+
+static long run_encode(ProtoMode mode, long iters)
+{
+    uint8_t out[PROTO_BUF_SIZE] = {0};
+    unsigned long acc = 0;
+
+    for (long i = 0; i < iters; i++)
+    {
+        acc += proto_encode(mode, PROTO_OP_RESULT, result_payload, sizeof(result_payload) - 1,
+                            out, sizeof(out));
+        out[0] ^= (uint8_t)i; // keep each encode observable
+    }
+    sink += acc + out[0];
+    return iters;
+}
+
+static long run_encode_binary(void *ctx, long iters)
+{
+    (void)ctx;
+    return run_encode(PROTO_BINARY, iters);
+}
+
+static long run_encode_text(void *ctx, long iters)
+{
+    (void)ctx;
+    return run_encode(PROTO_TEXT, iters);
+}
+
+/* A whole round at a real table, with in-process seats (seat.h) as the players */
+
+typedef struct
+{
+    Reactor *reactor;
+    Lobby lobby;
+    Conn *seats[3];
+    uint8_t *rounds;
+    unsigned long delivered;
+} TableCtx;
+
+static const SeatOps bench_seat_ops = {"bench", 1, on_seat_message, on_seat_close};
+
+static int setup_table(void **ctx)
+{
+    TableCtx *c = aligned_alloc(_Alignof(TableCtx), sizeof(TableCtx));
+    if (!c)
+    {
+        return -1;
+    }
+    memset(c, 0, sizeof(*c));
+    // the lobby wants a listener; nobody connects to it
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0 ||
+        !(c->reactor = reactor_create(REACTOR_BACKEND_AUTO)) ||
+        lobby_init(&c->lobby, c->reactor, fd, 3) < 0 || !(c->rounds = random_moves(3, ROUND_SETS)))
+    {
+        perror("table benchmark");
+        free(c);
+        return -1;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (!(c->seats[i] = lobby_open_seat(&c->lobby, &bench_seat_ops, c)))
+        {
+            return -1;
+        }
+    }
+    *ctx = c;
+    return 0;
+}
+
+static long run_table(void *ctx, long iters)
+{
+    TableCtx *c = ctx;
+    for (long i = 0; i < iters; i++)
+    {
+        const uint8_t *row = c->rounds + (i & (ROUND_SETS - 1)) * 3;
+        for (int p = 0; p < 3; p++)
+        {
+            static const char letters[] = "RPSLK";
+            conn_command(c->seats[p], PROTO_OP_MOVE, &letters[row[p]], 1);
+        }
+    }
+    sink += c->delivered;
+    return iters;
+}
+
+static void teardown_table(void *ctx)
+{
+    TableCtx *c = ctx;
+    lobby_shutdown(&c->lobby);
+    reactor_destroy(c->reactor);
+    free(c->rounds);
+    free(c);
+}
+
+static void on_seat_message(void *arg, const OutBuf *b)
+{
+    TableCtx *c = arg;
+    c->delivered += outbuf_len(b);
+}
+
+static void on_seat_close(void *arg)
+{
+    (void)arg;
+}
+
+/* Event loop: one byte bounced between the two ends of a socketpair */
+
+typedef struct
+{
+    Reactor *reactor;
+    int fds[2];
+    long trips;
+    long target;
+} PingCtx;
+
+static int setup_epoll(void **ctx)
+{
+    return setup_pingpong(ctx, REACTOR_BACKEND_EPOLL, "epoll");
+}
+
+static int setup_poll(void **ctx)
+{
+    return setup_pingpong(ctx, REACTOR_BACKEND_POLL, "poll");
+}
+
+static int setup_uring(void **ctx)
+{
+    return setup_pingpong(ctx, REACTOR_BACKEND_URING, "io_uring");
+}
+
+/* setup_pingpong: skipped (-1) if the reactor falls back to a backend other than want. */
+static int setup_pingpong(void **ctx, ReactorBackend backend, const char *want)
+{
+    PingCtx *c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return -1;
+    }
+    if (!(c->reactor = reactor_create(backend)) || strcmp(reactor_backend_name(c->reactor), want) != 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, c->fds) < 0 ||
+        reactor_add(c->reactor, c->fds[0], REACTOR_READ, on_ping, c) < 0 ||
+        reactor_add(c->reactor, c->fds[1], REACTOR_READ, on_pong, c) < 0)
+    {
+        if (c->reactor)
+            reactor_destroy(c->reactor);
+        free(c);
+        return -1;
+    }
+    *ctx = c;
+    return 0;
+}
+
+static long run_pingpong(void *ctx, long iters)
+{
+    PingCtx *c = ctx;
+    c->trips = 0;
+    c->target = iters;
+    if (write(c->fds[0], "p", 1) != 1)
+    {
+        return 1;
+    }
+    while (c->trips < c->target)
+    {
+        if (reactor_poll(c->reactor, 1000) < 0)
+        {
+            perror("reactor_poll");
+            break;
+        }
+    }
+    return c->trips ? c->trips : 1;
+}
+
+/* on_ping: the byte came back; count the trip and send it again. */
+static void on_ping(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    PingCtx *c = arg;
+    char buf[16];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        c->trips += n;
+        if (c->trips < c->target && write(fd, buf, 1) != 1)
+        {
+            c->target = c->trips; // cannot happen with a one-byte socketpair; stop
+        }
+    }
+}
+
+/* on_pong: echo what arrives. */
+static void on_pong(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    (void)arg;
+    char buf[16];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        if (write(fd, buf, (size_t)n) != n)
+        {
+            break;
+        }
+    }
+}
+
+static void teardown_pingpong(void *ctx)
+{
+    PingCtx *c = ctx;
+    reactor_del(c->reactor, c->fds[0]);
+    reactor_del(c->reactor, c->fds[1]);
+    close(c->fds[0]);
+    close(c->fds[1]);
+    reactor_destroy(c->reactor);
+    free(c);
+}
+
+static const char *detail_pingpong(void *ctx)
+{
+    return reactor_backend_name(((PingCtx *)ctx)->reactor);
+}
+
+/* Timer wheel: arm TIMER_COUNT timers at spread-out deadlines, then cancel them */
+
+typedef struct
+{
+    TimerWheel wheel;
+    Timer timers[TIMER_COUNT];
+    uint32_t delays[TIMER_COUNT];
+} TimerCtx;
+
+static void on_bench_timer(Timer *t, void *arg)
+{
+    (void)t;
+    (void)arg;
+}
+
+static int setup_timers(void **ctx)
+{
+    TimerCtx *c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return -1;
+    }
+    timer_wheel_init(&c->wheel, 0);
+    uint32_t seed = 7;
+    for (int i = 0; i < TIMER_COUNT; i++)
+    {
+        timer_init(&c->timers[i], on_bench_timer, NULL);
+        c->delays[i] = 1 + xorshift32(&seed) % 60000; // up to a minute, as for grace periods
+    }
+    *ctx = c;
+    return 0;
+}
+
+static long run_timers(void *ctx, long iters)
+{
+    TimerCtx *c = ctx;
+    long rounds = (iters + TIMER_COUNT - 1) / TIMER_COUNT;
+    for (long r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < TIMER_COUNT; i++)
+        {
+            timer_arm(&c->wheel, &c->timers[i], c->delays[i]);
+        }
+        for (int i = 0; i < TIMER_COUNT; i++)
+        {
+            timer_cancel(&c->wheel, &c->timers[i]);
+        }
+    }
+    return rounds * TIMER_COUNT;
+}
+
+static void teardown_free(void *ctx)
+{
+    free(ctx);
+}
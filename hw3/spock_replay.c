@@ -0,0 +1,973 @@
+/******************************************************************************
+ * spock_replay.c
+ *
+ * Replays recorded client traffic against a live server. It:
+ *   1) Reads a packet capture (pcap or pcapng, see pcap.h) in one pass and
+ *      reassembles every TCP flow to the server port (--port, default the
+ *      target's): the client's bytes in order, without retransmissions,
+ *      cut into the writes it made, and when the server answered each one.
+ *   2) Opens one connection per recorded flow to <server_ip> <port>, at
+ *      the time it was opened, and sends each write at its recorded time,
+ *      scaled by --speed (2 = twice as fast). With --speed 0 a write goes
+ *      out as soon as the server has sent what it had sent before it in
+ *      the recording: as fast as the server answers, in the same order.
+ *   3) Times the server's first bytes after every write that got an
+ *      answer in the recording, and reports both sets of response times
+ *      side by side (histogram.c), with the bytes the server sent.
+ *   4) With --max-slowdown F, exits 1 if the live p99 is over F times the
+ *      recorded one, so a captured incident becomes a regression test.
+ *   5) With --list, only prints the capture's TCP flows.
+ *
+ * The client's bytes are replayed as they were captured, so this works for
+ * any cleartext protocol spoken over TCP: spock_server's framed or text
+ * protocol, or hw1's speakd. What a session learned from its server (a
+ * resume token) is not rewritten, and TLS flows cannot be replayed.
+ *
+ * Usage example:
+ *   ./spock_replay --list ../hw2/google1.pcapng
+ *   ./spock_replay incident.pcap 127.0.0.1 5555
+ *   ./spock_replay --speed 0 --max-slowdown 1.5 incident.pcap 127.0.0.1 5555
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "histogram.h"
+#include "net.h"
+#include "pcap.h"
+#include "reactor.h"
+
+#define FLOW_BUCKETS 4096  /* flow hash table; a power of two */
+#define OOO_MAX 256        /* out-of-order segments held per direction */
+#define MERGE_US 1000      /* client segments closer than this are one write */
+#define DEFAULT_TIMEOUT 2  /* seconds to wait for a server that went quiet */
+
+typedef struct segment
+{
+    struct segment *next;
+    uint32_t seq;
+    uint32_t len;
+    uint8_t data[];
+} Segment;
+
+/* One direction of a recorded flow, being reassembled. */
+typedef struct
+{
+    int started;   /* next is known */
+    uint32_t next; /* sequence number of the next in-order byte */
+    Segment *ooo;  /* segments past a hole, by sequence number */
+    int nooo;
+    uint64_t bytes; /* in order, once each */
+    uint64_t gaps;  /* bytes the capture missed, skipped over */
+} Stream;
+
+/* One write the client made, as recorded. */
+typedef struct
+{
+    long long ts_us;
+    uint32_t off, len;      /* in the flow's client bytes */
+    uint64_t server_before; /* server bytes recorded before it */
+    long long resp_us;      /* until the server's next bytes, -1 = none */
+} Write;
+
+typedef enum
+{
+    FLOW_WAITING, /* not opened yet */
+    FLOW_OPEN,
+    FLOW_DONE
+} FlowState;
+
+typedef struct flow
+{
+    struct flow *hash_next;
+    uint8_t family;
+    uint8_t caddr[16], saddr[16];
+    uint16_t cport, sport;
+    long long first_us, last_us, last_up_us;
+    long packets;
+    int ended; /* FIN or RST seen: a new SYN on this 4-tuple is a new flow */
+    Stream up, down; /* client to server, server to client */
+    uint8_t *data;   /* client bytes */
+    size_t len, cap;
+    Write *writes;
+    int nwrites, cap_writes;
+    int answered; /* the server has sent something since the last write */
+
+    /* the replay */
+    FlowState state;
+    int fd;
+    int next_write;     /* first write not released yet */
+    int sent_write;     /* first write not completely sent */
+    size_t ready;       /* client bytes released */
+    size_t sent;
+    int want_write;
+    int eof;            /* the server closed */
+    uint64_t live_bytes;
+    long long await_us; /* when the write being timed went out, 0 = none */
+    long long await_rec;
+    long long blocked_ms; /* --speed 0: since when it waits for the server */
+    Timer timer;
+} Flow;
+
+/* Set in main() and while replaying (one thread). */
+static struct
+{
+    const char *host;
+    int port;
+    int cap_port;          /* the server's port in the capture, 0 = any */
+    double speed;          /* 0 = as fast as the server answers */
+    int timeout_ms;
+    double max_slowdown;   /* 0 = no regression check */
+    Flow *buckets[FLOW_BUCKETS];
+    Flow **flows;          /* in the order they appear */
+    int nflows, cap_flows;
+    long packets, segments, truncated;
+    long long cap_start_us, cap_end_us;
+    Reactor *reactor;
+    long long start_us;
+    long long last_activity_ms;
+    int open_flows;        /* not FLOW_DONE */
+    int unsent_flows;      /* with writes not all sent */
+    int errors, cut_short, stalls, overlapped;
+    Histogram recorded, live; /* microseconds, the same writes */
+} cfg;
+
+static void usage(const char *prog);
+static int read_capture(const char *path);
+static Flow *flow_for(const PcapTcp *s, int *up);
+static Flow *flow_new(const PcapTcp *s, int up, unsigned h);
+static unsigned flow_hash(const PcapTcp *s);
+static void stream_add(Flow *f, Stream *st, int up, const PcapTcp *s, long long ts);
+static void stream_drain(Flow *f, Stream *st, int up, long long ts);
+static void stream_hold(Flow *f, Stream *st, int up, uint32_t seq, const uint8_t *p,
+                        uint32_t len, long long ts);
+static void stream_skip(Flow *f, Stream *st, int up, long long ts);
+static void flow_bytes(Flow *f, int up, const uint8_t *p, uint32_t len, long long ts);
+static void list_flows(const char *path);
+static const char *endpoint(int family, const uint8_t *addr, uint16_t port, char *buf, size_t size);
+static int replay(void);
+static void report(int nreplayed, long long elapsed_us);
+static long long due_us(long long recorded_us);
+static void on_flow_timer(Timer *t, void *arg);
+static void flow_open(Flow *f);
+static void flow_pump(Flow *f);
+static void flow_send(Flow *f);
+static void flow_check_done(Flow *f);
+static void flow_close(Flow *f, int failed);
+static void on_flow_event(Reactor *r, int fd, unsigned events, void *arg);
+
+int main(int argc, char *argv[])
+{
+    int list = 0, port_given = 0;
+    cfg.speed = 1;
+    cfg.timeout_ms = DEFAULT_TIMEOUT * 1000;
+
+    static const struct option long_opts[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"port", required_argument, NULL, 'p'},
+        {"timeout", required_argument, NULL, 't'},
+        {"max-slowdown", required_argument, NULL, 'm'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:p:t:m:lh", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            cfg.speed = atof(optarg);
+            break;
+        case 'p':
+            cfg.cap_port = atoi(optarg);
+            port_given = 1;
+            break;
+        case 't':
+            cfg.timeout_ms = (int)(atof(optarg) * 1000);
+            break;
+        case 'm':
+            cfg.max_slowdown = atof(optarg);
+            break;
+        case 'l':
+            list = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != (list ? 1 : 3) || cfg.speed < 0 || cfg.timeout_ms <= 0 ||
+        cfg.max_slowdown < 0 || (port_given && (cfg.cap_port <= 0 || cfg.cap_port > 65535)))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    const char *path = argv[optind];
+    if (!list)
+    {
+        cfg.host = argv[optind + 1];
+        cfg.port = atoi(argv[optind + 2]);
+        if (!port_given)
+            cfg.cap_port = cfg.port;
+    }
+
+    if (read_capture(path) < 0)
+    {
+        return 1;
+    }
+    if (list)
+    {
+        list_flows(path);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return replay();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--speed X] [--port P] [--timeout SECS] [--max-slowdown F]\n"
+                    "       <capture> <server_ip> <port>\n"
+                    "       %s --list [--port P] <capture>\n",
+            prog, prog);
+    fprintf(stderr, "  --speed X        replay X times as fast as recorded (default 1;\n"
+                    "                   0 = each write as soon as the server has answered)\n");
+    fprintf(stderr, "  --port P         the server's port in the capture (default: <port>)\n");
+    fprintf(stderr, "  --timeout S      give up on a server that stays quiet this long (default %d)\n",
+            DEFAULT_TIMEOUT);
+    fprintf(stderr, "  --max-slowdown F exit 1 if the live p99 response time is over F times the\n"
+                    "                   recorded one\n");
+    fprintf(stderr, "  --list           print the capture's TCP flows and exit\n");
+    fprintf(stderr, "Example: %s --speed 0 incident.pcapng 127.0.0.1 5555\n", prog);
+}
+
+/*
+ * read_capture:
+ *   One pass over the capture: every TCP segment to or from cfg.cap_port
+ *   goes to its flow's reassembly. Returns 0, or -1 if it cannot be read.
+ */
+static int read_capture(const char *path)
+{
+    PcapReader r;
+    PcapPacket p;
+    PcapTcp s;
+    int rc;
+
+    if (pcap_open(&r, path) < 0)
+    {
+        return -1;
+    }
+    while ((rc = pcap_next(&r, &p)) == 1)
+    {
+        cfg.packets++;
+        if (pcap_tcp(&p, &s) < 0)
+        {
+            continue;
+        }
+        int up;
+        Flow *f = flow_for(&s, &up);
+        if (!f)
+        {
+            continue;
+        }
+        cfg.segments++;
+        f->packets++;
+        f->last_us = p.ts_us;
+        if (s.truncated && s.len > 0)
+        {
+            cfg.truncated++; // counted as a gap once the bytes after it arrive
+            continue;
+        }
+        stream_add(f, up ? &f->up : &f->down, up, &s, p.ts_us);
+        if (s.flags & (PCAP_TCP_FIN | PCAP_TCP_RST))
+        {
+            f->ended = 1;
+        }
+    }
+    pcap_close(&r);
+    if (rc < 0)
+    {
+        fprintf(stderr, "%s: malformed after %ld packets; using those.\n", path, cfg.packets);
+    }
+
+    // holes nothing filled: the capture missed those bytes
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        Flow *f = cfg.flows[i];
+        while (f->up.ooo)
+            stream_skip(f, &f->up, 1, f->last_us);
+        while (f->down.ooo)
+            stream_skip(f, &f->down, 0, f->last_us);
+    }
+    return 0;
+}
+
+/*
+ * flow_for:
+ *   The flow s belongs to, and whether it goes from client to server.
+ *   A flow is created for a segment to or from cfg.cap_port (any port if
+ *   0); its client is the side that sent the SYN, else the other port.
+ */
+static Flow *flow_for(const PcapTcp *s, int *up)
+{
+    unsigned h = flow_hash(s);
+    int alen = s->family == 4 ? 4 : 16;
+    int syn = (s->flags & (PCAP_TCP_SYN | PCAP_TCP_ACK)) == PCAP_TCP_SYN;
+
+    for (Flow *f = cfg.buckets[h]; f; f = f->hash_next)
+    {
+        if (f->family != s->family)
+            continue;
+        if (f->cport == s->sport && f->sport == s->dport &&
+            memcmp(f->caddr, s->src, alen) == 0 && memcmp(f->saddr, s->dst, alen) == 0)
+        {
+            if (syn && f->ended)
+                break; // the 4-tuple is used again
+            *up = 1;
+            return f;
+        }
+        if (f->cport == s->dport && f->sport == s->sport &&
+            memcmp(f->caddr, s->dst, alen) == 0 && memcmp(f->saddr, s->src, alen) == 0)
+        {
+            *up = 0;
+            return f;
+        }
+    }
+
+    if (!syn && cfg.cap_port && s->dport != cfg.cap_port && s->sport != cfg.cap_port)
+    {
+        return NULL;
+    }
+    if (syn)
+        *up = 1;
+    else if (cfg.cap_port)
+        *up = s->dport == cfg.cap_port;
+    else
+        *up = s->sport > s->dport; // guess: clients use the higher, ephemeral port
+    if (syn && cfg.cap_port && s->dport != cfg.cap_port)
+    {
+        return NULL;
+    }
+    return flow_new(s, *up, h);
+}
+
+static Flow *flow_new(const PcapTcp *s, int up, unsigned h)
+{
+    if (cfg.nflows == cfg.cap_flows)
+    {
+        int cap = cfg.cap_flows ? cfg.cap_flows * 2 : 256;
+        Flow **flows = realloc(cfg.flows, cap * sizeof(Flow *));
+        if (!flows)
+        {
+            perror("realloc");
+            return NULL;
+        }
+        cfg.flows = flows;
+        cfg.cap_flows = cap;
+    }
+    Flow *f = calloc(1, sizeof(*f));
+    if (!f)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    f->family = s->family;
+    memcpy(f->caddr, up ? s->src : s->dst, 16);
+    memcpy(f->saddr, up ? s->dst : s->src, 16);
+    f->cport = up ? s->sport : s->dport;
+    f->sport = up ? s->dport : s->sport;
+    f->fd = -1;
+    f->hash_next = cfg.buckets[h];
+    cfg.buckets[h] = f;
+    cfg.flows[cfg.nflows++] = f;
+    return f;
+}
+
+/* flow_hash: the same for both directions of a flow. */
+static unsigned flow_hash(const PcapTcp *s)
+{
+    int alen = s->family == 4 ? 4 : 16;
+    unsigned h = (unsigned)(s->sport ^ s->dport) * 2654435761u;
+    for (int i = 0; i < alen; i++)
+    {
+        h += (unsigned)(s->src[i] ^ s->dst[i]) * 16777619u;
+    }
+    return (h ^ (h >> 16)) & (FLOW_BUCKETS - 1);
+}
+
+/*
+ * stream_add:
+ *   One segment of st. In-order bytes go to flow_bytes() at once (minus
+ *   what was already there, for a retransmission); later ones are held
+ *   until the hole before them fills.
+ */
+static void stream_add(Flow *f, Stream *st, int up, const PcapTcp *s, long long ts)
+{
+    if (!f->first_us)
+    {
+        f->first_us = ts;
+    }
+    if (s->flags & PCAP_TCP_SYN)
+    {
+        st->started = 1;
+        st->next = s->seq + 1;
+        return;
+    }
+    if (s->len == 0)
+    {
+        return;
+    }
+    if (!st->started)
+    {
+        st->started = 1; // the capture began in the middle of the flow
+        st->next = s->seq;
+    }
+    uint32_t seq = s->seq, len = s->len;
+    const uint8_t *p = s->payload;
+    int32_t ahead = (int32_t)(seq - st->next);
+    if (ahead < 0)
+    {
+        if ((uint32_t)-ahead >= len)
+        {
+            return; // all seen before
+        }
+        p += -ahead;
+        len -= (uint32_t)-ahead;
+        seq = st->next;
+        ahead = 0;
+    }
+    if (ahead > 0)
+    {
+        stream_hold(f, st, up, seq, p, len, ts);
+        return;
+    }
+    flow_bytes(f, up, p, len, ts);
+    st->next += len;
+    stream_drain(f, st, up, ts);
+}
+
+/* stream_drain: deliver the held segments the stream has caught up with. */
+static void stream_drain(Flow *f, Stream *st, int up, long long ts)
+{
+    while (st->ooo && (int32_t)(st->ooo->seq - st->next) <= 0)
+    {
+        Segment *g = st->ooo;
+        st->ooo = g->next;
+        st->nooo--;
+        uint32_t skip = st->next - g->seq;
+        if (skip < g->len)
+        {
+            flow_bytes(f, up, g->data + skip, g->len - skip, ts);
+            st->next += g->len - skip;
+        }
+        free(g);
+    }
+}
+
+/* stream_hold: keep a segment past a hole, in order; a full queue gives up on the hole. */
+static void stream_hold(Flow *f, Stream *st, int up, uint32_t seq, const uint8_t *p,
+                        uint32_t len, long long ts)
+{
+    Segment *g = malloc(sizeof(*g) + len);
+    if (!g)
+    {
+        perror("malloc");
+        return;
+    }
+    g->seq = seq;
+    g->len = len;
+    memcpy(g->data, p, len);
+
+    Segment **at = &st->ooo;
+    while (*at && (int32_t)((*at)->seq - seq) <= 0)
+    {
+        at = &(*at)->next;
+    }
+    g->next = *at;
+    *at = g;
+    if (++st->nooo > OOO_MAX)
+    {
+        stream_skip(f, st, up, ts);
+    }
+}
+
+/* stream_skip: jump over the hole before the first held segment. */
+static void stream_skip(Flow *f, Stream *st, int up, long long ts)
+{
+    st->gaps += st->ooo->seq - st->next;
+    st->next = st->ooo->seq;
+    stream_drain(f, st, up, ts);
+}
+
+/*
+ * flow_bytes:
+ *   Reassembled bytes. The client's are stored as writes (segments sent
+ *   within MERGE_US of each other, with no answer between them, are one);
+ *   the server's first bytes after a write time that write's answer.
+ */
+static void flow_bytes(Flow *f, int up, const uint8_t *p, uint32_t len, long long ts)
+{
+    if (!up)
+    {
+        if (!f->answered && f->nwrites > 0)
+        {
+            Write *w = &f->writes[f->nwrites - 1];
+            w->resp_us = ts - w->ts_us;
+        }
+        f->answered = 1;
+        f->down.bytes += len;
+        return;
+    }
+
+    if (f->len + len > f->cap)
+    {
+        size_t cap = f->cap ? f->cap : 4096;
+        while (cap < f->len + len)
+            cap *= 2;
+        uint8_t *data = realloc(f->data, cap);
+        if (!data)
+        {
+            perror("realloc");
+            return;
+        }
+        f->data = data;
+        f->cap = cap;
+    }
+    memcpy(f->data + f->len, p, len);
+
+    if (f->nwrites > 0 && !f->answered && ts - f->last_up_us < MERGE_US)
+    {
+        f->writes[f->nwrites - 1].len += len;
+    }
+    else
+    {
+        if (f->nwrites == f->cap_writes)
+        {
+            int cap = f->cap_writes ? f->cap_writes * 2 : 16;
+            Write *writes = realloc(f->writes, cap * sizeof(Write));
+            if (!writes)
+            {
+                perror("realloc");
+                return;
+            }
+            f->writes = writes;
+            f->cap_writes = cap;
+        }
+        f->writes[f->nwrites++] = (Write){ts, (uint32_t)f->len, len, f->down.bytes, -1};
+    }
+    f->len += len;
+    f->up.bytes += len;
+    f->last_up_us = ts;
+    f->answered = 0;
+}
+
+/* list_flows: --list; one line per flow. */
+static void list_flows(const char *path)
+{
+    char client[64], server[64];
+
+    printf("[Replay] %s: %ld packets, %ld TCP segments in %d flows\n",
+           path, cfg.packets, cfg.segments, cfg.nflows);
+    if (cfg.nflows == 0)
+    {
+        return;
+    }
+    printf("%-46s %-46s %7s %9s %9s %6s %8s\n",
+           "client", "server", "packets", "up", "down", "writes", "seconds");
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        const Flow *f = cfg.flows[i];
+        printf("%-46s %-46s %7ld %9llu %9llu %6d %8.3f%s\n",
+               endpoint(f->family, f->caddr, f->cport, client, sizeof(client)),
+               endpoint(f->family, f->saddr, f->sport, server, sizeof(server)),
+               f->packets, (unsigned long long)f->up.bytes, (unsigned long long)f->down.bytes,
+               f->nwrites, (f->last_us - f->first_us) / 1e6,
+               f->up.gaps || f->down.gaps ? "  (bytes missing)" : "");
+    }
+}
+
+static const char *endpoint(int family, const uint8_t *addr, uint16_t port, char *buf, size_t size)
+{
+    char ip[INET6_ADDRSTRLEN];
+    inet_ntop(family == 4 ? AF_INET : AF_INET6, addr, ip, sizeof(ip));
+    snprintf(buf, size, family == 4 ? "%s:%u" : "[%s]:%u", ip, port);
+    return buf;
+}
+
+/*
+ * replay:
+ *   Run every recorded flow that has client bytes against cfg.host:port
+ *   until all are done, or the server has been quiet for cfg.timeout_ms
+ *   after the last write. Returns the exit status.
+ */
+static int replay(void)
+{
+    int n = 0;
+    uint64_t bytes = 0, gaps = 0;
+    long writes = 0;
+
+    cfg.cap_start_us = -1;
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        Flow *f = cfg.flows[i];
+        if (f->nwrites == 0)
+            continue;
+        if (cfg.cap_start_us < 0 || f->first_us < cfg.cap_start_us)
+            cfg.cap_start_us = f->first_us;
+        if (f->last_us > cfg.cap_end_us)
+            cfg.cap_end_us = f->last_us;
+        n++;
+        writes += f->nwrites;
+        bytes += f->up.bytes;
+        gaps += f->up.gaps + f->down.gaps;
+    }
+    if (n == 0)
+    {
+        fprintf(stderr, "[Replay] No client data to port %d in the capture (%d flows).\n",
+                cfg.cap_port, cfg.nflows);
+        return 1;
+    }
+    printf("[Replay] %d flows to port %d: %ld writes, %llu bytes over %.2f s\n",
+           n, cfg.cap_port, writes, (unsigned long long)bytes,
+           (cfg.cap_end_us - cfg.cap_start_us) / 1e6);
+    if (gaps || cfg.truncated)
+    {
+        printf("[Replay] The capture missed %llu bytes (%ld segments cut short); "
+               "replaying without them.\n", (unsigned long long)gaps, cfg.truncated);
+    }
+    if (cfg.speed > 0)
+        printf("[Replay] Against %s:%d at %.2fx the recorded pace\n", cfg.host, cfg.port, cfg.speed);
+    else
+        printf("[Replay] Against %s:%d, each write once the server has answered\n",
+               cfg.host, cfg.port);
+
+    cfg.reactor = reactor_create(REACTOR_BACKEND_AUTO);
+    if (!cfg.reactor)
+    {
+        fprintf(stderr, "[Replay] Could not create event loop.\n");
+        return 1;
+    }
+    hist_init(&cfg.recorded);
+    hist_init(&cfg.live);
+    cfg.start_us = reactor_now_us();
+    cfg.last_activity_ms = reactor_now_ms();
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        Flow *f = cfg.flows[i];
+        if (f->nwrites == 0)
+        {
+            f->state = FLOW_DONE;
+            continue;
+        }
+        cfg.open_flows++;
+        cfg.unsent_flows++;
+        timer_init(&f->timer, on_flow_timer, f);
+        if (cfg.speed > 0)
+            timer_arm(reactor_timers(cfg.reactor), &f->timer, due_us(f->first_us) / 1000);
+        else
+            flow_open(f); // in the order they were opened
+    }
+
+    while (cfg.open_flows > 0)
+    {
+        int timeout = -1;
+        if (cfg.unsent_flows == 0)
+        {
+            long long left = cfg.last_activity_ms + cfg.timeout_ms - reactor_now_ms();
+            if (left <= 0)
+                break; // whatever the server still owes, it is not sending it
+            timeout = (int)left;
+        }
+        if (reactor_poll(cfg.reactor, timeout) < 0)
+        {
+            fprintf(stderr, "[Replay] Event loop failed.\n");
+            break;
+        }
+    }
+    long long elapsed = reactor_now_us() - cfg.start_us;
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        if (cfg.flows[i]->state != FLOW_DONE)
+            flow_close(cfg.flows[i], 0);
+    }
+    reactor_destroy(cfg.reactor);
+
+    report(n, elapsed);
+    int slow = 0;
+    if (cfg.max_slowdown > 0 && cfg.live.count > 0)
+    {
+        double rec = (double)hist_percentile(&cfg.recorded, 99.0);
+        double live = (double)hist_percentile(&cfg.live, 99.0);
+        double ratio = rec > 0 ? live / rec : 0;
+        slow = rec > 0 && ratio > cfg.max_slowdown;
+        printf("[Replay] Regression check: live p99 is %.2fx the recording's (limit %.2fx): %s\n",
+               ratio, cfg.max_slowdown, slow ? "FAILED" : "ok");
+    }
+    return (cfg.errors || slow) ? 1 : 0;
+}
+
+/* report: the recorded and live response times, and what the server sent. */
+static void report(int nreplayed, long long elapsed_us)
+{
+    uint64_t rec_bytes = 0, live_bytes = 0;
+    int differ = 0;
+    for (int i = 0; i < cfg.nflows; i++)
+    {
+        const Flow *f = cfg.flows[i];
+        if (f->nwrites == 0)
+            continue;
+        rec_bytes += f->down.bytes;
+        live_bytes += f->live_bytes;
+        differ += f->live_bytes != f->down.bytes;
+    }
+
+    printf("[Replay] %d flows replayed in %.2f s\n", nreplayed, elapsed_us / 1e6);
+    printf("[Replay] Response time (us) %10s %10s %10s %10s %10s\n",
+           "p50", "p99", "p999", "max", "mean");
+    const Histogram *h[2] = {&cfg.recorded, &cfg.live};
+    static const char *label[2] = {"recorded", "live"};
+    for (int k = 0; k < 2; k++)
+    {
+        printf("[Replay]   %-16s %10llu %10llu %10llu %10llu %10.1f\n", label[k],
+               (unsigned long long)hist_percentile(h[k], 50.0),
+               (unsigned long long)hist_percentile(h[k], 99.0),
+               (unsigned long long)hist_percentile(h[k], 99.9),
+               (unsigned long long)h[k]->max, hist_mean(h[k]));
+    }
+    printf("[Replay] %llu answers timed", (unsigned long long)cfg.live.count);
+    if (cfg.overlapped)
+        printf(", %d more sent before the last was answered", cfg.overlapped);
+    printf("\n[Replay] Server bytes: recorded %llu, live %llu (%d flow%s)\n",
+           (unsigned long long)rec_bytes, (unsigned long long)live_bytes,
+           differ, differ == 1 ? " differs" : "s differ");
+    if (cfg.stalls)
+    {
+        printf("[Replay] %d write(s) went out without the answer the recording had before them.\n",
+               cfg.stalls);
+    }
+    if (cfg.cut_short)
+    {
+        printf("[Replay] %d flow(s) closed by the server before all writes were sent.\n",
+               cfg.cut_short);
+    }
+    if (cfg.errors)
+    {
+        printf("[Replay] %d flow(s) could not connect.\n", cfg.errors);
+    }
+}
+
+/* due_us: when something recorded at recorded_us happens in the replay (--speed > 0). */
+static long long due_us(long long recorded_us)
+{
+    return cfg.start_us + (long long)((recorded_us - cfg.cap_start_us) / cfg.speed);
+}
+
+/* on_flow_timer: time to open the flow, or for its next write. */
+static void on_flow_timer(Timer *t, void *arg)
+{
+    (void)t;
+    Flow *f = arg;
+
+    if (f->state == FLOW_WAITING)
+        flow_open(f);
+    else if (f->state == FLOW_OPEN)
+        flow_pump(f);
+}
+
+static void flow_open(Flow *f)
+{
+    f->fd = connect_to_server(cfg.host, cfg.port);
+    if (f->fd < 0 || reactor_add(cfg.reactor, f->fd, REACTOR_READ, on_flow_event, f) < 0)
+    {
+        cfg.errors++;
+        if (f->fd >= 0)
+            close(f->fd);
+        f->fd = -1;
+        f->state = FLOW_DONE;
+        cfg.open_flows--;
+        cfg.unsent_flows--;
+        return;
+    }
+    f->state = FLOW_OPEN;
+    flow_pump(f);
+}
+
+/*
+ * flow_pump:
+ *   Release the writes that are due: by the clock with --speed, or with
+ *   --speed 0 once the server has sent as much as it had before each (or
+ *   kept quiet for cfg.timeout_ms). Then send what was released.
+ */
+static void flow_pump(Flow *f)
+{
+    long long now = reactor_now_us();
+
+    while (f->next_write < f->nwrites)
+    {
+        const Write *w = &f->writes[f->next_write];
+        if (cfg.speed > 0)
+        {
+            long long due = due_us(w->ts_us);
+            if (due > now)
+            {
+                timer_arm(reactor_timers(cfg.reactor), &f->timer, (due + 999) / 1000);
+                break;
+            }
+        }
+        else if (f->live_bytes < w->server_before && !f->eof)
+        {
+            long long now_ms = reactor_now_ms();
+            if (!f->blocked_ms)
+                f->blocked_ms = now_ms;
+            if (now_ms - f->blocked_ms < cfg.timeout_ms)
+            {
+                timer_arm(reactor_timers(cfg.reactor), &f->timer, f->blocked_ms + cfg.timeout_ms);
+                break;
+            }
+            cfg.stalls++; // the server said less than it did in the recording
+        }
+        f->blocked_ms = 0;
+        f->ready = w->off + w->len;
+        f->next_write++;
+    }
+    flow_send(f);
+}
+
+/* flow_send: write what has been released; time each write once it is all out. */
+static void flow_send(Flow *f)
+{
+    while (f->sent < f->ready)
+    {
+        ssize_t n = send(f->fd, f->data + f->sent, f->ready - f->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (!f->want_write)
+                reactor_mod(cfg.reactor, f->fd, REACTOR_READ | REACTOR_WRITE);
+            f->want_write = 1;
+            return;
+        }
+        if (n < 0)
+        {
+            flow_close(f, 0);
+            return;
+        }
+        f->sent += (size_t)n;
+        cfg.last_activity_ms = reactor_now_ms();
+    }
+    if (f->want_write)
+    {
+        reactor_mod(cfg.reactor, f->fd, REACTOR_READ);
+        f->want_write = 0;
+    }
+
+    long long now = reactor_now_us();
+    while (f->sent_write < f->next_write)
+    {
+        const Write *w = &f->writes[f->sent_write];
+        if (w->off + w->len > f->sent)
+            break;
+        if (w->resp_us >= 0 && f->await_us)
+            cfg.overlapped++; // still waiting on the last one; not timed
+        else if (w->resp_us >= 0)
+        {
+            f->await_us = now;
+            f->await_rec = w->resp_us;
+        }
+        if (++f->sent_write == f->nwrites)
+            cfg.unsent_flows--;
+    }
+    flow_check_done(f);
+}
+
+/* flow_check_done: all sent, and the server has sent what it did (or hung up). */
+static void flow_check_done(Flow *f)
+{
+    if (f->state == FLOW_OPEN && f->sent_write == f->nwrites &&
+        (f->live_bytes >= f->down.bytes || f->eof))
+    {
+        flow_close(f, 0);
+    }
+}
+
+/* flow_close: end f's replay; with writes still unsent, they are not coming. */
+static void flow_close(Flow *f, int failed)
+{
+    if (f->state == FLOW_DONE)
+    {
+        return;
+    }
+    if (f->sent_write < f->nwrites && f->state == FLOW_OPEN)
+    {
+        cfg.cut_short++;
+        cfg.unsent_flows--;
+    }
+    else if (f->sent_write < f->nwrites)
+    {
+        cfg.unsent_flows--; // never opened
+    }
+    cfg.errors += failed;
+    timer_cancel(reactor_timers(cfg.reactor), &f->timer);
+    if (f->fd >= 0)
+    {
+        reactor_del(cfg.reactor, f->fd);
+        close(f->fd);
+        f->fd = -1;
+    }
+    f->state = FLOW_DONE;
+    cfg.open_flows--;
+}
+
+/*
+ * on_flow_event:
+ *   Reactor callback for one replayed connection (edge-triggered): finish
+ *   a blocked send, and drain what the server sent, timing the answer to
+ *   the last write.
+ */
+static void on_flow_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    Flow *f = arg;
+    static uint8_t buf[65536];
+
+    if ((events & REACTOR_WRITE) && f->want_write)
+    {
+        flow_send(f);
+    }
+    while (f->fd == fd)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            f->eof = 1;
+            flow_pump(f); // what is left goes out, and then the flow is done
+            if (f->fd == fd)
+                flow_close(f, 0);
+            return;
+        }
+        cfg.last_activity_ms = reactor_now_ms();
+        f->live_bytes += (uint64_t)n;
+        if (f->await_us)
+        {
+            hist_record(&cfg.live, (uint64_t)(reactor_now_us() - f->await_us));
+            hist_record(&cfg.recorded, (uint64_t)f->await_rec);
+            f->await_us = 0;
+        }
+    }
+    if (f->fd == fd)
+    {
+        flow_pump(f);
+    }
+}
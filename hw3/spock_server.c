@@ -1,508 +1,1281 @@
 /******************************************************************************
  * spock_server.c
  *
- * A multi-player (up to 5) "Rock, Paper, Scissors, Lizard, Spock" server that:
- *   1) Accepts <port> and <numPlayers> from the command line.
- *   2) Listens for exactly numPlayers clients to connect (server is only a ref).
- *   3) Runs multiple rounds:
+ * A multi-table "Rock, Paper, Scissors, Lizard, Spock" server that:
+ *   1) Accepts <port> and <numPlayers> (seats per table, up to 16) from the
+ *      command line.
+ *   2) Keeps listening for clients for as long as it runs (server is only a
+ *      ref). Connections are grouped, in arrival order, into tables of
+ *      numPlayers; each table is an independent game (see table.c).
+ *   3) Every table runs multiple rounds:
  *       - Each player sends a command: either "MOVE:<char>", "QUIT", or "RESET".
- *       - On QUIT, the entire game ends for all.
- *       - On RESET, the current scores are zeroed, and a new round begins.
+ *       - On QUIT, the game ends for everyone at that table.
+ *       - On RESET, the table's scores are zeroed, and a new round begins.
  *       - Once all players have sent valid moves, the server finds all
  *         "dominant" moves. Each player that played a dominant move gains +1.
  *       - The server broadcasts the round result with "RESULT:..."
- *   4) Continues until a QUIT or disconnection occurs.
+ *   4) A table continues until a QUIT or disconnection occurs; the other
+ *      tables keep playing.
+ *   5) A framed player who drops out of a playing table may reconnect and
+ *      resume the seat within --grace seconds (default 30); only then does
+ *      the game end.
+ *   6) With --move-timeout SECS, a round resolves that long after its first
+ *      move; players who have not moved by then forfeit the round.
+ *   7) With --threads N, runs N event loops (shards, see shard.c), each with
+ *      its own SO_REUSEPORT listener and its own tables.
+ *   8) With --admin-port P, serves counters and the move-to-RESULT latency
+ *      histogram at http://host:P/metrics (Prometheus text format). Every
+ *      move is only printed with --log-moves, and then rate-limited.
+ *   9) With --event-log FILE, appends every join, move, result, reset and
+ *      quit to FILE in a compact binary format, from a background thread
+ *      (see evlog.h); spock_logdump prints it.
+ *  10) With --tls-cert FILE (and --tls-key FILE), every connection speaks
+ *      TLS (see tls.h); reconnecting clients resume their session.
+ *  11) With --sock-profile SPEC, picks the TCP options of every connection
+ *      (Nagle off, quick ACKs, buffer sizes, user timeout, keepalive) and
+ *      the listen backlog; see sockopt.h. The admin endpoint shows them.
+ *  12) With --udp, players can also connect over UDP on the same port
+ *      number (see udp.h); they are served by the first event loop and
+ *      share its tables with TCP players. UDP is never encrypted.
+ *  13) Seats need not be remote (see seat.h): with --console, the server's
+ *      own stdin plays the first seat of the first table, and with
+ *      --bots N every table starts with N bots seated. All seats move
+ *      concurrently on the same event loop. --bot-tables N adds N tables
+ *      of nothing but bots, for capacity tests; --bot-strategy picks how
+ *      bots play (see bot.h) and --bot-think how long each takes to move.
+ *  14) With --io-uring, the event loops run on io_uring where the kernel
+ *      has it (6.0+; else epoll): multishot accept, and players at playing
+ *      tables receive through a provided buffer ring and send through the
+ *      submission ring, so a loop pass costs one system call (see
+ *      reactor.h). /metrics counts the system calls either way.
+ *  15) With --scores FILE, players who join under a player id (spock_client
+ *      --player) keep their wins and rounds across games and restarts, in
+ *      a memory-mapped log compacted into FILE.snap (see scores.h). The
+ *      admin endpoint serves the leaderboard at /leaderboard.
+ *  16) With --watch-port P, spectators can watch live tables from port P
+ *      (spock_client --watch). They are served by --fanout-threads threads
+ *      of their own; a table's shard publishes each message once, however
+ *      many are watching (see fanout.h).
+ *  17) With --hot-restart PATH, a new server started with the same option
+ *      takes over from the running one through the Unix socket PATH: it
+ *      inherits the listening sockets and every table in play, with its
+ *      players' connections, rounds, moves and deadlines, and the old one
+ *      exits (see restart.h). Nobody is disconnected; TLS, UDP and console
+ *      seats wait as away and resume with their session.
+ *  18) Every frame is checked before a table sees it: moves a seat cannot
+ *      make and unknown commands are dropped, and a player who sends more
+ *      than --frame-rate other frames a second, or mostly unusable ones,
+ *      is disconnected (see table.h). /metrics counts both.
  *
  * Usage example:
  *   ./spock_server 5555 3
- *   => Listens on TCP port 5555, waits for 3 clients.
+ *   => Listens on TCP port 5555, starts a game for every 3 clients.
+ *   ./spock_server --threads 0 5555 3
+ *   => Same, with one event loop per core.
+ *   ./spock_server --admin-port 9100 5555 3
+ *   => Same, with metrics at http://localhost:9100/metrics
+ *   ./spock_server --console 5131 2
+ *   => Two-player game between this terminal and one remote client.
+ *   ./spock_server --hot-restart /tmp/spock.sock 5555 3   (twice)
+ *   => The second one takes the first one's players over.
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <netinet/in.h>
 
-#define MAX_PLAYERS 5
-#define BUF_SIZE 1024
+#include "admin.h"
+#include "bot.h"
+#include "evlog.h"
+#include "fanout.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "restart.h"
+#include "rules.h"
+#include "scores.h"
+#include "shard.h"
+#include "sockopt.h"
+#include "dgram.h"
+#include "seat.h"
+#include "table.h"
+#include "tls.h"
 
-/* Moves enumeration */
-typedef enum
-{
-    MOVE_ROCK,
-    MOVE_PAPER,
-    MOVE_SCISSORS,
-    MOVE_LIZARD,
-    MOVE_SPOCK,
-    MOVE_INVALID
-} Move;
+/* Build with -DSPOCK_USE_POLL to force the poll() fallback backend. */
+#ifdef SPOCK_USE_POLL
+#define REACTOR_BACKEND REACTOR_BACKEND_POLL
+#else
+#define REACTOR_BACKEND REACTOR_BACKEND_AUTO
+#endif
+
+#define MAX_THREADS 256
+#define MAX_FANOUT_THREADS 64
+#define DEFAULT_STATS_INTERVAL 10
+#define MAX_LISTENERS (MAX_THREADS + MAX_FANOUT_THREADS + 2) /* game, watch, UDP, admin */
 
 /* Function prototypes */
 static void usage(const char *prog);
-static int start_server(int port);
-static void handle_game(int *client_fds, int numPlayers);
-static Move char_to_move(char c);
-static const char *move_to_string(Move m);
-static int beats(Move m1, Move m2);
+static int start_server(int port, int reuseport, const SockProfile *sock);
+static int start_udp(int port);
+static void report_shards(Shard *shards, int nshards);
+static void on_report_timer(Timer *t, void *arg);
+static void render_metrics(FILE *out, void *arg);
+static void on_scores_timer(Timer *t, void *arg);
+static void render_leaderboard(FILE *out, void *arg);
+static int parse_fsync(const char *arg, EvlogFsync *policy, int *ms);
+static void on_stop_signal(int sig);
+static int take_over(const char *path, RestartImage *im);
+static int open_listener(RestartListenKind kind, int port, int reuseport, const SockProfile *sock);
+static void close_inherited(void);
+static void restore_tables(RestartImage *im, Shard *shards, int nshards);
+static void renumber_tables(Shard *shards, int nshards, uint32_t max_id);
+static void on_restart_request(Reactor *r, int fd, unsigned events, void *arg);
+static int hand_over(int sock, Shard *shards, int nshards);
 
-/*
- * determine_multiplayer_winners:
- *   Identifies all "dominant" moves in this round.
- *   A move M_i is "dominant" if:
- *      (1) It beats at least one other move in the round.
- *      (2) It is NOT beaten by any other move in the round.
- *   Everyone who played M_i gets +1 to score.
- *
- *   @param moves[]: array of size numPlayers with each player's Move.
- *   @param winners[]: out-parameter to store the indices (0-based) of winners
- *   @param pNumWinners: out-parameter storing how many winners found
- */
-static void determine_multiplayer_winners(Move moves[], int numPlayers,
-                                          int winners[], int *pNumWinners);
+static volatile sig_atomic_t stop_requested;
+static int restart_taker = -1; /* a new server waiting for the handover */
+
+/* Listening sockets, kept so a hot restart can pass them on. */
+typedef struct
+{
+    RestartListener held[MAX_LISTENERS];      /* fd: the socket itself */
+    int nheld;
+    RestartListener inherited[MAX_LISTENERS]; /* from the old server; fd -1 once taken */
+    int ninherited;
+} Listeners;
+
+static Listeners listeners;
+
+/* What the main thread's timer and admin endpoint report on. */
+typedef struct
+{
+    Shard *shards;
+    int nshards;
+    int interval_ms;
+    TimerWheel *timers;
+    EvLog *events; /* NULL without --event-log */
+    const SockProfile *sock;
+    ScoreStore *scores; /* NULL without --scores */
+    Fanout *fanout;     /* NULL without --watch-port */
+} Reporter;
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    int nthreads = 1;
+    int stats_interval = DEFAULT_STATS_INTERVAL;
+    int grace = LOBBY_GRACE_MS / 1000;
+    double move_timeout = LOBBY_MOVE_TIMEOUT_MS / 1000.0;
+    int frame_rate = LOBBY_FRAME_RATE;
+    int frame_burst = LOBBY_FRAME_BURST;
+    int admin_port = 0;
+    int log_moves = 0;
+    const char *event_log = NULL;
+    EvlogFsync fsync_policy = EVLOG_FSYNC_INTERVAL;
+    int fsync_ms = 1000;
+    const char *scores_file = NULL;
+    int watch_port = 0;
+    int fanout_threads = 1;
+    const char *hot_restart = NULL;
+    const char *tls_cert = NULL;
+    const char *tls_key = NULL;
+    int udp = 0;
+    int console = 0;
+    int bots = 0;
+    int bot_tables = 0;
+    int bot_think_ms = 0;
+    ReactorBackend backend = REACTOR_BACKEND;
+    const BotStrategy *bot_play = bot_strategy("uniform");
+    SockProfile sock = *sockopt_default();
+
+    static const struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"stats-interval", required_argument, NULL, 'i'},
+        {"grace", required_argument, NULL, 'g'},
+        {"move-timeout", required_argument, NULL, 'm'},
+        {"frame-rate", required_argument, NULL, 'F'},
+        {"admin-port", required_argument, NULL, 'a'},
+        {"log-moves", no_argument, NULL, 'l'},
+        {"event-log", required_argument, NULL, 'e'},
+        {"event-fsync", required_argument, NULL, 'f'},
+        {"tls-cert", required_argument, NULL, 'c'},
+        {"tls-key", required_argument, NULL, 'k'},
+        {"udp", no_argument, NULL, 'u'},
+        {"sock-profile", required_argument, NULL, 'p'},
+        {"console", no_argument, NULL, 'C'},
+        {"bots", required_argument, NULL, 'b'},
+        {"bot-tables", required_argument, NULL, 'B'},
+        {"bot-strategy", required_argument, NULL, 's'},
+        {"bot-think", required_argument, NULL, 'w'},
+        {"io-uring", no_argument, NULL, 'U'},
+        {"scores", required_argument, NULL, 'o'},
+        {"watch-port", required_argument, NULL, 'W'},
+        {"fanout-threads", required_argument, NULL, 'T'},
+        {"hot-restart", required_argument, NULL, 'H'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:i:g:m:F:a:le:f:c:k:up:Cb:B:s:w:Uo:W:T:H:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'i':
+            stats_interval = atoi(optarg);
+            break;
+        case 'g':
+            grace = atoi(optarg);
+            break;
+        case 'm':
+            move_timeout = atof(optarg);
+            break;
+        case 'F':
+        {
+            char *comma;
+            frame_rate = (int)strtol(optarg, &comma, 10);
+            frame_burst = *comma == ',' ? atoi(comma + 1) : 2 * frame_rate;
+            if (frame_rate < 0 || (frame_rate > 0 && frame_burst < 1))
+            {
+                fprintf(stderr, "--frame-rate takes N or N,BURST (0 = no limit).\n");
+                exit(1);
+            }
+            break;
+        }
+        case 'a':
+            admin_port = atoi(optarg);
+            break;
+        case 'l':
+            log_moves = 1;
+            break;
+        case 'e':
+            event_log = optarg;
+            break;
+        case 'f':
+            if (parse_fsync(optarg, &fsync_policy, &fsync_ms) < 0)
+            {
+                fprintf(stderr, "--event-fsync takes never, batch or a number of ms.\n");
+                exit(1);
+            }
+            break;
+        case 'c':
+            tls_cert = optarg;
+            break;
+        case 'k':
+            tls_key = optarg;
+            break;
+        case 'u':
+            udp = 1;
+            break;
+        case 'p':
+            if (sockopt_parse(&sock, optarg) < 0)
+            {
+                exit(1);
+            }
+            break;
+        case 'C':
+            console = 1;
+            break;
+        case 'b':
+            bots = atoi(optarg);
+            break;
+        case 'B':
+            bot_tables = atoi(optarg);
+            break;
+        case 's':
+            if (!(bot_play = bot_strategy(optarg)))
+            {
+                fprintf(stderr, "Unknown bot strategy %s (%s).\n", optarg, bot_strategy_names());
+                exit(1);
+            }
+            break;
+        case 'w':
+            bot_think_ms = atoi(optarg);
+            break;
+        case 'U':
+            backend = REACTOR_BACKEND_URING;
+            break;
+        case 'o':
+            scores_file = optarg;
+            break;
+        case 'W':
+            watch_port = atoi(optarg);
+            break;
+        case 'T':
+            fanout_threads = atoi(optarg);
+            break;
+        case 'H':
+            hot_restart = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (argc - optind != 2)
     {
         usage(argv[0]);
         exit(1);
     }
 
-    int port = atoi(argv[1]);
-    int numPlayers = atoi(argv[2]);
+    int port = atoi(argv[optind]);
+    int numPlayers = atoi(argv[optind + 1]);
 
     if (numPlayers < 1 || numPlayers > MAX_PLAYERS)
     {
         fprintf(stderr, "numPlayers must be between 1 and %d.\n", MAX_PLAYERS);
         exit(1);
     }
+    if (bots < 0 || (bots > 0 && bots >= numPlayers))
+    {
+        fprintf(stderr, "--bots must leave at least one seat per table (below %d).\n", numPlayers);
+        exit(1);
+    }
+    if (bot_tables < 0)
+    {
+        bot_tables = 0;
+    }
+    if (bot_think_ms < 0)
+    {
+        bot_think_ms = 0;
+    }
+    if (nthreads == 0)
+    {
+        /* one event loop per core */
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (nthreads < 1 || nthreads > MAX_THREADS)
+    {
+        fprintf(stderr, "--threads must be between 0 (one per core) and %d.\n", MAX_THREADS);
+        exit(1);
+    }
+#ifndef SO_REUSEPORT
+    if (nthreads > 1)
+    {
+        fprintf(stderr, "SO_REUSEPORT is not supported here; using 1 thread.\n");
+        nthreads = 1;
+    }
+#endif
+    if (stats_interval < 1)
+    {
+        stats_interval = DEFAULT_STATS_INTERVAL;
+    }
+    if (grace < 0)
+    {
+        grace = 0;
+    }
+    if (move_timeout < 0)
+    {
+        move_timeout = 0;
+    }
+    if (fanout_threads < 1 || fanout_threads > MAX_FANOUT_THREADS)
+    {
+        fprintf(stderr, "--fanout-threads must be between 1 and %d.\n", MAX_FANOUT_THREADS);
+        exit(1);
+    }
+#ifndef SO_REUSEPORT
+    fanout_threads = 1;
+#endif
+    if (tls_key && !tls_cert)
+    {
+        fprintf(stderr, "--tls-key needs --tls-cert.\n");
+        exit(1);
+    }
+
+    /* one TLS context for every shard, so the session tickets work on any */
+    TlsCtx *tls = NULL;
+    if (tls_cert && !(tls = tls_server_ctx(tls_cert, tls_key)))
+    {
+        fprintf(stderr, "Error: could not load the TLS certificate %s.\n", tls_cert);
+        exit(1);
+    }
+
+    /* A peer that vanishes mid-send must not take the other tables down. */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Ctrl-C / SIGTERM go to this thread only (the threads started below
+     * inherit the mask), so the event log can be flushed before exiting. */
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    /* a server already running at the hot restart socket hands over first */
+    RestartImage image;
+    int taken_over = hot_restart ? take_over(hot_restart, &image) : 0;
+    if (taken_over < 0)
+    {
+        return 1;
+    }
+    /* with SO_REUSEPORT, listeners the old server did not have bind alongside its own */
+    int reuse = hot_restart != NULL;
+
+    /* shards hold cache-line aligned metrics, which calloc does not honour */
+    Shard *shards = aligned_alloc(_Alignof(Shard), nthreads * sizeof(Shard));
+    if (!shards)
+    {
+        perror("aligned_alloc");
+        return 1;
+    }
+
+    EvLog events;
+    if (event_log && evlog_open(&events, event_log, nthreads, fsync_policy, fsync_ms) < 0)
+    {
+        fprintf(stderr, "Error: could not open event log %s.\n", event_log);
+        return 1;
+    }
+    ScoreStore scores;
+    if (scores_file)
+    {
+        if (scores_open(&scores, scores_file, nthreads) < 0)
+        {
+            fprintf(stderr, "Error: could not open score store %s.\n", scores_file);
+            return 1;
+        }
+        printf("[Server] Scores in %s: %u players\n", scores_file, scores.nplayers);
+    }
+
+    /* Bind every listener up front so a bad port fails before any thread runs. */
+    Fanout fanout;
+    if (watch_port > 0)
+    {
+        int watch_fds[MAX_FANOUT_THREADS];
+        for (int i = 0; i < fanout_threads; i++)
+        {
+            if ((watch_fds[i] = open_listener(RESTART_LISTEN_WATCH, watch_port,
+                                              fanout_threads > 1 || reuse, &sock)) < 0)
+            {
+                fprintf(stderr, "Error: could not start the watch port %d.\n", watch_port);
+                return 1;
+            }
+        }
+        if (fanout_open(&fanout, nthreads, fanout_threads, watch_fds, backend) < 0)
+        {
+            return 1;
+        }
+        fanout.sock = &sock;
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        int server_fd = open_listener(RESTART_LISTEN_GAME, port, nthreads > 1 || reuse, &sock);
+        if (server_fd < 0)
+        {
+            fprintf(stderr, "Error: could not start server on port %d.\n", port);
+            return 1;
+        }
+        if (shard_init(&shards[i], i, nthreads, server_fd, numPlayers,
+                       backend, &shards[0]) < 0)
+        {
+            fprintf(stderr, "Error: could not create event loop.\n");
+            return 1;
+        }
+        shards[i].lobby.grace_ms = grace * 1000;
+        shards[i].lobby.move_timeout_ms = (int)(move_timeout * 1000);
+        shards[i].lobby.frame_rate = frame_rate;
+        shards[i].lobby.frame_burst = frame_burst;
+        shards[i].lobby.log_moves = log_moves;
+        shards[i].lobby.events = event_log ? &events.rings[i] : NULL;
+        shards[i].lobby.scores = scores_file ? &scores.rings[i] : NULL;
+        shards[i].lobby.feed = watch_port > 0 ? &fanout.feeds[i] : NULL;
+        shards[i].lobby.tls = tls;
+        shards[i].lobby.sock = &sock;
+        shards[i].lobby.bot_seats = bots;
+        shards[i].lobby.bot_strategy = bot_play;
+        shards[i].lobby.bot_think_ms = bot_think_ms;
+    }
+    /* the home shard never routes players away, so UDP ones stay with the socket */
+    if (udp)
+    {
+        int udp_fd = open_listener(RESTART_LISTEN_UDP, port, 0, &sock);
+        if (udp_fd < 0 || !dgram_open(&shards[0].lobby, udp_fd))
+        {
+            fprintf(stderr, "Error: could not start UDP on port %d.\n", port);
+            return 1;
+        }
+    }
+    if (event_log && evlog_start(&events) < 0)
+    {
+        return 1;
+    }
 
-    int server_fd = start_server(port);
-    if (server_fd < 0)
+    /* The shards run the tables; this thread only reports on them. */
+    Reactor *reactor = reactor_create(REACTOR_BACKEND);
+    if (!reactor)
     {
-        fprintf(stderr, "Error: could not start server on port %d.\n", port);
+        fprintf(stderr, "Error: could not create event loop.\n");
         return 1;
     }
+    Reporter rep = {shards, nthreads, stats_interval * 1000, reactor_timers(reactor),
+                    event_log ? &events : NULL, &sock, scores_file ? &scores : NULL,
+                    watch_port > 0 ? &fanout : NULL};
+    Admin admin;
+    if (admin_port > 0)
+    {
+        int admin_fd = open_listener(RESTART_LISTEN_ADMIN, admin_port, reuse, &sock);
+        if (admin_fd < 0 || admin_init(&admin, reactor, admin_fd, render_metrics, &rep) < 0)
+        {
+            fprintf(stderr, "Error: could not start admin endpoint on port %d.\n", admin_port);
+            return 1;
+        }
+        printf("[Server] Metrics at http://0.0.0.0:%d/metrics\n", admin_port);
+        if (scores_file)
+        {
+            admin_route(&admin, "/leaderboard", render_leaderboard, &scores);
+            printf("[Server] Leaderboard at http://0.0.0.0:%d/leaderboard\n", admin_port);
+        }
+    }
 
-    printf("[Server] Listening on port %d, expecting %d clients...\n",
-           port, numPlayers);
+    printf("[Server] Listening on port %d, %d players per table (%d x %s event loop%s%s)...\n",
+           port, numPlayers, nthreads, reactor_backend_name(shards[0].reactor),
+           tls ? ", TLS" : "", udp ? ", UDP too" : "");
+    char sock_desc[160];
+    printf("[Server] Socket profile: %s\n", sockopt_describe(&sock, sock_desc, sizeof(sock_desc)));
+    if (watch_port > 0)
+    {
+        printf("[Server] Spectators on port %d (%d fan-out thread%s)\n",
+               watch_port, fanout_threads, fanout_threads == 1 ? "" : "s");
+    }
+    if (taken_over)
+    {
+        close_inherited(); // listeners this server has no use for
+        restore_tables(&image, shards, nthreads);
+        restart_image_free(&image);
+    }
 
-    int client_fds[MAX_PLAYERS];
-    memset(client_fds, -1, sizeof(client_fds));
+    /* bot-only tables are spread over the shards like accepted players */
+    for (int i = 0; i < nthreads; i++)
+    {
+        int n = bot_tables / nthreads + (i < bot_tables % nthreads);
+        for (int k = 0; k < n; k++)
+        {
+            if (seat_bot_table(&shards[i].lobby) < 0)
+            {
+                fprintf(stderr, "Error: could not set up bot table %d.\n", k + 1);
+                return 1;
+            }
+        }
+    }
+    if (bots || bot_tables)
+    {
+        printf("[Server] Bots: %d per table, %d bot-only tables, %s strategy, %d ms to move\n",
+               bots, bot_tables, bot_play->name, bot_think_ms);
+    }
+    /* like UDP players, the console stays on the shard that owns its fd */
+    if (console && !seat_console_open(&shards[0].lobby, NULL))
+    {
+        fprintf(stderr, "Error: could not seat the console.\n");
+        return 1;
+    }
 
-    /* Accept exactly numPlayers connections */
-    int connected_count = 0;
-    while (connected_count < numPlayers)
+    for (int i = 0; i < nthreads; i++)
     {
-        struct sockaddr_in client_addr;
-        socklen_t addr_len = sizeof(client_addr);
-        int cfd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
-        if (cfd < 0)
+        if (shard_start(&shards[i]) < 0)
         {
-            perror("accept");
-            close(server_fd);
             return 1;
         }
-        client_fds[connected_count++] = cfd;
-        printf("[Server] New client connected (fd=%d). [%d/%d]\n",
-               cfd, connected_count, numPlayers);
+    }
+    if (watch_port > 0 && fanout_start(&fanout) < 0)
+    {
+        return 1;
     }
 
-    /* We can close the listening socket now if we only want these numPlayers. */
-    close(server_fd);
+    Timer report_timer;
+    timer_init(&report_timer, on_report_timer, &rep);
+    timer_arm(rep.timers, &report_timer, reactor_now_ms() + rep.interval_ms);
+    Timer scores_timer;
+    timer_init(&scores_timer, on_scores_timer, &rep);
+    if (scores_file)
+    {
+        timer_arm(rep.timers, &scores_timer, reactor_now_ms() + SCORES_DRAIN_MS);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal; // no SA_RESTART: interrupt reactor_poll()
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
 
-    /* Run the game loop (multiple rounds) until someone quits or disconnects. */
-    handle_game(client_fds, numPlayers);
+    int restart_fd = -1;
+    if (hot_restart)
+    {
+        if ((restart_fd = restart_listen(hot_restart)) < 0 ||
+            reactor_add(reactor, restart_fd, REACTOR_READ, on_restart_request, NULL) < 0)
+        {
+            fprintf(stderr, "Error: could not listen for a hot restart at %s.\n", hot_restart);
+            return 1;
+        }
+        printf("[Server] Hot restart socket at %s\n", hot_restart);
+    }
 
-    /* Cleanup */
-    for (int i = 0; i < numPlayers; i++)
+    int handed_to = -1; // the new server, once it has our tables
+    while (!stop_requested && handed_to < 0)
     {
-        if (client_fds[i] >= 0)
+        if (reactor_poll(reactor, -1) < 0)
         {
-            close(client_fds[i]);
+            fprintf(stderr, "[Server] Admin event loop failed.\n");
+            break;
+        }
+        if (restart_taker >= 0)
+        {
+            int taker = restart_taker;
+            restart_taker = -1;
+            if (hand_over(taker, shards, nthreads) == 0)
+            {
+                handed_to = taker;
+            }
         }
     }
 
+    if (event_log)
+    {
+        // the shards keep running until exit; whatever they pushed so far is written
+        evlog_stop(&events);
+    }
+    if (scores_file)
+    {
+        scores_stop(&scores); // likewise: later rounds are not recorded
+        printf("[Server] Scores saved.\n");
+    }
+    if (handed_to >= 0)
+    {
+        // the new server opens the files now; the socket at the path is its own
+        restart_signal(handed_to, RESTART_DONE);
+        close(handed_to);
+        printf("[Server] Handed over to the new server; exiting.\n");
+        return 0;
+    }
+    if (hot_restart)
+    {
+        unlink(hot_restart);
+    }
+    printf("[Server] Shutting down.\n");
     return 0;
 }
 
+static void on_stop_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
 static void usage(const char *prog)
 {
-    fprintf(stderr, "Usage: %s <port> <numPlayers>\n", prog);
-    fprintf(stderr, "Example: %s 5555 3\n", prog);
+    fprintf(stderr, "Usage: %s [--threads N] [--stats-interval SECS] [--grace SECS]\n"
+            "       [--move-timeout SECS] [--frame-rate N[,BURST]] [--admin-port PORT]\n"
+            "       [--log-moves] [--event-log FILE] [--event-fsync never|batch|MS]\n"
+            "       [--tls-cert FILE [--tls-key FILE]] [--udp] [--sock-profile SPEC]\n"
+            "       [--console] [--bots N] [--bot-tables N] [--bot-strategy NAME]\n"
+            "       [--bot-think MS] [--io-uring] [--scores FILE]\n"
+            "       [--watch-port PORT [--fanout-threads N]] [--hot-restart PATH]\n"
+            "       <port> <numPlayers>\n",
+            prog);
+    fprintf(stderr, "  --threads N          event-loop threads (0 = one per core, default 1)\n");
+    fprintf(stderr, "  --stats-interval S   seconds between per-shard table reports (default %d)\n",
+            DEFAULT_STATS_INTERVAL);
+    fprintf(stderr, "  --grace S            seconds a dropped player may take to resume (default %d, 0 = off)\n",
+            LOBBY_GRACE_MS / 1000);
+    fprintf(stderr, "  --move-timeout S     seconds after a round's first move before missing\n"
+                    "                       moves forfeit (fractions allowed, default 0 = wait)\n");
+    fprintf(stderr, "  --frame-rate N[,B]   frames a second a player may send besides its moves,\n"
+                    "                       B saved up (default %d,%d; 0 = no limit)\n",
+            LOBBY_FRAME_RATE, LOBBY_FRAME_BURST);
+    fprintf(stderr, "  --admin-port P       serve Prometheus metrics on port P (default off)\n");
+    fprintf(stderr, "  --log-moves          print every move and round result (at most %d lines/s)\n",
+            LOBBY_LOG_RATE);
+    fprintf(stderr, "  --event-log FILE     append game events to FILE (see spock_logdump)\n");
+    fprintf(stderr, "  --event-fsync P      sync the event log never, every batch, or every P ms\n"
+                    "                       (default 1000)\n");
+    fprintf(stderr, "  --tls-cert FILE      speak TLS with this PEM certificate (chain)\n");
+    fprintf(stderr, "  --tls-key FILE       its private key (default: in the certificate file)\n");
+    fprintf(stderr, "  --udp                also take players over UDP on the same port (cleartext)\n");
+    fprintf(stderr, "  --sock-profile SPEC  TCP options: game (default), bulk or kernel, then\n"
+                    "                       ,key=value overrides, e.g. game,sndbuf=262144,backlog=512\n"
+                    "                       (nodelay quickack sndbuf rcvbuf user-timeout keepidle\n"
+                    "                       keepintvl keepcnt backlog)\n");
+    fprintf(stderr, "  --console            play the first seat of the first table from this terminal\n");
+    fprintf(stderr, "  --bots N             seat N bots at every table (default 0)\n");
+    fprintf(stderr, "  --bot-tables N       also run N tables of bots only (capacity tests)\n");
+    fprintf(stderr, "  --bot-strategy NAME  how bots play: %s (default uniform)\n",
+            bot_strategy_names());
+    fprintf(stderr, "  --bot-think MS       how long after a round starts bots move (default 0)\n");
+    fprintf(stderr, "  --io-uring           run the event loops on io_uring if the kernel has it\n");
+    fprintf(stderr, "  --scores FILE        keep named players' scores in FILE (and FILE.snap)\n");
+    fprintf(stderr, "  --watch-port P       let spectators watch tables from port P\n");
+    fprintf(stderr, "  --fanout-threads N   threads serving the spectators (default 1)\n");
+    fprintf(stderr, "  --hot-restart PATH   take over from the server at socket PATH, if any, and\n"
+                    "                       hand over to the next one started with it\n");
+    fprintf(stderr, "Example: %s --threads 4 5555 3\n", prog);
 }
 
-/* start_server: create a listening socket on the specified port. */
-static int start_server(int port)
+/*
+ * take_over:
+ *   Ask the server at path for its tables. Returns 1 with its image in im
+ *   (its listeners taken out into listeners.inherited), 0 if nobody is
+ *   serving there, -1 on error. Returns once the old server has written
+ *   out its event log and scores.
+ */
+static int take_over(const char *path, RestartImage *im)
 {
-    int sfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sfd < 0)
+    int sock = restart_connect(path);
+    if (sock < 0)
     {
-        perror("socket");
+        if (errno == ENOENT || errno == ECONNREFUSED)
+        {
+            return 0;
+        }
+        perror(path);
         return -1;
     }
-
-    int opt = 1;
-    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    printf("[Server] Taking over from the server at %s...\n", path);
+    if (restart_recv(sock, im) < 0)
     {
-        perror("setsockopt");
-        close(sfd);
+        restart_image_free(im);
+        close(sock);
         return -1;
     }
 
-    struct sockaddr_in srv;
-    memset(&srv, 0, sizeof(srv));
-    srv.sin_family = AF_INET;
-    srv.sin_addr.s_addr = INADDR_ANY;
-    srv.sin_port = htons(port);
-
-    if (bind(sfd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
+    uint8_t tag;
+    RestartListener rl;
+    while (restart_get(im, &tag, 1) == 0 && tag == RESTART_REC_LISTENER &&
+           restart_get(im, &rl, sizeof(rl)) == 0)
     {
-        perror("bind");
-        close(sfd);
-        return -1;
+        rl.fd = restart_take_fd(im, rl.fd);
+        if (rl.fd >= 0 && listeners.ninherited < MAX_LISTENERS)
+            listeners.inherited[listeners.ninherited++] = rl;
+        else if (rl.fd >= 0)
+            close(rl.fd);
     }
+    im->pos--; // the first table's tag
 
-    if (listen(sfd, 5) < 0)
+    if (restart_signal(sock, RESTART_ACK) < 0)
     {
-        perror("listen");
-        close(sfd);
+        fprintf(stderr, "[Server] Hot restart: the old server went away.\n");
+        restart_image_free(im);
+        close(sock);
         return -1;
     }
-    return sfd;
+    if (restart_wait(sock, RESTART_DONE, RESTART_DONE_MS) < 0)
+    {
+        fprintf(stderr, "[Server] Hot restart: the old server did not finish; carrying on.\n");
+    }
+    close(sock);
+    return 1;
 }
 
 /*
- * handle_game:
- *   Main "round" loop: repeatedly gather moves or commands from each player,
- *   then compute winners or handle QUIT/RESET.
+ * open_listener:
+ *   A listening socket of kind on port: one the old server passed on if
+ *   there is one left, else a new one (start_server or start_udp).
  */
-static void handle_game(int *client_fds, int numPlayers)
+static int open_listener(RestartListenKind kind, int port, int reuseport, const SockProfile *sock)
 {
-    int scores[MAX_PLAYERS];
-    memset(scores, 0, sizeof(scores));
-
-    char buffer[BUF_SIZE];
-    fd_set read_fds;
+    int fd = -1;
+    for (int i = 0; i < listeners.ninherited && fd < 0; i++)
+    {
+        RestartListener *rl = &listeners.inherited[i];
+        if (rl->fd >= 0 && rl->kind == kind && rl->port == port)
+        {
+            fd = rl->fd;
+            rl->fd = -1;
+        }
+    }
+    if (fd < 0)
+    {
+        fd = kind == RESTART_LISTEN_UDP ? start_udp(port) : start_server(port, reuseport, sock);
+    }
+    if (fd >= 0 && listeners.nheld < MAX_LISTENERS)
+    {
+        listeners.held[listeners.nheld++] = (RestartListener){kind, port, fd};
+    }
+    return fd;
+}
 
-    while (1)
+/* close_inherited: the old server's listeners nobody took (their queued connections go). */
+static void close_inherited(void)
+{
+    for (int i = 0; i < listeners.ninherited; i++)
     {
-        /* We track each player's move for this round in moves[] */
-        Move moves[MAX_PLAYERS];
-        for (int i = 0; i < numPlayers; i++)
+        if (listeners.inherited[i].fd >= 0)
         {
-            moves[i] = MOVE_INVALID;
+            close(listeners.inherited[i].fd);
+            listeners.inherited[i].fd = -1;
         }
+    }
+}
 
-        int moves_received = 0;
+/*
+ * restore_tables:
+ *   Rebuild the old server's tables from im. A playing table goes to the
+ *   shard its id names, where its players' resume tokens are routed; the
+ *   players waiting at forming tables are seated at the home shard's.
+ */
+static void restore_tables(RestartImage *im, Shard *shards, int nshards)
+{
+    int playing = 0, waiting = 0, renumbered = 0;
+    uint32_t max_id = 0;
+    uint8_t tag = RESTART_REC_END;
+    RestartTable rt;
 
-        int round_over = 0;    // if we got all moves or a special command
-        int someone_quit = 0;  // if a QUIT or disconnect occurs
-        int someone_reset = 0; // if a RESET command occurs
+    while (restart_get(im, &tag, 1) == 0 && tag == RESTART_REC_TABLE)
+    {
+        if (restart_get(im, &rt, sizeof(rt)) < 0 || rt.id == 0)
+        {
+            break;
+        }
+        if (rt.state != TABLE_PLAYING && !renumbered)
+        {
+            // the playing tables come first: new ids must not meet theirs
+            renumber_tables(shards, nshards, max_id);
+            renumbered = 1;
+        }
+        Shard *s = rt.state == TABLE_PLAYING ? &shards[(rt.id - 1) % nshards] : &shards[0];
+        if (lobby_restore(&s->lobby, &rt, im) < 0)
+        {
+            break;
+        }
+        if (rt.state == TABLE_PLAYING)
+        {
+            playing++;
+            max_id = rt.id > max_id ? rt.id : max_id;
+        }
+        else
+        {
+            waiting += rt.seated;
+        }
+    }
+    if (!renumbered)
+    {
+        renumber_tables(shards, nshards, max_id);
+    }
+    if (tag != RESTART_REC_END)
+    {
+        fprintf(stderr, "[Server] Hot restart: the image is malformed; the tables after "
+                        "the first %d are lost.\n", playing);
+    }
+    printf("[Server] Took over %d playing table%s and %d waiting player%s.\n",
+           playing, playing == 1 ? "" : "s", waiting, waiting == 1 ? "" : "s");
+}
 
-        //----- Gather commands/moves from all players -----
-        while (moves_received < numPlayers && !round_over)
+/*
+ * renumber_tables:
+ *   Start every shard's table ids past max_id, keeping shard i on ids
+ *   i+1 modulo nshards.
+ */
+static void renumber_tables(Shard *shards, int nshards, uint32_t max_id)
+{
+    for (int i = 0; i < nshards; i++)
+    {
+        long long base = (long long)max_id + 1;
+        long long id = base + ((i + 1 - base) % nshards + nshards) % nshards;
+        Lobby *l = &shards[i].lobby;
+        if (id > l->next_table_id)
         {
-            FD_ZERO(&read_fds);
-            int max_fd = -1;
-            for (int i = 0; i < numPlayers; i++)
-            {
-                FD_SET(client_fds[i], &read_fds);
-                if (client_fds[i] > max_fd)
-                {
-                    max_fd = client_fds[i];
-                }
-            }
+            l->next_table_id = (uint32_t)id;
+        }
+    }
+}
 
-            int ret = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
-            if (ret < 0)
-            {
-                perror("select");
-                return;
-            }
+/* on_restart_request: a new server wants to take over; the main loop hands over. */
+static void on_restart_request(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    (void)arg;
+    int taker = restart_accept(fd);
+    if (taker >= 0 && restart_taker < 0)
+    {
+        restart_taker = taker;
+    }
+    else if (taker >= 0)
+    {
+        close(taker);
+    }
+}
 
-            /* Check for activity on each player's socket */
-            for (int i = 0; i < numPlayers; i++)
-            {
-                int fd = client_fds[i];
-                if (!FD_ISSET(fd, &read_fds))
-                {
-                    continue;
-                }
-
-                memset(buffer, 0, BUF_SIZE);
-                int n = recv(fd, buffer, BUF_SIZE - 1, 0);
-                if (n <= 0)
-                {
-                    // player disconnected or error => end entire session
-                    printf("[Server] Player %d disconnected. Ending game.\n", i + 1);
-                    someone_quit = 1;
-                    round_over = 1;
-                    break;
-                }
-
-                buffer[n] = '\0';
-                // parse command:
-                if (strncmp(buffer, "QUIT", 4) == 0)
-                {
-                    printf("[Server] Player %d requested QUIT.\n", i + 1);
-                    someone_quit = 1;
-                    round_over = 1;
-                    break;
-                }
-                else if (strncmp(buffer, "RESET", 5) == 0)
-                {
-                    printf("[Server] Player %d requested RESET.\n", i + 1);
-                    // zero out all scores
-                    for (int k = 0; k < numPlayers; k++)
-                    {
-                        scores[k] = 0;
-                    }
-                    // broadcast RESET
-                    for (int k = 0; k < numPlayers; k++)
-                    {
-                        send(client_fds[k], "RESET", 5, 0);
-                    }
-                    someone_reset = 1;
-                    round_over = 1;
-                    break;
-                }
-                else if (strncmp(buffer, "MOVE:", 5) == 0)
-                {
-                    char c = buffer[5];
-                    Move m = char_to_move(c);
-                    if (m != MOVE_INVALID && moves[i] == MOVE_INVALID)
-                    {
-                        moves[i] = m;
-                        moves_received++;
-                        printf("[Server] Player %d => %s\n", i + 1, move_to_string(m));
-                    }
-                    // else ignore invalid or duplicate move
-                }
-                else
-                {
-                    // unknown command
-                    printf("[Server] Player %d sent unknown: %s\n", i + 1, buffer);
-                }
-
-                if (round_over)
-                {
-                    break;
-                }
-            } // end for each player
-        } // end while collecting moves
-
-        //----- Decide how round ended -----
-        if (someone_quit)
-        {
-            // broadcast QUIT
-            for (int i = 0; i < numPlayers; i++)
-            {
-                send(client_fds[i], "QUIT", 4, 0);
-            }
-            break; // entire game ends
-        }
+/*
+ * hand_over:
+ *   Stop the shards and send the new server at sock our listeners and
+ *   tables. Returns 0 once it has them; then this server must exit. If
+ *   it does not take them, the shards resume and this returns -1.
+ */
+static int hand_over(int sock, Shard *shards, int nshards)
+{
+    printf("[Server] Hot restart: handing over...\n");
+    fflush(stdout);
+    for (int i = 0; i < nshards; i++)
+    {
+        shard_pause(&shards[i]);
+    }
+    for (int i = 0; i < nshards; i++)
+    {
+        shard_join(&shards[i]);
+    }
+    for (int i = 0; i < nshards; i++)
+    {
+        shard_settle(&shards[i]);
+    }
 
-        if (someone_reset)
+    RestartImage im;
+    restart_image_init(&im);
+    int rc = 0, tables = 0;
+    for (int i = 0; i < listeners.nheld && rc == 0; i++)
+    {
+        RestartListener rl = listeners.held[i];
+        if ((rl.fd = restart_put_fd(&im, rl.fd)) < 0 ||
+            restart_put_rec(&im, RESTART_REC_LISTENER, &rl, sizeof(rl)) < 0)
         {
-            // do NOT break the entire game => we skip winner calc & start new round
-            continue;
+            rc = -1;
         }
-
-        // If we got all moves, compute multi-winner(s)
-        if (moves_received == numPlayers)
+    }
+    // playing tables first (see restore_tables)
+    static const TableState order[] = {TABLE_PLAYING, TABLE_FORMING};
+    for (int k = 0; k < 2 && rc == 0; k++)
+    {
+        for (int i = 0; i < nshards && rc == 0; i++)
         {
-            int winners[MAX_PLAYERS];
-            int numWinners = 0;
-            determine_multiplayer_winners(moves, numPlayers, winners, &numWinners);
+            int n = lobby_save(&shards[i].lobby, order[k], &im);
+            rc = n < 0 ? -1 : 0;
+            tables += n > 0 && k == 0 ? n : 0;
+        }
+    }
+    uint8_t end = RESTART_REC_END;
+    if (rc == 0 && restart_put(&im, &end, 1) == 0 && restart_send(sock, &im) == 0)
+    {
+        rc = restart_wait(sock, RESTART_ACK, RESTART_ACK_MS);
+    }
+    else
+    {
+        rc = -1;
+    }
+    size_t bytes = im.len;
+    int nfds = im.nfds;
+    restart_image_free(&im);
 
-            if (numWinners == 0)
-            {
-                printf("[Server] Round ends in a tie.\n");
-            }
-            else
-            {
-                printf("[Server] Dominant move(s): ");
-                for (int w = 0; w < numWinners; w++)
-                {
-                    scores[winners[w]]++;
-                    printf("Player %d ", (winners[w] + 1));
-                }
-                printf("\n");
-            }
+    if (rc < 0)
+    {
+        fprintf(stderr, "[Server] Hot restart: the new server did not take over; carrying on.\n");
+        close(sock);
+        for (int i = 0; i < nshards; i++)
+        {
+            shard_resume(&shards[i]);
+        }
+        return -1;
+    }
+    printf("[Server] Hot restart: %d playing table%s handed over (%zu bytes, %d sockets).\n",
+           tables, tables == 1 ? "" : "s", bytes, nfds);
+    return 0;
+}
 
-            // Build & broadcast the RESULT message
-            // Format example: RESULT:numWinners:move0,move1:score0,score1
-            char moves_part[BUF_SIZE];
-            moves_part[0] = '\0';
-            for (int i = 0; i < numPlayers; i++)
-            {
-                char temp[32];
-                snprintf(temp, sizeof(temp), "%s%s",
-                         (i == 0) ? "" : ",",
-                         move_to_string(moves[i]));
-                strcat(moves_part, temp);
-            }
+/*
+ * report_shards:
+ *   Print tables per shard so load balance can be checked. Nothing is
+ *   printed while the numbers stay the same.
+ */
+static void report_shards(Shard *shards, int nshards)
+{
+    static long last_sig = -1;
+    long sig = 0;
 
-            char scores_part[BUF_SIZE];
-            scores_part[0] = '\0';
-            for (int i = 0; i < numPlayers; i++)
-            {
-                char temp[32];
-                snprintf(temp, sizeof(temp), "%s%d",
-                         (i == 0) ? "" : ",",
-                         scores[i]);
-                strcat(scores_part, temp);
-            }
+    for (int i = 0; i < nshards; i++)
+    {
+        Shard *s = &shards[i];
+        sig = sig * 31 + atomic_load_explicit(&s->stat_live_tables, memory_order_relaxed);
+        sig = sig * 31 + atomic_load_explicit(&s->stat_playing_tables, memory_order_relaxed);
+        sig = sig * 31 + atomic_load_explicit(&s->stat_connections, memory_order_relaxed);
+        sig = sig * 31 + atomic_load_explicit(&s->stat_handoffs_in, memory_order_relaxed);
+    }
+    if (sig == last_sig)
+    {
+        return;
+    }
+    last_sig = sig;
 
-            // Also list the winners
-            char winners_part[BUF_SIZE];
-            winners_part[0] = '\0';
-            for (int i = 0; i < numWinners; i++)
-            {
-                char temp[16];
-                snprintf(temp, sizeof(temp), "%s%d",
-                         (i == 0) ? "" : ",",
-                         (winners[i] + 1));
-                strcat(winners_part, temp);
-            }
+    printf("[Server] Shard  playing  forming  players  handoff-in  handoff-out\n");
+    for (int i = 0; i < nshards; i++)
+    {
+        Shard *s = &shards[i];
+        int live = atomic_load_explicit(&s->stat_live_tables, memory_order_relaxed);
+        int playing = atomic_load_explicit(&s->stat_playing_tables, memory_order_relaxed);
+        printf("[Server] %5d  %7d  %7d  %7d  %10ld  %11ld\n",
+               i, playing, live - playing,
+               atomic_load_explicit(&s->stat_connections, memory_order_relaxed),
+               atomic_load_explicit(&s->stat_handoffs_in, memory_order_relaxed),
+               atomic_load_explicit(&s->stat_handoffs_out, memory_order_relaxed));
+    }
+    fflush(stdout);
+}
 
-            char result_msg[BUF_SIZE];
-            snprintf(result_msg, sizeof(result_msg),
-                     "RESULT:%s:%s:%s", winners_part, moves_part, scores_part);
+static void on_report_timer(Timer *t, void *arg)
+{
+    Reporter *rep = arg;
 
-            for (int i = 0; i < numPlayers; i++)
-            {
-                send(client_fds[i], result_msg, strlen(result_msg), 0);
-            }
-        }
+    report_shards(rep->shards, rep->nshards);
+    timer_arm(rep->timers, t, reactor_now_ms() + rep->interval_ms);
+}
 
-        // Then we loop around to start a new round (unless QUIT ended us)
-    } // end while(1)
+/* on_scores_timer: bring the score store up to date with the shards' rings. */
+static void on_scores_timer(Timer *t, void *arg)
+{
+    Reporter *rep = arg;
 
-    printf("[Server] Game session ended.\n");
+    scores_drain(rep->scores);
+    timer_arm(rep->timers, t, reactor_now_ms() + SCORES_DRAIN_MS);
 }
 
-/* char_to_move: map single character to Move enum. */
-static Move char_to_move(char c)
+/* render_leaderboard: admin callback for /leaderboard, best first. */
+static void render_leaderboard(FILE *out, void *arg)
 {
-    switch (c)
-    {
-    case 'R':
-    case 'r':
-        return MOVE_ROCK;
-    case 'P':
-    case 'p':
-        return MOVE_PAPER;
-    case 'S':
-    case 's':
-        return MOVE_SCISSORS;
-    case 'L':
-    case 'l':
-        return MOVE_LIZARD;
-    case 'K':
-    case 'k':
-        return MOVE_SPOCK;
-    default:
-        return MOVE_INVALID;
+    const ScoreStore *s = arg;
+    const ScorePlayer *top[SCORES_TOP_K];
+    int n = scores_top(s, top, SCORES_TOP_K);
+
+    fprintf(out, "%-4s  %-15s  %8s  %8s\n", "rank", "player", "wins", "rounds");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(out, "%4d  %-15s  %8u  %8u\n", i + 1, top[i]->name, top[i]->wins, top[i]->rounds);
     }
 }
 
-/* move_to_string: return human-readable name of move. */
-static const char *move_to_string(Move m)
+/*
+ * render_metrics:
+ *   Admin callback: sum every shard's counters (only now, at scrape time)
+ *   and print them with the table and connection gauges.
+ */
+static void render_metrics(FILE *out, void *arg)
 {
-    switch (m)
-    {
-    case MOVE_ROCK:
-        return "Rock";
-    case MOVE_PAPER:
-        return "Paper";
-    case MOVE_SCISSORS:
-        return "Scissors";
-    case MOVE_LIZARD:
-        return "Lizard";
-    case MOVE_SPOCK:
-        return "Spock";
-    default:
-        return "Invalid";
+    Reporter *rep = arg;
+    MetricsSnapshot total;
+    long playing = 0, live = 0, conns = 0, handoffs_in = 0, handoffs_out = 0;
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < rep->nshards; i++)
+    {
+        Shard *s = &rep->shards[i];
+        metrics_collect(&total, &s->lobby.metrics);
+        live += atomic_load_explicit(&s->stat_live_tables, memory_order_relaxed);
+        playing += atomic_load_explicit(&s->stat_playing_tables, memory_order_relaxed);
+        conns += atomic_load_explicit(&s->stat_connections, memory_order_relaxed);
+        handoffs_in += atomic_load_explicit(&s->stat_handoffs_in, memory_order_relaxed);
+        handoffs_out += atomic_load_explicit(&s->stat_handoffs_out, memory_order_relaxed);
+    }
+
+    metrics_write(out, &total);
+    fprintf(out, "# HELP spock_tables Live tables by state.\n# TYPE spock_tables gauge\n"
+                 "spock_tables{state=\"playing\"} %ld\nspock_tables{state=\"forming\"} %ld\n",
+            playing, live - playing);
+    fprintf(out, "# HELP spock_connections Open player connections.\n"
+                 "# TYPE spock_connections gauge\nspock_connections %ld\n", conns);
+    fprintf(out, "# HELP spock_handoffs_total Players moved between shards.\n"
+                 "# TYPE spock_handoffs_total counter\n"
+                 "spock_handoffs_total{direction=\"in\"} %ld\n"
+                 "spock_handoffs_total{direction=\"out\"} %ld\n",
+            handoffs_in, handoffs_out);
+    fprintf(out, "# HELP spock_shards Event-loop threads.\n# TYPE spock_shards gauge\n"
+                 "spock_shards %d\n", rep->nshards);
+    unsigned long reactor_calls = 0;
+    for (int i = 0; i < rep->nshards; i++)
+    {
+        reactor_calls += reactor_syscalls(rep->shards[i].reactor);
+    }
+    fprintf(out, "# HELP spock_reactor_syscalls_total Event-loop system calls (waits and registrations).\n"
+                 "# TYPE spock_reactor_syscalls_total counter\n"
+                 "spock_reactor_syscalls_total{backend=\"%s\"} %lu\n",
+            reactor_backend_name(rep->shards[0].reactor), reactor_calls);
+    fprintf(out, "# HELP spock_pool_objects Slab-allocated objects, in use and carved.\n"
+                 "# TYPE spock_pool_objects gauge\n");
+    for (int k = 0; k < 4; k++)
+    {
+        long in_use = 0, capacity = 0;
+        const char *name = NULL;
+        for (int i = 0; i < rep->nshards; i++)
+        {
+            Lobby *l = &rep->shards[i].lobby;
+            const Slab *slabs[4] = {&l->conns, &l->table_hot, &l->table_cold, &l->inputs};
+            name = slabs[k]->name;
+            in_use += atomic_load_explicit(&slabs[k]->in_use, memory_order_relaxed);
+            capacity += atomic_load_explicit(&slabs[k]->capacity, memory_order_relaxed);
+        }
+        fprintf(out, "spock_pool_objects{pool=\"%s\",state=\"in_use\"} %ld\n"
+                     "spock_pool_objects{pool=\"%s\",state=\"capacity\"} %ld\n",
+                name, in_use, name, capacity);
+    }
+    sockopt_write_metrics(out, rep->sock);
+
+    if (rep->events)
+    {
+        unsigned long dropped = 0;
+        for (int i = 0; i < rep->events->nrings; i++)
+        {
+            dropped += atomic_load_explicit(&rep->events->rings[i].dropped, memory_order_relaxed);
+        }
+        fprintf(out, "# HELP spock_event_log_dropped_total Events dropped because a ring was full.\n"
+                     "# TYPE spock_event_log_dropped_total counter\n"
+                     "spock_event_log_dropped_total %lu\n", dropped);
+    }
+    if (rep->scores)
+    {
+        // the store belongs to this thread, so it is read directly
+        const ScoreStore *s = rep->scores;
+        unsigned long dropped = 0;
+        for (int i = 0; i < s->nrings; i++)
+        {
+            dropped += atomic_load_explicit(&s->rings[i].dropped, memory_order_relaxed);
+        }
+        fprintf(out, "# HELP spock_score_players Players in the score store.\n"
+                     "# TYPE spock_score_players gauge\nspock_score_players %u\n"
+                     "# HELP spock_score_log_bytes Size of the score log since its last compaction.\n"
+                     "# TYPE spock_score_log_bytes gauge\nspock_score_log_bytes %zu\n"
+                     "# HELP spock_score_compactions_total Score log compactions into a snapshot.\n"
+                     "# TYPE spock_score_compactions_total counter\n"
+                     "spock_score_compactions_total %lu\n"
+                     "# HELP spock_score_events_dropped_total Score updates lost to a full ring.\n"
+                     "# TYPE spock_score_events_dropped_total counter\n"
+                     "spock_score_events_dropped_total %lu\n",
+                s->nplayers, s->log_used, s->compactions, dropped + s->unknown);
+    }
+    if (rep->fanout)
+    {
+        const Fanout *f = rep->fanout;
+        long spectators = 0, channels = 0, messages = 0, slow = 0, lapped = 0;
+        unsigned long published = 0;
+        for (int i = 0; i < f->nthreads; i++)
+        {
+            const FanoutThread *ft = &f->threads[i];
+            spectators += atomic_load_explicit(&ft->stat_spectators, memory_order_relaxed);
+            channels += atomic_load_explicit(&ft->stat_channels, memory_order_relaxed);
+            messages += atomic_load_explicit(&ft->stat_messages, memory_order_relaxed);
+            slow += atomic_load_explicit(&ft->stat_slow, memory_order_relaxed);
+            lapped += atomic_load_explicit(&ft->stat_lapped, memory_order_relaxed);
+        }
+        for (int i = 0; i < f->nfeeds; i++)
+        {
+            published += atomic_load_explicit(&f->feeds[i].head, memory_order_relaxed);
+        }
+        fprintf(out, "# HELP spock_spectators Open spectator connections.\n"
+                     "# TYPE spock_spectators gauge\nspock_spectators %ld\n"
+                     "# HELP spock_watched_tables Tables with spectators, per fan-out thread.\n"
+                     "# TYPE spock_watched_tables gauge\nspock_watched_tables %ld\n"
+                     "# HELP spock_fanout_published_total Messages the shards published for spectators.\n"
+                     "# TYPE spock_fanout_published_total counter\nspock_fanout_published_total %lu\n"
+                     "# HELP spock_spectator_messages_total Messages queued to spectators.\n"
+                     "# TYPE spock_spectator_messages_total counter\nspock_spectator_messages_total %ld\n"
+                     "# HELP spock_spectator_drops_total Spectators disconnected for not reading.\n"
+                     "# TYPE spock_spectator_drops_total counter\nspock_spectator_drops_total %ld\n"
+                     "# HELP spock_fanout_lapped_total Published messages a fan-out thread fell too far behind to read.\n"
+                     "# TYPE spock_fanout_lapped_total counter\nspock_fanout_lapped_total %ld\n",
+                spectators, channels, published, messages, slow, lapped);
     }
 }
 
-/* "beats": Return 1 if m1 beats m2 under RPSLS rules, else 0. */
-static int beats(Move m1, Move m2)
+/* parse_fsync: "never", "batch", or a sync interval in milliseconds. */
+static int parse_fsync(const char *arg, EvlogFsync *policy, int *ms)
 {
-    if ((m1 == MOVE_PAPER && (m2 == MOVE_ROCK || m2 == MOVE_SPOCK)) ||
-        (m1 == MOVE_SCISSORS && (m2 == MOVE_PAPER || m2 == MOVE_LIZARD)) ||
-        (m1 == MOVE_SPOCK && (m2 == MOVE_SCISSORS || m2 == MOVE_ROCK)) ||
-        (m1 == MOVE_ROCK && (m2 == MOVE_SCISSORS || m2 == MOVE_LIZARD)) ||
-        (m1 == MOVE_LIZARD && (m2 == MOVE_SPOCK || m2 == MOVE_PAPER)))
+    if (strcmp(arg, "never") == 0)
     {
-        return 1;
+        *policy = EVLOG_FSYNC_NEVER;
+        return 0;
+    }
+    if (strcmp(arg, "batch") == 0)
+    {
+        *policy = EVLOG_FSYNC_BATCH;
+        return 0;
+    }
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || v < 1 || v > 3600000)
+    {
+        return -1;
     }
+    *policy = EVLOG_FSYNC_INTERVAL;
+    *ms = (int)v;
     return 0;
 }
 
 /*
- * determine_multiplayer_winners:
- *   Find all "dominant" moves. Each dominant move's players get +1.
- *   A move is "dominant" if it is not beaten by any other move, and it beats
- *   at least one other move in this round (so it’s not a pointless same-same scenario).
- *
- *   winners[] is an OUT array of indices of players who have a dominant move.
- *   *pNumWinners is how many entries are in winners[].
+ * start_server: create a listening socket on the specified port.
+ *   With reuseport, several sockets can bind the same port and the kernel
+ *   spreads new connections across them (one per shard). The socket
+ *   profile sizes its buffers and sets the backlog.
  */
-static void determine_multiplayer_winners(Move moves[], int numPlayers,
-                                          int winners[], int *pNumWinners)
+static int start_server(int port, int reuseport, const SockProfile *sock)
 {
-    *pNumWinners = 0;
-    // We'll find the set of unique moves that are dominant. Then see which players used them.
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sfd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt");
+        close(sfd);
+        return -1;
+    }
+#ifdef SO_REUSEPORT
+    if (reuseport && setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(sfd);
+        return -1;
+    }
+#else
+    (void)reuseport;
+#endif
 
-    // 1) Identify which moves are dominant
-    int isDominant[MAX_PLAYERS]; // which player has a dominant move
-    memset(isDominant, 0, sizeof(isDominant));
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_addr.s_addr = INADDR_ANY;
+    srv.sin_port = htons(port);
 
-    for (int i = 0; i < numPlayers; i++)
+    if (bind(sfd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
     {
-        if (moves[i] == MOVE_INVALID)
-            continue;
+        perror("bind");
+        close(sfd);
+        return -1;
+    }
 
-        int i_is_beaten = 0;
-        int i_beats_any = 0;
-        for (int j = 0; j < numPlayers; j++)
-        {
-            if (i == j || moves[j] == MOVE_INVALID)
-            {
-                continue;
-            }
-            if (beats(moves[j], moves[i]))
-            {
-                // j's move beats i's move => i can't be dominant
-                i_is_beaten = 1;
-                break;
-            }
-            if (beats(moves[i], moves[j]))
-            {
-                i_beats_any = 1;
-            }
-        }
+    if (sockopt_listen(sfd, sock) < 0)
+    {
+        perror("listen");
+        close(sfd);
+        return -1;
+    }
+    return sfd;
+}
 
-        if (!i_is_beaten && i_beats_any)
-        {
-            isDominant[i] = 1; // player i’s move is dominant
-        }
+/* start_udp: a UDP socket bound to the specified port, for dgram_open(). */
+static int start_udp(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
     }
 
-    // 2) Fill winners[] with all i for which isDominant[i] = 1
-    int count = 0;
-    for (int i = 0; i < numPlayers; i++)
+    struct sockaddr_in srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_addr.s_addr = INADDR_ANY;
+    srv.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&srv, sizeof(srv)) < 0)
     {
-        if (isDominant[i])
-        {
-            winners[count++] = i;
-        }
+        perror("bind");
+        close(fd);
+        return -1;
     }
-    *pNumWinners = count;
+    return fd;
 }
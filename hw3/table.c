@@ -0,0 +1,2212 @@
+/******************************************************************************
+ * table.c
+ *
+ * Table state machine and lobby for spock_server.
+ *
+ * Each table runs multiple rounds:
+ *   - Each player sends a command: either MOVE <char>, QUIT, or RESET, in the
+ *     framed or the legacy text protocol (see proto.h).
+ *   - On QUIT, the game ends for everyone at that table. So does a
+ *     disconnect, unless a framed player resumes the session within the
+ *     lobby's grace period (see lobby_join).
+ *   - On RESET, the table's scores are zeroed, and a new round begins.
+ *   - Once all players have sent valid moves (or the move deadline passes),
+ *     the table finds all "dominant" moves. Each player that played a
+ *     dominant move gains +1, and the table broadcasts a RESULT message.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "table.h"
+#include "dgram.h"
+#include "seat.h"
+
+static int lobby_listen(Lobby *l);
+static int lobby_seat(Lobby *l, Conn *c);
+static int lobby_join(Lobby *l, Conn *c, const ProtoFrame *f);
+static int lobby_resume(Lobby *l, Conn *c);
+static void lobby_name_player(Lobby *l, Conn *c, const char *name, size_t len);
+static Table *table_create(Lobby *l);
+static Table *table_find(Lobby *l, uint32_t id);
+static int table_is_quiet(const Table *t);
+static void table_seat(Table *t, Conn *c);
+static void table_unseat(Table *t, Conn *c);
+static void table_resume(Table *t, int seat, Conn *c);
+static void table_set_away(Table *t, Conn *c);
+static void table_clear_away(Table *t, int seat);
+static void table_arm_grace(Table *t);
+static void table_arm_deadline(Table *t);
+static void on_grace_expired(Timer *tm, void *arg);
+static void on_move_deadline(Timer *tm, void *arg);
+static void table_send_session(Table *t, Conn *c);
+static void table_close(Table *t);
+static void table_free(Table *t);
+static void table_start_round(Table *t);
+static void table_resolve_round(Table *t);
+static void table_broadcast(Table *t, uint8_t op, const void *payload, size_t len);
+static void table_broadcast_bufs(Table *t, OutBuf *bufs[2]);
+static void table_broadcast_result(Table *t, const int winners[], int numWinners);
+static void table_publish(Table *t, uint8_t op, const void *payload, size_t len);
+static void table_tell(Table *t, const char *fmt, ...);
+static int table_handle_frame(Table *t, Conn *c, const ProtoFrame *f);
+static OutBuf *encode_message(OutPool *pool, ProtoMode mode, uint8_t op,
+                              const void *payload, size_t len);
+static Conn *seat_conn_new(Lobby *l, const SeatOps *ops, void *arg);
+static int table_save_seat(Table *t, int i, RestartImage *im, long long now);
+static int conn_portable(const Conn *c);
+static int conn_restore(Lobby *l, const RestartSeat *rs, RestartImage *im, Conn **out);
+static void conn_abandon(Conn *c);
+static int conn_register(Lobby *l, Conn *c);
+static int conn_process(Conn *c);
+static int conn_admit(Conn *c, const ProtoFrame *f);
+static int conn_handle_frame(Conn *c, const ProtoFrame *f);
+static void conn_lost(Conn *c);
+static void conn_send(Conn *c, OutBuf *b);
+static void conn_send_message(Conn *c, uint8_t op, const void *payload, size_t len);
+static int conn_write(Conn *c);
+static void conn_flush(Conn *c);
+static void conn_close(Conn *c);
+static void conn_abort(Conn *c);
+static const char *conn_name(const Conn *c);
+static ProtoParser *conn_in(Conn *c);
+static void conn_in_release(Conn *c);
+static ssize_t conn_recv(Conn *c, void *buf, size_t len);
+static ssize_t conn_sendv(void *arg, const struct iovec *iov, int iovcnt);
+static int conn_handshake(Conn *c);
+static void on_conn_event(Reactor *r, int fd, unsigned events, void *arg);
+static void on_accept(Reactor *r, int fd, unsigned events, void *arg);
+static void on_accepted(Reactor *r, int fd, int client_fd, void *arg);
+static void lobby_accept(Lobby *l, int cfd);
+static void conn_try_stream(Conn *c);
+static void on_conn_data(Reactor *r, int fd, const void *data, ssize_t len, void *arg);
+static uint64_t new_session_nonce(void);
+static int lobby_log_ok(Lobby *l);
+static void table_event(Table *t, EvType type, int seat, unsigned value, uint32_t arg);
+static void table_score_round(Table *t, uint32_t winner_mask);
+
+int lobby_init(Lobby *l, Reactor *r, int listen_fd, int numPlayers)
+{
+    memset(l, 0, sizeof(*l));
+    l->reactor = r;
+    l->listen_fd = listen_fd;
+    l->numPlayers = numPlayers;
+    l->next_table_id = 1;
+    l->table_id_step = 1;
+    l->grace_ms = LOBBY_GRACE_MS;
+    l->move_timeout_ms = LOBBY_MOVE_TIMEOUT_MS;
+    l->frame_rate = LOBBY_FRAME_RATE;
+    l->frame_burst = LOBBY_FRAME_BURST;
+    outpool_init(&l->pool);
+    slab_init(&l->conns, "conn", sizeof(Conn));
+    slab_init(&l->table_hot, "table", sizeof(Table));
+    slab_init(&l->table_cold, "table_cold", sizeof(TableCold));
+    slab_init(&l->inputs, "input", sizeof(ProtoParser));
+
+    if (set_nonblocking(listen_fd) < 0)
+    {
+        perror("fcntl");
+        return -1;
+    }
+    return lobby_listen(l);
+}
+
+/* lobby_listen: take connections from l's listener, by multishot accept if the reactor has it. */
+static int lobby_listen(Lobby *l)
+{
+    if (reactor_add_acceptor(l->reactor, l->listen_fd, on_accepted, l) < 0 &&
+        reactor_add(l->reactor, l->listen_fd, REACTOR_READ, on_accept, l) < 0)
+    {
+        perror("reactor_add");
+        return -1;
+    }
+    return 0;
+}
+
+void lobby_shutdown(Lobby *l)
+{
+    while (l->tables)
+    {
+        table_close(l->tables);
+    }
+    if (l->listen_fd >= 0)
+    {
+        reactor_del(l->reactor, l->listen_fd);
+        close(l->listen_fd);
+        l->listen_fd = -1;
+    }
+    outpool_destroy(&l->pool);
+}
+
+/*
+ * on_accept:
+ *   Reactor callback for the listening socket. Accept every pending
+ *   connection (edge-triggered); it is seated once it sends a command.
+ */
+static void on_accept(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)events;
+    Lobby *l = arg;
+
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int cfd = accept(fd, (struct sockaddr *)&client_addr, &addr_len);
+        if (cfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
+        }
+        lobby_accept(l, cfd);
+    }
+}
+
+/* on_accepted: the same, for each connection a multishot accept hands us. */
+static void on_accepted(Reactor *r, int fd, int client_fd, void *arg)
+{
+    (void)r;
+    (void)fd;
+    if (client_fd < 0)
+    {
+        if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+            perror("accept");
+        return;
+    }
+    lobby_accept(arg, client_fd);
+}
+
+/* lobby_accept: take in one accepted socket; it is closed on failure. */
+static void lobby_accept(Lobby *l, int cfd)
+{
+    Conn *c = slab_alloc(&l->conns);
+    if (!c)
+    {
+        perror("slab_alloc");
+        close(cfd);
+        return;
+    }
+    metric_add(&l->metrics, METRIC_ACCEPTS, 1);
+    if (l->sock)
+    {
+        metric_add(&l->metrics, METRIC_SOCKOPT_ERRORS, (unsigned long)sockopt_apply(cfd, l->sock));
+    }
+    c->fd = cfd;
+    c->carried_move = MOVE_INVALID;
+    c->mode = PROTO_TEXT;
+    outq_init(&c->outq);
+    if (l->tls && !(c->tls = tls_conn_new(l->tls, cfd, NULL)))
+    {
+        close(cfd);
+        slab_free(&l->conns, c);
+        return;
+    }
+    conn_register(l, c);
+}
+
+int lobby_adopt(Lobby *l, Conn *c)
+{
+    if (conn_register(l, c) < 0)
+    {
+        return -1;
+    }
+    int rc = c->resume_table ? lobby_resume(l, c) : lobby_seat(l, c);
+    if (rc < 0)
+    {
+        return -1;
+    }
+    // frames that arrived right behind the one that got c handed over
+    rc = conn_process(c);
+    if (rc > 0)
+    {
+        conn_lost(c);
+    }
+    if (rc == 0)
+    {
+        conn_in_release(c);
+    }
+    if (rc == 0 && c->tls && tls_pending(c->tls))
+    {
+        // records TLS already decrypted: the socket won't signal those again
+        on_conn_event(l->reactor, c->fd, REACTOR_READ, c);
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+Conn *lobby_open_udp(Lobby *l, UdpPeer *p)
+{
+    Conn *c = slab_alloc(&l->conns);
+    if (!c)
+    {
+        perror("slab_alloc");
+        return NULL;
+    }
+    metric_add(&l->metrics, METRIC_ACCEPTS, 1);
+    c->fd = -1;
+    c->udp = p;
+    c->lobby = l;
+    c->carried_move = MOVE_INVALID;
+    c->mode = PROTO_BINARY; // no PROTO_MAGIC over UDP (see udp.h)
+    outq_init(&c->outq);
+    l->connections++;
+    return c;
+}
+
+Conn *lobby_open_seat(Lobby *l, const SeatOps *ops, void *arg)
+{
+    Conn *c = seat_conn_new(l, ops, arg);
+    if (!c)
+    {
+        return NULL;
+    }
+    return lobby_seat(l, c) < 0 ? NULL : c;
+}
+
+Conn *table_open_seat(Table *t, int i, const SeatOps *ops, void *arg)
+{
+    Conn *c = seat_conn_new(t->lobby, ops, arg);
+    if (c)
+    {
+        c->table = t;
+        c->seat = i;
+        t->seats[i] = c;
+    }
+    return c;
+}
+
+/* seat_conn_new: a Conn for an in-process seat, not seated yet. */
+static Conn *seat_conn_new(Lobby *l, const SeatOps *ops, void *arg)
+{
+    Conn *c = slab_alloc(&l->conns);
+    if (!c)
+    {
+        perror("slab_alloc");
+        ops->close(arg);
+        return NULL;
+    }
+    c->fd = -1;
+    c->ops = ops;
+    c->ops_arg = arg;
+    c->lobby = l;
+    c->carried_move = MOVE_INVALID;
+    c->mode = PROTO_BINARY;
+    outq_init(&c->outq);
+    l->connections++;
+    return c;
+}
+
+void lobby_pause(Lobby *l)
+{
+    l->paused = 1;
+    reactor_del(l->reactor, l->listen_fd); // the kernel queues new players meanwhile
+    for (Table *t = l->tables; t; t = t->next)
+    {
+        for (int i = 0; i < t->seated; i++)
+        {
+            if (t->seats[i] && t->seats[i]->stream)
+            {
+                reactor_stream_pause(l->reactor, t->seats[i]->fd);
+            }
+        }
+    }
+}
+
+int lobby_busy(const Lobby *l)
+{
+    for (const Table *t = l->tables; t; t = t->next)
+    {
+        for (int i = 0; i < t->seated; i++)
+        {
+            const Conn *c = t->seats[i];
+            if (c && c->stream && reactor_stream_busy(l->reactor, c->fd))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void lobby_unpause(Lobby *l)
+{
+    for (Table *t = l->tables; t; t = t->next)
+    {
+        for (int i = 0; i < t->seated; i++)
+        {
+            if (t->seats[i] && t->seats[i]->stream)
+            {
+                reactor_stream_resume(l->reactor, t->seats[i]->fd);
+            }
+        }
+    }
+    lobby_listen(l);
+    l->paused = 0;
+}
+
+int lobby_save(Lobby *l, TableState state, RestartImage *im)
+{
+    long long now = reactor_now_ms();
+    int n = 0;
+
+    for (Table *t = l->tables; t; t = t->next)
+    {
+        if (t->state != state)
+        {
+            continue;
+        }
+        RestartTable rt;
+        memset(&rt, 0, sizeof(rt));
+        rt.id = t->id;
+        rt.round = t->round;
+        rt.state = t->state;
+        rt.numPlayers = t->numPlayers;
+        rt.seated = t->seated;
+        rt.moves_received = t->moves_received;
+        rt.away = t->away;
+        for (int i = 0; i < t->seated; i++)
+        {
+            if (t->seats[i] && !conn_portable(t->seats[i]))
+                rt.away |= 1u << i; // its socket stays behind; it comes back with its session
+        }
+        rt.last_result_len = t->last_result ? (uint16_t)outbuf_len(t->last_result) : 0;
+        rt.deadline_ms = -1;
+        if (timer_armed(&t->move_timer))
+        {
+            long long left = t->move_timer.expires - now;
+            rt.deadline_ms = left > 0 ? (int32_t)left : 0;
+        }
+        memcpy(rt.moves, t->moves, sizeof(rt.moves));
+        memcpy(rt.scores, t->scores, sizeof(rt.scores));
+        if (restart_put_rec(im, RESTART_REC_TABLE, &rt, sizeof(rt)) < 0)
+        {
+            return -1;
+        }
+        for (int i = 0; i < t->seated; i++)
+        {
+            if (table_save_seat(t, i, im, now) < 0)
+            {
+                return -1;
+            }
+        }
+        if (t->last_result &&
+            restart_put(im, t->last_result->data + t->last_result->start, rt.last_result_len) < 0)
+        {
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+/*
+ * table_save_seat:
+ *   Seat i as a RestartSeat: a socket goes along with the bytes it has
+ *   not parsed yet and those not yet written to it.
+ */
+static int table_save_seat(Table *t, int i, RestartImage *im, long long now)
+{
+    Conn *c = t->seats[i];
+    RestartSeat rs;
+
+    memset(&rs, 0, sizeof(rs));
+    rs.fd = -1;
+    rs.session = t->cold->session[i];
+    rs.player = t->cold->player[i];
+    if (c && c->ops && seat_is_bot(c))
+    {
+        rs.kind = RESTART_SEAT_BOT;
+        return restart_put(im, &rs, sizeof(rs));
+    }
+    if (!c || !conn_portable(c))
+    {
+        rs.kind = RESTART_SEAT_AWAY;
+        rs.away_ms = c ? 0 : now - t->cold->away_since[i];
+        return restart_put(im, &rs, sizeof(rs));
+    }
+
+    rs.kind = RESTART_SEAT_CONN;
+    rs.mode = c->in ? c->in->mode : c->mode;
+    memcpy(rs.name, c->player, sizeof(rs.name));
+    rs.in_len = c->in ? (uint32_t)(c->in->end - c->in->start) : 0;
+    for (int k = 0; k < c->outq.count; k++)
+    {
+        const OutRef *r = &c->outq.refs[(c->outq.head + k) % OUTQ_LEN];
+        rs.out_len += (uint32_t)(outbuf_len(r->buf) - r->off);
+    }
+    if ((rs.fd = restart_put_fd(im, c->fd)) < 0 || restart_put(im, &rs, sizeof(rs)) < 0 ||
+        (c->in && restart_put(im, c->in->buf + c->in->start, rs.in_len) < 0))
+    {
+        return -1;
+    }
+    for (int k = 0; k < c->outq.count; k++)
+    {
+        const OutRef *r = &c->outq.refs[(c->outq.head + k) % OUTQ_LEN];
+        if (restart_put(im, r->buf->data + r->buf->start + r->off, outbuf_len(r->buf) - r->off) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* conn_portable: a plain TCP socket, whose state is all in the kernel and in c. */
+static int conn_portable(const Conn *c)
+{
+    return !c->ops && !c->udp && !c->tls;
+}
+
+int lobby_restore(Lobby *l, const RestartTable *rt, RestartImage *im)
+{
+    if (rt->seated > MAX_PLAYERS || rt->numPlayers > MAX_PLAYERS || rt->seated > rt->numPlayers)
+    {
+        return -1;
+    }
+    long long now = reactor_now_ms();
+    RestartSeat seats[MAX_PLAYERS];
+    Conn *conns[MAX_PLAYERS];
+
+    for (int i = 0; i < rt->seated; i++)
+    {
+        conns[i] = NULL;
+        if (restart_get(im, &seats[i], sizeof(seats[i])) < 0)
+        {
+            return -1;
+        }
+        if (seats[i].kind == RESTART_SEAT_CONN && conn_restore(l, &seats[i], im, &conns[i]) < 0)
+        {
+            return -1;
+        }
+    }
+    OutBuf *result = NULL;
+    if (rt->last_result_len > 0)
+    {
+        if (rt->last_result_len > OUTBUF_SIZE)
+        {
+            return -1;
+        }
+        if ((result = outbuf_get(&l->pool)))
+        {
+            result->end = rt->last_result_len;
+        }
+        if (restart_get(im, result ? result->data : NULL, rt->last_result_len) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (rt->state == TABLE_FORMING)
+    {
+        // waiting players start again at this lobby's forming table, moves and all
+        if (result)
+            outbuf_unref(result);
+        for (int i = 0; i < rt->seated; i++)
+        {
+            if (conns[i])
+            {
+                conns[i]->carried_move = rt->moves[i];
+                lobby_adopt(l, conns[i]);
+            }
+        }
+        return 0;
+    }
+
+    Table *t = table_create(l);
+    if (!t)
+    {
+        for (int i = 0; i < rt->seated; i++)
+        {
+            if (conns[i])
+                conn_close(conns[i]);
+        }
+        if (result)
+            outbuf_unref(result);
+        return 0;
+    }
+    if (l->feed)
+    {
+        fanout_table_live(l->feed, t->id, -1); // renamed
+        fanout_table_live(l->feed, rt->id, 1);
+    }
+    t->id = rt->id;
+    t->round = rt->round;
+    t->numPlayers = rt->numPlayers;
+    t->seated = rt->seated;
+    t->moves_received = rt->moves_received;
+    t->state = TABLE_PLAYING;
+    t->last_result = result;
+    memcpy(t->moves, rt->moves, sizeof(t->moves));
+    memcpy(t->scores, rt->scores, sizeof(t->scores));
+    l->playing_tables++;
+
+    for (int i = 0; i < rt->seated; i++)
+    {
+        const RestartSeat *rs = &seats[i];
+        t->cold->session[i] = rs->session;
+        t->cold->player[i] = rs->player;
+        t->cold->moved_at_us[i] = reactor_now_us();
+        OutQueue q = conns[i] ? conns[i]->outq : (OutQueue){0};
+        if (conns[i] && conn_register(l, conns[i]) == 0)
+        {
+            Conn *c = conns[i];
+            c->table = t;
+            c->seat = i;
+            t->seats[i] = c;
+            conn_flush(c);
+            continue;
+        }
+        outq_clear(&q); // conn_register freed the Conn, or there was none
+        if (rs->kind == RESTART_SEAT_BOT && seat_bot_restore(t, i))
+        {
+            continue;
+        }
+        // away, or its socket or bot could not be set up: hold the seat
+        t->away |= 1u << i;
+        t->cold->away_since[i] = now - (rs->kind == RESTART_SEAT_AWAY ? rs->away_ms : 0);
+    }
+    table_arm_grace(t);
+    if (rt->deadline_ms >= 0)
+    {
+        timer_arm(reactor_timers(l->reactor), &t->move_timer, now + rt->deadline_ms);
+    }
+    else
+    {
+        table_arm_deadline(t);
+    }
+    return 0;
+}
+
+/*
+ * conn_restore:
+ *   A network player's Conn from rs and the bytes that follow it in im,
+ *   with its unwritten output queued, but not registered with the
+ *   reactor yet. *out is NULL if it cannot be set up. Returns -1 only if
+ *   im is cut short.
+ */
+static int conn_restore(Lobby *l, const RestartSeat *rs, RestartImage *im, Conn **out)
+{
+    int fd = restart_take_fd(im, rs->fd);
+    Conn *c = fd >= 0 ? slab_alloc(&l->conns) : NULL;
+
+    *out = NULL;
+    if (!c)
+    {
+        if (fd >= 0)
+            close(fd);
+        return (restart_get(im, NULL, rs->in_len) < 0 || restart_get(im, NULL, rs->out_len) < 0)
+                   ? -1 : 0;
+    }
+    c->fd = fd;
+    c->lobby = l;
+    c->carried_move = MOVE_INVALID;
+    c->mode = rs->mode == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+    outq_init(&c->outq);
+    memcpy(c->player, rs->name, sizeof(c->player));
+    c->player[sizeof(c->player) - 1] = '\0';
+
+    // a partial frame (the rest is still in the socket)
+    if (rs->in_len > 0)
+    {
+        size_t avail = 0;
+        ProtoParser *in = conn_in(c);
+        uint8_t *space = in ? proto_parser_space(in, &avail) : NULL;
+        int fits = space && rs->in_len <= avail;
+        if (restart_get(im, fits ? space : NULL, rs->in_len) < 0)
+        {
+            conn_abandon(c);
+            return -1;
+        }
+        if (fits)
+            proto_parser_commit(in, rs->in_len);
+    }
+    for (uint32_t left = rs->out_len; left > 0;)
+    {
+        uint32_t n = left < OUTBUF_SIZE ? left : OUTBUF_SIZE;
+        OutBuf *b = c->outq.count < OUTQ_LEN ? outbuf_get(&l->pool) : NULL;
+        if (restart_get(im, b ? b->data : NULL, n) < 0)
+        {
+            if (b)
+                outbuf_unref(b);
+            conn_abandon(c);
+            return -1;
+        }
+        if (b)
+        {
+            b->end = n;
+            outq_push(&c->outq, b);
+            outbuf_unref(b);
+        }
+        left -= n;
+    }
+    *out = c;
+    return 0;
+}
+
+/* conn_abandon: free a Conn that conn_restore has not got registered. */
+static void conn_abandon(Conn *c)
+{
+    outq_clear(&c->outq);
+    close(c->fd);
+    slab_free(&c->lobby->inputs, c->in);
+    slab_free(&c->lobby->conns, c);
+}
+
+int conn_command(Conn *c, uint8_t op, const void *payload, size_t len)
+{
+    ProtoFrame f = {op, (uint32_t)len, payload};
+    return conn_handle_frame(c, &f) < 0 ? -1 : 0;
+}
+
+int conn_input(Conn *c, const uint8_t *data, size_t len)
+{
+    size_t avail;
+    ProtoParser *in = conn_in(c);
+    uint8_t *space = in ? proto_parser_space(in, &avail) : NULL;
+    if (!space || len > avail)
+    {
+        conn_lost(c); // a datagram holds whole frames, so nothing is pending
+        return -1;
+    }
+    memcpy(space, data, len);
+    proto_parser_commit(in, len);
+    int rc = conn_process(c);
+    if (rc < 0)
+    {
+        return -1;
+    }
+    if (rc > 0 || c->in->end > c->in->start)
+    {
+        conn_lost(c); // malformed, or a frame cut short
+        return -1;
+    }
+    conn_in_release(c);
+    return 0;
+}
+
+void conn_drop(Conn *c)
+{
+    conn_lost(c);
+}
+
+/* conn_register: watch c on this lobby's reactor. Frees it on failure. */
+static int conn_register(Lobby *l, Conn *c)
+{
+    c->lobby = l;
+    if (set_nonblocking(c->fd) < 0 ||
+        reactor_add(l->reactor, c->fd, REACTOR_READ, on_conn_event, c) < 0)
+    {
+        perror("new connection");
+        tls_conn_free(c->tls);
+        close(c->fd);
+        slab_free(&l->inputs, c->in);
+        slab_free(&l->conns, c);
+        return -1;
+    }
+    l->connections++;
+    return 0;
+}
+
+/*
+ * lobby_seat:
+ *   Seat a new player at the forming table, starting the table once it is
+ *   full. Returns -1 (and closes c) if there is no table to sit at.
+ */
+static int lobby_seat(Lobby *l, Conn *c)
+{
+    if (!l->forming)
+    {
+        if (!(l->forming = table_create(l)))
+        {
+            conn_close(c);
+            return -1;
+        }
+        // bots first; each sits down through here with the table formed
+        for (int i = 0; i < l->bot_seats && l->forming->seated < l->numPlayers - 1; i++)
+        {
+            seat_bot_open(l);
+        }
+    }
+
+    Table *t = l->forming;
+    if (t->seated == 0)
+    {
+        l->forming_since_ms = reactor_now_ms();
+    }
+    table_seat(t, c);
+    if (!c->ops || !c->ops->quiet)
+        printf("[Server] New client connected (%s). Table %u [%d/%d]\n",
+               conn_name(c), t->id, t->seated, t->numPlayers);
+    table_event(t, EV_JOIN, c->seat, t->seated, 0);
+    if (t->cold->session[c->seat])
+    {
+        table_send_session(t, c);
+    }
+
+    if (c->carried_move != MOVE_INVALID)
+    {
+        t->moves[c->seat] = c->carried_move;
+        t->cold->moved_at_us[c->seat] = reactor_now_us();
+        t->moves_received++;
+        table_event(t, EV_MOVE, c->seat, c->carried_move, 0);
+        c->carried_move = MOVE_INVALID;
+    }
+
+    if (t->seated == t->numPlayers)
+    {
+        t->state = TABLE_PLAYING;
+        l->forming = NULL;
+        l->playing_tables++;
+        if (!table_is_quiet(t))
+            printf("[Server] Table %u started (%d tables playing).\n",
+                   t->id, l->playing_tables);
+        table_event(t, EV_START, -1, t->numPlayers, 0);
+        if (l->feed)
+        {
+            fanout_started(l->feed, t->id);
+            table_tell(t, "Table %u started with %d players.", t->id, t->numPlayers);
+        }
+        if (t->moves_received == t->numPlayers)
+        {
+            table_resolve_round(t);
+            table_start_round(t);
+        }
+        else
+        {
+            table_arm_deadline(t); // for moves carried over from a handoff
+        }
+    }
+    return 0;
+}
+
+/*
+ * lobby_join:
+ *   JOIN from a connection that is not seated yet. A token names the
+ *   session to resume: "<table id>.<nonce>". Without one (or with one we
+ *   cannot read) the player takes a new seat, ranked if the payload is
+ *   "@<player id>".
+ *   Returns -1 if c is no longer this lobby's (closed or handed over).
+ */
+static int lobby_join(Lobby *l, Conn *c, const ProtoFrame *f)
+{
+    char token[48];
+    unsigned id;
+    unsigned long long nonce;
+
+    if (f->len > 0 && f->payload[0] == '@')
+    {
+        lobby_name_player(l, c, (const char *)f->payload + 1, f->len - 1);
+        return lobby_seat(l, c);
+    }
+    if (f->len == 0 || f->len >= sizeof(token))
+    {
+        return lobby_seat(l, c);
+    }
+    memcpy(token, f->payload, f->len);
+    token[f->len] = '\0';
+    if (sscanf(token, "%u.%llx", &id, &nonce) != 2 || id == 0)
+    {
+        return lobby_seat(l, c);
+    }
+    c->resume_table = id;
+    c->resume_nonce = nonce;
+
+    /* table ids are spread over lobbies by table_id_step (see shard.c) */
+    uint32_t owner = (id - 1) % l->table_id_step;
+    if (l->route && !c->udp && !c->ops && owner != (l->next_table_id - 1) % l->table_id_step)
+    {
+        // queued output belongs to this lobby's pool, so it must go first
+        if (conn_write(c) != 1)
+        {
+            conn_close(c);
+            return -1;
+        }
+        reactor_del(l->reactor, c->fd);
+        l->connections--;
+        c->lobby = NULL;
+        l->route(l->route_arg, c, (int)owner);
+        return -1;
+    }
+    return lobby_resume(l, c);
+}
+
+/* lobby_resume: take back the seat named by c->resume_*, or start afresh. */
+static int lobby_resume(Lobby *l, Conn *c)
+{
+    Table *t = table_find(l, c->resume_table);
+    uint64_t nonce = c->resume_nonce;
+
+    c->resume_table = 0;
+    c->resume_nonce = 0;
+    for (int i = 0; t && nonce && i < t->seated; i++)
+    {
+        if (t->cold->session[i] == nonce)
+        {
+            table_resume(t, i, c);
+            return 0;
+        }
+    }
+
+    printf("[Server] %s: session expired; seating as a new player.\n", conn_name(c));
+    static const char expired[] = "Session expired; joining a new table.";
+    conn_send_message(c, PROTO_OP_INFO, expired, sizeof(expired) - 1);
+    return lobby_seat(l, c);
+}
+
+/* lobby_name_player: record c's rounds under a player id once it is seated. */
+static void lobby_name_player(Lobby *l, Conn *c, const char *name, size_t len)
+{
+    if (!l->scores)
+    {
+        return; // no score store: everyone plays unranked
+    }
+    if (!scores_valid_name(name, len))
+    {
+        static const char bad[] = "Player ids are 1-15 letters, digits, '.', '_' or '-'; "
+                                  "playing unranked.";
+        conn_send_message(c, PROTO_OP_INFO, bad, sizeof(bad) - 1);
+        return;
+    }
+    memcpy(c->player, name, len); // travels with c if it is handed to another shard
+    c->player[len] = '\0';
+}
+
+int lobby_release_forming(Lobby *l, Conn **out, int max)
+{
+    Table *t = l->forming;
+    int n = 0;
+
+    if (!t)
+    {
+        return 0;
+    }
+    while (t->seated > 0 && n < max)
+    {
+        Conn *c = t->seats[t->seated - 1];
+        if (c->ops)
+        {
+            table_unseat(t, c); // the lobby they go to seats its own bots
+            conn_close(c);
+            continue;
+        }
+        if (!outq_empty(&c->outq) || c->udp)
+        {
+            break; // queued buffers belong to this shard's pool; UDP to its socket
+        }
+        c->carried_move = t->moves[c->seat];
+        table_unseat(t, c);
+        reactor_del(l->reactor, c->fd);
+        l->connections--;
+        c->table = NULL;
+        c->lobby = NULL;
+        out[n++] = c;
+    }
+    if (t->seated == 0)
+    {
+        table_free(t);
+    }
+    return n;
+}
+
+/* table_create: allocate an empty FORMING table and link it into the lobby. */
+static Table *table_create(Lobby *l)
+{
+    Table *t = slab_alloc(&l->table_hot);
+    TableCold *cold = t ? slab_alloc(&l->table_cold) : NULL;
+    if (!cold)
+    {
+        perror("slab_alloc");
+        slab_free(&l->table_hot, t);
+        return NULL;
+    }
+    t->cold = cold;
+    t->id = l->next_table_id;
+    l->next_table_id += l->table_id_step;
+    if (l->feed)
+    {
+        fanout_table_live(l->feed, t->id, 1);
+    }
+    t->lobby = l;
+    t->numPlayers = l->numPlayers;
+    t->state = TABLE_FORMING;
+    timer_init(&t->move_timer, on_move_deadline, t);
+    timer_init(&t->cold->grace_timer, on_grace_expired, t);
+    table_start_round(t);
+
+    t->next = l->tables;
+    if (l->tables)
+    {
+        l->tables->prev = t;
+    }
+    l->tables = t;
+    l->live_tables++;
+    return t;
+}
+
+/*
+ * table_find:
+ *   Look a live table up by id. Only resuming players need this, so a
+ *   scan of the lobby's list is fine.
+ */
+static Table *table_find(Lobby *l, uint32_t id)
+{
+    for (Table *t = l->tables; t; t = t->next)
+    {
+        if (t->id == id)
+        {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/* table_is_quiet: every seat is a quiet in-process one (e.g. a bot-only table). */
+static int table_is_quiet(const Table *t)
+{
+    for (int i = 0; i < t->seated; i++)
+    {
+        const Conn *c = t->seats[i];
+        if (!c || !c->ops || !c->ops->quiet)
+        {
+            return 0;
+        }
+    }
+    return t->seated > 0;
+}
+
+static void table_seat(Table *t, Conn *c)
+{
+    c->table = t;
+    c->seat = t->seated;
+    t->seats[t->seated++] = c;
+    // only framed clients understand SESSION, so only they can resume
+    t->cold->session[c->seat] = (c->mode == PROTO_BINARY && !c->ops) ? new_session_nonce() : 0;
+    t->cold->player[c->seat] = 0;
+    if (c->player[0] && t->lobby->scores)
+    {
+        // through the ring its rounds will use, so the store sees it first
+        ScoreEvent e;
+        memset(&e, 0, sizeof(e));
+        e.player = scores_player_id(c->player, strlen(c->player));
+        e.type = SCORE_NAME;
+        memcpy(e.name, c->player, sizeof(e.name));
+        scoring_push(t->lobby->scores, &e);
+        t->cold->player[c->seat] = e.player;
+    }
+}
+
+/*
+ * table_unseat:
+ *   Remove a player from a table that has not started yet. The last seat
+ *   is moved into the hole so seats[0..seated) stays dense.
+ */
+static void table_unseat(Table *t, Conn *c)
+{
+    int i = c->seat;
+    int last = --t->seated;
+
+    if (t->moves[i] != MOVE_INVALID)
+    {
+        t->moves_received--;
+    }
+    if (i != last)
+    {
+        t->seats[i] = t->seats[last];
+        t->seats[i]->seat = i;
+        t->moves[i] = t->moves[last];
+        t->scores[i] = t->scores[last];
+        t->cold->session[i] = t->cold->session[last];
+        t->cold->player[i] = t->cold->player[last];
+    }
+    t->seats[last] = NULL;
+    t->moves[last] = MOVE_INVALID;
+    t->scores[last] = 0;
+    t->cold->session[last] = 0;
+    t->cold->player[last] = 0;
+}
+
+/*
+ * table_resume:
+ *   Give seat i back to its player, now on connection c. If the table
+ *   still holds the old connection (the drop went unnoticed), that one is
+ *   closed. The player only gets the last RESULT and a SESSION snapshot,
+ *   which is all it needs to carry on.
+ */
+static void table_resume(Table *t, int i, Conn *c)
+{
+    if (t->seats[i])
+    {
+        conn_close(t->seats[i]);
+    }
+    else
+    {
+        table_clear_away(t, i);
+    }
+    t->seats[i] = c;
+    c->table = t;
+    c->seat = i;
+    printf("[Server] Table %u: Player %d resumed (%s).\n", t->id, i + 1, conn_name(c));
+    table_event(t, EV_RESUME, i, 0, 0);
+    table_tell(t, "Player %d is back.", i + 1);
+
+    if (t->last_result)
+    {
+        conn_send(c, t->last_result);
+    }
+    table_send_session(t, c);
+}
+
+/* table_set_away: close c but keep its seat for the lobby's grace period. */
+static void table_set_away(Table *t, Conn *c)
+{
+    int i = c->seat;
+
+    t->away |= 1u << i;
+    t->cold->away_since[i] = reactor_now_ms();
+    t->seats[i] = NULL;
+    conn_close(c);
+    table_arm_grace(t);
+    table_tell(t, "Player %d is away; the seat is held for %d s.", i + 1,
+               t->lobby->grace_ms / 1000);
+}
+
+static void table_clear_away(Table *t, int i)
+{
+    t->away &= ~(1u << i);
+    table_arm_grace(t);
+}
+
+/*
+ * table_arm_grace:
+ *   Point the grace timer at the seat that has been away longest (every
+ *   seat gets the same grace period), or stop it if nobody is away.
+ */
+static void table_arm_grace(Table *t)
+{
+    TimerWheel *w = reactor_timers(t->lobby->reactor);
+    long long first = -1;
+
+    for (int i = 0; i < t->numPlayers; i++)
+    {
+        if ((t->away & (1u << i)) && (first < 0 || t->cold->away_since[i] < first))
+        {
+            first = t->cold->away_since[i];
+        }
+    }
+    if (first < 0)
+    {
+        timer_cancel(w, &t->cold->grace_timer);
+        return;
+    }
+    timer_arm(w, &t->cold->grace_timer, first + t->lobby->grace_ms);
+}
+
+/* on_grace_expired: an away player did not come back in time. */
+static void on_grace_expired(Timer *tm, void *arg)
+{
+    (void)tm;
+    Table *t = arg;
+    int seat = -1;
+
+    for (int i = 0; i < t->numPlayers; i++)
+    {
+        if ((t->away & (1u << i)) &&
+            (seat < 0 || t->cold->away_since[i] < t->cold->away_since[seat]))
+        {
+            seat = i;
+        }
+    }
+    printf("[Server] Table %u: Player %d did not come back. Ending game.\n",
+           t->id, seat + 1);
+    table_close(t);
+}
+
+/*
+ * table_arm_deadline:
+ *   Start the round's move deadline once a playing table has its first
+ *   move; later moves do not extend it.
+ */
+static void table_arm_deadline(Table *t)
+{
+    int timeout = t->lobby->move_timeout_ms;
+
+    if (timeout > 0 && t->state == TABLE_PLAYING && t->moves_received > 0 &&
+        !timer_armed(&t->move_timer))
+    {
+        timer_arm(reactor_timers(t->lobby->reactor), &t->move_timer,
+                  reactor_now_ms() + timeout);
+    }
+}
+
+/* on_move_deadline: resolve the round with the moves that made it in time. */
+static void on_move_deadline(Timer *tm, void *arg)
+{
+    (void)tm;
+    Table *t = arg;
+
+    if (lobby_log_ok(t->lobby))
+        printf("[Server] Table %u: Move deadline passed with %d of %d moves in; "
+               "missing moves forfeit.\n",
+               t->id, t->moves_received, t->numPlayers);
+    table_resolve_round(t);
+    table_start_round(t);
+}
+
+/*
+ * table_send_session:
+ *   Tell c how to resume: "<table id>.<nonce>:<seat>:<moved>", where moved
+ *   says whether its move for the current round is already in.
+ */
+static void table_send_session(Table *t, Conn *c)
+{
+    char payload[64];
+    int len = snprintf(payload, sizeof(payload), "%u.%016llx:%d:%d",
+                       t->id, (unsigned long long)t->cold->session[c->seat], c->seat + 1,
+                       t->moves[c->seat] != MOVE_INVALID);
+    conn_send_message(c, PROTO_OP_SESSION, payload, len);
+}
+
+/* new_session_nonce: an unguessable, non-zero resume token. */
+static uint64_t new_session_nonce(void)
+{
+    static _Thread_local uint64_t counter;
+    uint64_t n = 0;
+
+    while (n == 0)
+    {
+        if (getrandom(&n, sizeof(n), 0) != (ssize_t)sizeof(n))
+        {
+            // no entropy available: settle for unique
+            n = ((uint64_t)reactor_now_ms() << 24) ^ ++counter ^ (uint64_t)(uintptr_t)&n;
+        }
+    }
+    return n;
+}
+
+/* table_close: tell everyone the game is over and release the table. */
+static void table_close(Table *t)
+{
+    int quiet = table_is_quiet(t);
+    table_broadcast(t, PROTO_OP_QUIT, NULL, 0);
+    for (int i = 0; i < t->seated; i++)
+    {
+        if (t->seats[i])
+        {
+            conn_close(t->seats[i]);
+        }
+    }
+    if (!quiet)
+        printf("[Server] Table %u game session ended.\n", t->id);
+    table_event(t, EV_END, -1, 0, 0);
+    table_free(t);
+}
+
+/* table_free: unlink an (empty) table from its lobby and free it. */
+static void table_free(Table *t)
+{
+    Lobby *l = t->lobby;
+
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        l->tables = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    if (l->forming == t)
+        l->forming = NULL;
+    if (t->state == TABLE_PLAYING)
+        l->playing_tables--;
+    TimerWheel *w = reactor_timers(l->reactor);
+    timer_cancel(w, &t->move_timer);
+    timer_cancel(w, &t->cold->grace_timer);
+    if (t->last_result)
+        outbuf_unref(t->last_result);
+    l->live_tables--;
+    if (l->feed)
+    {
+        fanout_table_live(l->feed, t->id, -1);
+    }
+    slab_free(&l->table_cold, t->cold);
+    slab_free(&l->table_hot, t);
+}
+
+static void conn_close(Conn *c)
+{
+    conn_write(c); // last chance for e.g. a QUIT
+    outq_clear(&c->outq);
+    if (c->ops)
+    {
+        c->ops->close(c->ops_arg);
+    }
+    else if (c->udp)
+    {
+        dgram_close(c->udp);
+    }
+    else
+    {
+        reactor_del(c->lobby->reactor, c->fd);
+        tls_conn_free(c->tls);
+        close(c->fd);
+    }
+    Lobby *l = c->lobby;
+    l->connections--;
+    slab_free(&l->inputs, c->in);
+    slab_free(&l->conns, c);
+}
+
+/* conn_abort: make the event loop report c lost (see conn_send). */
+static void conn_abort(Conn *c)
+{
+    if (c->udp)
+        dgram_fail(c->udp);
+    else if (!c->ops) // an in-process seat has no queue to overflow
+        shutdown(c->fd, SHUT_RDWR);
+}
+
+/* conn_name: c as log lines show it, by fd, UDP connection id or seat kind. */
+static const char *conn_name(const Conn *c)
+{
+    static _Thread_local char name[24];
+    if (c->ops)
+        snprintf(name, sizeof(name), "%s", c->ops->kind);
+    else if (c->udp)
+        snprintf(name, sizeof(name), "udp=%08x", dgram_peer_id(c->udp));
+    else
+        snprintf(name, sizeof(name), "fd=%d", c->fd);
+    return name;
+}
+
+/*
+ * conn_send:
+ *   Queue a reference to b for this connection and try to write it now.
+ *   A connection whose queue is full, or whose socket failed, is shut
+ *   down; the reactor then reports it and the normal disconnect path
+ *   cleans up, so callers never see a connection vanish mid-broadcast.
+ *   An in-process seat is handed b directly.
+ */
+static void conn_send(Conn *c, OutBuf *b)
+{
+    if (c->ops)
+    {
+        c->ops->deliver(c->ops_arg, b);
+        return;
+    }
+    if (outq_push(&c->outq, b) < 0)
+    {
+        if (c->table)
+            printf("[Server] Table %u: Player %d is not reading; dropping.\n",
+                   c->table->id, c->seat + 1);
+        else
+            printf("[Server] %s is not reading; dropping.\n", conn_name(c));
+        conn_abort(c);
+        return;
+    }
+    if (c->outq.count == 1)
+    {
+        conn_flush(c);
+    }
+}
+
+/* conn_send_message: encode one message in c's protocol and send it. */
+static void conn_send_message(Conn *c, uint8_t op, const void *payload, size_t len)
+{
+    OutBuf *b = encode_message(&c->lobby->pool, c->mode, op, payload, len);
+    if (b)
+    {
+        conn_send(c, b);
+        outbuf_unref(b);
+    }
+}
+
+/* conn_write: flush c's queue once, counting what it costs. See outq_flush. */
+static int conn_write(Conn *c)
+{
+    if (c->ops)
+    {
+        return 1; // nothing is ever queued
+    }
+    if (c->udp)
+    {
+        return dgram_write(c->udp); // counted when the datagrams are sent
+    }
+    Metrics *m = &c->lobby->metrics;
+    size_t written = 0;
+    int rc = outq_flush_via(&c->outq, conn_sendv, c, &written);
+
+    metric_add(m, METRIC_BYTES_OUT, written);
+    if (rc == 0)
+    {
+        metric_add(m, METRIC_SHORT_WRITES, 1);
+    }
+    return rc;
+}
+
+/* conn_flush: write what the socket takes, and watch for writability if not all. */
+static void conn_flush(Conn *c)
+{
+    if (c->udp)
+    {
+        dgram_queue(c->udp); // batched with the rest of this loop iteration's output
+        return;
+    }
+    int rc = conn_write(c);
+    if (rc < 0)
+    {
+        outq_clear(&c->outq);
+        shutdown(c->fd, SHUT_RDWR);
+        rc = 1;
+    }
+    reactor_mod(c->lobby->reactor, c->fd, rc ? REACTOR_READ : REACTOR_READ | REACTOR_WRITE);
+}
+
+/* table_start_round: clear per-round state so players can send new moves. */
+static void table_start_round(Table *t)
+{
+    for (int i = 0; i < MAX_PLAYERS; i++)
+    {
+        t->moves[i] = MOVE_INVALID;
+    }
+    t->moves_received = 0;
+    if (t->lobby)
+    {
+        timer_cancel(reactor_timers(t->lobby->reactor), &t->move_timer);
+    }
+}
+
+/* encode_message: serialize one message into a fresh pooled buffer. */
+static OutBuf *encode_message(OutPool *pool, ProtoMode mode, uint8_t op,
+                              const void *payload, size_t len)
+{
+    OutBuf *b = outbuf_get(pool);
+    if (!b)
+    {
+        return NULL;
+    }
+    b->end = proto_encode(mode, op, payload, len, b->data, OUTBUF_SIZE);
+    return b;
+}
+
+/*
+ * table_broadcast:
+ *   Send one message to every seated player, encoded once for each of the
+ *   protocols spoken at the table.
+ */
+static void table_broadcast(Table *t, uint8_t op, const void *payload, size_t len)
+{
+    OutBuf *bufs[2] = {NULL, NULL};
+
+    for (int i = 0; i < t->seated; i++)
+    {
+        if (!t->seats[i])
+        {
+            continue; // away
+        }
+        int m = t->seats[i]->mode;
+        if (!bufs[m])
+        {
+            bufs[m] = encode_message(&t->lobby->pool, m, op, payload, len);
+        }
+    }
+    table_broadcast_bufs(t, bufs);
+    table_publish(t, op, payload, len);
+}
+
+/*
+ * table_broadcast_bufs:
+ *   Queue a reference to bufs[mode] on every seated player, then drop the
+ *   caller's references. Buffers return to the pool once all are written.
+ */
+static void table_broadcast_bufs(Table *t, OutBuf *bufs[2])
+{
+    for (int i = 0; i < t->seated; i++)
+    {
+        Conn *c = t->seats[i];
+        OutBuf *b = c ? bufs[c->mode] : NULL;
+        if (b)
+        {
+            conn_send(c, b);
+        }
+    }
+    for (int m = 0; m < 2; m++)
+    {
+        if (bufs[m])
+        {
+            outbuf_unref(bufs[m]);
+        }
+    }
+}
+
+/*
+ * on_conn_event:
+ *   Reactor callback for a player's socket. Finish any queued output first,
+ *   then read. The epoll backend is edge-triggered, so keep reading until
+ *   the socket would block. Bytes go straight into the connection's parser,
+ *   which may hold a partial frame from the previous read or several
+ *   pipelined ones; once everything is parsed, the parser goes back to the
+ *   lobby's slab until the next read.
+ */
+static void on_conn_event(Reactor *r, int fd, unsigned events, void *arg)
+{
+    (void)r;
+    (void)fd;
+    Conn *c = arg;
+
+    if (c->tls)
+    {
+        int rc = conn_handshake(c);
+        if (rc <= 0)
+        {
+            if (rc < 0)
+                conn_lost(c);
+            return;
+        }
+    }
+    if ((events & REACTOR_WRITE) && !outq_empty(&c->outq))
+    {
+        conn_flush(c);
+    }
+    if (c->stream)
+    {
+        return; // reads come to on_conn_data
+    }
+
+    while (1)
+    {
+        size_t avail;
+        ProtoParser *in = conn_in(c);
+        if (!in)
+        {
+            conn_lost(c); // out of memory
+            return;
+        }
+        uint8_t *space = proto_parser_space(in, &avail);
+        ssize_t n = conn_recv(c, space, avail);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (c->lobby->sock)
+                sockopt_quickack(c->fd, c->lobby->sock);
+            conn_in_release(c);
+            conn_try_stream(c);
+            return; // drained
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n > 0)
+        {
+            proto_parser_commit(in, n);
+            metric_add(&c->lobby->metrics, METRIC_BYTES_IN, (unsigned long)n);
+            int rc = conn_process(c);
+            if (rc < 0)
+            {
+                return; // c is gone
+            }
+            if (rc == 0)
+            {
+                continue;
+            }
+        }
+        conn_lost(c);
+        return;
+    }
+}
+
+/*
+ * conn_handshake:
+ *   Drive c's TLS handshake. Returns 1 once it is complete, 0 while it
+ *   waits for the socket (watched in the direction it needs), -1 if it
+ *   failed.
+ */
+static int conn_handshake(Conn *c)
+{
+    if (c->tls_ready)
+    {
+        return 1;
+    }
+    int rc = tls_handshake(c->tls);
+    if (rc <= 0)
+    {
+        if (rc == 0)
+            reactor_mod(c->lobby->reactor, c->fd,
+                        tls_wants_write(c->tls) ? REACTOR_READ | REACTOR_WRITE : REACTOR_READ);
+        return rc;
+    }
+    c->tls_ready = 1;
+    Metrics *m = &c->lobby->metrics;
+    metric_add(m, METRIC_TLS_HANDSHAKES, 1);
+    metric_add(m, METRIC_TLS_RESUMED, tls_resumed(c->tls) ? 1 : 0);
+    metric_add(m, METRIC_TLS_KTLS, tls_ktls_send(c->tls) ? 1 : 0);
+    if (tls_wants_write(c->tls))
+    {
+        reactor_mod(c->lobby->reactor, c->fd, REACTOR_READ);
+    }
+    return 1;
+}
+
+/* conn_in: c's input parser, taken from the lobby's slab if it has none. */
+static ProtoParser *conn_in(Conn *c)
+{
+    if (!c->in && (c->in = slab_alloc(&c->lobby->inputs)))
+    {
+        proto_parser_init(c->in);
+        c->in->mode = c->mode;
+    }
+    return c->in;
+}
+
+/* conn_in_release: give c's parser back if it holds no partial frame. */
+static void conn_in_release(Conn *c)
+{
+    if (c->in && c->in->start == c->in->end)
+    {
+        c->mode = c->in->mode;
+        slab_free(&c->lobby->inputs, c->in);
+        c->in = NULL;
+    }
+}
+
+/* conn_recv: recv(), through TLS if c uses it. */
+static ssize_t conn_recv(Conn *c, void *buf, size_t len)
+{
+    metric_add(&c->lobby->metrics, METRIC_SOCKET_SYSCALLS, 1);
+    return c->tls ? tls_recv(c->tls, buf, len) : recv(c->fd, buf, len, 0);
+}
+
+/*
+ * conn_sendv:
+ *   c's outq_sendv: into the reactor's send queue for a stream, through
+ *   TLS if it encrypts in user space, else sendmsg().
+ */
+static ssize_t conn_sendv(void *arg, const struct iovec *iov, int iovcnt)
+{
+    Conn *c = arg;
+    if (c->stream)
+    {
+        return reactor_send(c->lobby->reactor, c->fd, iov, iovcnt); // sent with the next wait
+    }
+    metric_add(&c->lobby->metrics, METRIC_SOCKET_SYSCALLS, 1);
+    if (c->tls && !tls_ktls_send(c->tls))
+    {
+        return tls_sendv(c->tls, iov, iovcnt);
+    }
+    /* sendmsg() rather than writev() so a dead peer can't raise SIGPIPE */
+    struct msghdr msg = {0};
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+}
+
+/*
+ * conn_try_stream:
+ *   Called with c's socket drained. A plaintext player at a playing table
+ *   stays on this shard for good, so on an io_uring reactor it moves to
+ *   completion I/O: the kernel receives into the reactor's buffer ring and
+ *   sends on its own, with no recv() or sendmsg() per message.
+ */
+static void conn_try_stream(Conn *c)
+{
+    if (c->stream || c->tls || !c->table || c->table->state != TABLE_PLAYING ||
+        !outq_empty(&c->outq) || c->lobby->paused)
+    {
+        return;
+    }
+    if (reactor_stream(c->lobby->reactor, c->fd, on_conn_data) == 0)
+    {
+        c->stream = 1;
+    }
+}
+
+/*
+ * on_conn_data:
+ *   Reactor callback for a stream: bytes, end of stream or an error.
+ *   Bytes go through c's parser exactly as recv()ed ones would.
+ */
+static void on_conn_data(Reactor *r, int fd, const void *data, ssize_t len, void *arg)
+{
+    (void)r;
+    (void)fd;
+    Conn *c = arg;
+    const uint8_t *p = data;
+
+    if (len <= 0)
+    {
+        conn_lost(c);
+        return;
+    }
+    metric_add(&c->lobby->metrics, METRIC_BYTES_IN, (unsigned long)len);
+    while (len > 0)
+    {
+        size_t avail;
+        ProtoParser *in = conn_in(c);
+        if (!in)
+        {
+            conn_lost(c); // out of memory
+            return;
+        }
+        uint8_t *space = proto_parser_space(in, &avail);
+        size_t n = (size_t)len < avail ? (size_t)len : avail;
+        memcpy(space, p, n);
+        proto_parser_commit(in, n);
+        p += n;
+        len -= (ssize_t)n;
+
+        int rc = conn_process(c);
+        if (rc < 0)
+        {
+            return; // c is gone
+        }
+        if (rc > 0)
+        {
+            conn_lost(c);
+            return;
+        }
+    }
+    conn_in_release(c);
+}
+
+/*
+ * conn_process:
+ *   Handle every complete frame in c's parser. Returns 0 once it needs
+ *   more bytes, 1 on a protocol error, or -1 if c was closed or handed to
+ *   another lobby (and must not be touched).
+ */
+static int conn_process(Conn *c)
+{
+    ProtoFrame f;
+    int rc;
+
+    if (!c->in)
+    {
+        return 0; // nothing pending
+    }
+    while ((rc = proto_next(c->in, &f)) > 0)
+    {
+        c->mode = c->in->mode; // PROTO_MAGIC switches it
+        int admit = conn_admit(c, &f);
+        if (admit < 0)
+        {
+            return 1;
+        }
+        if (admit == 0)
+        {
+            continue;
+        }
+        if (conn_handle_frame(c, &f) < 0)
+        {
+            return -1;
+        }
+    }
+    if (rc == 0)
+    {
+        return 0;
+    }
+    metric_add(&c->lobby->metrics, METRIC_PARSE_ERRORS, 1);
+    if (c->table)
+        printf("[Server] Table %u: Player %d sent a malformed frame.\n",
+               c->table->id, c->seat + 1);
+    else
+        printf("[Server] %s sent a malformed frame.\n", conn_name(c));
+    return 1;
+}
+
+/*
+ * conn_admit:
+ *   Check a frame from the network before anything acts on it. A MOVE the
+ *   seat can still make this round is free; every other frame costs a
+ *   token, and one that can do nothing is dropped and counted in the
+ *   strike window. A seat gets one RESET a round: each goes to the
+ *   whole table, and a round does not end until everyone has moved. Returns 1 to handle f, 0 to drop it, or -1 if c is
+ *   abusive and must be disconnected (with conn_lost()).
+ */
+static int conn_admit(Conn *c, const ProtoFrame *f)
+{
+    Lobby *l = c->lobby;
+    int bad = 0;
+
+    switch (f->op)
+    {
+    case PROTO_OP_MOVE:
+        if (f->len != 1 || char_to_move((char)f->payload[0]) == MOVE_INVALID)
+            bad = 1;
+        else if (c->table && c->table->moves[c->seat] != MOVE_INVALID)
+            bad = 1; // already moved this round
+        break;
+    case PROTO_OP_RESET:
+        if (c->table && c->reset_table == c->table->id && c->reset_round == c->table->round)
+            bad = 1; // already reset this round
+        else if (c->table)
+        {
+            c->reset_table = c->table->id;
+            c->reset_round = c->table->round;
+        }
+        break;
+    case PROTO_OP_HELLO:
+    case PROTO_OP_JOIN:
+    case PROTO_OP_QUIT:
+        break;
+    default:
+        bad = 1; // nothing a player may send
+        break;
+    }
+    c->strikes = (c->strikes << 1) | (uint64_t)bad;
+    if (f->op == PROTO_OP_MOVE && !bad)
+    {
+        return 1; // at most one a round, and the round needs it
+    }
+
+    if (l->frame_rate > 0 && c->tokens < 1000)
+    {
+        long long now = reactor_now_ms();
+        c->tokens += (now - c->tokens_ms) * l->frame_rate;
+        if (c->tokens > (long long)l->frame_burst * 1000)
+            c->tokens = (long long)l->frame_burst * 1000;
+        c->tokens_ms = now;
+        if (c->tokens < 1000)
+        {
+            metric_add(&l->metrics, METRIC_RATE_LIMITED, 1);
+            printf("[Server] %s sends more than %d frames/s; dropping.\n",
+                   conn_name(c), l->frame_rate);
+            return -1;
+        }
+    }
+    c->tokens -= 1000;
+
+    if (bad)
+    {
+        metric_add(&l->metrics, METRIC_FRAMES_REJECTED, 1);
+        if (__builtin_popcountll(c->strikes) > LOBBY_STRIKE_LIMIT)
+        {
+            metric_add(&l->metrics, METRIC_ABUSE_DROPS, 1);
+            printf("[Server] %s sent %d unusable frames of its last 64; dropping.\n",
+                   conn_name(c), __builtin_popcountll(c->strikes));
+            return -1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * conn_handle_frame:
+ *   Apply one frame from c. A new connection is seated by its first
+ *   command, unless that command is a JOIN resuming a session.
+ *   Returns -1 if c is gone, 0 otherwise.
+ */
+static int conn_handle_frame(Conn *c, const ProtoFrame *f)
+{
+    if (f->op == PROTO_OP_HELLO)
+    {
+        // client speaks the framed protocol; confirm so it switches too
+        conn_send_message(c, PROTO_OP_HELLO, NULL, 0);
+        return 0;
+    }
+    if (!c->table)
+    {
+        if (f->op == PROTO_OP_JOIN)
+        {
+            return lobby_join(c->lobby, c, f) < 0 ? -1 : 0;
+        }
+        if (lobby_seat(c->lobby, c) < 0)
+        {
+            return -1;
+        }
+    }
+    return table_handle_frame(c->table, c, f);
+}
+
+/*
+ * conn_lost:
+ *   c hung up, failed or broke the protocol. At a forming table the seat
+ *   is simply given back. At a playing table a framed player's seat is
+ *   kept for the grace period; otherwise the game ends.
+ */
+static void conn_lost(Conn *c)
+{
+    Table *t = c->table;
+
+    if (!t)
+    {
+        conn_close(c);
+        return;
+    }
+    table_event(t, EV_LEAVE, c->seat, 0, 0);
+    if (t->state == TABLE_FORMING)
+    {
+        // nobody is playing yet => just give the seat back
+        printf("[Server] Table %u: waiting player disconnected.\n", t->id);
+        table_unseat(t, c);
+        conn_close(c);
+        return;
+    }
+    if (t->cold->session[c->seat] && c->lobby->grace_ms > 0)
+    {
+        printf("[Server] Table %u: Player %d disconnected. Holding the seat for %d ms.\n",
+               t->id, c->seat + 1, c->lobby->grace_ms);
+        table_set_away(t, c);
+        return;
+    }
+    // player disconnected or error => end the game at this table
+    printf("[Server] Table %u: Player %d disconnected. Ending game.\n",
+           t->id, c->seat + 1);
+    table_close(t);
+}
+
+/*
+ * table_handle_frame:
+ *   Apply one command from player c. Returns -1 if the table was closed
+ *   (its connections are freed), 0 otherwise.
+ */
+static int table_handle_frame(Table *t, Conn *c, const ProtoFrame *f)
+{
+    int i = c->seat;
+
+    switch (f->op)
+    {
+    case PROTO_OP_JOIN:
+        break; // already seated
+    case PROTO_OP_QUIT:
+        printf("[Server] Table %u: Player %d requested QUIT.\n", t->id, i + 1);
+        table_event(t, EV_QUIT, i, 0, 0);
+        table_close(t);
+        return -1;
+    case PROTO_OP_RESET:
+        printf("[Server] Table %u: Player %d requested RESET.\n", t->id, i + 1);
+        table_event(t, EV_RESET, i, 0, 0);
+        // zero out all scores
+        for (int k = 0; k < t->numPlayers; k++)
+        {
+            t->scores[k] = 0;
+        }
+        if (t->last_result)
+        {
+            outbuf_unref(t->last_result); // no longer the table's state
+            t->last_result = NULL;
+        }
+        table_broadcast(t, PROTO_OP_RESET, NULL, 0);
+        // skip winner calc & start new round
+        table_start_round(t);
+        break;
+    case PROTO_OP_MOVE:
+    {
+        Move m = (f->len == 1) ? char_to_move((char)f->payload[0]) : MOVE_INVALID;
+        if (m != MOVE_INVALID && t->moves[i] == MOVE_INVALID)
+        {
+            t->moves[i] = m;
+            t->cold->moved_at_us[i] = reactor_now_us();
+            t->moves_received++;
+            metric_add(&t->lobby->metrics, METRIC_MOVES, 1);
+            table_event(t, EV_MOVE, i, m, 0);
+            if (lobby_log_ok(t->lobby))
+                printf("[Server] Table %u: Player %d => %s\n", t->id, i + 1, move_to_string(m));
+        }
+        // else ignore invalid or duplicate move (only a local seat's gets here)
+
+        if (t->moves_received == t->numPlayers)
+        {
+            table_resolve_round(t);
+            table_start_round(t);
+        }
+        else
+        {
+            table_arm_deadline(t);
+        }
+        break;
+    }
+    default:
+        // unknown command (conn_admit() drops the network's)
+        if (lobby_log_ok(t->lobby))
+            printf("[Server] Table %u: Player %d sent unknown: %.*s\n",
+                   t->id, i + 1, (int)f->len, (const char *)f->payload);
+        break;
+    }
+    return 0;
+}
+
+/* table_resolve_round: all moves are in; compute multi-winner(s) and broadcast. */
+static void table_resolve_round(Table *t)
+{
+    int numPlayers = t->numPlayers;
+    int32_t *scores = t->scores;
+
+    Move moves[MAX_PLAYERS];
+    for (int i = 0; i < numPlayers; i++)
+    {
+        moves[i] = (Move)t->moves[i];
+    }
+
+    int winners[MAX_PLAYERS];
+    int numWinners = 0;
+    determine_multiplayer_winners(moves, numPlayers, winners, &numWinners);
+    t->round++;
+
+    int verbose = lobby_log_ok(t->lobby);
+    if (numWinners == 0)
+    {
+        if (verbose)
+            printf("[Server] Table %u: Round %u ends in a tie.\n", t->id, t->round);
+    }
+    else
+    {
+        if (verbose)
+            printf("[Server] Table %u: Round %u dominant move(s): ", t->id, t->round);
+        for (int w = 0; w < numWinners; w++)
+        {
+            scores[winners[w]]++;
+            if (verbose)
+                printf("Player %d ", (winners[w] + 1));
+        }
+        if (verbose)
+            printf("\n");
+    }
+
+    table_broadcast_result(t, winners, numWinners);
+
+    uint32_t winner_mask = 0;
+    for (int w = 0; w < numWinners; w++)
+    {
+        winner_mask |= 1u << winners[w];
+    }
+    table_event(t, EV_RESULT, -1, numWinners, winner_mask);
+    table_score_round(t, winner_mask);
+
+    Metrics *m = &t->lobby->metrics;
+    long long now = reactor_now_us();
+    metric_add(m, METRIC_ROUNDS, 1);
+    for (int i = 0; i < numPlayers; i++)
+    {
+        if (moves[i] != MOVE_INVALID)
+        {
+            metric_observe_us(m, now - t->cold->moved_at_us[i]);
+        }
+    }
+}
+
+/*
+ * table_event:
+ *   Record an event in the lobby's event log ring, if logging is on.
+ *   Never blocks: a full ring drops the record (see evring_push).
+ */
+static void table_event(Table *t, EvType type, int seat, unsigned value, uint32_t arg)
+{
+    Lobby *l = t->lobby;
+    if (!l->events)
+    {
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    EvRecord rec;
+    rec.time_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    rec.table = t->id;
+    rec.round = t->round;
+    rec.type = (uint8_t)type;
+    rec.shard = (uint8_t)((l->next_table_id - 1) % l->table_id_step);
+    rec.seat = (seat < 0) ? 0xFF : (uint8_t)seat;
+    rec.value = (uint8_t)value;
+    rec.arg = arg;
+    evring_push(l->events, &rec);
+}
+
+/*
+ * table_score_round:
+ *   Send every ranked seat's round to the score store, forfeits included.
+ *   Like table_event, a full ring drops rather than blocks.
+ */
+static void table_score_round(Table *t, uint32_t winner_mask)
+{
+    Lobby *l = t->lobby;
+    if (!l->scores)
+    {
+        return;
+    }
+    for (int i = 0; i < t->numPlayers; i++)
+    {
+        if (t->cold->player[i])
+        {
+            ScoreEvent e = {.player = t->cold->player[i], .type = SCORE_ROUND,
+                            .won = (uint8_t)((winner_mask >> i) & 1)};
+            scoring_push(l->scores, &e);
+        }
+    }
+}
+
+/*
+ * lobby_log_ok:
+ *   Whether a per-move/per-round line may be printed: only with log_moves,
+ *   and at most LOBBY_LOG_RATE a second, so logging cannot become the
+ *   server's main cost. Reports how many lines were dropped.
+ */
+static int lobby_log_ok(Lobby *l)
+{
+    if (!l->log_moves)
+    {
+        return 0;
+    }
+    long long now = reactor_now_ms();
+    if (now - l->log_window_ms >= 1000)
+    {
+        if (l->log_suppressed)
+        {
+            printf("[Server] (%ld log lines suppressed)\n", l->log_suppressed);
+        }
+        l->log_window_ms = now;
+        l->log_lines = 0;
+        l->log_suppressed = 0;
+    }
+    if (l->log_lines < LOBBY_LOG_RATE)
+    {
+        l->log_lines++;
+        return 1;
+    }
+    l->log_suppressed++;
+    return 0;
+}
+
+/* put_str / put_uint: append to a payload without snprintf temporaries. */
+static uint8_t *put_str(uint8_t *p, const char *s)
+{
+    while (*s)
+    {
+        *p++ = (uint8_t)*s++;
+    }
+    return p;
+}
+
+static uint8_t *put_uint(uint8_t *p, uint32_t v)
+{
+    uint8_t tmp[10];
+    int n = 0;
+    do
+    {
+        tmp[n++] = (uint8_t)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n)
+    {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+/*
+ * table_broadcast_result:
+ *   Serialize the round exactly once, straight into a pooled buffer, and
+ *   queue a reference to it for every player.
+ *   Payload example: winner0,winner1:move0,move1:score0,score1
+ *   (legacy text peers receive it as "RESULT:<payload>", copied from the
+ *   same bytes only if such a peer is seated).
+ */
+static void table_broadcast_result(Table *t, const int winners[], int numWinners)
+{
+    OutBuf *bin = outbuf_get(&t->lobby->pool);
+    if (!bin)
+    {
+        return;
+    }
+
+    /* payload first, leaving room for the longest header in front of it */
+    uint8_t *payload = bin->data + PROTO_MAX_HEADER;
+    uint8_t *p = payload;
+    for (int i = 0; i < numWinners; i++)
+    {
+        if (i)
+            *p++ = ',';
+        p = put_uint(p, winners[i] + 1);
+    }
+    *p++ = ':';
+    for (int i = 0; i < t->numPlayers; i++)
+    {
+        if (i)
+            *p++ = ',';
+        p = put_str(p, move_to_string((Move)t->moves[i]));
+    }
+    *p++ = ':';
+    for (int i = 0; i < t->numPlayers; i++)
+    {
+        if (i)
+            *p++ = ',';
+        if (t->scores[i] < 0)
+            *p++ = '-';
+        p = put_uint(p, t->scores[i] < 0 ? (uint32_t)-t->scores[i] : (uint32_t)t->scores[i]);
+    }
+    size_t len = p - payload;
+
+    size_t hlen = proto_header_size(PROTO_BINARY, PROTO_OP_RESULT, len);
+    bin->start = PROTO_MAX_HEADER - hlen;
+    bin->end = PROTO_MAX_HEADER + len;
+    proto_write_header(PROTO_BINARY, PROTO_OP_RESULT, len, bin->data + bin->start);
+
+    OutBuf *bufs[2] = {NULL, NULL};
+    bufs[PROTO_BINARY] = bin;
+    for (int i = 0; i < t->seated; i++)
+    {
+        if (t->seats[i] && t->seats[i]->mode == PROTO_TEXT)
+        {
+            bufs[PROTO_TEXT] = encode_message(&t->lobby->pool, PROTO_TEXT,
+                                              PROTO_OP_RESULT, payload, len);
+            break;
+        }
+    }
+
+    // kept for players who resume
+    if (t->last_result)
+    {
+        outbuf_unref(t->last_result);
+    }
+    outbuf_ref(bin);
+    t->last_result = bin;
+
+    table_broadcast_bufs(t, bufs);
+    table_publish(t, PROTO_OP_RESULT, payload, len);
+}
+
+/*
+ * table_publish:
+ *   Hand a message to the table's spectators, if it may have any: one
+ *   copy into the lobby's feed, however many are watching (fanout.h).
+ */
+static void table_publish(Table *t, uint8_t op, const void *payload, size_t len)
+{
+    FanoutFeed *feed = t->lobby->feed;
+    if (feed && fanout_watched(feed, t->id))
+    {
+        fanout_publish(feed, t->id, op, payload, len);
+    }
+}
+
+/* table_tell: an INFO line for spectators only, formatted only if watched. */
+static void table_tell(Table *t, const char *fmt, ...)
+{
+    FanoutFeed *feed = t->lobby->feed;
+    if (!feed || !fanout_watched(feed, t->id))
+    {
+        return;
+    }
+    char text[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        size_t len = ((size_t)n < sizeof(text)) ? (size_t)n : sizeof(text) - 1;
+        fanout_publish(feed, t->id, PROTO_OP_INFO, text, len);
+    }
+}
@@ -0,0 +1,323 @@
+/******************************************************************************
+ * table.h
+ *
+ * Tables and the lobby/matchmaker.
+ *
+ *   - A Table is one game of numPlayers seats. It is a small state machine
+ *     (FORMING -> PLAYING -> closed) that keeps its moves[], scores[], seats
+ *     and round counter packed in its first cache lines; what a round does
+ *     not touch (session tokens, timestamps, the grace timer) lives apart
+ *     in its TableCold, so thousands of tables stay cheap.
+ *   - Conns, Tables, TableColds and input buffers come from per-lobby slabs
+ *     (slab.h), so joins and leaves reuse memory instead of calling malloc.
+ *     A Conn only holds an input buffer while it has unparsed bytes.
+ *   - The Lobby owns the listening socket. Every new player is
+ *     seated at the table that is currently forming; once that table is
+ *     full it starts playing and a new table begins to form.
+ *   - All tables share one Reactor; nothing blocks, so one process on one
+ *     port can run many concurrent games.
+ *   - A player is seated on their first command (or JOIN), not at accept,
+ *     so a reconnecting player can resume instead of taking a new seat.
+ *   - Framed players get a session token. If one drops out of a playing
+ *     table, the seat, moves[] and scores[] are kept for grace_ms and a
+ *     JOIN with the token takes the seat back; only when the grace period
+ *     runs out does the game end for everyone.
+ *   - With an event ring (events), joins, moves, results, resets and so on
+ *     are also recorded for the durable event log (evlog.h).
+ *   - With a score ring (scores), players who join under a player id have
+ *     every round they finish recorded in the persistent score store
+ *     (scores.h), from the shard that seats them. The id stays with the
+ *     seat, so it survives a resume.
+ *   - With a spectator feed (feed), every message the players of a watched
+ *     table get, and a line for each change of the table's state, is
+ *     also published once for the fan-out threads (fanout.h).
+ *   - Hot-path events are counted in the lobby's Metrics (metrics.h);
+ *     per-move console lines are off unless log_moves is set, and then
+ *     capped at LOBBY_LOG_RATE lines a second.
+ *   - Every frame from the network is checked before any table sees it, at
+ *     a constant cost per frame: a move the seat can still make is free,
+ *     anything else spends a token from the connection's bucket
+ *     (frame_rate a second, up to frame_burst saved), and frames that
+ *     cannot do anything (a malformed or second move in the round, a
+ *     second RESET from the seat in the round, an unknown command) are
+ *     dropped. A connection that runs out of tokens,
+ *     or has more than LOBBY_STRIKE_LIMIT of its last 64 frames dropped,
+ *     is disconnected.
+ *   - With a move deadline (move_timeout_ms), a round resolves that long
+ *     after its first move even if some players have not moved: missing
+ *     moves are forfeits. Deadlines live on the reactor's timer wheel.
+ *   - With a TLS context (tls), an accepted connection completes its
+ *     handshake before its first frame is read; see tls.h.
+ *   - Accepted connections get the lobby's socket options (sock), if set.
+ *   - With a UDP endpoint (udp, home lobby only), players can also come in
+ *     over UDP (dgram.h); their Conns have no socket of their own.
+ *   - A seat need not be a socket at all: in-process players (the server's
+ *     console, bots; see seat.h) are Conns with SeatOps that get every
+ *     message as it is sent, and play by feeding frames to conn_input().
+ *     With bot_seats, every new table starts with that many bots seated;
+ *     they play bot_strategy (bot.h).
+ *   - For a hot restart (restart.h), a lobby can be paused (no accepts, its
+ *     io_uring streams drained), saved into a RestartImage, and its tables
+ *     restored in another process with the same sockets. Players who
+ *     cannot move with their socket (TLS, UDP, the console) are restored
+ *     as away, and resume with their session tokens like dropped players.
+ ******************************************************************************/
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdint.h>
+
+#include "evlog.h"
+#include "fanout.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "outbuf.h"
+#include "proto.h"
+#include "reactor.h"
+#include "restart.h"
+#include "rules.h"
+#include "scores.h"
+#include "slab.h"
+#include "sockopt.h"
+#include "tls.h"
+
+#define BUF_SIZE 1024
+#define LOBBY_GRACE_MS 30000 /* default time a dropped player may resume */
+#define LOBBY_MOVE_TIMEOUT_MS 0 /* default move deadline (0 = wait forever) */
+#define LOBBY_LOG_RATE 100     /* per-move log lines per second, at most */
+#define LOBBY_FRAME_RATE 100   /* default frames a second a player may send besides moves */
+#define LOBBY_FRAME_BURST 200  /* and how many may be saved up */
+#define LOBBY_STRIKE_LIMIT 16  /* rejected frames among a player's last 64 before a drop */
+
+typedef struct table Table;
+typedef struct lobby Lobby;
+typedef struct dgram Dgram;
+typedef struct udp_peer UdpPeer;
+typedef struct conn Conn;
+struct bot_strategy;
+
+/*
+ * What drives an in-process seat. Its Conn speaks the framed protocol and
+ * has no output queue: deliver() sees each message right away, in the
+ * middle of whatever the table is doing, so it must not feed input back
+ * from there (arm a timer instead).
+ */
+typedef struct
+{
+    const char *kind;                               /* for log lines */
+    int quiet;                                      /* no per-seat log lines */
+    void (*deliver)(void *arg, const OutBuf *b);    /* one framed message */
+    void (*close)(void *arg);                       /* the Conn is being freed */
+} SeatOps;
+
+/* One player's connection. */
+struct conn
+{
+    int fd;   /* -1 for a UDP or in-process player */
+    int seat; /* index into table->seats[] */
+    Table *table;
+    Lobby *lobby;
+    TlsConn *tls;         /* TLS state, or NULL for a cleartext listener */
+    uint8_t tls_ready;    /* handshake complete */
+    uint8_t stream;       /* completion I/O on an io_uring reactor (reactor_stream) */
+    UdpPeer *udp;         /* UDP transport state, or NULL for TCP */
+    const SeatOps *ops;   /* in-process seat, or NULL for a network player */
+    void *ops_arg;
+    ProtoParser *in;      /* unparsed input (from the lobby's slab), or NULL */
+    uint8_t mode;         /* ProtoMode the peer speaks */
+    OutQueue outq;        /* references to messages not yet written */
+    MpscNode qnode;       /* link while being handed to another shard */
+    uint8_t carried_move; /* move made at the old shard's forming table */
+    uint32_t resume_table; /* JOIN token being routed to its shard, or 0 */
+    uint64_t resume_nonce;
+    char player[SCORES_NAME_MAX]; /* player id from JOIN "@<id>", "" = unranked */
+    long long tokens;     /* frame_rate bucket, in thousandths of a frame */
+    long long tokens_ms;  /* when it was last refilled */
+    uint64_t strikes;     /* the last 64 frames checked, newest in bit 0: 1 = rejected */
+    uint32_t reset_table; /* where its last admitted RESET went, 0 = none */
+    uint32_t reset_round; /* and in which round */
+};
+
+typedef enum
+{
+    TABLE_FORMING, /* waiting for seats to fill */
+    TABLE_PLAYING
+} TableState;
+
+/* A table's state that moves and round resolution do not need. */
+typedef struct
+{
+    uint64_t session[MAX_PLAYERS]; /* per-seat resume token, 0 = none */
+    uint64_t player[MAX_PLAYERS];  /* per-seat score store id, 0 = unranked */
+    long long away_since[MAX_PLAYERS];
+    long long moved_at_us[MAX_PLAYERS]; /* when each move arrived (latency) */
+    Timer grace_timer;            /* earliest away seat's grace deadline */
+} TableCold;
+
+struct table
+{
+    /* hot: every move and every round */
+    uint32_t id;
+    uint32_t round;
+    uint8_t numPlayers;
+    uint8_t seated;
+    uint8_t moves_received;
+    uint8_t state;                /* TableState */
+    uint16_t away;                /* seats waiting to be resumed (bit mask) */
+    uint8_t moves[MAX_PLAYERS];   /* Move values, MOVE_INVALID = none yet */
+    int32_t scores[MAX_PLAYERS];
+    Conn *seats[MAX_PLAYERS];     /* NULL while that player is away */
+    OutBuf *last_result;          /* resent to players who resume */
+    Lobby *lobby;
+    Timer move_timer;             /* round deadline, armed by the first move */
+
+    /* cold */
+    TableCold *cold;
+    Table *prev, *next; /* lobby's list of live tables */
+};
+
+struct lobby
+{
+    Reactor *reactor;
+    int listen_fd;
+    int numPlayers;    /* seats per table */
+    uint32_t next_table_id;
+    uint32_t table_id_step; /* keeps ids unique across shards */
+    Table *forming;    /* table currently accepting players, or NULL */
+    long long forming_since_ms; /* when forming got its first player */
+    Table *tables;     /* all live tables */
+    int live_tables;
+    int playing_tables;
+    int connections;
+    OutPool pool;      /* output buffers for this lobby's thread */
+    Slab conns;        /* Conn */
+    Slab table_hot;    /* Table */
+    Slab table_cold;   /* TableCold */
+    Slab inputs;       /* ProtoParser: input buffers */
+    int grace_ms;      /* how long an away seat is kept (0 = not at all) */
+    int move_timeout_ms; /* round deadline after its first move (0 = none) */
+    int frame_rate;    /* per-connection frame budget a second (0 = no limit) */
+    int frame_burst;
+    int log_moves;     /* print every move and round result (rate-limited) */
+    long long log_window_ms;
+    int log_lines;     /* lines printed in the current one-second window */
+    long log_suppressed;
+    Metrics metrics;   /* written only by this lobby's thread */
+    EvRing *events;    /* this thread's event log ring, or NULL */
+    ScoreRing *scores; /* this thread's score store ring, or NULL */
+    FanoutFeed *feed;  /* this thread's spectator feed, or NULL */
+    TlsCtx *tls;       /* accepted connections speak TLS (shared), or NULL */
+    Dgram *udp;        /* UDP endpoint, or NULL */
+    const SockProfile *sock; /* options for accepted connections, or NULL */
+    int bot_seats;     /* bots seated at every new table (< numPlayers) */
+    const struct bot_strategy *bot_strategy; /* how they play; NULL = uniform */
+    int bot_think_ms;  /* how long after a round starts a bot moves */
+    int paused;        /* lobby_pause(): nothing new is accepted or streamed */
+
+    /*
+     * Hand a connection whose session lives on another lobby (shard index
+     * owner) over to it. Unset means there is no other lobby.
+     */
+    void (*route)(void *arg, Conn *c, int owner);
+    void *route_arg;
+};
+
+/*
+ * lobby_init:
+ *   Register the (listening) server socket with the reactor. Accepted
+ *   connections are grouped into tables of numPlayers.
+ *   Returns 0 on success, -1 on error.
+ */
+int lobby_init(Lobby *l, Reactor *r, int listen_fd, int numPlayers);
+
+/* lobby_shutdown: close every table and connection, and the listener. */
+void lobby_shutdown(Lobby *l);
+
+/*
+ * lobby_adopt:
+ *   Register a connection from another lobby with this lobby's reactor.
+ *   A connection with a resume_table takes its session's seat back;
+ *   otherwise it is seated at the forming table and c->carried_move is
+ *   replayed as its first move.
+ *   On failure the connection is closed and freed. Returns 0 or -1.
+ */
+int lobby_adopt(Lobby *l, Conn *c);
+
+/*
+ * lobby_release_forming:
+ *   Detach every player waiting at the forming table (without closing
+ *   them) so they can be adopted by another lobby, and drop the table.
+ *   Up to max connections are stored in out[]. Returns how many.
+ */
+int lobby_release_forming(Lobby *l, Conn **out, int max);
+
+/*
+ * lobby_pause:
+ *   Stop taking connections and pause every io_uring stream, ahead of a
+ *   hot restart. Keep polling until lobby_busy() is 0, so the bytes the
+ *   kernel already received are handled here.
+ */
+void lobby_pause(Lobby *l);
+
+/* lobby_busy: whether a paused stream still has I/O with the kernel. */
+int lobby_busy(const Lobby *l);
+
+/* lobby_unpause: undo lobby_pause (the hot restart did not happen). */
+void lobby_unpause(Lobby *l);
+
+/*
+ * lobby_save:
+ *   Append a RESTART_REC_TABLE record for every table of l in state, with
+ *   its players' sockets, to im. Nothing in l changes. Returns the number
+ *   of tables, or -1 if out of memory.
+ */
+int lobby_save(Lobby *l, TableState state, RestartImage *im);
+
+/*
+ * lobby_restore:
+ *   Rebuild the table rt (whose seats and last RESULT follow in im) in l.
+ *   A playing table keeps its id, round, moves, scores and move deadline;
+ *   a forming table's players are seated again, here, with their moves.
+ *   Returns 0, or -1 if im is malformed.
+ */
+int lobby_restore(Lobby *l, const RestartTable *rt, RestartImage *im);
+
+/*
+ * table_open_seat:
+ *   Put an in-process player in empty seat i of a table being restored.
+ *   As with lobby_open_seat, arg belongs to the seat from here on.
+ */
+Conn *table_open_seat(Table *t, int i, const SeatOps *ops, void *arg);
+
+/*
+ * lobby_open_seat:
+ *   Seat an in-process player at the forming table. arg belongs to the
+ *   seat from here on: ops->close(arg) runs when its Conn is freed, or
+ *   right away if it cannot be seated (then this returns NULL).
+ */
+Conn *lobby_open_seat(Lobby *l, const SeatOps *ops, void *arg);
+
+/*
+ * conn_command:
+ *   A command (PROTO_OP_MOVE, _RESET, _QUIT) from an in-process seat,
+ *   handled as if its frame had arrived. Returns -1 if c is gone.
+ */
+int conn_command(Conn *c, uint8_t op, const void *payload, size_t len);
+
+/* The UDP endpoint's side of a Conn (see dgram.h) */
+
+/* lobby_open_udp: a Conn for a new UDP player; NULL if out of memory. */
+Conn *lobby_open_udp(Lobby *l, UdpPeer *p);
+
+/*
+ * conn_input:
+ *   Whole frames for c from a transport without a socket of its own (one
+ *   UDP datagram, or an in-process seat's command). Returns -1 if c is
+ *   gone (closed, its peer or seat freed), 0 otherwise.
+ */
+int conn_input(Conn *c, const uint8_t *data, size_t len);
+
+/* conn_drop: c's transport lost it, as if its socket had hung up. */
+void conn_drop(Conn *c);
+
+#endif /* TABLE_H */
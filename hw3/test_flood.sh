@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# test_flood.sh - flood protection: a player who floods RESET is dropped
+# once its second and later RESETs in a round fill the strike window,
+# well before its token bucket runs out.
+#
+# Run from hw3 after make:  make test
+#
+
+PORT=$((20000 + $$ % 20000))
+ADMIN=$((PORT + 1))
+dir=$(mktemp -d)
+trap 'kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+
+./spock_server --admin-port $ADMIN $PORT 2 > "$dir/server.out" 2>&1 &
+server=$!
+for i in $(seq 20); do
+    { exec 3<> /dev/tcp/127.0.0.1/$PORT; } 2> /dev/null && break
+    sleep 0.1
+done
+
+# 64 RESETs in one go: far fewer than the default burst of 200 frames.
+# The server may hang up before it has read them all.
+trap '' PIPE
+for i in $(seq 64); do
+    printf 'RESET\n'
+done >&3 2> /dev/null
+
+# the server must hang up on us (EOF or a reset, not a timeout)
+timeout 5 cat <&3 > /dev/null 2>&1
+if [ $? -eq 124 ]; then
+    echo "FAIL: the connection flooding RESET was not dropped"
+    exit 1
+fi
+exec 3<&-
+
+exec 4<> /dev/tcp/127.0.0.1/$ADMIN
+printf 'GET /metrics HTTP/1.0\r\n\r\n' >&4
+metrics=$(timeout 5 cat <&4)
+abuse=$(printf '%s\n' "$metrics" | sed -n 's/^spock_abuse_drops_total \([0-9]*\).*/\1/p')
+limited=$(printf '%s\n' "$metrics" | sed -n 's/^spock_rate_limited_total \([0-9]*\).*/\1/p')
+rejected=$(printf '%s\n' "$metrics" | sed -n 's/^spock_frames_rejected_total \([0-9]*\).*/\1/p')
+if [ "$abuse" != 1 ] || [ "$limited" != 0 ]; then
+    echo "FAIL: want one abuse drop and no rate limit, got abuse=$abuse rate_limited=$limited"
+    cat "$dir/server.out"
+    exit 1
+fi
+echo "PASS: a RESET flood was dropped after $rejected rejected RESETs"
@@ -0,0 +1,221 @@
+/******************************************************************************
+ * timer.c
+ *
+ * Hierarchical timing wheel (see timer.h).
+ *
+ * A timer is placed by its distance from the wheel's current time: level L
+ * holds timers due within TIMER_SLOTS^(L+1) ms, in the slot selected by
+ * bits [L*TIMER_SLOT_BITS, (L+1)*TIMER_SLOT_BITS) of its deadline. When
+ * level 0 wraps around, the next level's current slot is re-filed into
+ * the levels below it.
+ ******************************************************************************/
+#include <string.h>
+
+#include "timer.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_SLOT_BITS)
+#define MAX_DELTA ((1LL << LEVEL_SHIFT(TIMER_LEVELS)) - 1)
+
+static void link_timer(TimerWheel *w, Timer *t);
+static void unlink_timer(TimerWheel *w, Timer *t);
+static void cascade(TimerWheel *w);
+static uint64_t rotate_right(uint64_t v, int n);
+
+void timer_wheel_init(TimerWheel *w, long long now_ms)
+{
+    memset(w, 0, sizeof(*w));
+    w->now = now_ms;
+}
+
+void timer_init(Timer *t, timer_cb cb, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+void timer_arm(TimerWheel *w, Timer *t, long long expires_ms)
+{
+    if (timer_armed(t))
+    {
+        unlink_timer(w, t);
+    }
+    t->expires = expires_ms;
+    link_timer(w, t);
+}
+
+void timer_cancel(TimerWheel *w, Timer *t)
+{
+    if (timer_armed(t))
+    {
+        unlink_timer(w, t);
+    }
+}
+
+/* link_timer: file t into the slot its deadline falls in. */
+static void link_timer(TimerWheel *w, Timer *t)
+{
+    long long expires = t->expires;
+    long long delta = expires - w->now;
+
+    if (delta < 0)
+    {
+        // already due: the slot being processed next
+        expires = w->now;
+        delta = 0;
+    }
+    else if (delta > MAX_DELTA)
+    {
+        // beyond the wheel: park at the far end; cascading re-files it
+        expires = w->now + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1LL << LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+    int slot = (expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+
+    Timer **head = &w->slots[level][slot];
+    t->next = *head;
+    if (t->next)
+    {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)slot;
+    w->occupied[level] |= 1ULL << slot;
+}
+
+static void unlink_timer(TimerWheel *w, Timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+    {
+        t->next->pprev = t->pprev;
+    }
+    if (!w->slots[t->level][t->slot])
+    {
+        w->occupied[t->level] &= ~(1ULL << t->slot);
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/* cascade: level 0 wrapped; re-file the current slot of each level above. */
+static void cascade(TimerWheel *w)
+{
+    for (int level = 1; level < TIMER_LEVELS; level++)
+    {
+        int idx = (w->now >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        Timer *t = w->slots[level][idx];
+        w->slots[level][idx] = NULL;
+        w->occupied[level] &= ~(1ULL << idx);
+        while (t)
+        {
+            Timer *next = t->next;
+            link_timer(w, t);
+            t = next;
+        }
+        if (idx != 0)
+        {
+            break; // this level did not wrap, so the ones above did not either
+        }
+    }
+}
+
+void timer_wheel_advance(TimerWheel *w, long long now_ms)
+{
+    while (w->now <= now_ms)
+    {
+        int idx = w->now & SLOT_MASK;
+        if (idx == 0)
+        {
+            cascade(w);
+        }
+
+        uint64_t ahead = w->occupied[0] >> idx;
+        if (!ahead)
+        {
+            // nothing left in this turn of level 0: jump to the next one
+            long long next = (w->now | SLOT_MASK) + 1;
+            w->now = (next <= now_ms) ? next : now_ms + 1;
+            continue;
+        }
+        int skip = __builtin_ctzll(ahead);
+        if (skip > 0)
+        {
+            // never move past now_ms, or timers armed later would fire early
+            w->now = (w->now + skip <= now_ms) ? w->now + skip : now_ms + 1;
+            continue;
+        }
+
+        /* callbacks may arm or cancel timers, including in this slot */
+        Timer *t;
+        while ((t = w->slots[0][idx]) != NULL)
+        {
+            unlink_timer(w, t);
+            t->cb(t, t->arg);
+        }
+        w->now++;
+    }
+}
+
+static uint64_t rotate_right(uint64_t v, int n)
+{
+    return n ? (v >> n) | (v << (64 - n)) : v;
+}
+
+int timer_wheel_timeout(const TimerWheel *w, long long now_ms)
+{
+    long long best = -1;
+
+    for (int level = 0; level < TIMER_LEVELS; level++)
+    {
+        if (!w->occupied[level])
+        {
+            continue;
+        }
+        int shift = LEVEL_SHIFT(level);
+        int idx = (w->now >> shift) & SLOT_MASK;
+        uint64_t ahead = rotate_right(w->occupied[level], idx);
+
+        long long when;
+        if (level == 0)
+        {
+            when = w->now + __builtin_ctzll(ahead);
+        }
+        else
+        {
+            // the current slot was already cascaded, unless we are exactly
+            // at the boundary where that is about to happen
+            int aligned = (w->now & ((1LL << shift) - 1)) == 0;
+            if (!aligned)
+            {
+                ahead &= ~1ULL;
+            }
+            int k = ahead ? __builtin_ctzll(ahead) : TIMER_SLOTS;
+            when = ((w->now >> shift) + k) << shift;
+        }
+        if (best < 0 || when < best)
+        {
+            best = when;
+        }
+    }
+
+    if (best < 0)
+    {
+        return -1;
+    }
+    long long left = best - now_ms;
+    if (left <= 0)
+    {
+        return 0;
+    }
+    return left > 0x7FFFFFFF ? 0x7FFFFFFF : (int)left;
+}
@@ -0,0 +1,76 @@
+/******************************************************************************
+ * timer.h
+ *
+ * Hierarchical timing wheel used by the reactor for deadlines.
+ *
+ *   - TIMER_LEVELS wheels of TIMER_SLOTS slots each; level 0 has 1 ms
+ *     slots, every higher level's slots are TIMER_SLOTS times wider, so
+ *     four levels cover about 4.6 hours (later deadlines are clamped).
+ *   - Timers are intrusive (embed a Timer in the owning object), so arming,
+ *     cancelling and expiring are all O(1) and never allocate.
+ *   - A timer in a higher level is moved down ("cascaded") when its slot
+ *     comes up, at most TIMER_LEVELS - 1 times over its life.
+ *   - One bitmap of occupied slots per level gives the next deadline
+ *     without walking empty slots, which is what the event loop sleeps on.
+ *   - Not thread-safe: a wheel belongs to one event loop.
+ ******************************************************************************/
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+typedef struct timer Timer;
+
+/* Called once when the timer expires; it may re-arm the timer. */
+typedef void (*timer_cb)(Timer *t, void *arg);
+
+struct timer
+{
+    Timer *next;
+    Timer **pprev; /* NULL while not armed */
+    long long expires; /* absolute, in reactor_now_ms() milliseconds */
+    timer_cb cb;
+    void *arg;
+    uint8_t level, slot;
+};
+
+typedef struct
+{
+    long long now; /* next millisecond to process */
+    uint64_t occupied[TIMER_LEVELS]; /* bit s set if slots[level][s] != NULL */
+    Timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *w, long long now_ms);
+
+/* timer_init: set up a timer that is not armed yet. */
+void timer_init(Timer *t, timer_cb cb, void *arg);
+
+/* timer_arm: (re)arm t to fire at expires_ms. A past deadline fires next. */
+void timer_arm(TimerWheel *w, Timer *t, long long expires_ms);
+
+/* timer_cancel: disarm t; a no-op if it is not armed. */
+void timer_cancel(TimerWheel *w, Timer *t);
+
+static inline int timer_armed(const Timer *t)
+{
+    return t->pprev != NULL;
+}
+
+/*
+ * timer_wheel_timeout:
+ *   Milliseconds the loop may sleep before the wheel needs attention
+ *   (0 if a timer is already due), or -1 if no timer is armed. Deadlines
+ *   in the higher levels report when their slot is cascaded, which is
+ *   never later than the deadline itself.
+ */
+int timer_wheel_timeout(const TimerWheel *w, long long now_ms);
+
+/* timer_wheel_advance: fire every timer whose deadline is <= now_ms. */
+void timer_wheel_advance(TimerWheel *w, long long now_ms);
+
+#endif /* TIMER_H */
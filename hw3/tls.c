@@ -0,0 +1,399 @@
+/******************************************************************************
+ * tls.c
+ *
+ * OpenSSL-backed TLS layer (see tls.h).
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include "tls.h"
+
+struct tls_ctx
+{
+    SSL_CTX *ssl;
+    int server;
+    pthread_mutex_t lock; /* guards session */
+    SSL_SESSION *session; /* client: latest session, offered on reconnect */
+};
+
+struct tls_conn
+{
+    SSL *ssl;
+    TlsCtx *ctx;
+    int fd;
+    int want_write; /* the handshake waits for writability */
+    int done;       /* handshake complete */
+    int failed;     /* fatal error: no close_notify */
+    int ktls_send;
+};
+
+static SSL_CTX *new_ssl_ctx(const SSL_METHOD *method, TlsCtx *owner);
+static int on_new_session(SSL *ssl, SSL_SESSION *session);
+static void report(const char *what);
+static int is_ip_literal(const char *host);
+
+TlsCtx *tls_server_ctx(const char *cert_file, const char *key_file)
+{
+    TlsCtx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+    {
+        return NULL;
+    }
+    ctx->server = 1;
+    pthread_mutex_init(&ctx->lock, NULL);
+    if (!(ctx->ssl = new_ssl_ctx(TLS_server_method(), ctx)))
+    {
+        tls_ctx_free(ctx);
+        return NULL;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx->ssl, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx->ssl, key_file ? key_file : cert_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx->ssl) != 1)
+    {
+        report(cert_file);
+        tls_ctx_free(ctx);
+        return NULL;
+    }
+
+    /* resumption: tickets (TLS 1.3 and 1.2) and the session-id cache (1.2) */
+    static const unsigned char sid_ctx[] = "spock";
+    SSL_CTX_set_session_id_context(ctx->ssl, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx->ssl, SSL_SESS_CACHE_SERVER);
+    return ctx;
+}
+
+TlsCtx *tls_client_ctx(const char *ca_file)
+{
+    TlsCtx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    if (!(ctx->ssl = new_ssl_ctx(TLS_client_method(), ctx)))
+    {
+        tls_ctx_free(ctx);
+        return NULL;
+    }
+    int ok = ca_file ? SSL_CTX_load_verify_locations(ctx->ssl, ca_file, NULL)
+                     : SSL_CTX_set_default_verify_paths(ctx->ssl);
+    if (ok != 1)
+    {
+        report(ca_file ? ca_file : "system CAs");
+        tls_ctx_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_verify(ctx->ssl, SSL_VERIFY_PEER, NULL);
+
+    /* keep only the latest session ourselves, for the next connect */
+    SSL_CTX_set_session_cache_mode(ctx->ssl, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx->ssl, on_new_session);
+    return ctx;
+}
+
+static SSL_CTX *new_ssl_ctx(const SSL_METHOD *method, TlsCtx *owner)
+{
+    SSL_CTX *ssl = SSL_CTX_new(method);
+    if (!ssl)
+    {
+        report("SSL_CTX_new");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ssl, TLS1_2_VERSION);
+    SSL_CTX_set_app_data(ssl, owner);
+
+    /*
+     * PARTIAL_WRITE + MOVING_WRITE_BUFFER: tls_sendv() may be retried with
+     * a re-gathered (longer) buffer, as an OutQueue does after EAGAIN.
+     * RELEASE_BUFFERS: idle connections don't hold 2 x 16 KiB each.
+     */
+    SSL_CTX_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+    long opts = SSL_OP_IGNORE_UNEXPECTED_EOF; // a dropped player is not an attack
+#ifdef SSL_OP_ENABLE_KTLS
+    opts |= SSL_OP_ENABLE_KTLS;
+#endif
+    SSL_CTX_set_options(ssl, opts);
+    return ssl;
+}
+
+void tls_ctx_free(TlsCtx *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+    if (ctx->session)
+    {
+        SSL_SESSION_free(ctx->session);
+    }
+    if (ctx->ssl)
+    {
+        SSL_CTX_free(ctx->ssl);
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+/*
+ * on_new_session:
+ *   A client got a (new) session ticket; keep a copy. Not the session
+ *   itself: OpenSSL marks that unresumable if the connection then dies
+ *   without close_notify, which is exactly when we want to resume it.
+ */
+static int on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    TlsCtx *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    SSL_SESSION *copy = SSL_SESSION_dup(session);
+    if (!copy)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->session)
+    {
+        SSL_SESSION_free(ctx->session);
+    }
+    ctx->session = copy;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0; // session is still OpenSSL's
+}
+
+TlsConn *tls_conn_new(TlsCtx *ctx, int fd, const char *host)
+{
+    TlsConn *t = calloc(1, sizeof(*t));
+    if (!t || !(t->ssl = SSL_new(ctx->ssl)) || SSL_set_fd(t->ssl, fd) != 1)
+    {
+        report("SSL_new");
+        if (t && t->ssl)
+            SSL_free(t->ssl);
+        free(t);
+        return NULL;
+    }
+    t->ctx = ctx;
+    t->fd = fd;
+
+    if (ctx->server)
+    {
+        SSL_set_accept_state(t->ssl);
+        return t;
+    }
+    SSL_set_connect_state(t->ssl);
+    if (host && is_ip_literal(host))
+    {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(t->ssl), host);
+    }
+    else if (host)
+    {
+        SSL_set_tlsext_host_name(t->ssl, host);
+        SSL_set1_host(t->ssl, host);
+    }
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->session)
+    {
+        SSL_set_session(t->ssl, ctx->session);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return t;
+}
+
+void tls_conn_free(TlsConn *t)
+{
+    if (!t)
+    {
+        return;
+    }
+    if (t->done && !t->failed)
+    {
+        SSL_shutdown(t->ssl); // one non-blocking attempt at close_notify
+    }
+    SSL_free(t->ssl);
+    free(t);
+}
+
+int tls_handshake(TlsConn *t)
+{
+    if (t->done)
+    {
+        return 1;
+    }
+    ERR_clear_error();
+    int r = SSL_do_handshake(t->ssl);
+    if (r == 1)
+    {
+        t->done = 1;
+#ifdef BIO_get_ktls_send
+        t->ktls_send = BIO_get_ktls_send(SSL_get_wbio(t->ssl)) > 0;
+#endif
+        return 1;
+    }
+    switch (SSL_get_error(t->ssl, r))
+    {
+    case SSL_ERROR_WANT_READ:
+        t->want_write = 0;
+        return 0;
+    case SSL_ERROR_WANT_WRITE:
+        t->want_write = 1;
+        return 0;
+    default:
+        t->failed = 1;
+        report("TLS handshake");
+        return -1;
+    }
+}
+
+int tls_wants_write(const TlsConn *t)
+{
+    return t->want_write;
+}
+
+/* map a failed SSL_read/SSL_write onto recv()/send() conventions */
+static ssize_t io_error(TlsConn *t, int r)
+{
+    int err = SSL_get_error(t->ssl, r);
+    switch (err)
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0; // close_notify
+    case SSL_ERROR_SYSCALL:
+        t->failed = 1;
+        if (errno == 0)
+            return 0; // EOF without close_notify
+        return -1;
+    default:
+        t->failed = 1;
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+ssize_t tls_recv(TlsConn *t, void *buf, size_t len)
+{
+    ERR_clear_error();
+    errno = 0;
+    int r = SSL_read(t->ssl, buf, len > 0x7FFFFFFF ? 0x7FFFFFFF : (int)len);
+    return r > 0 ? r : io_error(t, r);
+}
+
+ssize_t tls_sendv(TlsConn *t, const struct iovec *iov, int iovcnt)
+{
+    if (t->ktls_send)
+    {
+        struct msghdr msg = {0};
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = iovcnt;
+        return sendmsg(t->fd, &msg, MSG_NOSIGNAL);
+    }
+
+    /* gather small messages into full records instead of one record each */
+    unsigned char rec[TLS_RECORD_SIZE];
+    ssize_t total = 0;
+    int i = 0;
+    size_t off = 0;
+    while (i < iovcnt)
+    {
+        size_t fill = 0;
+        while (i < iovcnt && fill < sizeof(rec))
+        {
+            size_t take = iov[i].iov_len - off;
+            if (take > sizeof(rec) - fill)
+                take = sizeof(rec) - fill;
+            memcpy(rec + fill, (const char *)iov[i].iov_base + off, take);
+            fill += take;
+            off += take;
+            if (off == iov[i].iov_len)
+            {
+                i++;
+                off = 0;
+            }
+        }
+        if (fill == 0)
+        {
+            break;
+        }
+        ERR_clear_error();
+        errno = 0;
+        int r = SSL_write(t->ssl, rec, (int)fill);
+        if (r <= 0)
+        {
+            ssize_t rc = io_error(t, r);
+            if (total > 0 && rc < 0 && errno == EAGAIN)
+                return total;
+            return rc == 0 ? (errno = EPIPE, -1) : rc;
+        }
+        total += r;
+        if ((size_t)r < fill)
+        {
+            break; // partial: the caller resumes from total
+        }
+    }
+    return total;
+}
+
+ssize_t tls_send(TlsConn *t, const void *buf, size_t len)
+{
+    struct iovec iov = {(void *)buf, len};
+    return tls_sendv(t, &iov, 1);
+}
+
+int tls_shutdown(TlsConn *t)
+{
+    ERR_clear_error();
+    return SSL_shutdown(t->ssl) < 0 ? -1 : 0;
+}
+
+int tls_pending(const TlsConn *t)
+{
+    return SSL_pending(t->ssl) > 0;
+}
+
+int tls_resumed(const TlsConn *t)
+{
+    return SSL_session_reused(t->ssl);
+}
+
+int tls_ktls_send(const TlsConn *t)
+{
+    return t->ktls_send;
+}
+
+const char *tls_describe(const TlsConn *t, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s %s%s%s", SSL_get_version(t->ssl), SSL_get_cipher_name(t->ssl),
+             tls_resumed(t) ? ", resumed" : "", t->ktls_send ? ", kTLS send" : "");
+    return buf;
+}
+
+static void report(const char *what)
+{
+    unsigned long e = ERR_get_error();
+    char reason[256];
+    if (e)
+    {
+        ERR_error_string_n(e, reason, sizeof(reason));
+    }
+    else
+    {
+        snprintf(reason, sizeof(reason), "%s", errno ? strerror(errno) : "connection closed");
+    }
+    fprintf(stderr, "%s: %s\n", what, reason);
+    ERR_clear_error();
+}
+
+static int is_ip_literal(const char *host)
+{
+    unsigned char addr[16];
+    return inet_pton(AF_INET, host, addr) == 1 || inet_pton(AF_INET6, host, addr) == 1;
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ * tls.h
+ *
+ * Optional TLS for spock_server/spock_client (and speak/speakd), on OpenSSL.
+ *
+ *   - A TlsCtx holds the configuration: the server's certificate and key,
+ *     or the CAs a client trusts. It is shared by every connection and
+ *     every shard thread.
+ *   - Reconnecting clients skip the full handshake: the server issues
+ *     session tickets (valid on every shard, they share the ticket keys),
+ *     and a client TlsCtx keeps its latest session for the next connect.
+ *   - Kernel TLS is requested on every connection. When the kernel takes
+ *     over the record encryption for sending (tls_ktls_send), writes can
+ *     go straight to the socket, so writev() of shared OutBufs and
+ *     sendfile() keep working; otherwise tls_sendv() encrypts in user
+ *     space. Reads always go through tls_recv().
+ *   - tls_recv()/tls_sendv() behave like recv()/sendmsg(): a non-blocking
+ *     socket that would block returns -1 with errno EAGAIN.
+ ******************************************************************************/
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define TLS_RECORD_SIZE 16384 /* plaintext gathered into one record, at most */
+
+typedef struct tls_ctx TlsCtx;
+typedef struct tls_conn TlsConn;
+
+/*
+ * tls_server_ctx:
+ *   Server configuration from a PEM certificate (chain) and private key;
+ *   key_file NULL = the key is in cert_file. NULL (reported) on error.
+ */
+TlsCtx *tls_server_ctx(const char *cert_file, const char *key_file);
+
+/*
+ * tls_client_ctx:
+ *   Client configuration trusting the CAs in ca_file (e.g. a self-signed
+ *   server certificate), or the system's CAs if ca_file is NULL.
+ */
+TlsCtx *tls_client_ctx(const char *ca_file);
+
+void tls_ctx_free(TlsCtx *ctx);
+
+/*
+ * tls_conn_new:
+ *   TLS state for the connected socket fd. A client connection verifies
+ *   that the server's certificate is for host (a name or IP literal) and
+ *   offers the context's saved session. NULL on error.
+ */
+TlsConn *tls_conn_new(TlsCtx *ctx, int fd, const char *host);
+
+/* tls_conn_free: send close_notify if possible and free (fd stays open). */
+void tls_conn_free(TlsConn *t);
+
+/*
+ * tls_handshake:
+ *   Advance the handshake. Returns 1 once it is done, 0 if it must wait
+ *   for the socket (tls_wants_write says for which direction), -1 if it
+ *   failed (reported). On a blocking socket it runs to completion.
+ */
+int tls_handshake(TlsConn *t);
+int tls_wants_write(const TlsConn *t);
+
+ssize_t tls_recv(TlsConn *t, void *buf, size_t len);
+ssize_t tls_sendv(TlsConn *t, const struct iovec *iov, int iovcnt);
+ssize_t tls_send(TlsConn *t, const void *buf, size_t len);
+
+/* tls_shutdown: send close_notify; the peer reads EOF, t can still receive. */
+int tls_shutdown(TlsConn *t);
+
+/* tls_pending: decrypted bytes are waiting inside t (poll won't say so). */
+int tls_pending(const TlsConn *t);
+
+/* tls_resumed: the handshake resumed an earlier session. */
+int tls_resumed(const TlsConn *t);
+
+/* tls_ktls_send: the kernel encrypts what is written to the fd directly. */
+int tls_ktls_send(const TlsConn *t);
+
+/* tls_describe: e.g. "TLSv1.3 TLS_AES_256_GCM_SHA384, resumed, kTLS send" */
+const char *tls_describe(const TlsConn *t, char *buf, size_t size);
+
+#endif /* TLS_H */
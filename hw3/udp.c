@@ -0,0 +1,171 @@
+/******************************************************************************
+ * udp.c
+ *
+ * UDP transport wire format: headers, ack windows, RTT (see udp.h).
+ ******************************************************************************/
+#include "udp.h"
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void udp_write_header(uint8_t *out, const UdpHeader *h)
+{
+    out[0] = UDP_MAGIC;
+    out[1] = h->flags;
+    out[2] = 0;
+    out[3] = 0;
+    put32(out + 4, h->conn);
+    put32(out + 8, h->seq);
+    put32(out + 12, h->ack);
+    put32(out + 16, h->ack_bits);
+}
+
+int udp_read_header(const uint8_t *in, size_t len, UdpHeader *h)
+{
+    if (len < UDP_HEADER_SIZE || in[0] != UDP_MAGIC)
+    {
+        return -1;
+    }
+    h->flags = in[1];
+    h->conn = get32(in + 4);
+    h->seq = get32(in + 8);
+    h->ack = get32(in + 12);
+    h->ack_bits = get32(in + 16);
+    return h->conn ? 0 : -1;
+}
+
+int udp_window_mark(UdpWindow *w, uint32_t seq)
+{
+    if (seq == 0)
+    {
+        return 0;
+    }
+    if (w->max == 0 || seq > w->max)
+    {
+        uint32_t shift = w->max ? seq - w->max : 0;
+        w->bits = (shift == 0 || shift >= 64) ? 0 : w->bits << shift;
+        if (shift > 0 && shift <= 64)
+        {
+            w->bits |= 1ULL << (shift - 1); // the old max
+        }
+        w->max = seq;
+        return 1;
+    }
+    uint32_t behind = w->max - seq;
+    if (behind == 0 || behind > 64)
+    {
+        return 0;
+    }
+    uint64_t bit = 1ULL << (behind - 1);
+    if (w->bits & bit)
+    {
+        return 0;
+    }
+    w->bits |= bit;
+    return 1;
+}
+
+void udp_window_ack(const UdpWindow *w, UdpHeader *h)
+{
+    h->ack = w->max;
+    h->ack_bits = (uint32_t)w->bits;
+}
+
+int udp_acked(const UdpHeader *h, uint32_t seq)
+{
+    if (seq == 0 || seq > h->ack)
+    {
+        return 0;
+    }
+    uint32_t behind = h->ack - seq;
+    return behind == 0 || (behind <= 32 && (h->ack_bits & (1u << (behind - 1))));
+}
+
+int udp_reliable_op(uint8_t first_byte)
+{
+    switch (first_byte)
+    {
+    case PROTO_OP_MOVE:
+    case PROTO_OP_QUIT:
+    case PROTO_OP_RESET:
+    case PROTO_OP_RESULT:
+    case PROTO_OP_JOIN:
+    case PROTO_OP_SESSION:
+        return 1;
+    default:
+        return 0; // INFO
+    }
+}
+
+int udp_payload_reliable(const uint8_t *p, size_t n)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        if (p[i] == PROTO_MAGIC)
+        {
+            i++;
+            continue;
+        }
+        if (udp_reliable_op(p[i]))
+        {
+            return 1;
+        }
+        /* skip the frame: opcode, LEB128 length, payload */
+        uint32_t len = 0;
+        int shift = 0;
+        i++;
+        while (i < n && (p[i] & 0x80) && shift < 28)
+        {
+            len |= (uint32_t)(p[i++] & 0x7F) << shift;
+            shift += 7;
+        }
+        if (i >= n)
+        {
+            return 1; // malformed: be safe
+        }
+        len |= (uint32_t)(p[i++] & 0x7F) << shift;
+        i += len;
+    }
+    return 0;
+}
+
+void udp_rtt_init(UdpRtt *r)
+{
+    r->srtt_ms = 0;
+    r->rttvar_ms = 0;
+    r->rto_ms = UDP_RTO_INITIAL_MS;
+}
+
+void udp_rtt_sample(UdpRtt *r, long long ms)
+{
+    int m = ms < 1 ? 1 : (ms > UDP_RTO_MAX_MS ? UDP_RTO_MAX_MS : (int)ms);
+    if (r->srtt_ms == 0)
+    {
+        r->srtt_ms = m;
+        r->rttvar_ms = m / 2;
+    }
+    else
+    {
+        int err = r->srtt_ms > m ? r->srtt_ms - m : m - r->srtt_ms;
+        r->rttvar_ms = (3 * r->rttvar_ms + err) / 4;
+        r->srtt_ms = (7 * r->srtt_ms + m) / 8;
+    }
+    int rto = r->srtt_ms + 4 * r->rttvar_ms;
+    r->rto_ms = rto < UDP_RTO_MIN_MS ? UDP_RTO_MIN_MS : (rto > UDP_RTO_MAX_MS ? UDP_RTO_MAX_MS : rto);
+}
+
+void udp_rtt_backoff(UdpRtt *r)
+{
+    r->rto_ms = r->rto_ms * 2 > UDP_RTO_MAX_MS ? UDP_RTO_MAX_MS : r->rto_ms * 2;
+}
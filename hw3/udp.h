@@ -0,0 +1,123 @@
+/******************************************************************************
+ * udp.h
+ *
+ * Wire format of the UDP transport shared by spock_server (dgram.c) and
+ * spock_client (net.c).
+ *
+ *   - Every datagram starts with a UDP_HEADER_SIZE header:
+ *       [magic][flags][0][0][conn id: 4][seq: 4][ack: 4][ack bits: 4]
+ *     (big endian), followed by whole proto.h frames exactly as they would
+ *     go over TCP; a frame never spans two datagrams. Both ends speak the
+ *     framed protocol from the first datagram: there is no PROTO_MAGIC.
+ *   - The client picks a random, non-zero connection id and sets UDP_OPEN
+ *     until it hears back; the id, not the address, names the connection,
+ *     so a client whose NAT mapping changes keeps its seat.
+ *   - The server seats nobody whose address it has not heard back from:
+ *     until the connection is open every client datagram is UDP_COOKIE,
+ *     with UDP_COOKIE_SIZE bytes after the header, before the frames. The
+ *     first (a probe) carries zeros; the server answers UDP_CLOSE |
+ *     UDP_COOKIE with a cookie made from the source address, the
+ *     connection id, the time and a secret, without keeping any state,
+ *     and only a UDP_OPEN datagram that echoes a current cookie opens the
+ *     connection. A cookie answer is never larger than the datagram it
+ *     answers, so forged source addresses get the server nothing to
+ *     amplify.
+ *   - Each datagram carrying frames has its own sequence number (from 1);
+ *     0 marks a pure ack or ping. Every header acknowledges the highest
+ *     sequence number received (ack) and, in ack bits, which of the 32
+ *     before it arrived too, so one lost ack is repaired by the next.
+ *   - Only datagrams with a frame that matters to the game (MOVE, RESULT,
+ *     and JOIN, SESSION, RESET, QUIT) are UDP_RELIABLE: the receiver acks
+ *     them and the sender retransmits those alone, with the same sequence
+ *     number, after an RFC 6298 style timeout. INFO is sent once. The
+ *     receiver drops duplicates, so a frame is applied at most once, in
+ *     arrival order (there is no reordering buffer).
+ *   - UDP_PING asks for an ack (keepalive); UDP_CLOSE ends the connection,
+ *     or answers a datagram for a connection the server does not know.
+ ******************************************************************************/
+#ifndef UDP_H
+#define UDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#define UDP_MAGIC 0x5C
+#define UDP_HEADER_SIZE 20
+#define UDP_MAX_PAYLOAD PROTO_BUF_SIZE /* fits the peer's parser in one go */
+#define UDP_COOKIE_SIZE 8
+#define UDP_MTU (UDP_HEADER_SIZE + UDP_COOKIE_SIZE + UDP_MAX_PAYLOAD)
+#define UDP_WINDOW 32 /* sequence numbers in flight; the span ack bits cover */
+
+#define UDP_RTO_INITIAL_MS 200
+#define UDP_RTO_MIN_MS 20
+#define UDP_RTO_MAX_MS 2000
+#define UDP_MAX_TRIES 8        /* transmissions of a packet before giving up */
+#define UDP_KEEPALIVE_MS 1000  /* a client pings when it has sent nothing for this long */
+#define UDP_IDLE_MS 5000       /* silence after which a peer counts as gone */
+
+/* Header flags */
+#define UDP_OPEN 0x01     /* client: the connection is new (until answered) */
+#define UDP_RELIABLE 0x02 /* acknowledge this datagram; it is retransmitted */
+#define UDP_PING 0x04     /* acknowledge, even without a sequence number */
+#define UDP_CLOSE 0x08    /* connection closed, or unknown to the server */
+#define UDP_COOKIE 0x10   /* a cookie follows the header (see above) */
+
+typedef struct
+{
+    uint8_t flags;
+    uint32_t conn;
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t ack_bits;
+} UdpHeader;
+
+/* Sequence numbers seen from the peer, for acks and duplicate detection. */
+typedef struct
+{
+    uint32_t max;  /* highest received, 0 = none yet */
+    uint64_t bits; /* bit i: max - 1 - i was received too */
+} UdpWindow;
+
+/* Round-trip estimate and retransmission timeout (RFC 6298). */
+typedef struct
+{
+    int srtt_ms; /* 0 = no sample yet */
+    int rttvar_ms;
+    int rto_ms;
+} UdpRtt;
+
+void udp_write_header(uint8_t *out, const UdpHeader *h);
+
+/* udp_read_header: parse a datagram's header. Returns 0, or -1 if it isn't one. */
+int udp_read_header(const uint8_t *in, size_t len, UdpHeader *h);
+
+/*
+ * udp_window_mark:
+ *   Record that seq arrived. Returns 1 if it is new, 0 for a duplicate or
+ *   a sequence number too old to tell (more than 64 behind).
+ */
+int udp_window_mark(UdpWindow *w, uint32_t seq);
+
+/* udp_window_ack: fill h->ack and h->ack_bits from w. */
+void udp_window_ack(const UdpWindow *w, UdpHeader *h);
+
+/* udp_acked: whether header h acknowledges our datagram seq. */
+int udp_acked(const UdpHeader *h, uint32_t seq);
+
+/* udp_reliable_op: whether a frame starting with this byte must be retransmitted. */
+int udp_reliable_op(uint8_t first_byte);
+
+/* udp_payload_reliable: whether any frame in p[0..n) must be. */
+int udp_payload_reliable(const uint8_t *p, size_t n);
+
+void udp_rtt_init(UdpRtt *r);
+
+/* udp_rtt_sample: a datagram sent once was acked after ms. */
+void udp_rtt_sample(UdpRtt *r, long long ms);
+
+/* udp_rtt_backoff: a retransmission timed out; double the timeout. */
+void udp_rtt_backoff(UdpRtt *r);
+
+#endif /* UDP_H */